@@ -0,0 +1,137 @@
+/*
+ * Copyright (c) 2013 Jens Kuske <jenskuske@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+/*
+ * Throughput of the V4L2 backends themselves, against the decoders of
+ * v4l2_mock.c taking no time to decode. 1080p H.264 goes through decode,
+ * get_picture and release_picture the way a player and its mixer drive them,
+ * through the generic stateful backend for each CAPTURE layout and, for
+ * comparison, through the MFC backend with its submit thread.
+ *
+ *   bench_backends [-n pictures]
+ */
+
+#include <stdlib.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "vdpau_private.h"
+#include "v4l2_mock.h"
+
+static const uint8_t header[] = { 0x00, 0x00, 0x00, 0x01, 0x67, 0x4d, 0x40, 0x28,
+                                  0x00, 0x00, 0x00, 0x01, 0x68, 0xee, 0x3c, 0x80 };
+static uint8_t slice[32768] = { 0x00, 0x00, 0x00, 0x01, 0x41, 0x9a };
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+// every picture that is ready, handed straight back
+static uint32_t harvest(const decoder_backend_t *backend, void *dec)
+{
+    VdpVideoSurface surface;
+    uint32_t generation, count = 0;
+    void **output;
+    int frame;
+
+    for (;;) {
+        if (backend->get_picture(dec, &frame, &output, &surface, &generation) != VDP_STATUS_OK) {
+            fprintf(stderr, "get_picture failed\n");
+            exit(1);
+        }
+        if (frame < 0)
+            return count;
+        backend->release_picture(dec, frame);
+        count++;
+    }
+}
+
+static void run(const decoder_backend_t *backend, const char *name, __u32 capture_format, uint32_t pictures)
+{
+    VdpBitstreamBuffer buffer = { VDP_BITSTREAM_BUFFER_VERSION };
+    uint32_t i, received = 0;
+    int idle = 0;
+
+    v4l2_mock_config.capture_format = capture_format;
+    void *dec = backend->open(VDP_DECODER_PROFILE_H264_MAIN, 1920, 1080, 4);
+    if (!dec) {
+        fprintf(stderr, "%s: cannot open the %s backend on the mock device\n", name, backend->name);
+        exit(1);
+    }
+
+    buffer.bitstream = header;
+    buffer.bitstream_bytes = sizeof(header);
+    backend->decode(dec, 1, &buffer, VDP_INVALID_HANDLE, 0);
+
+    buffer.bitstream = slice;
+    buffer.bitstream_bytes = sizeof(slice);
+    uint64_t start = now_ns();
+    for (i = 0; i < pictures; i++) {
+        if (backend->decode(dec, 1, &buffer, i + 1, 1) != VDP_STATUS_OK) {
+            fprintf(stderr, "%s: decoding picture %u failed\n", name, i);
+            exit(1);
+        }
+        received += harvest(backend, dec);
+    }
+    while (received < pictures && idle++ < 1000) {
+        uint32_t n = harvest(backend, dec);
+        if (n)
+            idle = 0;
+        else
+            usleep(100);
+        received += n;
+    }
+    uint64_t elapsed = now_ns() - start;
+
+    backend->close(dec);
+
+    printf("%-24s %8.0f pictures/s  %6.1f us/picture  (%u of %u out)\n", name,
+           received * 1e9 / elapsed, elapsed / 1e3 / (received ? received : 1), received, pictures);
+}
+
+int main(int argc, char **argv)
+{
+    uint32_t pictures = 20000;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:")) != -1) {
+        switch (opt) {
+        case 'n':
+            pictures = atoi(optarg);
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-n pictures]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    v4l2_mock_config.width = 1920;
+    v4l2_mock_config.height = 1080;
+
+    run(&decoder_backend_v4l2, "v4l2 YUV420M", V4L2_PIX_FMT_YUV420M, pictures);
+    run(&decoder_backend_v4l2, "v4l2 YUV420", V4L2_PIX_FMT_YUV420, pictures);
+    run(&decoder_backend_v4l2, "v4l2 NV12M", V4L2_PIX_FMT_NV12M, pictures);
+    run(&decoder_backend_v4l2, "v4l2 NV12", V4L2_PIX_FMT_NV12, pictures);
+    run(&decoder_backend_mfc, "mfc NV12M", 0, pictures);
+
+    return 0;
+}
@@ -0,0 +1,271 @@
+/*
+ * Copyright (c) 2013 Jens Kuske <jenskuske@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+/*
+ * Microbenchmark of the handle table in handles.c. Measures handle_get()
+ * on a table of live handles, alone and from several threads at once while
+ * another thread keeps creating and destroying handles, the cost of a
+ * create/destroy pair with many handles alive, and create/get/destroy from
+ * several threads at once contending for the free list.
+ *
+ *   bench_handles [-n handles] [-t max_threads] [-m ms per run]
+ */
+
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "vdpau_private.h"
+
+typedef struct
+{
+    const int *handles;
+    int count;
+    int stop;
+    uint64_t ops;
+    uint64_t misses;
+} reader_t;
+
+typedef struct
+{
+    int stop;
+    uint64_t pairs;
+    uint64_t failed;
+} churner_t;
+
+static volatile int churn_stop;
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void *reader_thread(void *arg)
+{
+    reader_t *r = arg;
+    uint64_t ops = 0, misses = 0;
+    unsigned int i = 0;
+
+    while (!__atomic_load_n(&r->stop, __ATOMIC_RELAXED))
+    {
+        int j;
+
+        // in batches, so the stop flag stays out of the measurement
+        for (j = 0; j < 1024; j++)
+        {
+            if (!handle_get(r->handles[i], HANDLE_TYPE_VIDEO_SURFACE))
+                misses++;
+            i = (i + 1) % r->count;
+        }
+        ops += 1024;
+    }
+
+    r->ops = ops;
+    r->misses = misses;
+    return NULL;
+}
+
+static void *churn_thread(void *arg)
+{
+    uint64_t *pairs = arg;
+    static int object;
+
+    while (!churn_stop)
+    {
+        int handle = handle_create(&object, HANDLE_TYPE_DECODER);
+        handle_get(handle, HANDLE_TYPE_DECODER);
+        handle_destroy(handle);
+        (*pairs)++;
+    }
+
+    return NULL;
+}
+
+static void *churner_thread(void *arg)
+{
+    churner_t *c = arg;
+    uint64_t pairs = 0, failed = 0;
+    static int object;
+
+    while (!__atomic_load_n(&c->stop, __ATOMIC_RELAXED))
+    {
+        int j;
+
+        for (j = 0; j < 256; j++)
+        {
+            int handle = handle_create(&object, HANDLE_TYPE_DECODER);
+            if (handle_get(handle, HANDLE_TYPE_DECODER) != &object)
+                failed++;
+            handle_destroy(handle);
+        }
+        pairs += 256;
+    }
+
+    c->pairs = pairs;
+    c->failed = failed;
+    return NULL;
+}
+
+// every thread creates, looks up and destroys its own handles, all on the same free list
+static void run_churners(int threads, unsigned int ms)
+{
+    churner_t churners[threads];
+    pthread_t tid[threads];
+    uint64_t pairs = 0, failed = 0, slowest = UINT64_MAX;
+    int i;
+
+    for (i = 0; i < threads; i++)
+    {
+        memset(&churners[i], 0, sizeof(churners[i]));
+        pthread_create(&tid[i], NULL, churner_thread, &churners[i]);
+    }
+
+    uint64_t start = now_ns();
+    usleep(ms * 1000);
+
+    for (i = 0; i < threads; i++)
+        __atomic_store_n(&churners[i].stop, 1, __ATOMIC_RELAXED);
+    for (i = 0; i < threads; i++)
+    {
+        pthread_join(tid[i], NULL);
+        pairs += churners[i].pairs;
+        failed += churners[i].failed;
+        slowest = min(slowest, churners[i].pairs);
+    }
+    uint64_t elapsed = now_ns() - start;
+
+    printf("churn     %2d thread%s          %7.1f k create/destroy per s, %7.1f k per thread (slowest %.1f k)%s\n",
+           threads, threads == 1 ? " " : "s", pairs * 1e6 / elapsed, pairs * 1e6 / elapsed / threads,
+           slowest * 1e6 / elapsed, failed ? "  LOOKUPS FAILED" : "");
+}
+
+static void run_readers(const int *handles, int count, int threads, int churn, unsigned int ms)
+{
+    reader_t readers[threads];
+    pthread_t tid[threads], churner;
+    uint64_t ops = 0, misses = 0, pairs = 0;
+    int i;
+
+    churn_stop = 0;
+    if (churn)
+        pthread_create(&churner, NULL, churn_thread, &pairs);
+
+    for (i = 0; i < threads; i++)
+    {
+        readers[i].handles = handles;
+        readers[i].count = count;
+        readers[i].stop = 0;
+        pthread_create(&tid[i], NULL, reader_thread, &readers[i]);
+    }
+
+    uint64_t start = now_ns();
+    usleep(ms * 1000);
+
+    for (i = 0; i < threads; i++)
+        __atomic_store_n(&readers[i].stop, 1, __ATOMIC_RELAXED);
+    for (i = 0; i < threads; i++)
+    {
+        pthread_join(tid[i], NULL);
+        ops += readers[i].ops;
+        misses += readers[i].misses;
+    }
+    uint64_t elapsed = now_ns() - start;
+
+    churn_stop = 1;
+    if (churn)
+        pthread_join(churner, NULL);
+
+    printf("get       %2d thread%s%s  %7.1f Mops/s  %5.2f ns/op per thread%s\n",
+           threads, threads == 1 ? " " : "s", churn ? " + churn" : "        ",
+           ops * 1e3 / elapsed, (double)elapsed * threads / ops,
+           misses ? "  LOOKUPS FAILED" : "");
+    if (churn)
+        printf("          churn thread       %7.1f k create/destroy per s\n", pairs * 1e6 / elapsed);
+}
+
+static void run_create_destroy(int live, int rounds)
+{
+    static int object;
+    int i;
+
+    uint64_t start = now_ns();
+    for (i = 0; i < rounds; i++)
+    {
+        int handle = handle_create(&object, HANDLE_TYPE_DECODER);
+        handle_destroy(handle);
+    }
+    uint64_t elapsed = now_ns() - start;
+
+    printf("create+destroy with %d live  %6.1f ns/pair\n", live, (double)elapsed / rounds);
+}
+
+int main(int argc, char **argv)
+{
+    int count = 4096, max_threads = 8;
+    unsigned int ms = 300;
+    int opt, i, t;
+
+    while ((opt = getopt(argc, argv, "n:t:m:h")) != -1)
+    {
+        switch (opt)
+        {
+        case 'n': count = atoi(optarg); break;
+        case 't': max_threads = atoi(optarg); break;
+        case 'm': ms = atoi(optarg); break;
+        default:
+            fprintf(stderr, "usage: %s [-n handles] [-t max_threads] [-m ms per run]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (count < 1 || max_threads < 1)
+        return 1;
+
+    // the objects are never dereferenced, any address will do
+    int *handles = malloc(count * sizeof(int));
+    if (!handles)
+        return 1;
+    for (i = 0; i < count; i++)
+    {
+        handles[i] = handle_create(&handles[i], HANDLE_TYPE_VIDEO_SURFACE);
+        if (handles[i] == -1)
+        {
+            fprintf(stderr, "handle_create failed after %d handles\n", i);
+            return 1;
+        }
+    }
+
+    printf("handle table, %d live handles, %u ms per run\n", count, ms);
+
+    run_create_destroy(count, 1000000);
+
+    for (t = 1; t <= max_threads; t *= 2)
+        run_readers(handles, count, t, 0, ms);
+    for (t = 1; t <= max_threads; t *= 2)
+        run_readers(handles, count, t, 1, ms);
+    for (t = 1; t <= max_threads; t *= 2)
+        run_churners(t, ms);
+
+    for (i = 0; i < count; i++)
+        handle_destroy(handles[i]);
+    free(handles);
+
+    return 0;
+}
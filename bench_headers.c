@@ -0,0 +1,404 @@
+/*
+ * Copyright (c) 2013 Jens Kuske <jenskuske@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+/*
+ * Cost of the stream headers vdp_decoder_render synthesizes, against a
+ * backend that drops everything. A minute of 1080p60 H.264 High goes through
+ * the SPS/PPS cache in decoder.c, once with one PPS, once alternating two
+ * PPS as some encoders do, and is compared to building and comparing the
+ * SPS/PPS on every frame as the driver did before the cache. Then the
+ * header writers of every codec and the bitstream writer on their own.
+ *
+ *   bench_headers [-s seconds of video]
+ */
+
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "vdpau_private.h"
+#include "h264_stream.h"
+#include "mpeg12_stream.h"
+#include "mpeg4_stream.h"
+#include "vc1_stream.h"
+#include "hevc_stream.h"
+
+#define FPS 60
+
+static uint64_t header_bytes, slice_bytes;
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static VdpStatus null_query_capabilities(VdpDecoderProfile profile, VdpBool *is_supported,
+                                         uint32_t *max_width, uint32_t *max_height)
+{
+    *is_supported = VDP_TRUE;
+    return VDP_STATUS_OK;
+}
+
+static void *null_open(VdpDecoderProfile profile, uint32_t width, uint32_t height, uint32_t max_references)
+{
+    static int private;
+    return &private;
+}
+
+static void null_close(void *private)
+{
+}
+
+static VdpStatus null_decode(void *private, uint32_t buffer_count,
+                             VdpBitstreamBuffer const *buffers, VdpVideoSurface output, uint32_t generation)
+{
+    // decode_header() hands over the SPS and PPS as one buffer of their own
+    if (buffer_count == 1 && buffers[0].bitstream_bytes < 1024)
+        header_bytes += buffers[0].bitstream_bytes;
+    else
+        slice_bytes += buffers[0].bitstream_bytes;
+    return VDP_STATUS_OK;
+}
+
+static VdpStatus null_flush(void *private)
+{
+    return VDP_STATUS_OK;
+}
+
+static VdpStatus null_set_buffering(void *private, uint32_t buffering)
+{
+    return VDP_STATUS_OK;
+}
+
+static const decoder_backend_t decoder_backend_null =
+{
+    .name = "null",
+    .query_capabilities = null_query_capabilities,
+    .open = null_open,
+    .close = null_close,
+    .decode = null_decode,
+    .flush = null_flush,
+    .set_buffering = null_set_buffering,
+};
+
+const decoder_backend_t *const decoder_backends[] =
+{
+    &decoder_backend_null,
+    NULL
+};
+
+void video_surface_dmabuf_purge(device_ctx_t *dev, void *decoder)
+{
+}
+
+// a typical broadcast 1080p High profile stream, IDR every second
+static void h264_info(VdpPictureInfoH264 *info, int frame, int alternate_pps)
+{
+    int i;
+
+    memset(info, 0, sizeof(*info));
+    info->slice_count = 4;
+    info->is_reference = frame % 3 != 2;
+    info->frame_num = frame % FPS;
+    info->field_order_cnt[0] = info->field_order_cnt[1] = (frame % FPS) * 2;
+    info->num_ref_frames = 4;
+    info->frame_mbs_only_flag = 1;
+    info->direct_8x8_inference_flag = 1;
+    info->entropy_coding_mode_flag = 1;
+    info->transform_8x8_mode_flag = 1;
+    info->deblocking_filter_control_present_flag = 1;
+    info->weighted_bipred_idc = alternate_pps && (frame & 1) ? 2 : 0;
+    info->pic_init_qp_minus26 = -3;
+    info->log2_max_frame_num_minus4 = 2;
+    info->log2_max_pic_order_cnt_lsb_minus4 = 4;
+    info->num_ref_idx_l0_active_minus1 = 2;
+    memset(info->scaling_lists_4x4, 16, sizeof(info->scaling_lists_4x4));
+    memset(info->scaling_lists_8x8, 16, sizeof(info->scaling_lists_8x8));
+    for (i = 0; i < 16; i++)
+        info->referenceFrames[i].surface = VDP_INVALID_HANDLE;
+    for (i = 0; i < 4 && i < frame % FPS; i++)
+    {
+        info->referenceFrames[i].surface = i;
+        info->referenceFrames[i].frame_idx = (frame - i - 1) % FPS;
+        info->referenceFrames[i].top_is_reference = info->referenceFrames[i].bottom_is_reference = VDP_TRUE;
+    }
+}
+
+static void report(const char *name, int frames, uint64_t elapsed)
+{
+    double per_frame = (double)elapsed / frames;
+
+    printf("%-32s %7.0f ns/frame  %6.3f%% of a 60 fps frame\n",
+           name, per_frame, per_frame * FPS / 1e7);
+}
+
+// the driver before the cache, both parameter sets built and compared on every frame
+static void run_rebuild(int frames, int alternate_pps)
+{
+    VdpPictureInfoH264 info;
+    uint8_t *last = NULL;
+    int last_len = 0, changed = 0, i;
+
+    uint64_t start = now_ns();
+    for (i = 0; i < frames; i++)
+    {
+        uint8_t *header = malloc(HEADER_MAX_SIZE);
+        int sps, pps;
+
+        h264_info(&info, i, alternate_pps);
+        sps = write_nal_unit(NAL_UNIT_TYPE_SPS, 1920, 1080, VDP_DECODER_PROFILE_H264_HIGH, &info, -1, header, HEADER_MAX_SIZE);
+        pps = write_nal_unit(NAL_UNIT_TYPE_PPS, 1920, 1080, VDP_DECODER_PROFILE_H264_HIGH, &info, -1, header + sps, HEADER_MAX_SIZE - sps);
+
+        if (!last || last_len != sps + pps || memcmp(last, header, sps + pps))
+        {
+            changed++;
+            free(last);
+            last = header;
+            last_len = sps + pps;
+        }
+        else
+        {
+            free(header);
+        }
+    }
+    uint64_t elapsed = now_ns() - start;
+    free(last);
+
+    report(alternate_pps ? "rebuild every frame, 2 PPS" : "rebuild every frame", frames, elapsed);
+    printf("%-32s %d header changes\n", "", changed);
+}
+
+static void run_cached(VdpDevice device, VdpVideoSurface surface, int frames, int alternate_pps)
+{
+    static uint8_t slices[65536];
+    VdpBitstreamBuffer buffer = { VDP_BITSTREAM_BUFFER_VERSION, slices, sizeof(slices) };
+    VdpDecoder decoder;
+    int i;
+
+    if (vdp_decoder_create(device, VDP_DECODER_PROFILE_H264_HIGH, 1920, 1080, 4, &decoder) != VDP_STATUS_OK)
+    {
+        fprintf(stderr, "vdp_decoder_create failed\n");
+        exit(1);
+    }
+    decoder_ctx_t *dec = handle_get(decoder, HANDLE_TYPE_DECODER);
+
+    header_bytes = slice_bytes = 0;
+
+    // the pictures are built up front, so only the render path is timed
+    VdpPictureInfoH264 *infos = malloc(frames * sizeof(VdpPictureInfoH264));
+    for (i = 0; i < frames; i++)
+        h264_info(&infos[i], i, alternate_pps);
+
+    uint64_t start = now_ns();
+    for (i = 0; i < frames; i++)
+        vdp_decoder_render(decoder, surface, &infos[i], 1, &buffer);
+    uint64_t elapsed = now_ns() - start;
+
+    // the same minus the header work, to isolate it
+    start = now_ns();
+    for (i = 0; i < frames; i++)
+        dec->backend->decode(dec->private, 1, &buffer, surface, 0);
+    uint64_t raw = now_ns() - start;
+
+    report(alternate_pps ? "cached, 2 PPS" : "cached", frames, elapsed > raw ? elapsed - raw : 0);
+    printf("%-32s %u hits, %u misses, %llu header bytes sent\n", "",
+           dec->header_hits, dec->header_misses, (unsigned long long)header_bytes);
+
+    free(infos);
+    vdp_decoder_destroy(decoder);
+}
+
+typedef struct
+{
+    VdpPictureInfoH264 h264;
+    VdpPictureInfoMPEG1Or2 mpeg12;
+    VdpPictureInfoMPEG4Part2 mpeg4;
+    VdpPictureInfoVC1 vc1;
+#ifdef VDP_DECODER_PROFILE_HEVC_MAIN
+    VdpPictureInfoHEVC hevc;
+#endif
+} synth_info_t;
+
+static int synth_h264(synth_info_t *info, uint8_t *buf, int size)
+{
+    int sps = write_nal_unit(NAL_UNIT_TYPE_SPS, 1920, 1080, VDP_DECODER_PROFILE_H264_HIGH, &info->h264, -1, buf, size);
+    return sps + write_nal_unit(NAL_UNIT_TYPE_PPS, 1920, 1080, VDP_DECODER_PROFILE_H264_HIGH, &info->h264, -1, buf + sps, size - sps);
+}
+
+static int synth_mpeg2(synth_info_t *info, uint8_t *buf, int size)
+{
+    int seq = mpeg12_write_sequence_header(1920, 1080, VDP_DECODER_PROFILE_MPEG2_MAIN, &info->mpeg12, buf, size);
+    return seq + mpeg12_write_picture_header(VDP_DECODER_PROFILE_MPEG2_MAIN, &info->mpeg12, buf + seq, size - seq);
+}
+
+static int synth_mpeg4(synth_info_t *info, uint8_t *buf, int size)
+{
+    return mpeg4_write_vol_header(1280, 720, VDP_DECODER_PROFILE_MPEG4_PART2_ASP, &info->mpeg4, buf, size);
+}
+
+static int synth_vc1(synth_info_t *info, uint8_t *buf, int size)
+{
+    int seq = vc1_write_sequence_header(1920, 1080, VDP_DECODER_PROFILE_VC1_ADVANCED, &info->vc1, buf, size);
+    return seq + vc1_write_frame_header(VDP_DECODER_PROFILE_VC1_ADVANCED, &info->vc1, 0, NULL, buf + seq, size - seq);
+}
+
+#ifdef VDP_DECODER_PROFILE_HEVC_MAIN
+static int synth_hevc(synth_info_t *info, uint8_t *buf, int size)
+{
+    return hevc_write_parameter_sets(1920, 1080, VDP_DECODER_PROFILE_HEVC_MAIN, &info->hevc, NULL, buf, size);
+}
+#endif
+
+static const struct
+{
+    const char *name;
+    int (*write)(synth_info_t *info, uint8_t *buf, int size);
+} synth_codecs[] =
+{
+    { "H.264 SPS+PPS", synth_h264 },
+    { "MPEG-2 sequence+picture", synth_mpeg2 },
+    { "MPEG-4 VOL", synth_mpeg4 },
+    { "VC-1 sequence+frame", synth_vc1 },
+#ifdef VDP_DECODER_PROFILE_HEVC_MAIN
+    { "HEVC VPS+SPS+PPS", synth_hevc },
+#endif
+};
+
+// every header writer on its own, the rate a stream of changing headers could sustain
+static void run_synthesis(int rounds)
+{
+    static uint8_t buf[HEADER_MAX_SIZE];
+    synth_info_t *info = calloc(1, sizeof(synth_info_t));
+    unsigned int c;
+    int i;
+
+    if (!info)
+        return;
+
+    h264_info(&info->h264, 1, 1);
+    info->mpeg12.picture_structure = 3;
+    info->mpeg12.picture_coding_type = 2;
+    info->mpeg12.f_code[0][0] = info->mpeg12.f_code[0][1] = 2;
+    info->mpeg12.f_code[1][0] = info->mpeg12.f_code[1][1] = 15;
+    info->mpeg4.vop_time_increment_resolution = 30000;
+    info->vc1.interlace = 1;
+    info->vc1.loopfilter = 1;
+#ifdef VDP_DECODER_PROFILE_HEVC_MAIN
+    info->hevc.chroma_format_idc = 1;
+    info->hevc.pic_width_in_luma_samples = 1920;
+    info->hevc.pic_height_in_luma_samples = 1088;
+    info->hevc.log2_diff_max_min_luma_coding_block_size = 3;
+    info->hevc.sps_max_dec_pic_buffering_minus1 = 4;
+#endif
+
+    printf("\nheader writers, %d rounds\n", rounds);
+    for (c = 0; c < sizeof(synth_codecs) / sizeof(synth_codecs[0]); c++)
+    {
+        int len = 0;
+
+        uint64_t start = now_ns();
+        for (i = 0; i < rounds; i++)
+            len = synth_codecs[c].write(info, buf, sizeof(buf));
+        uint64_t elapsed = now_ns() - start;
+
+        printf("%-32s %7.0f ns/header  %4d bytes  %6.1f MB/s\n", synth_codecs[c].name,
+               (double)elapsed / rounds, len, (double)len * rounds * 1e3 / elapsed);
+    }
+
+    free(info);
+}
+
+// the mix of short fields and Exp-Golomb codes headers are made of
+static void run_bs_writer(int rounds)
+{
+    static uint8_t buf[HEADER_MAX_SIZE];
+    uint64_t bits = 0;
+    bs_t b;
+    int i, j;
+
+    uint64_t start = now_ns();
+    for (i = 0; i < rounds; i++)
+    {
+        bs_init(&b, buf, sizeof(buf));
+        for (j = 0; j < 64; j++)
+        {
+            bs_write_u1(&b, j & 1);
+            bs_write_u(&b, 4, j);
+            bs_write_ue(&b, j * 37);
+            bs_write_se(&b, 16 - j);
+        }
+        bits += bs_pos(&b) * 8;
+    }
+    uint64_t elapsed = now_ns() - start;
+
+    printf("%-32s %7.1f Mbit/s  %5.2f ns/field\n", "bitstream writer",
+           bits * 1e3 / elapsed, (double)elapsed / ((uint64_t)rounds * 256));
+}
+
+int main(int argc, char **argv)
+{
+    int seconds = 60;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "s:h")) != -1)
+    {
+        switch (opt)
+        {
+        case 's': seconds = atoi(optarg); break;
+        default:
+            fprintf(stderr, "usage: %s [-s seconds of video]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (seconds < 1)
+        return 1;
+
+    // no X11 or EGL, a bare device and surface are enough for the decoder
+    device_ctx_t *dev = calloc(1, sizeof(device_ctx_t));
+    video_surface_ctx_t *vs = calloc(1, sizeof(video_surface_ctx_t));
+    if (!dev || !vs)
+        return 1;
+    vs->device = dev;
+    vs->width = 1920;
+    vs->height = 1080;
+    vs->chroma_type = VDP_CHROMA_TYPE_420;
+
+    int device = handle_create(dev, HANDLE_TYPE_DEVICE);
+    int surface = handle_create(vs, HANDLE_TYPE_VIDEO_SURFACE);
+    if (device == -1 || surface == -1)
+        return 1;
+
+    printf("H.264 SPS/PPS, 1080p%d High, %d frames\n", FPS, seconds * FPS);
+    run_rebuild(seconds * FPS, 0);
+    run_cached(device, surface, seconds * FPS, 0);
+    run_rebuild(seconds * FPS, 1);
+    run_cached(device, surface, seconds * FPS, 1);
+
+    run_synthesis(seconds * FPS * 10);
+    run_bs_writer(seconds * FPS * 10);
+
+    handle_destroy(surface);
+    handle_destroy(device);
+    free(vs);
+    free(dev);
+
+    return 0;
+}
@@ -37,6 +37,7 @@ typedef struct
     uint8_t* p;
     uint8_t* end;
     int bits_left;
+    uint64_t cache; // the 8 - bits_left bits of the current byte, right aligned
 } bs_t;
 
 #define _OPTIMIZE_BS_ 1
@@ -72,6 +73,7 @@ static inline bs_t* bs_init(bs_t* b, uint8_t* buf, size_t size)
     b->p = buf;
     b->end = buf + size;
     b->bits_left = 8;
+    b->cache = 0;
     return b;
 }
 
@@ -93,6 +95,7 @@ static inline bs_t* bs_clone(bs_t* dest, const bs_t* src)
     dest->p = src->p;
     dest->end = src->end;
     dest->bits_left = src->bits_left;
+    dest->cache = src->cache;
     return dest;
 }
 
@@ -109,29 +112,38 @@ static inline int bs_pos(bs_t* b) { if (b->p > b->end) { return (b->end - b->sta
 
 static inline int bs_bytes_left(bs_t* b) { return (b->end - b->p); }
 
-static inline void bs_write_u1(bs_t* b, uint32_t v)
+/*
+ * Writes are collected in a 64 bit accumulator and stored a whole byte at a
+ * time. The partially filled byte is mirrored to *p after every call, so the
+ * buffer always reflects everything written so far.
+ */
+static inline void bs_write_u(bs_t* b, int n, uint32_t v)
 {
-    b->bits_left--;
+    int bits = 8 - b->bits_left;
+    uint64_t cache;
 
-    if (! bs_eof(b))
+    if (n <= 0)
+        return;
+
+    cache = (b->cache << n) | (v & (0xffffffffu >> (32 - n)));
+    bits += n;
+
+    while (bits >= 8)
     {
-        // FIXME this is slow, but we must clear bit first
-        // is it better to memset(0) the whole buffer during bs_init() instead?
-        // if we don't do either, we introduce pretty nasty bugs
-        (*(b->p)) &= ~(0x01 << b->bits_left);
-        (*(b->p)) |= ((v & 0x01) << b->bits_left);
+        bits -= 8;
+        if (! bs_eof(b)) { *b->p = cache >> bits; }
+        b->p++;
     }
 
-    if (b->bits_left == 0) { b->p ++; b->bits_left = 8; }
+    b->cache = cache & ((1u << bits) - 1);
+    b->bits_left = 8 - bits;
+
+    if (bits && ! bs_eof(b)) { *b->p = b->cache << (8 - bits); }
 }
 
-static inline void bs_write_u(bs_t* b, int n, uint32_t v)
+static inline void bs_write_u1(bs_t* b, uint32_t v)
 {
-    int i;
-    for (i = 0; i < n; i++)
-    {
-        bs_write_u1(b, (v >> ( n - i - 1 ))&0x01 );
-    }
+    bs_write_u(b, 1, v);
 }
 
 static inline void bs_write_f(bs_t* b, int n, uint32_t v) { bs_write_u(b, n, v); }
@@ -151,59 +163,17 @@ static inline void bs_write_u8(bs_t* b, uint32_t v)
 
 static inline void bs_write_ue(bs_t* b, uint32_t v)
 {
-    static const int len_table[256] =
-    {
-        1,
-        1,
-        2,2,
-        3,3,3,3,
-        4,4,4,4,4,4,4,4,
-        5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,5,
-        6,6,6,6,6,6,6,6,6,6,6,6,6,6,6,6,
-        6,6,6,6,6,6,6,6,6,6,6,6,6,6,6,6,
-        7,7,7,7,7,7,7,7,7,7,7,7,7,7,7,7,
-        7,7,7,7,7,7,7,7,7,7,7,7,7,7,7,7,
-        7,7,7,7,7,7,7,7,7,7,7,7,7,7,7,7,
-        7,7,7,7,7,7,7,7,7,7,7,7,7,7,7,7,
-        8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,
-        8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,
-        8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,
-        8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,
-        8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,
-        8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,
-        8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,
-        8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,
-    };
-
-    int len;
-
-    if (v == 0)
-    {
-        bs_write_u1(b, 1);
-    }
-    else
+    uint64_t code = (uint64_t)v + 1;
+    int len = 64 - __builtin_clzll(code);
+
+    // len-1 leading zeros, then code itself in len bits, split to stay within 32 bit writes
+    bs_write_u(b, len - 1, 0);
+    if (len > 32)
     {
-        v++;
-
-        if (v >= 0x01000000)
-        {
-            len = 24 + len_table[ v >> 24 ];
-        }
-        else if(v >= 0x00010000)
-        {
-            len = 16 + len_table[ v >> 16 ];
-        }
-        else if(v >= 0x00000100)
-        {
-            len =  8 + len_table[ v >>  8 ];
-        }
-        else
-        {
-            len = len_table[ v ];
-        }
-
-        bs_write_u(b, 2*len-1, v);
+        bs_write_u(b, len - 32, code >> 32);
+        len = 32;
     }
+    bs_write_u(b, len, code);
 }
 
 static inline void bs_write_se(bs_t* b, int32_t v)
@@ -0,0 +1,299 @@
+/*
+ * Copyright (c) 2013 Jens Kuske <jenskuske@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include <string.h>
+#include <semaphore.h>
+#include <time.h>
+
+#include "vdpau_private.h"
+#include "capture.h"
+
+#define CAPTURE_RING_SIZE (16 << 20) // must be a power of two
+
+/*
+ * The decode thread is the only producer and the writer thread the only
+ * consumer, so head and tail each have a single owner and the ring needs no
+ * lock. When the ring is full the frame is dropped rather than blocking the
+ * decode thread.
+ */
+typedef struct
+{
+    uint32_t len;           // whole record including this header, 8 byte aligned
+    uint32_t size;          // bitstream bytes
+    uint32_t info_size;
+    uint32_t buffer_count;
+    uint64_t timestamp;
+    uint32_t profile;
+    uint32_t flags;
+} ring_record_t;
+
+struct capture_struct
+{
+    uint8_t *ring;
+    uint64_t head;
+    uint64_t tail;
+    int stop;
+    sem_t wake;
+    pthread_t thread;
+
+    FILE *raw;
+    FILE *idx;
+    uint64_t raw_offset;
+    VdpDecoderProfile profile;
+    uint32_t info_size;
+
+    uint32_t records;
+    uint32_t dropped;
+};
+
+uint32_t capture_info_size(VdpDecoderProfile profile)
+{
+    switch (profile)
+    {
+    case VDP_DECODER_PROFILE_MPEG1:
+    case VDP_DECODER_PROFILE_MPEG2_SIMPLE:
+    case VDP_DECODER_PROFILE_MPEG2_MAIN:
+        return sizeof(VdpPictureInfoMPEG1Or2);
+
+    case VDP_DECODER_PROFILE_H264_BASELINE:
+    case VDP_DECODER_PROFILE_H264_MAIN:
+    case VDP_DECODER_PROFILE_H264_HIGH:
+        return sizeof(VdpPictureInfoH264);
+
+    case VDP_DECODER_PROFILE_VC1_SIMPLE:
+    case VDP_DECODER_PROFILE_VC1_MAIN:
+    case VDP_DECODER_PROFILE_VC1_ADVANCED:
+        return sizeof(VdpPictureInfoVC1);
+
+    case VDP_DECODER_PROFILE_MPEG4_PART2_SP:
+    case VDP_DECODER_PROFILE_MPEG4_PART2_ASP:
+    case VDP_DECODER_PROFILE_DIVX4_QMOBILE:
+    case VDP_DECODER_PROFILE_DIVX4_MOBILE:
+    case VDP_DECODER_PROFILE_DIVX4_HOME_THEATER:
+    case VDP_DECODER_PROFILE_DIVX4_HD_1080P:
+    case VDP_DECODER_PROFILE_DIVX5_QMOBILE:
+    case VDP_DECODER_PROFILE_DIVX5_MOBILE:
+    case VDP_DECODER_PROFILE_DIVX5_HOME_THEATER:
+    case VDP_DECODER_PROFILE_DIVX5_HD_1080P:
+        return sizeof(VdpPictureInfoMPEG4Part2);
+
+#ifdef VDP_DECODER_PROFILE_HEVC_MAIN
+    case VDP_DECODER_PROFILE_HEVC_MAIN:
+        return sizeof(VdpPictureInfoHEVC);
+#endif
+
+    default:
+        return 0;
+    }
+}
+
+static void ring_copy_in(capture_t *cap, uint64_t pos, const void *src, uint32_t n)
+{
+    uint32_t off = pos & (CAPTURE_RING_SIZE - 1);
+    uint32_t first = n < CAPTURE_RING_SIZE - off ? n : CAPTURE_RING_SIZE - off;
+
+    memcpy(cap->ring + off, src, first);
+    memcpy(cap->ring, (const uint8_t *)src + first, n - first);
+}
+
+static void ring_copy_out(capture_t *cap, uint64_t pos, void *dst, uint32_t n)
+{
+    uint32_t off = pos & (CAPTURE_RING_SIZE - 1);
+    uint32_t first = n < CAPTURE_RING_SIZE - off ? n : CAPTURE_RING_SIZE - off;
+
+    memcpy(dst, cap->ring + off, first);
+    memcpy((uint8_t *)dst + first, cap->ring, n - first);
+}
+
+static void ring_write_file(capture_t *cap, uint64_t pos, uint32_t n, FILE *f)
+{
+    uint32_t off = pos & (CAPTURE_RING_SIZE - 1);
+    uint32_t first = n < CAPTURE_RING_SIZE - off ? n : CAPTURE_RING_SIZE - off;
+
+    fwrite(cap->ring + off, 1, first, f);
+    if (n > first)
+        fwrite(cap->ring, 1, n - first, f);
+}
+
+static void capture_drain(capture_t *cap)
+{
+    uint64_t tail = cap->tail;
+    uint64_t head = __atomic_load_n(&cap->head, __ATOMIC_ACQUIRE);
+
+    while (tail != head)
+    {
+        ring_record_t rec;
+        capture_index_t entry;
+
+        ring_copy_out(cap, tail, &rec, sizeof(rec));
+
+        entry.offset = cap->raw_offset;
+        entry.timestamp = rec.timestamp;
+        entry.size = rec.size;
+        entry.profile = rec.profile;
+        entry.info_size = rec.info_size;
+        entry.buffer_count = rec.buffer_count;
+        entry.flags = rec.flags;
+        entry.reserved = 0;
+
+        fwrite(&entry, sizeof(entry), 1, cap->idx);
+        ring_write_file(cap, tail + sizeof(rec), rec.buffer_count * sizeof(uint32_t) + rec.info_size, cap->idx);
+        ring_write_file(cap, tail + sizeof(rec) + rec.buffer_count * sizeof(uint32_t) + rec.info_size, rec.size, cap->raw);
+        cap->raw_offset += rec.size;
+
+        tail += rec.len;
+        __atomic_store_n(&cap->tail, tail, __ATOMIC_RELEASE);
+    }
+}
+
+static void *capture_thread(void *arg)
+{
+    capture_t *cap = arg;
+    int stop;
+
+    do
+    {
+        while (sem_wait(&cap->wake) != 0)
+            ;
+
+        // everything published before stop was set is drained below
+        stop = __atomic_load_n(&cap->stop, __ATOMIC_ACQUIRE);
+        capture_drain(cap);
+    } while (!stop);
+
+    return NULL;
+}
+
+capture_t *capture_open(const char *name, VdpDecoderProfile profile, uint32_t width, uint32_t height)
+{
+    char path[256];
+    capture_file_header_t header;
+
+    capture_t *cap = calloc(1, sizeof(capture_t));
+    if (!cap)
+        return NULL;
+
+    cap->profile = profile;
+    cap->info_size = capture_info_size(profile);
+
+    cap->ring = malloc(CAPTURE_RING_SIZE);
+    if (!cap->ring)
+        goto err_ring;
+
+    snprintf(path, sizeof(path), "%s.raw", name);
+    cap->raw = fopen(path, "w");
+    if (!cap->raw)
+        goto err_raw;
+
+    snprintf(path, sizeof(path), "%s.idx", name);
+    cap->idx = fopen(path, "w");
+    if (!cap->idx)
+        goto err_idx;
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, CAPTURE_MAGIC, sizeof(CAPTURE_MAGIC));
+    header.version = CAPTURE_VERSION;
+    header.profile = profile;
+    header.width = width;
+    header.height = height;
+    fwrite(&header, sizeof(header), 1, cap->idx);
+
+    sem_init(&cap->wake, 0, 0);
+    if (pthread_create(&cap->thread, NULL, capture_thread, cap) != 0)
+        goto err_thread;
+
+    return cap;
+
+err_thread:
+    sem_destroy(&cap->wake);
+    fclose(cap->idx);
+err_idx:
+    fclose(cap->raw);
+err_raw:
+    free(cap->ring);
+err_ring:
+    free(cap);
+    return NULL;
+}
+
+void capture_submit(capture_t *cap, VdpPictureInfo const *info, uint32_t buffer_count,
+                    VdpBitstreamBuffer const *buffers, uint32_t flags)
+{
+    ring_record_t rec;
+    struct timespec ts;
+    uint64_t head = cap->head;
+    uint64_t pos;
+    uint32_t i;
+
+    memset(&rec, 0, sizeof(rec));
+    for (i = 0; i < buffer_count; i++)
+        rec.size += buffers[i].bitstream_bytes;
+    rec.info_size = info ? cap->info_size : 0;
+    rec.buffer_count = buffer_count;
+    rec.profile = cap->profile;
+    rec.flags = flags;
+    rec.len = (sizeof(rec) + buffer_count * sizeof(uint32_t) + rec.info_size + rec.size + 7) & ~7;
+
+    if (rec.len > CAPTURE_RING_SIZE - (head - __atomic_load_n(&cap->tail, __ATOMIC_ACQUIRE)))
+    {
+        cap->dropped++;
+        return;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    rec.timestamp = (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+
+    ring_copy_in(cap, head, &rec, sizeof(rec));
+    pos = head + sizeof(rec);
+    for (i = 0; i < buffer_count; i++)
+    {
+        ring_copy_in(cap, pos, &buffers[i].bitstream_bytes, sizeof(uint32_t));
+        pos += sizeof(uint32_t);
+    }
+    ring_copy_in(cap, pos, info, rec.info_size);
+    pos += rec.info_size;
+    for (i = 0; i < buffer_count; i++)
+    {
+        ring_copy_in(cap, pos, buffers[i].bitstream, buffers[i].bitstream_bytes);
+        pos += buffers[i].bitstream_bytes;
+    }
+
+    __atomic_store_n(&cap->head, head + rec.len, __ATOMIC_RELEASE);
+    cap->records++;
+    sem_post(&cap->wake);
+}
+
+void capture_close(capture_t *cap)
+{
+    if (!cap)
+        return;
+
+    __atomic_store_n(&cap->stop, 1, __ATOMIC_RELEASE);
+    sem_post(&cap->wake);
+    pthread_join(cap->thread, NULL);
+
+    VDPAU_DBG("capture: %u frames, %llu bytes written, %u dropped", cap->records,
+              (unsigned long long)cap->raw_offset, cap->dropped);
+
+    sem_destroy(&cap->wake);
+    fclose(cap->idx);
+    fclose(cap->raw);
+    free(cap->ring);
+    free(cap);
+}
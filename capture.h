@@ -0,0 +1,74 @@
+/*
+ * Copyright (c) 2013 Jens Kuske <jenskuske@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifndef __CAPTURE_H__
+#define __CAPTURE_H__
+
+#include <stdint.h>
+#include <vdpau/vdpau.h>
+
+/*
+ * On-disk format of a bitstream capture.
+ *
+ * <name>.raw holds the submitted bitstream buffers back to back, exactly as
+ * they were passed to the MFC. <name>.idx starts with a capture_file_header_t
+ * followed by one capture_index_t per decode call, each followed by
+ * buffer_count uint32_t sizes of the individual VdpBitstreamBuffers and
+ * info_size bytes of the VdpPictureInfo that came with them.
+ */
+
+#define CAPTURE_MAGIC   "VDPCAPT"
+#define CAPTURE_VERSION 1
+
+typedef struct
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t profile;
+    uint32_t width;
+    uint32_t height;
+} capture_file_header_t;
+
+typedef struct
+{
+    uint64_t offset;        // into <name>.raw
+    uint64_t timestamp;     // CLOCK_MONOTONIC at submit, in ns
+    uint32_t size;
+    uint32_t profile;
+    uint32_t info_size;
+    uint32_t buffer_count;
+    uint32_t flags;
+    uint32_t reserved;
+} capture_index_t;
+
+// the buffer is a parameter set synthesized by the driver, not application data
+#define CAPTURE_FLAG_HEADER (1 << 0)
+// only the first of the buffers was synthesized by the driver, e.g. a picture header
+#define CAPTURE_FLAG_PREFIX (1 << 1)
+
+typedef struct capture_struct capture_t;
+
+capture_t *capture_open(const char *name, VdpDecoderProfile profile, uint32_t width, uint32_t height);
+void capture_submit(capture_t *cap, VdpPictureInfo const *info, uint32_t buffer_count,
+                    VdpBitstreamBuffer const *buffers, uint32_t flags);
+void capture_close(capture_t *cap);
+
+uint32_t capture_info_size(VdpDecoderProfile profile);
+
+#endif
@@ -18,18 +18,111 @@
  */
 
 #include <string.h>
-#include <unistd.h>
-#include <errno.h>
+#include <time.h>
 
 #include "vdpau_private.h"
 #include "h264_stream.h"
+#include "mpeg12_stream.h"
+#include "mpeg4_stream.h"
+#include "vc1_stream.h"
+#include "hevc_stream.h"
+#include "capture.h"
+#include "vdpau_odroid.h"
 
 static VdpStatus decode_h264(struct decoder_ctx_struct *dec, VdpPictureInfo const *info, uint32_t buffer_count,
                       VdpBitstreamBuffer const *buffers, VdpVideoSurface output);
 
+static VdpStatus decode_mpeg12(struct decoder_ctx_struct *dec, VdpPictureInfo const *info, uint32_t buffer_count,
+                      VdpBitstreamBuffer const *buffers, VdpVideoSurface output);
+
+static VdpStatus decode_mpeg4(struct decoder_ctx_struct *dec, VdpPictureInfo const *info, uint32_t buffer_count,
+                      VdpBitstreamBuffer const *buffers, VdpVideoSurface output);
+
+static VdpStatus decode_vc1(struct decoder_ctx_struct *dec, VdpPictureInfo const *info, uint32_t buffer_count,
+                      VdpBitstreamBuffer const *buffers, VdpVideoSurface output);
+
+#ifdef VDP_DECODER_PROFILE_HEVC_MAIN
+static VdpStatus decode_hevc(struct decoder_ctx_struct *dec, VdpPictureInfo const *info, uint32_t buffer_count,
+                      VdpBitstreamBuffer const *buffers, VdpVideoSurface output);
+#endif
+
 static VdpStatus decode_raw(struct decoder_ctx_struct *dec, VdpPictureInfo const *info, uint32_t buffer_count,
                       VdpBitstreamBuffer const *buffers, VdpVideoSurface output);
 
+static VdpStatus submit_buffers(struct decoder_ctx_struct *dec, VdpPictureInfo const *info, uint32_t buffer_count,
+                      VdpBitstreamBuffer const *buffers, VdpVideoSurface output, uint32_t capture_flags);
+
+static VdpStatus decode_picture(struct decoder_ctx_struct *dec, VdpPictureInfo const *info, uint32_t buffer_count,
+                      VdpBitstreamBuffer const *buffers, VdpVideoSurface output);
+
+typedef int (*header_writer_t)(decoder_ctx_t *dec, VdpPictureInfo const *info, uint8_t *buf, int size);
+
+static int random_access_h264(VdpPictureInfo const *info, uint32_t buffer_count, VdpBitstreamBuffer const *buffers);
+#ifdef VDP_DECODER_PROFILE_HEVC_MAIN
+static int random_access_hevc(VdpPictureInfo const *info, uint32_t buffer_count, VdpBitstreamBuffer const *buffers);
+#endif
+
+static uint64_t get_time(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static VdpStatus flush(decoder_ctx_t *dec)
+{
+    // the hardware may lose the stream headers along with the pictures, send them again
+    dec->last_header = NULL;
+
+    return dec->backend->flush(dec->private);
+}
+
+// the next backend from *index on that supports the profile, only the one VDPAU_BACKEND names if set
+static const decoder_backend_t *find_backend(VdpDecoderProfile profile, int *index,
+                                             VdpBool *is_supported, uint32_t *max_width, uint32_t *max_height)
+{
+    char *name = getenv("VDPAU_BACKEND");
+
+    for (; decoder_backends[*index]; (*index)++) {
+        const decoder_backend_t *backend = decoder_backends[*index];
+        if (name && strcmp(name, backend->name))
+            continue;
+
+        if (backend->query_capabilities(profile, is_supported, max_width, max_height) == VDP_STATUS_OK && *is_supported) {
+            (*index)++;
+            return backend;
+        }
+    }
+
+    *is_supported = VDP_FALSE;
+    return NULL;
+}
+
+/*
+ * Opens the first backend that takes the stream. If none does the decoder is
+ * still created, as before backends were pluggable, but fails to render.
+ */
+static void open_backend(decoder_ctx_t *dec, uint32_t max_references)
+{
+    const decoder_backend_t *backend;
+    uint32_t max_width, max_height;
+    VdpBool supported;
+    int i = 0;
+
+    while ((backend = find_backend(dec->profile, &i, &supported, &max_width, &max_height))) {
+        dec->private = backend->open(dec->profile, dec->width, dec->height, max_references);
+        if (dec->private) {
+            VDPAU_DBG("Decoding with the %s backend", backend->name);
+            dec->backend = backend;
+            return;
+        }
+        VDPAU_ERR("The %s backend failed to open", backend->name);
+    }
+
+    // closing, flushing and buffering take a NULL context
+    dec->backend = decoder_backends[0];
+}
+
 VdpStatus vdp_decoder_create(VdpDevice device,
                              VdpDecoderProfile profile,
                              uint32_t width,
@@ -37,7 +130,7 @@ VdpStatus vdp_decoder_create(VdpDevice device,
                              uint32_t max_references,
                              VdpDecoder *decoder)
 {
-    device_ctx_t *dev = handle_get(device);
+    device_ctx_t *dev = handle_get(device, HANDLE_TYPE_DEVICE);
     if (!dev)
         return VDP_STATUS_INVALID_HANDLE;
 
@@ -59,19 +152,49 @@ VdpStatus vdp_decoder_create(VdpDevice device,
     case VDP_DECODER_PROFILE_MPEG1:
     case VDP_DECODER_PROFILE_MPEG2_SIMPLE:
     case VDP_DECODER_PROFILE_MPEG2_MAIN:
-        dec->decode = decode_raw;
+        dec->decode = decode_mpeg12;
         break;
 
     case VDP_DECODER_PROFILE_H264_BASELINE:
     case VDP_DECODER_PROFILE_H264_MAIN:
     case VDP_DECODER_PROFILE_H264_HIGH:
+        dec->h264_reorder = malloc(sizeof(h264_reorder_t));
+        if (dec->h264_reorder)
+            h264_reorder_init(dec->h264_reorder);
+        else
+            ret = VDP_STATUS_RESOURCES;
         dec->decode = decode_h264;
+        dec->random_access = random_access_h264;
         break;
 
     case VDP_DECODER_PROFILE_MPEG4_PART2_SP:
     case VDP_DECODER_PROFILE_MPEG4_PART2_ASP:
-        dec->decode = decode_raw;
+    case VDP_DECODER_PROFILE_DIVX4_QMOBILE:
+    case VDP_DECODER_PROFILE_DIVX4_MOBILE:
+    case VDP_DECODER_PROFILE_DIVX4_HOME_THEATER:
+    case VDP_DECODER_PROFILE_DIVX4_HD_1080P:
+    case VDP_DECODER_PROFILE_DIVX5_QMOBILE:
+    case VDP_DECODER_PROFILE_DIVX5_MOBILE:
+    case VDP_DECODER_PROFILE_DIVX5_HOME_THEATER:
+    case VDP_DECODER_PROFILE_DIVX5_HD_1080P:
+        dec->decode = decode_mpeg4;
+        break;
+
+    case VDP_DECODER_PROFILE_VC1_SIMPLE:
+    case VDP_DECODER_PROFILE_VC1_MAIN:
+    case VDP_DECODER_PROFILE_VC1_ADVANCED:
+        dec->decode = decode_vc1;
+        break;
+
+#ifdef VDP_DECODER_PROFILE_HEVC_MAIN
+    case VDP_DECODER_PROFILE_HEVC_MAIN:
+        dec->hevc_rps = calloc(1, sizeof(hevc_rps_table_t));
+        if (!dec->hevc_rps)
+            ret = VDP_STATUS_RESOURCES;
+        dec->decode = decode_hevc;
+        dec->random_access = random_access_hevc;
         break;
+#endif
 
     default:
         ret = VDP_STATUS_INVALID_DECODER_PROFILE;
@@ -82,29 +205,53 @@ VdpStatus vdp_decoder_create(VdpDevice device,
     if (debug) {
         if (strstr(debug, "dump"))
             dec->debug |= DEBUG_DECODE_DUMP;
-        if (strstr(debug, "raw")) {
+        if (strstr(debug, "raw"))
             dec->debug |= DEBUG_DECODE_RAW;
-            if(truncate("vid.raw", 0)) {
-                if (errno != ENOENT) {
-                    goto err_data;
-                }
-            }
-        }
     }
 
+    int auto_flush = DECODER_AUTO_FLUSH_DEFAULT_MS;
+    char *env = getenv("VDPAU_AUTO_FLUSH");
+    if (env)
+        auto_flush = atoi(env);
+    dec->auto_flush = (uint64_t)max(auto_flush, 0) * 1000000ull;
+
     if (ret != VDP_STATUS_OK)
         goto err_data;
 
-    int handle = handle_create(dec);
-    if (handle == -1)
-        goto err_data;
+    if (dec->debug & DEBUG_DECODE_RAW) {
+        dec->capture = capture_open("vid", profile, width, height);
+        if (!dec->capture)
+            VDPAU_ERR("Failed to open bitstream capture vid.raw");
+    }
 
-    dec->private = decoder_open(profile, width, height);
+    int handle = handle_create(dec, HANDLE_TYPE_DECODER);
+    if (handle == -1)
+        goto err_handle;
+
+    open_backend(dec, max_references);
+
+    // stateless backends map the picture info themselves, nothing to synthesize
+    if (dec->private && dec->backend->decode_picture)
+        dec->decode = decode_picture;
+
+    char *buffering = getenv("VDPAU_BUFFERING");
+    if (buffering && dec->private) {
+        if (!strcmp(buffering, "low-latency"))
+            dec->backend->set_buffering(dec->private, VDP_DECODER_BUFFERING_LOW_LATENCY_ODROID);
+        else if (!strcmp(buffering, "smooth"))
+            dec->backend->set_buffering(dec->private, VDP_DECODER_BUFFERING_SMOOTH_ODROID);
+        else if (strcmp(buffering, "balanced"))
+            VDPAU_ERR("Unknown VDPAU_BUFFERING %s, using balanced", buffering);
+    }
 
     *decoder = handle;
     return VDP_STATUS_OK;
 
+err_handle:
+    capture_close(dec->capture);
 err_data:
+    free(dec->h264_reorder);
+    free(dec->hevc_rps);
     free(dec);
 err_ctx:
     return VDP_STATUS_RESOURCES;
@@ -112,16 +259,20 @@ err_ctx:
 
 VdpStatus vdp_decoder_destroy(VdpDecoder decoder)
 {
-    decoder_ctx_t *dec = handle_get(decoder);
+    decoder_ctx_t *dec = handle_get(decoder, HANDLE_TYPE_DECODER);
     if (!dec)
         return VDP_STATUS_INVALID_HANDLE;
 
-    decoder_close(dec->private);
+    // imported pictures keep the decoder buffers alive
+    video_surface_dmabuf_purge(dec->device, dec->private);
+    dec->backend->close(dec->private);
+    capture_close(dec->capture);
 
-    free(dec->header);
-    free(dec->last_header);
+    VDPAU_DBG("header cache: %u hits, %u misses", dec->header_hits, dec->header_misses);
 
     handle_destroy(decoder);
+    free(dec->h264_reorder);
+    free(dec->hevc_rps);
     free(dec);
 
     return VDP_STATUS_OK;
@@ -132,7 +283,7 @@ VdpStatus vdp_decoder_get_parameters(VdpDecoder decoder,
                                      uint32_t *width,
                                      uint32_t *height)
 {
-    decoder_ctx_t *dec = handle_get(decoder);
+    decoder_ctx_t *dec = handle_get(decoder, HANDLE_TYPE_DECODER);
     if (!dec)
         return VDP_STATUS_INVALID_HANDLE;
 
@@ -154,16 +305,32 @@ VdpStatus vdp_decoder_render(VdpDecoder decoder,
                              uint32_t bitstream_buffer_count,
                              VdpBitstreamBuffer const *bitstream_buffers)
 {
-    decoder_ctx_t *dec = handle_get(decoder);
+    decoder_ctx_t *dec = handle_get(decoder, HANDLE_TYPE_DECODER);
     if (!dec)
         return VDP_STATUS_INVALID_HANDLE;
 
-    video_surface_ctx_t *vid = handle_get(target);
+    video_surface_ctx_t *vid = handle_get(target, HANDLE_TYPE_VIDEO_SURFACE);
     if (!vid)
         return VDP_STATUS_INVALID_HANDLE;
 
+    if (!dec->private)
+        return VDP_STATUS_ERROR;
+
     vid->source_format = INTERNAL_YCBCR_FORMAT;
+    vid->backend = dec->backend;
     vid->private = dec->private;
+    dec->generation = ++vid->decode_generation;
+
+    // an IDR/IRAP picture after a pause in decoding is most likely a seek, anything
+    // still in the hardware belongs to the old position; only the RASL pictures of
+    // an HEVC CRA reference anything before it, and those are skipped after a seek
+    uint64_t now = get_time();
+    if (dec->auto_flush && dec->last_render && now - dec->last_render > dec->auto_flush &&
+            dec->random_access && dec->random_access(picture_info, bitstream_buffer_count, bitstream_buffers)) {
+        VDPAU_DBG("Random access picture after %llu ms, flushing", (unsigned long long)((now - dec->last_render) / 1000000));
+        flush(dec);
+    }
+    dec->last_render = now;
 
     if (dec->decode)
         return dec->decode(dec, picture_info, bitstream_buffer_count, bitstream_buffers, target);
@@ -171,31 +338,246 @@ VdpStatus vdp_decoder_render(VdpDecoder decoder,
     return VDP_STATUS_OK;
 }
 
+VdpStatus vdp_decoder_flush_odroid(VdpDecoder decoder)
+{
+    decoder_ctx_t *dec = handle_get(decoder, HANDLE_TYPE_DECODER);
+    if (!dec)
+        return VDP_STATUS_INVALID_HANDLE;
+
+    return flush(dec);
+}
+
+VdpStatus vdp_decoder_set_buffering_odroid(VdpDecoder decoder, VdpDecoderBufferingOdroid buffering)
+{
+    decoder_ctx_t *dec = handle_get(decoder, HANDLE_TYPE_DECODER);
+    if (!dec)
+        return VDP_STATUS_INVALID_HANDLE;
+
+    if (buffering > VDP_DECODER_BUFFERING_SMOOTH_ODROID)
+        return VDP_STATUS_INVALID_VALUE;
+
+    return dec->backend->set_buffering(dec->private, buffering);
+}
+
+static uint32_t header_hash(const uint8_t *key, uint32_t len)
+{
+    uint32_t hash = 2166136261u;
+    uint32_t i;
+
+    for (i = 0; i < len; i++)
+        hash = (hash ^ key[i]) * 16777619u;
+
+    return hash;
+}
+
+/*
+ * Submits the stream headers described by key unless they are identical to
+ * the ones sent last. Encoded headers are kept in a small per decoder cache,
+ * so write is only called the first time a parameter set is seen.
+ */
+static VdpStatus decode_header(decoder_ctx_t *dec, const void *key, uint32_t key_len,
+                               header_writer_t write, VdpPictureInfo const *info,
+                               VdpVideoSurface output)
+{
+    header_cache_entry_t *e = dec->last_header;
+    uint32_t hash = header_hash(key, key_len);
+    int i;
+
+    if (e && e->hash == hash && e->key_len == key_len && !memcmp(e->key, key, key_len))
+        return VDP_STATUS_OK;
+
+    e = NULL;
+    for (i = 0; i < HEADER_CACHE_SIZE; i++) {
+        header_cache_entry_t *c = &dec->header_cache[i];
+        if (c->len && c->hash == hash && c->key_len == key_len && !memcmp(c->key, key, key_len)) {
+            e = c;
+            break;
+        }
+    }
+
+    if (e) {
+        dec->header_hits++;
+    } else {
+        dec->header_misses++;
+
+        e = &dec->header_cache[dec->header_cache_next];
+        dec->header_cache_next = (dec->header_cache_next + 1) % HEADER_CACHE_SIZE;
+
+        int len = write(dec, info, e->data, HEADER_MAX_SIZE);
+        if (len <= 0) {
+            e->len = 0;
+            return VDP_STATUS_ERROR;
+        }
+
+        e->len = len;
+        e->hash = hash;
+        e->key_len = key_len;
+        memcpy(e->key, key, key_len);
+    }
+
+    dec->last_header = e;
+
+    VdpBitstreamBuffer buffer;
+    buffer.struct_version = VDP_BITSTREAM_BUFFER_VERSION;
+    buffer.bitstream = e->data;
+    buffer.bitstream_bytes = e->len;
+    return submit_buffers(dec, info, 1, &buffer, output, CAPTURE_FLAG_HEADER);
+}
+
+static int write_h264_header(decoder_ctx_t *dec, VdpPictureInfo const *info, uint8_t *buf, int size)
+{
+    int sps, pps;
+
+    sps = write_nal_unit(NAL_UNIT_TYPE_SPS, dec->width, dec->height, dec->profile, (VdpPictureInfoH264*)info,
+                         dec->h264_reorder->num_reorder_frames, buf, size);
+    if (sps < 0)
+        return -1;
+    pps = write_nal_unit(NAL_UNIT_TYPE_PPS, dec->width, dec->height, dec->profile, (VdpPictureInfoH264*)info,
+                         dec->h264_reorder->num_reorder_frames, buf + sps, size - sps);
+    if (pps < 0)
+        return -1;
+
+    return sps + pps;
+}
+
+_Static_assert(sizeof(h264_header_key_t) <= HEADER_KEY_SIZE, "h264 header key too large");
+
 static VdpStatus decode_h264(struct decoder_ctx_struct *dec, VdpPictureInfo const *info, uint32_t buffer_count,
                       VdpBitstreamBuffer const *buffers, VdpVideoSurface output) {
-    if (dec->header == NULL)
-        dec->header = calloc(256, 1);
-    dec->header_len = write_nal_unit(NAL_UNIT_TYPE_SPS, dec->width, dec->height, dec->profile, (VdpPictureInfoH264*)info, dec->header, 256);
-    dec->header_len += write_nal_unit(NAL_UNIT_TYPE_PPS, dec->width, dec->height, dec->profile, (VdpPictureInfoH264*)info, dec->header + dec->header_len, 256 - dec->header_len);
-
-    if (dec->last_header == NULL || dec->header_len != dec->last_header_len || memcmp(dec->last_header, dec->header, dec->header_len)) {
-        VdpBitstreamBuffer buffer;
-        buffer.struct_version = VDP_BITSTREAM_BUFFER_VERSION;
-        buffer.bitstream = dec->header;
-        buffer.bitstream_bytes = dec->header_len;
-        decode_raw(dec, info, 1, &buffer, output);
-
-        if (dec->last_header)
-            free(dec->last_header);
-        dec->last_header = dec->header;
-        dec->header = NULL;
-        dec->last_header_len = dec->header_len;
+    h264_header_key_t key;
+    int num_reorder_frames;
+
+    num_reorder_frames = h264_reorder_update(dec->h264_reorder, (VdpPictureInfoH264*)info,
+                                             random_access_h264(info, buffer_count, buffers));
+    h264_header_key(&key, dec->width, dec->height, dec->profile, (VdpPictureInfoH264*)info, num_reorder_frames);
+
+    VdpStatus ret = decode_header(dec, &key, sizeof(key), write_h264_header, info, output);
+    if (ret != VDP_STATUS_OK)
+        return ret;
+
+    return decode_raw(dec, info, buffer_count, buffers, output);
+}
+
+static int write_mpeg12_header(decoder_ctx_t *dec, VdpPictureInfo const *info, uint8_t *buf, int size)
+{
+    return mpeg12_write_sequence_header(dec->width, dec->height, dec->profile, (VdpPictureInfoMPEG1Or2*)info, buf, size);
+}
+
+_Static_assert(sizeof(mpeg12_header_key_t) <= HEADER_KEY_SIZE, "mpeg12 header key too large");
+
+static VdpStatus decode_mpeg12(struct decoder_ctx_struct *dec, VdpPictureInfo const *info, uint32_t buffer_count,
+                      VdpBitstreamBuffer const *buffers, VdpVideoSurface output) {
+    mpeg12_header_key_t key;
+    uint8_t picture_header[MPEG12_PICTURE_HEADER_MAX_SIZE];
+    VdpBitstreamBuffer picture[buffer_count + 1];
+
+    mpeg12_header_key(&key, dec->width, dec->height, dec->profile, (VdpPictureInfoMPEG1Or2*)info);
+
+    VdpStatus ret = decode_header(dec, &key, sizeof(key), write_mpeg12_header, info, output);
+    if (ret != VDP_STATUS_OK)
+        return ret;
+
+    // the picture headers have to travel in the same MFC buffer as the slices
+    int len = mpeg12_write_picture_header(dec->profile, (VdpPictureInfoMPEG1Or2*)info, picture_header, sizeof(picture_header));
+    if (len < 0)
+        return VDP_STATUS_ERROR;
+
+    picture[0].struct_version = VDP_BITSTREAM_BUFFER_VERSION;
+    picture[0].bitstream = picture_header;
+    picture[0].bitstream_bytes = len;
+    memcpy(picture + 1, buffers, buffer_count * sizeof(VdpBitstreamBuffer));
+
+    return submit_buffers(dec, info, buffer_count + 1, picture, output, CAPTURE_FLAG_PREFIX);
+}
+
+static int write_mpeg4_header(decoder_ctx_t *dec, VdpPictureInfo const *info, uint8_t *buf, int size)
+{
+    return mpeg4_write_vol_header(dec->width, dec->height, dec->profile, (VdpPictureInfoMPEG4Part2*)info, buf, size);
+}
+
+_Static_assert(sizeof(mpeg4_header_key_t) <= HEADER_KEY_SIZE, "mpeg4 header key too large");
+
+static VdpStatus decode_mpeg4(struct decoder_ctx_struct *dec, VdpPictureInfo const *info, uint32_t buffer_count,
+                      VdpBitstreamBuffer const *buffers, VdpVideoSurface output) {
+    mpeg4_header_key_t key;
+
+    // short video header (H.263) pictures carry everything in their picture header
+    if (!((VdpPictureInfoMPEG4Part2*)info)->short_video_header) {
+        mpeg4_header_key(&key, dec->width, dec->height, dec->profile, (VdpPictureInfoMPEG4Part2*)info);
+
+        VdpStatus ret = decode_header(dec, &key, sizeof(key), write_mpeg4_header, info, output);
+        if (ret != VDP_STATUS_OK)
+            return ret;
     }
+
     return decode_raw(dec, info, buffer_count, buffers, output);
 }
 
-static VdpStatus decode_raw(struct decoder_ctx_struct *dec, VdpPictureInfo const *info, uint32_t buffer_count,
+static int write_vc1_header(decoder_ctx_t *dec, VdpPictureInfo const *info, uint8_t *buf, int size)
+{
+    return vc1_write_sequence_header(dec->width, dec->height, dec->profile, (VdpPictureInfoVC1*)info, buf, size);
+}
+
+_Static_assert(sizeof(vc1_header_key_t) <= HEADER_KEY_SIZE, "vc1 header key too large");
+
+static VdpStatus decode_vc1(struct decoder_ctx_struct *dec, VdpPictureInfo const *info, uint32_t buffer_count,
                       VdpBitstreamBuffer const *buffers, VdpVideoSurface output) {
+    vc1_header_key_t key;
+    uint8_t frame_header[VC1_FRAME_HEADER_MAX_SIZE];
+    VdpBitstreamBuffer picture[buffer_count + 1];
+    uint32_t i, frame_size = 0;
+
+    vc1_header_key(&key, dec->width, dec->height, dec->profile, (VdpPictureInfoVC1*)info);
+
+    VdpStatus ret = decode_header(dec, &key, sizeof(key), write_vc1_header, info, output);
+    if (ret != VDP_STATUS_OK)
+        return ret;
+
+    for (i = 0; i < buffer_count; i++)
+        frame_size += buffers[i].bitstream_bytes;
+
+    const uint8_t *frame = (buffer_count && buffers[0].bitstream_bytes >= 3) ? buffers[0].bitstream : NULL;
+    int len = vc1_write_frame_header(dec->profile, (VdpPictureInfoVC1*)info, frame_size, frame, frame_header, sizeof(frame_header));
+    if (len < 0)
+        return VDP_STATUS_ERROR;
+    if (len == 0)
+        return decode_raw(dec, info, buffer_count, buffers, output);
+
+    picture[0].struct_version = VDP_BITSTREAM_BUFFER_VERSION;
+    picture[0].bitstream = frame_header;
+    picture[0].bitstream_bytes = len;
+    memcpy(picture + 1, buffers, buffer_count * sizeof(VdpBitstreamBuffer));
+
+    return submit_buffers(dec, info, buffer_count + 1, picture, output, CAPTURE_FLAG_PREFIX);
+}
+
+#ifdef VDP_DECODER_PROFILE_HEVC_MAIN
+static int write_hevc_header(decoder_ctx_t *dec, VdpPictureInfo const *info, uint8_t *buf, int size)
+{
+    return hevc_write_parameter_sets(dec->width, dec->height, dec->profile, (VdpPictureInfoHEVC*)info, dec->hevc_rps, buf, size);
+}
+
+_Static_assert(sizeof(hevc_header_key_t) <= HEADER_KEY_SIZE, "hevc header key too large");
+
+static VdpStatus decode_hevc(struct decoder_ctx_struct *dec, VdpPictureInfo const *info, uint32_t buffer_count,
+                      VdpBitstreamBuffer const *buffers, VdpVideoSurface output) {
+    hevc_header_key_t key;
+
+    // a newly seen SPS short-term RPS changes the key at the next IRAP picture, the SPS goes out again before it
+    hevc_learn_rps(dec->hevc_rps, (VdpPictureInfoHEVC*)info);
+    hevc_header_key(&key, dec->width, dec->height, dec->profile, (VdpPictureInfoHEVC*)info, dec->hevc_rps);
+
+    VdpStatus ret = decode_header(dec, &key, sizeof(key), write_hevc_header, info, output);
+    if (ret != VDP_STATUS_OK)
+        return ret;
+
+    return decode_raw(dec, info, buffer_count, buffers, output);
+}
+#endif
+
+// VDPAU_DEBUG=dump and raw, for whatever goes to the backend
+static void trace_buffers(struct decoder_ctx_struct *dec, VdpPictureInfo const *info, uint32_t buffer_count,
+                      VdpBitstreamBuffer const *buffers, uint32_t capture_flags) {
     unsigned int i;
 
     if (dec->debug & DEBUG_DECODE_DUMP) {
@@ -209,18 +591,53 @@ static VdpStatus decode_raw(struct decoder_ctx_struct *dec, VdpPictureInfo const
         }
     }
 
-    if (dec->debug & DEBUG_DECODE_RAW) {
-        FILE *f = fopen("vid.raw", "a+");
-        for (i = 0; i < buffer_count; i++)
-        {
-            fwrite(buffers[i].bitstream, 1, buffers[i].bitstream_bytes, f);
-        }
-        fclose(f);
+    if (dec->capture)
+        capture_submit(dec->capture, info, buffer_count, buffers, capture_flags);
+}
+
+static VdpStatus submit_buffers(struct decoder_ctx_struct *dec, VdpPictureInfo const *info, uint32_t buffer_count,
+                      VdpBitstreamBuffer const *buffers, VdpVideoSurface output, uint32_t capture_flags) {
+    trace_buffers(dec, info, buffer_count, buffers, capture_flags);
+
+    return dec->backend->decode(dec->private, buffer_count, buffers, output, dec->generation);
+}
+
+static VdpStatus decode_picture(struct decoder_ctx_struct *dec, VdpPictureInfo const *info, uint32_t buffer_count,
+                      VdpBitstreamBuffer const *buffers, VdpVideoSurface output) {
+    trace_buffers(dec, info, buffer_count, buffers, 0);
+
+    return dec->backend->decode_picture(dec->private, info, buffer_count, buffers, output, dec->generation);
+}
+
+static VdpStatus decode_raw(struct decoder_ctx_struct *dec, VdpPictureInfo const *info, uint32_t buffer_count,
+                      VdpBitstreamBuffer const *buffers, VdpVideoSurface output) {
+    return submit_buffers(dec, info, buffer_count, buffers, output, 0);
+}
+
+static int random_access_h264(VdpPictureInfo const *info, uint32_t buffer_count, VdpBitstreamBuffer const *buffers)
+{
+    uint32_t i;
+
+    // slices come with start codes, the first NAL unit decides
+    for (i = 0; i < buffer_count; i++) {
+        const uint8_t *p = buffers[i].bitstream;
+        uint32_t j;
+
+        for (j = 0; j + 3 < buffers[i].bitstream_bytes; j++)
+            if (p[j] == 0x00 && p[j + 1] == 0x00 && p[j + 2] == 0x01)
+                return (p[j + 3] & 0x1f) == NAL_UNIT_TYPE_CODED_SLICE_IDR;
     }
 
-    return decoder_decode(dec->private, buffer_count, buffers, output);
+    return 0;
 }
 
+#ifdef VDP_DECODER_PROFILE_HEVC_MAIN
+static int random_access_hevc(VdpPictureInfo const *info, uint32_t buffer_count, VdpBitstreamBuffer const *buffers)
+{
+    return ((VdpPictureInfoHEVC *)info)->RAPPicFlag;
+}
+#endif
+
 VdpStatus vdp_decoder_query_capabilities(VdpDevice device,
                                          VdpDecoderProfile profile,
                                          VdpBool *is_supported,
@@ -232,10 +649,12 @@ VdpStatus vdp_decoder_query_capabilities(VdpDevice device,
     if (!is_supported || !max_level || !max_macroblocks || !max_width || !max_height)
         return VDP_STATUS_INVALID_POINTER;
 
-    device_ctx_t *dev = handle_get(device);
+    device_ctx_t *dev = handle_get(device, HANDLE_TYPE_DEVICE);
     if (!dev)
         return VDP_STATUS_INVALID_HANDLE;
 
+    int index = 0;
+
     // guessed in lack of documentation, bigger pictures should be possible
     *max_level = 16;
     *max_width = 3840;
@@ -250,9 +669,25 @@ VdpStatus vdp_decoder_query_capabilities(VdpDevice device,
     case VDP_DECODER_PROFILE_H264_BASELINE:
     case VDP_DECODER_PROFILE_H264_MAIN:
     case VDP_DECODER_PROFILE_H264_HIGH:
+    case VDP_DECODER_PROFILE_VC1_SIMPLE:
+    case VDP_DECODER_PROFILE_VC1_MAIN:
+    case VDP_DECODER_PROFILE_VC1_ADVANCED:
+#ifdef VDP_DECODER_PROFILE_HEVC_MAIN
+    case VDP_DECODER_PROFILE_HEVC_MAIN:
+#endif
     case VDP_DECODER_PROFILE_MPEG4_PART2_SP:
     case VDP_DECODER_PROFILE_MPEG4_PART2_ASP:
-        *is_supported = VDP_TRUE;
+    case VDP_DECODER_PROFILE_DIVX4_QMOBILE:
+    case VDP_DECODER_PROFILE_DIVX4_MOBILE:
+    case VDP_DECODER_PROFILE_DIVX4_HOME_THEATER:
+    case VDP_DECODER_PROFILE_DIVX4_HD_1080P:
+    case VDP_DECODER_PROFILE_DIVX5_QMOBILE:
+    case VDP_DECODER_PROFILE_DIVX5_MOBILE:
+    case VDP_DECODER_PROFILE_DIVX5_HOME_THEATER:
+    case VDP_DECODER_PROFILE_DIVX5_HD_1080P:
+        // the backends know which codecs the hardware actually takes
+        find_backend(profile, &index, is_supported, max_width, max_height);
+        *max_macroblocks = (*max_width * *max_height) / (16 * 16);
         break;
 
     default:
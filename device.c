@@ -18,6 +18,17 @@
  */
 
 #include "vdpau_private.h"
+#include "vdpau_odroid.h"
+
+// the MFC first, its driver doesn't behave like other stateful decoders,
+// stateless ones only take H.264 and MPEG-2 and go last
+const decoder_backend_t *const decoder_backends[] =
+{
+    &decoder_backend_mfc,
+    &decoder_backend_v4l2,
+    &decoder_backend_stateless,
+    NULL
+};
 
 __attribute__((constructor))
 static
@@ -25,6 +36,7 @@ void
 library_constructor(void)
 {
     XInitThreads();
+    memstat_init();
 }
 
 VdpStatus vdp_imp_device_create_x11(Display *display,
@@ -39,7 +51,7 @@ VdpStatus vdp_imp_device_create_x11(Display *display,
     if (!dev)
         return VDP_STATUS_RESOURCES;
 
-    int handle = handle_create(dev);
+    int handle = handle_create(dev, HANDLE_TYPE_DEVICE);
     if (handle == -1)
     {
         free(dev);
@@ -176,12 +188,16 @@ VdpStatus vdp_imp_device_create_x11(Display *display,
         return VDP_STATUS_RESOURCES;
     }
 
+    video_surface_dmabuf_init(dev);
+
     if (!eglMakeCurrent(dev->egl.display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT)) {
         VDPAU_DBG ("Could not set EGL context to none %x", eglGetError());
         free(dev);
         return VDP_STATUS_RESOURCES;
     }
 
+    video_surface_pool_init(dev);
+
     *device = handle;
     *get_proc_address = &vdp_get_proc_address;
 
@@ -190,10 +206,21 @@ VdpStatus vdp_imp_device_create_x11(Display *display,
 
 VdpStatus vdp_device_destroy(VdpDevice device)
 {
-    device_ctx_t *dev = handle_get(device);
+    device_ctx_t *dev = handle_get(device, HANDLE_TYPE_DEVICE);
     if (!dev)
         return VDP_STATUS_INVALID_HANDLE;
 
+    video_surface_dmabuf_flush(dev);
+    video_surface_pool_flush(dev);
+
+    int i;
+    for (i = 0; decoder_backends[i]; i++)
+        if (decoder_backends[i]->drain)
+            decoder_backends[i]->drain();
+
+    if (memstat_enabled())
+        memstat_dump();
+
     gl_delete_shader(&dev->egl.yuvi420_rgb);
     gl_delete_shader(&dev->egl.yuyv422_rgb);
     gl_delete_shader(&dev->egl.uyvy422_rgb);
@@ -202,6 +229,8 @@ VdpStatus vdp_device_destroy(VdpDevice device)
     gl_delete_shader(&dev->egl.vuy8444_rgb);
     gl_delete_shader(&dev->egl.copy);
     gl_delete_shader(&dev->egl.brswap);
+    gl_delete_shader(&dev->egl.yuvi420_external_rgb);
+    gl_delete_shader(&dev->egl.yuvnv12_external_rgb);
 
     eglDestroyContext(dev->egl.display, dev->egl.context);
     eglDestroySurface(dev->egl.display, dev->egl.surface);
@@ -219,7 +248,7 @@ VdpStatus vdp_preemption_callback_register(VdpDevice device,
                                            VdpPreemptionCallback callback,
                                            void *context)
 {
-    device_ctx_t *dev = handle_get(device);
+    device_ctx_t *dev = handle_get(device, HANDLE_TYPE_DEVICE);
     if (!dev)
         return VDP_STATUS_INVALID_HANDLE;
 
@@ -301,7 +330,7 @@ VdpStatus vdp_get_proc_address(VdpDevice device_handle,
     if (!function_pointer)
         return VDP_STATUS_INVALID_POINTER;
 
-    device_ctx_t *device = handle_get(device_handle);
+    device_ctx_t *device = handle_get(device_handle, HANDLE_TYPE_DEVICE);
     if (!device)
         return VDP_STATUS_INVALID_HANDLE;
 
@@ -319,6 +348,18 @@ VdpStatus vdp_get_proc_address(VdpDevice device_handle,
 
         return VDP_STATUS_OK;
     }
+    else if (function_id == VDP_FUNC_ID_DECODER_FLUSH_ODROID)
+    {
+        *function_pointer = &vdp_decoder_flush_odroid;
+
+        return VDP_STATUS_OK;
+    }
+    else if (function_id == VDP_FUNC_ID_DECODER_SET_BUFFERING_ODROID)
+    {
+        *function_pointer = &vdp_decoder_set_buffering_odroid;
+
+        return VDP_STATUS_OK;
+    }
 
     return VDP_STATUS_INVALID_FUNC_ID;
 }
@@ -171,6 +171,49 @@ static const char* fragment_shaders[] = {
     "uniform sampler2D s_tex;"
     "void main(void) {"
     "   gl_FragColor = texture2D(s_tex, vTexcoord).bgra;"
+    "}",
+
+    /* YUVI420 RGB from dma-buf EGLImages, one R8 image per plane */
+    "#extension GL_OES_EGL_image_external : require\n"
+    "precision mediump float;"
+    "varying vec2 vTexcoord;"
+    "uniform samplerExternalOES s_ytex,s_utex,s_vtex;"
+    "const vec3 offset = vec3(-0.0625, -0.5, -0.5);"
+    "uniform vec3 rcoeff;"
+    "uniform vec3 gcoeff;"
+    "uniform vec3 bcoeff;"
+    "void main(void) {"
+    "  float r,g,b;"
+    "  vec3 yuv;"
+    "  yuv.x=texture2D(s_ytex,vTexcoord).r;"
+    "  yuv.y=texture2D(s_utex,vTexcoord).r;"
+    "  yuv.z=texture2D(s_vtex,vTexcoord).r;"
+    "  yuv += offset;"
+    "  r = dot(yuv, rcoeff);"
+    "  g = dot(yuv, gcoeff);"
+    "  b = dot(yuv, bcoeff);"
+    "  gl_FragColor=vec4(r,g,b,1.0);"
+    "}",
+
+    /* NV12 RGB from dma-buf EGLImages, R8 luma and GR88 chroma */
+    "#extension GL_OES_EGL_image_external : require\n"
+    "precision mediump float;"
+    "varying vec2 vTexcoord;"
+    "uniform samplerExternalOES s_ytex,s_uvtex;"
+    "const vec3 offset = vec3(-0.0625, -0.5, -0.5);"
+    "uniform vec3 rcoeff;"
+    "uniform vec3 gcoeff;"
+    "uniform vec3 bcoeff;"
+    "void main(void) {"
+    "  float r,g,b;"
+    "  vec3 yuv;"
+    "  yuv.x=texture2D(s_ytex,vTexcoord).r;"
+    "  yuv.yz=texture2D(s_uvtex,vTexcoord).rg;"
+    "  yuv += offset;"
+    "  r = dot(yuv, rcoeff);"
+    "  g = dot(yuv, gcoeff);"
+    "  b = dot(yuv, bcoeff);"
+    "  gl_FragColor=vec4(r,g,b,1.0);"
     "}"
 
 };
@@ -310,6 +353,7 @@ gl_init_shader (shader_ctx_t *shader,
 
     switch(process_type) {
         case SHADER_YUVI420_RGB:
+        case SHADER_YUVI420_EXTERNAL_RGB:
             shader->texture[0] = glGetUniformLocation(shader->program, "s_ytex");
             CHECKEGL
             shader->texture[1] = glGetUniformLocation(shader->program, "s_utex");
@@ -318,6 +362,7 @@ gl_init_shader (shader_ctx_t *shader,
             CHECKEGL
             break;
         case SHADER_YUVNV12_RGB:
+        case SHADER_YUVNV12_EXTERNAL_RGB:
             shader->texture[0] = glGetUniformLocation(shader->program, "s_ytex");
             CHECKEGL
             shader->texture[1] = glGetUniformLocation(shader->program, "s_uvtex");
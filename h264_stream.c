@@ -23,6 +23,7 @@
 #include <stdint.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 
 #include "h264_stream.h"
 
@@ -43,11 +44,50 @@ int intlog2(int x)
     return log;
 }
 
+/**
+   Find the first pair of zero bytes in [p, end).
+   Whole machine words without any zero byte are skipped, the byte wise check
+   only runs on words that contain at least one zero.
+   @return  pointer to the first zero of the pair, or end if there is none
+ */
+static const uint8_t* find_zero_pair(const uint8_t* p, const uint8_t* end)
+{
+    const unsigned long ones = ~0UL / 0xff;
+    const unsigned long highs = ones << 7;
+
+    while (end - p > 1)
+    {
+        const uint8_t* stop;
+
+        while ((size_t)(end - p) >= sizeof(unsigned long))
+        {
+            unsigned long x;
+            memcpy(&x, p, sizeof(x));
+            if ((x - ones) & ~x & highs)
+                break;
+            p += sizeof(x);
+        }
+
+        stop = p + sizeof(unsigned long);
+        if (stop > end - 1) { stop = end - 1; }
+
+        for (; p < stop; p++)
+        {
+            if (p[0] == 0x00 && p[1] == 0x00)
+                return p;
+        }
+    }
+
+    return end;
+}
+
 /**
    Convert RBSP data to NAL data (Annex B format).
    The size of nal_buf must be 4/3 * the size of the rbsp_buf (rounded up) to guarantee the output will fit.
    If that is not true, output may be truncated and an error will be returned.
    If that is true, there is no possible error during this conversion.
+   Runs without two consecutive zero bytes are copied as a block, so this is
+   also cheap enough for rewriting slice data in-band.
    @param[in] rbsp_buf   the rbsp data
    @param[in] rbsp_size  pointer to the size of the rbsp data
    @param[in,out] nal_buf   allocated memory in which to put the nal data
@@ -58,41 +98,35 @@ int intlog2(int x)
 // 7.4.1.1 Encapsulation of an SODB within an RBSP
 int rbsp_to_nal(const uint8_t* rbsp_buf, const int* rbsp_size, uint8_t* nal_buf, int* nal_size)
 {
-    int i;
-    int j     = 1;
-    int count = 0;
+    const uint8_t* src = rbsp_buf;
+    const uint8_t* end = rbsp_buf + *rbsp_size;
+    int j = 1;
 
-    if (*nal_size > 0) { nal_buf[0] = 0x00; } // zero out first byte since we start writing from second byte
+    if (*nal_size <= 0) { return -1; }
+    nal_buf[0] = 0x00; // zero out first byte since we start writing from second byte
 
-    for ( i = 0; i < *rbsp_size ; i++ )
+    while (src < end)
     {
-        if ( j >= *nal_size )
-        {
-            // error, not enough space
-            return -1;
-        }
+        const uint8_t* pair = find_zero_pair(src, end);
+        int n = ((pair < end - 1) ? pair + 2 : end) - src;
 
-        if ( ( count == 2 ) && !(rbsp_buf[i] & 0xFC) ) // HACK 0xFC
-        {
-            nal_buf[j] = 0x03;
-            j++;
-            count = 0;
-        }
-        nal_buf[j] = rbsp_buf[i];
-        if ( rbsp_buf[i] == 0x00 )
-        {
-            count++;
-        }
-        else
+        if (j + n > *nal_size) { return -1; } // error, not enough space
+        memcpy(nal_buf + j, src, n);
+        src += n;
+        j += n;
+
+        // the last two bytes written are 00 00, escape anything that could form a start code
+        if (src < end && !(*src & 0xFC))
         {
-            count = 0;
+            if (j >= *nal_size) { return -1; }
+            nal_buf[j++] = 0x03;
         }
-        j++;
     }
 
-    if (rbsp_buf[(*rbsp_size) -1] == 0x00) {
-        nal_buf[j] = 0x03;
-        j++;
+    if (*rbsp_size > 0 && rbsp_buf[(*rbsp_size) - 1] == 0x00)
+    {
+        if (j >= *nal_size) { return -1; }
+        nal_buf[j++] = 0x03;
     }
 
     *nal_size = j;
@@ -101,6 +135,95 @@ int rbsp_to_nal(const uint8_t* rbsp_buf, const int* rbsp_size, uint8_t* nal_buf,
 
 /***************************** writing ******************************/
 
+void h264_header_key(h264_header_key_t *key, int width, int height, VdpDecoderProfile profile, VdpPictureInfoH264 *vdppi,
+                     int num_reorder_frames)
+{
+    memset(key, 0, sizeof(*key));
+
+    key->profile = profile;
+    key->width = width;
+    key->height = height;
+    key->frame_mbs_only_flag = vdppi->frame_mbs_only_flag;
+    key->mb_adaptive_frame_field_flag = vdppi->mb_adaptive_frame_field_flag;
+    key->direct_8x8_inference_flag = vdppi->direct_8x8_inference_flag;
+    key->num_ref_frames = vdppi->num_ref_frames;
+    key->log2_max_frame_num_minus4 = vdppi->log2_max_frame_num_minus4;
+    key->pic_order_cnt_type = vdppi->pic_order_cnt_type;
+    key->log2_max_pic_order_cnt_lsb_minus4 = vdppi->log2_max_pic_order_cnt_lsb_minus4;
+    key->delta_pic_order_always_zero_flag = vdppi->delta_pic_order_always_zero_flag;
+    key->num_reorder_frames = num_reorder_frames;
+    key->entropy_coding_mode_flag = vdppi->entropy_coding_mode_flag;
+    key->pic_order_present_flag = vdppi->pic_order_present_flag;
+    key->num_ref_idx_l0_active_minus1 = vdppi->num_ref_idx_l0_active_minus1;
+    key->num_ref_idx_l1_active_minus1 = vdppi->num_ref_idx_l1_active_minus1;
+    key->weighted_pred_flag = vdppi->weighted_pred_flag;
+    key->weighted_bipred_idc = vdppi->weighted_bipred_idc;
+    key->pic_init_qp_minus26 = vdppi->pic_init_qp_minus26;
+    key->chroma_qp_index_offset = vdppi->chroma_qp_index_offset;
+    key->second_chroma_qp_index_offset = vdppi->second_chroma_qp_index_offset;
+    key->deblocking_filter_control_present_flag = vdppi->deblocking_filter_control_present_flag;
+    key->constrained_intra_pred_flag = vdppi->constrained_intra_pred_flag;
+    key->redundant_pic_cnt_present_flag = vdppi->redundant_pic_cnt_present_flag;
+    key->transform_8x8_mode_flag = vdppi->transform_8x8_mode_flag;
+    memcpy(key->scaling_lists_4x4, vdppi->scaling_lists_4x4, sizeof(key->scaling_lists_4x4));
+    memcpy(key->scaling_lists_8x8, vdppi->scaling_lists_8x8, sizeof(key->scaling_lists_8x8));
+}
+
+void h264_reorder_init(h264_reorder_t *r)
+{
+    memset(r, 0, sizeof(*r));
+    r->observed = -1;
+    r->num_reorder_frames = -1;
+    r->first_field = -1;
+}
+
+// returns the num_reorder_frames the SPS of this picture announces
+int h264_reorder_update(h264_reorder_t *r, VdpPictureInfoH264 *vdppi, int idr)
+{
+    int32_t poc;
+    int i, depth = 0;
+
+    if (idr)
+    {
+        r->count = 0;
+        r->first_field = -1;
+        r->num_reorder_frames = r->observed;
+    }
+
+    if (vdppi->field_pic_flag)
+    {
+        // the second field shares its frame's place in output order
+        if (r->first_field == vdppi->frame_num)
+        {
+            r->first_field = -1;
+            return r->num_reorder_frames;
+        }
+        r->first_field = vdppi->frame_num;
+        poc = vdppi->field_order_cnt[vdppi->bottom_field_flag];
+    }
+    else
+    {
+        r->first_field = -1;
+        poc = vdppi->field_order_cnt[0] < vdppi->field_order_cnt[1] ? vdppi->field_order_cnt[0] : vdppi->field_order_cnt[1];
+    }
+
+    for (i = 0; i < r->count; i++)
+        if (r->poc[i] > poc)
+            depth++;
+
+    if (depth > r->observed)
+        r->observed = depth;
+
+    if (r->count == H264_REORDER_WINDOW)
+    {
+        memmove(r->poc, r->poc + 1, (H264_REORDER_WINDOW - 1) * sizeof(r->poc[0]));
+        r->count--;
+    }
+    r->poc[r->count++] = poc;
+
+    return r->num_reorder_frames;
+}
+
 /**
  Write a NAL unit to a byte buffer.
  The NAL which is written out has a type determined by h->nal and data which comes from other fields within h depending on its type.
@@ -110,23 +233,28 @@ int rbsp_to_nal(const uint8_t* rbsp_buf, const int* rbsp_size, uint8_t* nal_buf,
  @return                    the length of data actually written
  */
 //7.3.1 NAL unit syntax
-int write_nal_unit(int nal_unit_type, int width, int height, VdpDecoderProfile profile, VdpPictureInfoH264 *vdppi, uint8_t* buf, int size)
+int write_nal_unit(int nal_unit_type, int width, int height, VdpDecoderProfile profile, VdpPictureInfoH264 *vdppi,
+                   int num_reorder_frames, uint8_t* buf, int size)
 {
     #define HEADER_SIZE 3
+    uint8_t rbsp_buf[NAL_RBSP_MAX_SIZE];
     int rbsp_size = size*3/4; // NOTE this may have to be slightly smaller (3/4 smaller, worst case) in order to be guaranteed to fit
-    uint8_t* rbsp_buf = (uint8_t*)calloc(1, rbsp_size); // FIXME can use malloc?
     int nal_size = size - HEADER_SIZE;
+    bs_t b;
 
-    bs_t* b = bs_new(rbsp_buf, rbsp_size);
+    if (nal_size <= 0) { return -1; }
+    if (rbsp_size > (int)sizeof(rbsp_buf)) { rbsp_size = sizeof(rbsp_buf); }
+
+    bs_init(&b, rbsp_buf, rbsp_size);
 
     switch ( nal_unit_type )
     {
         case NAL_UNIT_TYPE_SPS:
-            write_seq_parameter_set_rbsp(width, height, profile, vdppi, b);
+            write_seq_parameter_set_rbsp(width, height, profile, vdppi, num_reorder_frames, &b);
             break;
 
         case NAL_UNIT_TYPE_PPS:
-            write_pic_parameter_set_rbsp(vdppi, b);
+            write_pic_parameter_set_rbsp(vdppi, &b);
             break;
 
         default:
@@ -134,43 +262,173 @@ int write_nal_unit(int nal_unit_type, int width, int height, VdpDecoderProfile p
             return 0;
     }
 
-
-    if (bs_overrun(b)) { bs_free(b); free(rbsp_buf); return -1; }
+    if (bs_overrun(&b)) { return -1; }
 
     // now get the actual size used
-    rbsp_size = bs_pos(b);
+    rbsp_size = bs_pos(&b);
+
+    if (rbsp_to_nal(rbsp_buf, &rbsp_size, buf + HEADER_SIZE, &nal_size) < 0) { return -1; }
 
-    int rc = rbsp_to_nal(rbsp_buf, &rbsp_size, buf + HEADER_SIZE, &nal_size);
-    if (rc < 0) { bs_free(b); free(rbsp_buf); return -1; }
+    bs_init(&b, buf, HEADER_SIZE + 1);
 
-    bs_free(b);
-    free(rbsp_buf);
+    bs_write_u8(&b, 0);
+    bs_write_u8(&b, 0);
+    bs_write_u8(&b, 1);
 
-    b = bs_new(buf, size);
+    bs_write_f(&b,1, 0);
+    bs_write_u(&b,2, NAL_REF_IDC_PRIORITY_HIGHEST);
+    bs_write_u(&b,5, nal_unit_type);
 
-    bs_write_u8(b, 0);
-    bs_write_u8(b, 0);
-    bs_write_u8(b, 1);
+    return nal_size + HEADER_SIZE;
+}
 
-    bs_write_f(b,1, 0);
-    bs_write_u(b,2, NAL_REF_IDC_PRIORITY_HIGHEST);
-    bs_write_u(b,5, nal_unit_type);
 
-    bs_free(b);
+// 8.5.6 frame scan, VDPAU hands the lists over in raster order
+static const uint8_t zigzag_4x4[16] =
+{
+     0,  1,  4,  8,  5,  2,  3,  6,  9, 12, 13, 10,  7, 11, 14, 15
+};
 
-    return nal_size + HEADER_SIZE;
+static const uint8_t zigzag_8x8[64] =
+{
+     0,  1,  8, 16,  9,  2,  3, 10, 17, 24, 32, 25, 18, 11,  4,  5,
+    12, 19, 26, 33, 40, 48, 41, 34, 27, 20, 13,  6,  7, 14, 21, 28,
+    35, 42, 49, 56, 57, 50, 43, 36, 29, 22, 15, 23, 30, 37, 44, 51,
+    58, 59, 52, 45, 38, 31, 39, 46, 53, 60, 61, 54, 47, 55, 62, 63
+};
+
+// Table A-1, level 1b left out
+static const struct
+{
+    uint8_t level_idc;
+    uint32_t max_fs;        // MaxFS, macroblocks per frame
+    uint32_t max_dpb_mbs;   // MaxDpbMbs
+} level_limits[] =
+{
+    { 10,    99,    396 },
+    { 11,   396,    900 },
+    { 12,   396,   2376 },
+    { 20,   396,   2376 },
+    { 21,   792,   4752 },
+    { 22,  1620,   8100 },
+    { 30,  1620,   8100 },
+    { 31,  3600,  18000 },
+    { 32,  5120,  20480 },
+    { 40,  8192,  32768 },
+    { 42,  8704,  34816 },
+    { 50, 22080, 110400 },
+    { 51, 36864, 184320 },
+};
+
+#define NUM_LEVELS (sizeof(level_limits) / sizeof(level_limits[0]))
+
+/**
+ Pick the lowest level whose frame size and DPB limits fit the stream.
+ The frame rate is unknown here, so MaxMBPS is not taken into account.
+ @param[out] max_dpb_frames  MaxDpbFrames of the chosen level
+ @return  level_idc
+ */
+int h264_level(int mb_width, int mb_height, int num_ref_frames, int* max_dpb_frames)
+{
+    uint32_t frame_mbs = mb_width * mb_height;
+    unsigned int i;
+
+    for (i = 0; i < NUM_LEVELS - 1; i++)
+    {
+        uint32_t max_fs = level_limits[i].max_fs;
+
+        // A.3.1 f) and g), neither dimension may exceed sqrt(8 * MaxFS)
+        if (frame_mbs > max_fs
+            || (uint32_t)(mb_width * mb_width) > 8 * max_fs
+            || (uint32_t)(mb_height * mb_height) > 8 * max_fs)
+            continue;
+
+        if ((uint32_t)num_ref_frames * frame_mbs <= level_limits[i].max_dpb_mbs)
+            break;
+    }
+
+    *max_dpb_frames = level_limits[i].max_dpb_mbs / (frame_mbs ? frame_mbs : 1);
+    if (*max_dpb_frames > 16) { *max_dpb_frames = 16; }
+    if (*max_dpb_frames < num_ref_frames) { *max_dpb_frames = num_ref_frames; }
+
+    return level_limits[i].level_idc;
 }
 
+int h264_scaling_lists_present(VdpPictureInfoH264* pps)
+{
+    const uint8_t* l = &pps->scaling_lists_4x4[0][0];
+    int i, flat = 1, zero = 1;
+
+    for (i = 0; i < (int)sizeof(pps->scaling_lists_4x4); i++)
+    {
+        flat &= l[i] == 16;
+        zero &= l[i] == 0;
+    }
+
+    l = &pps->scaling_lists_8x8[0][0];
+    for (i = 0; i < (int)sizeof(pps->scaling_lists_8x8); i++)
+    {
+        flat &= l[i] == 16;
+        zero &= l[i] == 0;
+    }
+
+    // all zero means the application didn't fill them in
+    return !flat && !zero;
+}
+
+//E.1.1 VUI parameters syntax
+static void write_vui_parameters(VdpDecoderProfile profile, VdpPictureInfoH264* sps, int max_dpb_frames,
+                                 int num_reorder_frames, bs_t* b)
+{
+    // the stream's own needs instead of MaxDpbFrames, the decoder outputs a picture
+    // as soon as num_reorder_frames later ones were decoded
+    int max_dec_frame_buffering = sps->num_ref_frames;
+
+    // output order equals decoding order, no reordering delay is needed
+    if (profile == VDP_DECODER_PROFILE_H264_BASELINE || sps->pic_order_cnt_type == 2 || sps->num_ref_frames == 0)
+        num_reorder_frames = 0;
+    // not measured yet, a stream can't hold back more pictures than it references
+    else if (num_reorder_frames < 0)
+        num_reorder_frames = sps->num_ref_frames;
+
+    if (num_reorder_frames > max_dec_frame_buffering)
+        max_dec_frame_buffering = num_reorder_frames;
+    if (max_dec_frame_buffering > max_dpb_frames)
+        max_dec_frame_buffering = max_dpb_frames;
+    if (num_reorder_frames > max_dec_frame_buffering)
+        num_reorder_frames = max_dec_frame_buffering;
+
+    bs_write_u1(b, 0);//sps->vui.aspect_ratio_info_present_flag);
+    bs_write_u1(b, 0);//sps->vui.overscan_info_present_flag);
+    bs_write_u1(b, 0);//sps->vui.video_signal_type_present_flag);
+    bs_write_u1(b, 0);//sps->vui.chroma_loc_info_present_flag);
+    bs_write_u1(b, 0);//sps->vui.timing_info_present_flag);
+    bs_write_u1(b, 0);//sps->vui.nal_hrd_parameters_present_flag);
+    bs_write_u1(b, 0);//sps->vui.vcl_hrd_parameters_present_flag);
+    bs_write_u1(b, 0);//sps->vui.pic_struct_present_flag);
+    bs_write_u1(b, 1);//sps->vui.bitstream_restriction_flag);
+    bs_write_u1(b, 1);//sps->vui.motion_vectors_over_pic_boundaries_flag);
+    bs_write_ue(b, 2);//sps->vui.max_bytes_per_pic_denom);
+    bs_write_ue(b, 1);//sps->vui.max_bits_per_mb_denom);
+    bs_write_ue(b, 16);//sps->vui.log2_max_mv_length_horizontal);
+    bs_write_ue(b, 16);//sps->vui.log2_max_mv_length_vertical);
+    bs_write_ue(b, num_reorder_frames);
+    bs_write_ue(b, max_dec_frame_buffering);
+}
 
 //7.3.2.1 Sequence parameter set RBSP syntax
-void write_seq_parameter_set_rbsp(int width, int height, VdpDecoderProfile profile, VdpPictureInfoH264* sps, bs_t* b)
+void write_seq_parameter_set_rbsp(int width, int height, VdpDecoderProfile profile, VdpPictureInfoH264* sps,
+                                  int num_reorder_frames, bs_t* b)
 {
     int mb_width = (width + 15) / 16;
     int mb_height = (height + 15) / 16;
+    int level_idc, max_dpb_frames;
 
     if( !sps->frame_mbs_only_flag )
         mb_height = ( mb_height + 1 ) & ~1;
 
+    level_idc = h264_level(mb_width, mb_height, sps->num_ref_frames, &max_dpb_frames);
+
     int profile_idc;
     switch (profile) {
         case VDP_DECODER_PROFILE_H264_BASELINE:
@@ -190,7 +448,7 @@ void write_seq_parameter_set_rbsp(int width, int height, VdpDecoderProfile profi
     bs_write_u1(b, 0);//sps->constraint_set2_flag);
     bs_write_u1(b, 0);//sps->constraint_set3_flag);
     bs_write_u(b, 4, 0);  /* reserved_zero_4bits */
-    bs_write_u8(b, 40);//sps->level_idc);
+    bs_write_u8(b, level_idc);
     bs_write_ue(b, 0);//sps->seq_parameter_set_id);
     if(profile_idc >= H264_PROFILE_HIGH)
     {
@@ -198,6 +456,7 @@ void write_seq_parameter_set_rbsp(int width, int height, VdpDecoderProfile profi
         bs_write_ue(b, 0);//sps->bit_depth_luma_minus8);
         bs_write_ue(b, 0);//sps->bit_depth_chroma_minus8);
         bs_write_u1(b, 0);//sps->qpprime_y_zero_transform_bypass_flag);
+        // the matrices go into the PPS, so they can change without a new sequence
         bs_write_u1(b, 0);//sps->seq_scaling_matrix_present_flag);
     }
 
@@ -229,8 +488,9 @@ void write_seq_parameter_set_rbsp(int width, int height, VdpDecoderProfile profi
     }
     bs_write_u1(b, sps->direct_8x8_inference_flag);
 
-    int crop_width = mb_width*16 - width;
-    int crop_height = (mb_height*16 - height) >> !sps->frame_mbs_only_flag;
+    // offsets are in chroma sample units, CropUnitX = 2 and CropUnitY = 2 * ( 2 - frame_mbs_only_flag ) for 4:2:0
+    int crop_width = (mb_width*16 - width) >> 1;
+    int crop_height = (mb_height*16 - height) >> (1 + !sps->frame_mbs_only_flag);
     int crop = crop_width || crop_height;
     bs_write_u1(b, crop);//sps->frame_cropping_flag);
     if( crop )
@@ -240,41 +500,35 @@ void write_seq_parameter_set_rbsp(int width, int height, VdpDecoderProfile profi
         bs_write_ue(b, 0);
         bs_write_ue(b, crop_height);
     }
-    bs_write_u1(b, 0);//sps->vui_parameters_present_flag);
-    //if( sps->vui_parameters_present_flag )
-    //{
-    //    write_vui_parameters(sps, b);
-    //}
+    bs_write_u1(b, 1);//sps->vui_parameters_present_flag);
+    write_vui_parameters(profile, sps, max_dpb_frames, num_reorder_frames, b);
     write_rbsp_trailing_bits(b);
 }
 
 //7.3.2.1.1 Scaling list syntax
-void write_scaling_list(bs_t* b, uint8_t* scalingList, int sizeOfScalingList, int useDefaultScalingMatrixFlag )
+void write_scaling_list(bs_t* b, const uint8_t* scalingList, const uint8_t* scan, int sizeOfScalingList)
 {
     int j;
-
     int lastScale = 8;
-    int nextScale = 8;
+    int size = sizeOfScalingList;
+
+    // a trailing run of equal values is implied by ending the list with a zero nextScale
+    while( size > 1 && scalingList[ scan[ size - 1 ] ] == scalingList[ scan[ size - 2 ] ] )
+        size--;
 
     for( j = 0; j < sizeOfScalingList; j++ )
     {
-        int delta_scale;
+        int nextScale = (j < size) ? scalingList[ scan[ j ] ] : 0;
+        int delta_scale = nextScale - lastScale;
 
-        if( nextScale != 0 )
-        {
-            // FIXME will not write in most compact way - could truncate list if all remaining elements are equal
-            nextScale = scalingList[ j ];
-
-            if (useDefaultScalingMatrixFlag)
-            {
-                nextScale = 0;
-            }
-
-            delta_scale = (nextScale - lastScale) % 256 ;
-            bs_write_se(b, delta_scale);
-        }
+        // delta_scale is coded modulo 256 in the range -128..127
+        if (delta_scale > 127) { delta_scale -= 256; }
+        if (delta_scale < -128) { delta_scale += 256; }
+        bs_write_se(b, delta_scale);
 
-        lastScale = scalingList[ j ];
+        if( nextScale == 0 )
+            break;
+        lastScale = nextScale;
     }
 }
 
@@ -336,28 +590,26 @@ void write_pic_parameter_set_rbsp(VdpPictureInfoH264* pps, bs_t* b)
     if ( 1 )//pps->_more_rbsp_data_present )
     {
         bs_write_u1(b, pps->transform_8x8_mode_flag);
-        bs_write_u1(b, 0);//pps->pic_scaling_matrix_present_flag);
-        /*if( pps->pic_scaling_matrix_present_flag )
+        int scaling_matrix_present = h264_scaling_lists_present(pps);
+
+        bs_write_u1(b, scaling_matrix_present);
+        if( scaling_matrix_present )
         {
             int i;
+            // always send the lists explicitly, so no fall-back rule applies
             for( i = 0; i < 6 + 2* pps->transform_8x8_mode_flag; i++ )
             {
-                bs_write_u1(b, pps->pic_scaling_list_present_flag[ i ]);
-                if( pps->pic_scaling_list_present_flag[ i ] )
+                bs_write_u1(b, 1);//pps->pic_scaling_list_present_flag[ i ]);
+                if( i < 6 )
+                {
+                    write_scaling_list( b, pps->scaling_lists_4x4[ i ], zigzag_4x4, 16 );
+                }
+                else
                 {
-                    if( i < 6 )
-                    {
-                        write_scaling_list( b, pps->ScalingList4x4[ i ], 16,
-                                      pps->UseDefaultScalingMatrix4x4Flag[ i ] );
-                    }
-                    else
-                    {
-                        write_scaling_list( b, pps->ScalingList8x8[ i - 6 ], 64,
-                                      pps->UseDefaultScalingMatrix8x8Flag[ i - 6 ] );
-                    }
+                    write_scaling_list( b, pps->scaling_lists_8x8[ i - 6 ], zigzag_8x8, 64 );
                 }
             }
-        }*/
+        }
         bs_write_se(b, pps->second_chroma_qp_index_offset);
     }
 
@@ -377,6 +629,265 @@ void write_rbsp_trailing_bits(bs_t* b)
     }
 }
 
+/*
+ * Reads RBSP bits straight out of a NAL unit, emulation prevention bytes are
+ * skipped on the way. pos counts RBSP bits, which is what the bit sizes a
+ * stateless decoder wants are measured in. Reading past the end yields zeros
+ * and sets overrun.
+ */
+typedef struct
+{
+    const uint8_t* p;
+    const uint8_t* end;
+    int zeros;
+    uint8_t byte;
+    int bits_left;
+    uint32_t pos;
+    int overrun;
+} rbsp_reader_t;
+
+static uint32_t rbsp_read_u1(rbsp_reader_t* r)
+{
+    if (!r->bits_left)
+    {
+        uint8_t b;
+
+        if (r->p >= r->end) { r->overrun = 1; return 0; }
+        b = *r->p++;
+        // 7.4.1 emulation_prevention_three_byte
+        if (r->zeros >= 2 && b == 0x03)
+        {
+            if (r->p >= r->end) { r->overrun = 1; return 0; }
+            b = *r->p++;
+            r->zeros = 0;
+        }
+        r->zeros = b ? 0 : r->zeros + 1;
+        r->byte = b;
+        r->bits_left = 8;
+    }
+
+    r->bits_left--;
+    r->pos++;
+    return (r->byte >> r->bits_left) & 1;
+}
+
+static uint32_t rbsp_read_u(rbsp_reader_t* r, int n)
+{
+    uint32_t v = 0;
+
+    while (n--)
+        v = (v << 1) | rbsp_read_u1(r);
+
+    return v;
+}
+
+static uint32_t rbsp_read_ue(rbsp_reader_t* r)
+{
+    int leading_zeros = 0;
+
+    while (!rbsp_read_u1(r) && !r->overrun)
+    {
+        if (++leading_zeros > 31) { r->overrun = 1; return 0; }
+    }
+
+    return (1u << leading_zeros) - 1 + rbsp_read_u(r, leading_zeros);
+}
+
+static int32_t rbsp_read_se(rbsp_reader_t* r)
+{
+    uint32_t v = rbsp_read_ue(r);
+
+    return (v & 1) ? (int32_t)((v + 1) / 2) : -(int32_t)(v / 2);
+}
+
+#define SLICE_TYPE_P  0
+#define SLICE_TYPE_B  1
+#define SLICE_TYPE_I  2
+#define SLICE_TYPE_SP 3
+#define SLICE_TYPE_SI 4
+
+//7.3.3.1 Reference picture list modification syntax, at most one modification per reference
+static int skip_ref_pic_list_modification(rbsp_reader_t* r, uint32_t num_ref_idx)
+{
+    uint32_t modification_of_pic_nums_idc, count = 0;
+
+    if (!rbsp_read_u1(r))
+        return 0;
+
+    do
+    {
+        modification_of_pic_nums_idc = rbsp_read_ue(r);
+        if (modification_of_pic_nums_idc == 3)
+            return 0;
+        if (modification_of_pic_nums_idc < 3)
+            rbsp_read_ue(r); // abs_diff_pic_num_minus1 or long_term_pic_num
+    } while (++count <= num_ref_idx && !r->overrun);
+
+    return -1;
+}
+
+//7.3.3.2 Prediction weight table syntax, ChromaArrayType is 1 for every VDPAU H.264 profile
+static void skip_pred_weight_table(rbsp_reader_t* r, int slice_type, uint32_t num_ref_idx_l0, uint32_t num_ref_idx_l1)
+{
+    uint32_t i;
+    int list;
+
+    rbsp_read_ue(r); // luma_log2_weight_denom
+    rbsp_read_ue(r); // chroma_log2_weight_denom
+
+    for (list = 0; list < (slice_type == SLICE_TYPE_B ? 2 : 1) && !r->overrun; list++)
+    {
+        for (i = 0; i < (list ? num_ref_idx_l1 : num_ref_idx_l0) && !r->overrun; i++)
+        {
+            if (rbsp_read_u1(r)) // luma_weight_flag
+            {
+                rbsp_read_se(r);
+                rbsp_read_se(r);
+            }
+            if (rbsp_read_u1(r)) // chroma_weight_flag
+            {
+                rbsp_read_se(r);
+                rbsp_read_se(r);
+                rbsp_read_se(r);
+                rbsp_read_se(r);
+            }
+        }
+    }
+}
+
+//7.3.3.3 Decoded reference picture marking syntax
+static void skip_dec_ref_pic_marking(rbsp_reader_t* r, int idr)
+{
+    uint32_t memory_management_control_operation;
+
+    if (idr)
+    {
+        rbsp_read_u1(r); // no_output_of_prior_pics_flag
+        rbsp_read_u1(r); // long_term_reference_flag
+        return;
+    }
+
+    if (!rbsp_read_u1(r)) // adaptive_ref_pic_marking_mode_flag
+        return;
+
+    do
+    {
+        memory_management_control_operation = rbsp_read_ue(r);
+        if (memory_management_control_operation == 1 || memory_management_control_operation == 3)
+            rbsp_read_ue(r); // difference_of_pic_nums_minus1
+        if (memory_management_control_operation == 2)
+            rbsp_read_ue(r); // long_term_pic_num
+        if (memory_management_control_operation == 3 || memory_management_control_operation == 6)
+            rbsp_read_ue(r); // long_term_frame_idx
+        if (memory_management_control_operation == 4)
+            rbsp_read_ue(r); // max_long_term_frame_idx_plus1
+    } while (memory_management_control_operation != 0 && !r->overrun);
+}
+
+//7.3.3 Slice header syntax, of the first coded slice in buf
+int h264_parse_slice_header(const uint8_t* buf, int size, VdpPictureInfoH264* vdppi, h264_slice_header_t* sh)
+{
+    const uint8_t* end = buf + size;
+    const uint8_t* p;
+    rbsp_reader_t r;
+    int nal_unit_type = 0, field_pic_flag = 0;
+    uint32_t num_ref_idx_l0, num_ref_idx_l1, max_num_ref_idx;
+    uint32_t start;
+
+    // slices come with start codes, skip whatever else precedes the first one
+    for (p = buf; p + 3 < end; p++)
+    {
+        if (p[0] == 0x00 && p[1] == 0x00 && p[2] == 0x01)
+        {
+            nal_unit_type = p[3] & 0x1f;
+            if (nal_unit_type == NAL_UNIT_TYPE_CODED_SLICE_NON_IDR || nal_unit_type == NAL_UNIT_TYPE_CODED_SLICE_IDR)
+                break;
+            p += 2;
+        }
+    }
+    if (p + 3 >= end)
+        return -1;
+
+    memset(sh, 0, sizeof(*sh));
+    sh->nal_ref_idc = (p[3] >> 5) & 0x03;
+    sh->nal_unit_type = nal_unit_type;
+
+    memset(&r, 0, sizeof(r));
+    r.p = p + 4;
+    r.end = end;
+
+    rbsp_read_ue(&r); // first_mb_in_slice
+    sh->slice_type = rbsp_read_ue(&r) % 5;
+    rbsp_read_ue(&r); // pic_parameter_set_id
+    rbsp_read_u(&r, vdppi->log2_max_frame_num_minus4 + 4); // frame_num
+    if (!vdppi->frame_mbs_only_flag)
+    {
+        field_pic_flag = rbsp_read_u1(&r);
+        if (field_pic_flag)
+            rbsp_read_u1(&r); // bottom_field_flag
+    }
+    if (nal_unit_type == NAL_UNIT_TYPE_CODED_SLICE_IDR)
+        sh->idr_pic_id = rbsp_read_ue(&r);
+
+    start = r.pos;
+    if (vdppi->pic_order_cnt_type == 0)
+    {
+        sh->pic_order_cnt_lsb = rbsp_read_u(&r, vdppi->log2_max_pic_order_cnt_lsb_minus4 + 4);
+        if (vdppi->pic_order_present_flag && !vdppi->field_pic_flag)
+            sh->delta_pic_order_cnt_bottom = rbsp_read_se(&r);
+    }
+    if (vdppi->pic_order_cnt_type == 1 && !vdppi->delta_pic_order_always_zero_flag)
+    {
+        sh->delta_pic_order_cnt0 = rbsp_read_se(&r);
+        if (vdppi->pic_order_present_flag && !vdppi->field_pic_flag)
+            sh->delta_pic_order_cnt1 = rbsp_read_se(&r);
+    }
+    sh->pic_order_cnt_bit_size = r.pos - start;
+
+    if (vdppi->redundant_pic_cnt_present_flag)
+        rbsp_read_ue(&r); // redundant_pic_cnt
+    if (sh->slice_type == SLICE_TYPE_B)
+        rbsp_read_u1(&r); // direct_spatial_mv_pred_flag
+
+    // VDPAU passes the PPS defaults, the slice may override them
+    num_ref_idx_l0 = vdppi->num_ref_idx_l0_active_minus1 + 1;
+    num_ref_idx_l1 = vdppi->num_ref_idx_l1_active_minus1 + 1;
+    if (sh->slice_type == SLICE_TYPE_P || sh->slice_type == SLICE_TYPE_SP || sh->slice_type == SLICE_TYPE_B)
+    {
+        if (rbsp_read_u1(&r)) // num_ref_idx_active_override_flag
+        {
+            num_ref_idx_l0 = rbsp_read_ue(&r) + 1;
+            if (sh->slice_type == SLICE_TYPE_B)
+                num_ref_idx_l1 = rbsp_read_ue(&r) + 1;
+        }
+
+        // 7.4.3, 32 references for a field, 16 for a frame
+        max_num_ref_idx = field_pic_flag ? 32 : 16;
+        if (r.overrun || num_ref_idx_l0 > max_num_ref_idx
+            || (sh->slice_type == SLICE_TYPE_B && num_ref_idx_l1 > max_num_ref_idx))
+            return -1;
+    }
+
+    if (sh->slice_type != SLICE_TYPE_I && sh->slice_type != SLICE_TYPE_SI
+        && skip_ref_pic_list_modification(&r, num_ref_idx_l0))
+        return -1;
+    if (sh->slice_type == SLICE_TYPE_B && skip_ref_pic_list_modification(&r, num_ref_idx_l1))
+        return -1;
+
+    if ((vdppi->weighted_pred_flag && (sh->slice_type == SLICE_TYPE_P || sh->slice_type == SLICE_TYPE_SP))
+        || (vdppi->weighted_bipred_idc == 1 && sh->slice_type == SLICE_TYPE_B))
+        skip_pred_weight_table(&r, sh->slice_type, num_ref_idx_l0, num_ref_idx_l1);
+
+    if (sh->nal_ref_idc)
+    {
+        start = r.pos;
+        skip_dec_ref_pic_marking(&r, nal_unit_type == NAL_UNIT_TYPE_CODED_SLICE_IDR);
+        sh->dec_ref_pic_marking_bit_size = r.pos - start;
+    }
+
+    return r.overrun ? -1 : 0;
+}
+
 #if 0
 #include <stdio.h>
 int main(int ac, char **av) {
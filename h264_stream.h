@@ -31,15 +31,101 @@
 
 #include "bs.h"
 
-int write_nal_unit(int nal_unit_type, int width, int height, VdpDecoderProfile profile, VdpPictureInfoH264 *vdppi, uint8_t* buf, int size);
+// every VdpPictureInfoH264 field the SPS/PPS writers consume, zero padded so it can be hashed;
+// the SPS fields come first, everything from entropy_coding_mode_flag on only ends up in the PPS
+typedef struct
+{
+    uint32_t profile;
+    uint16_t width;
+    uint16_t height;
+    uint8_t frame_mbs_only_flag;
+    uint8_t mb_adaptive_frame_field_flag;
+    uint8_t direct_8x8_inference_flag;
+    uint8_t num_ref_frames;
+    uint8_t log2_max_frame_num_minus4;
+    uint8_t pic_order_cnt_type;
+    uint8_t log2_max_pic_order_cnt_lsb_minus4;
+    uint8_t delta_pic_order_always_zero_flag;
+    int8_t num_reorder_frames;
 
-void write_seq_parameter_set_rbsp(int width, int height, VdpDecoderProfile profile, VdpPictureInfoH264* sps, bs_t* b);
-void write_scaling_list(bs_t* b, uint8_t* scalingList, int sizeOfScalingList, int useDefaultScalingMatrixFlag );
+    uint8_t entropy_coding_mode_flag;
+    uint8_t pic_order_present_flag;
+    uint8_t num_ref_idx_l0_active_minus1;
+    uint8_t num_ref_idx_l1_active_minus1;
+    uint8_t weighted_pred_flag;
+    uint8_t weighted_bipred_idc;
+    int8_t pic_init_qp_minus26;
+    int8_t chroma_qp_index_offset;
+    int8_t second_chroma_qp_index_offset;
+    uint8_t deblocking_filter_control_present_flag;
+    uint8_t constrained_intra_pred_flag;
+    uint8_t redundant_pic_cnt_present_flag;
+    uint8_t transform_8x8_mode_flag;
+    uint8_t scaling_lists_4x4[6][16];
+    uint8_t scaling_lists_8x8[2][64];
+} h264_header_key_t;
+
+void h264_header_key(h264_header_key_t *key, int width, int height, VdpDecoderProfile profile, VdpPictureInfoH264 *vdppi,
+                     int num_reorder_frames);
+
+#define H264_REORDER_WINDOW 16
+
+/*
+ * How far output order runs behind decoding order isn't in VdpPictureInfoH264,
+ * it's measured from the picture order counts as pictures come by: the most
+ * pictures that preceded one in decoding order and follow it in output order.
+ * What the SPS announces only changes at IDR pictures, -1 until then.
+ */
+typedef struct h264_reorder_struct
+{
+    int32_t poc[H264_REORDER_WINDOW];   // of the latest pictures since the last IDR
+    int count;
+    int observed;                       // deepest reordering seen in the stream, -1 none yet
+    int num_reorder_frames;
+    int first_field;                    // frame_num of an unpaired first field, -1 none
+} h264_reorder_t;
+
+void h264_reorder_init(h264_reorder_t *r);
+int h264_reorder_update(h264_reorder_t *r, VdpPictureInfoH264 *vdppi, int idr);
+
+// upper bound of a single parameter set RBSP, write_nal_unit builds it on the stack
+#define NAL_RBSP_MAX_SIZE 1024
+
+int rbsp_to_nal(const uint8_t* rbsp_buf, const int* rbsp_size, uint8_t* nal_buf, int* nal_size);
+
+// num_reorder_frames goes to the SPS VUI, -1 if not known
+int write_nal_unit(int nal_unit_type, int width, int height, VdpDecoderProfile profile, VdpPictureInfoH264 *vdppi,
+                   int num_reorder_frames, uint8_t* buf, int size);
+
+void write_seq_parameter_set_rbsp(int width, int height, VdpDecoderProfile profile, VdpPictureInfoH264* sps,
+                                  int num_reorder_frames, bs_t* b);
+void write_scaling_list(bs_t* b, const uint8_t* scalingList, const uint8_t* scan, int sizeOfScalingList);
 
 void write_pic_parameter_set_rbsp(VdpPictureInfoH264* pps, bs_t* b);
 
 void write_rbsp_trailing_bits(bs_t* b);
 
+int h264_level(int mb_width, int mb_height, int num_ref_frames, int* max_dpb_frames);
+int h264_scaling_lists_present(VdpPictureInfoH264* pps);
+
+// the slice header fields a frame based stateless decoder needs and VdpPictureInfoH264 lacks
+typedef struct
+{
+    uint8_t nal_ref_idc;
+    uint8_t nal_unit_type;
+    uint8_t slice_type;                 // slice_type % 5
+    uint16_t idr_pic_id;
+    uint16_t pic_order_cnt_lsb;
+    int32_t delta_pic_order_cnt_bottom;
+    int32_t delta_pic_order_cnt0;
+    int32_t delta_pic_order_cnt1;
+    uint32_t pic_order_cnt_bit_size;
+    uint32_t dec_ref_pic_marking_bit_size;
+} h264_slice_header_t;
+
+// parses the first coded slice in a picture's bitstream, returns 0 on success
+int h264_parse_slice_header(const uint8_t* buf, int size, VdpPictureInfoH264* vdppi, h264_slice_header_t* sh);
+
 //NAL ref idc codes
 #define NAL_REF_IDC_PRIORITY_HIGHEST    3
 #define NAL_REF_IDC_PRIORITY_HIGH       2
@@ -47,6 +133,8 @@ void write_rbsp_trailing_bits(bs_t* b);
 #define NAL_REF_IDC_PRIORITY_DISPOSABLE 0
 
 //Table 7-1 NAL unit type codes
+#define NAL_UNIT_TYPE_CODED_SLICE_NON_IDR            1    // Coded slice of a non-IDR picture
+#define NAL_UNIT_TYPE_CODED_SLICE_IDR                5    // Coded slice of an IDR picture
 #define NAL_UNIT_TYPE_SPS                            7    // Sequence parameter set
 #define NAL_UNIT_TYPE_PPS                            8    // Picture parameter set
 
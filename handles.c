@@ -18,60 +18,145 @@
  */
 
 #include <string.h>
+#include <pthread.h>
 
 #include "vdpau_private.h"
 
-#define INITIAL_SIZE 16
+/*
+ * A handle is type(4) | generation(8) | index(20). Slots live in fixed size
+ * chunks that are never moved or freed, so handle_get() needs no lock.
+ * Create and destroy are serialized and pop/push a free-list.
+ */
+
+#define INDEX_BITS 20
+#define GEN_BITS 8
+#define TYPE_SHIFT (INDEX_BITS + GEN_BITS)
+#define INDEX_MASK ((1u << INDEX_BITS) - 1)
+#define GEN_MASK ((1u << GEN_BITS) - 1)
+
+#define CHUNK_BITS 8
+#define CHUNK_SIZE (1u << CHUNK_BITS)
+#define MAX_CHUNKS ((INDEX_MASK + 1) / CHUNK_SIZE)
+
+typedef struct
+{
+    uint32_t key;        // the live handle, 0 while the slot is free
+    uint32_t gen;
+    uint32_t next_free;  // index + 1 of the next free slot, 0 terminates
+    void *data;
+} handle_slot_t;
 
 static struct
 {
-    void **data;
-    int size;
-} ht;
+    handle_slot_t *chunks[MAX_CHUNKS];
+    uint32_t num_chunks;
+    uint32_t free_head;
+    pthread_mutex_t mutex;
+} ht = { .mutex = PTHREAD_MUTEX_INITIALIZER };
+
+static handle_slot_t *slot_get(uint32_t index)
+{
+    handle_slot_t *chunk = __atomic_load_n(&ht.chunks[index >> CHUNK_BITS], __ATOMIC_ACQUIRE);
+    if (!chunk)
+        return NULL;
+
+    return &chunk[index & (CHUNK_SIZE - 1)];
+}
 
-int handle_create(void *data)
+static int grow(void)
 {
-    int index;
+    uint32_t i;
+
+    if (ht.num_chunks >= MAX_CHUNKS)
+        return -1;
+
+    handle_slot_t *chunk = calloc(CHUNK_SIZE, sizeof(handle_slot_t));
+    if (!chunk)
+        return -1;
 
+    uint32_t base = ht.num_chunks * CHUNK_SIZE;
+    for (i = CHUNK_SIZE; i > 0; i--)
+    {
+        chunk[i - 1].next_free = ht.free_head;
+        ht.free_head = base + i;
+    }
+
+    __atomic_store_n(&ht.chunks[ht.num_chunks], chunk, __ATOMIC_RELEASE);
+    ht.num_chunks++;
+
+    return 0;
+}
+
+int handle_create(void *data, handle_type_t type)
+{
     if (!data)
         return -1;
 
-    for (index = 0; index < ht.size; index++)
-        if (ht.data[index] == NULL)
-            break;
+    pthread_mutex_lock(&ht.mutex);
 
-    if (index >= ht.size)
+    if (!ht.free_head && grow())
     {
-        int new_size = ht.size ? ht.size * 2 : INITIAL_SIZE;
-        void **new_data = realloc(ht.data, new_size * sizeof(void *));
-        if (!new_data)
-            return -1;
-
-        memset(new_data + ht.size, 0, (new_size - ht.size) * sizeof(void *));
-        ht.data = new_data;
-        ht.size = new_size;
+        pthread_mutex_unlock(&ht.mutex);
+        return -1;
     }
 
-    ht.data[index] = data;
-    return index + 1;
+    uint32_t index = ht.free_head - 1;
+    handle_slot_t *slot = slot_get(index);
+    ht.free_head = slot->next_free;
+
+    uint32_t handle = ((uint32_t)type << TYPE_SHIFT) | ((slot->gen & GEN_MASK) << INDEX_BITS) | index;
+
+    __atomic_store_n(&slot->data, data, __ATOMIC_RELAXED);
+    __atomic_store_n(&slot->key, handle, __ATOMIC_RELEASE);
+
+    pthread_mutex_unlock(&ht.mutex);
+
+    return handle;
 }
 
-void *handle_get(int handle)
+void *handle_get(int handle, handle_type_t type)
 {
-    if (handle == VDP_INVALID_HANDLE)
+    uint32_t h = handle;
+
+    // also rejects VDP_INVALID_HANDLE, no type uses the top nibble 0xf
+    if ((h >> TYPE_SHIFT) != type)
         return NULL;
 
-    int index = handle - 1;
-    if (index < ht.size)
-        return ht.data[index];
+    handle_slot_t *slot = slot_get(h & INDEX_MASK);
+    if (!slot)
+        return NULL;
 
-    return NULL;
+    if (__atomic_load_n(&slot->key, __ATOMIC_ACQUIRE) != h)
+        return NULL;
+
+    void *data = __atomic_load_n(&slot->data, __ATOMIC_RELAXED);
+
+    // seqlock style recheck, the slot might have been recycled meanwhile
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    if (__atomic_load_n(&slot->key, __ATOMIC_RELAXED) != h)
+        return NULL;
+
+    return data;
 }
 
 void handle_destroy(int handle)
 {
-    int index = handle - 1;
+    uint32_t h = handle;
+    uint32_t index = h & INDEX_MASK;
+
+    pthread_mutex_lock(&ht.mutex);
+
+    handle_slot_t *slot = slot_get(index);
+    if (slot && slot->key == h)
+    {
+        __atomic_store_n(&slot->key, 0, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_RELEASE);
+        __atomic_store_n(&slot->data, NULL, __ATOMIC_RELAXED);
+
+        slot->gen++;
+        slot->next_free = ht.free_head;
+        ht.free_head = index + 1;
+    }
 
-    if (index < ht.size)
-        ht.data[index] = NULL;
+    pthread_mutex_unlock(&ht.mutex);
 }
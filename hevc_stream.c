@@ -0,0 +1,626 @@
+/*
+ * Copyright (c) 2013 Jens Kuske <jenskuske@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+
+/*
+ * VDPAU passes HEVC slices without parameter sets, the MFC however wants an
+ * elementary stream. VPS, SPS and PPS are rebuilt here from
+ * VdpPictureInfoHEVC, syntax references are to ITU-T H.265 (04/2013).
+ *
+ * VDPAU leaves out a few things, the generated parameter sets assume
+ * parameter set id 0, a single temporal sub-layer and lt_ref_pic_poc_lsb_sps
+ * of zero. The SPS short-term RPS sets are learned from the pictures that
+ * reference them.
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include "hevc_stream.h"
+#include "h264_stream.h"
+
+#ifdef VDP_DECODER_PROFILE_HEVC_MAIN
+
+static int compare_delta_poc(const void *a, const void *b)
+{
+    const int32_t *x = a, *y = b;
+    return *x - *y;
+}
+
+static void learn_set(hevc_rps_table_t *table, VdpPictureInfoHEVC *info)
+{
+    int32_t negative[HEVC_MAX_DPB][2], positive[HEVC_MAX_DPB][2];
+    hevc_st_rps_t set;
+    int i, j;
+
+    // IDR pictures have no RPS, CurrRpsIdx == num_short_term_ref_pic_sets is one coded in the slice header
+    if (info->IDRPicFlag || info->CurrRpsIdx >= info->num_short_term_ref_pic_sets ||
+        info->CurrRpsIdx >= HEVC_MAX_ST_RPS)
+        return;
+
+    // after the RPS is applied the short-term references in the DPB are exactly the set
+    memset(&set, 0, sizeof(set));
+    for (i = 0; i < HEVC_MAX_DPB; i++)
+    {
+        int used = 0;
+
+        if (info->RefPics[i] == VDP_INVALID_HANDLE || info->IsLongTerm[i])
+            continue;
+
+        for (j = 0; j < info->NumPocStCurrBefore && j < 8; j++)
+            used |= info->RefPicSetStCurrBefore[j] == i;
+        for (j = 0; j < info->NumPocStCurrAfter && j < 8; j++)
+            used |= info->RefPicSetStCurrAfter[j] == i;
+
+        int32_t delta = info->PicOrderCntVal[i] - info->CurrPicOrderCntVal;
+        if (delta < 0)
+        {
+            negative[set.num_negative][0] = -delta;
+            negative[set.num_negative++][1] = used;
+        }
+        else if (delta > 0)
+        {
+            positive[set.num_positive][0] = delta;
+            positive[set.num_positive++][1] = used;
+        }
+    }
+
+    // 7.4.8 the closest pictures come first in both directions
+    qsort(negative, set.num_negative, sizeof(negative[0]), compare_delta_poc);
+    qsort(positive, set.num_positive, sizeof(positive[0]), compare_delta_poc);
+    for (i = 0; i < set.num_negative; i++)
+    {
+        set.delta_poc[i] = -negative[i][0];
+        set.used[i] = negative[i][1];
+    }
+    for (i = 0; i < set.num_positive; i++)
+    {
+        set.delta_poc[set.num_negative + i] = positive[i][0];
+        set.used[set.num_negative + i] = positive[i][1];
+    }
+
+    if (table->learned_known[info->CurrRpsIdx] && !memcmp(&table->learned[info->CurrRpsIdx], &set, sizeof(set)))
+        return;
+
+    table->learned_known[info->CurrRpsIdx] = 1;
+    table->learned[info->CurrRpsIdx] = set;
+    table->pending = 1;
+}
+
+void hevc_learn_rps(hevc_rps_table_t *table, VdpPictureInfoHEVC *info)
+{
+    learn_set(table, info);
+
+    // a new SPS mid-CVS would reset the decoder, it waits for the next IRAP picture
+    if (!info->RAPPicFlag || !table->pending)
+        return;
+
+    memcpy(table->known, table->learned_known, sizeof(table->known));
+    memcpy(table->sets, table->learned, sizeof(table->sets));
+    table->pending = 0;
+    table->generation++;
+}
+
+void hevc_header_key(hevc_header_key_t *key, int width, int height, VdpDecoderProfile profile,
+                     VdpPictureInfoHEVC *info, const hevc_rps_table_t *rps)
+{
+    memset(key, 0, sizeof(*key));
+
+    key->profile = profile;
+    key->width = width;
+    key->height = height;
+    key->rps_generation = rps ? rps->generation : 0;
+    key->chroma_format_idc = info->chroma_format_idc;
+    key->pic_width_in_luma_samples = info->pic_width_in_luma_samples;
+    key->pic_height_in_luma_samples = info->pic_height_in_luma_samples;
+    key->separate_colour_plane_flag = info->separate_colour_plane_flag;
+    key->bit_depth_luma_minus8 = info->bit_depth_luma_minus8;
+    key->bit_depth_chroma_minus8 = info->bit_depth_chroma_minus8;
+    key->log2_max_pic_order_cnt_lsb_minus4 = info->log2_max_pic_order_cnt_lsb_minus4;
+    key->sps_max_dec_pic_buffering_minus1 = info->sps_max_dec_pic_buffering_minus1;
+    key->log2_min_luma_coding_block_size_minus3 = info->log2_min_luma_coding_block_size_minus3;
+    key->log2_diff_max_min_luma_coding_block_size = info->log2_diff_max_min_luma_coding_block_size;
+    key->log2_min_transform_block_size_minus2 = info->log2_min_transform_block_size_minus2;
+    key->log2_diff_max_min_transform_block_size = info->log2_diff_max_min_transform_block_size;
+    key->max_transform_hierarchy_depth_inter = info->max_transform_hierarchy_depth_inter;
+    key->max_transform_hierarchy_depth_intra = info->max_transform_hierarchy_depth_intra;
+    key->scaling_list_enabled_flag = info->scaling_list_enabled_flag;
+    key->amp_enabled_flag = info->amp_enabled_flag;
+    key->sample_adaptive_offset_enabled_flag = info->sample_adaptive_offset_enabled_flag;
+    key->pcm_enabled_flag = info->pcm_enabled_flag;
+    key->pcm_sample_bit_depth_luma_minus1 = info->pcm_sample_bit_depth_luma_minus1;
+    key->pcm_sample_bit_depth_chroma_minus1 = info->pcm_sample_bit_depth_chroma_minus1;
+    key->log2_min_pcm_luma_coding_block_size_minus3 = info->log2_min_pcm_luma_coding_block_size_minus3;
+    key->log2_diff_max_min_pcm_luma_coding_block_size = info->log2_diff_max_min_pcm_luma_coding_block_size;
+    key->pcm_loop_filter_disabled_flag = info->pcm_loop_filter_disabled_flag;
+    key->num_short_term_ref_pic_sets = info->num_short_term_ref_pic_sets;
+    key->long_term_ref_pics_present_flag = info->long_term_ref_pics_present_flag;
+    key->num_long_term_ref_pics_sps = info->num_long_term_ref_pics_sps;
+    key->sps_temporal_mvp_enabled_flag = info->sps_temporal_mvp_enabled_flag;
+    key->strong_intra_smoothing_enabled_flag = info->strong_intra_smoothing_enabled_flag;
+    key->dependent_slice_segments_enabled_flag = info->dependent_slice_segments_enabled_flag;
+    key->output_flag_present_flag = info->output_flag_present_flag;
+    key->num_extra_slice_header_bits = info->num_extra_slice_header_bits;
+    key->sign_data_hiding_enabled_flag = info->sign_data_hiding_enabled_flag;
+    key->cabac_init_present_flag = info->cabac_init_present_flag;
+    key->num_ref_idx_l0_default_active_minus1 = info->num_ref_idx_l0_default_active_minus1;
+    key->num_ref_idx_l1_default_active_minus1 = info->num_ref_idx_l1_default_active_minus1;
+    key->init_qp_minus26 = info->init_qp_minus26;
+    key->constrained_intra_pred_flag = info->constrained_intra_pred_flag;
+    key->transform_skip_enabled_flag = info->transform_skip_enabled_flag;
+    key->cu_qp_delta_enabled_flag = info->cu_qp_delta_enabled_flag;
+    key->diff_cu_qp_delta_depth = info->diff_cu_qp_delta_depth;
+    key->pps_cb_qp_offset = info->pps_cb_qp_offset;
+    key->pps_cr_qp_offset = info->pps_cr_qp_offset;
+    key->pps_slice_chroma_qp_offsets_present_flag = info->pps_slice_chroma_qp_offsets_present_flag;
+    key->weighted_pred_flag = info->weighted_pred_flag;
+    key->weighted_bipred_flag = info->weighted_bipred_flag;
+    key->transquant_bypass_enabled_flag = info->transquant_bypass_enabled_flag;
+    key->tiles_enabled_flag = info->tiles_enabled_flag;
+    key->entropy_coding_sync_enabled_flag = info->entropy_coding_sync_enabled_flag;
+    key->loop_filter_across_tiles_enabled_flag = info->loop_filter_across_tiles_enabled_flag;
+    key->pps_loop_filter_across_slices_enabled_flag = info->pps_loop_filter_across_slices_enabled_flag;
+    key->deblocking_filter_control_present_flag = info->deblocking_filter_control_present_flag;
+    key->deblocking_filter_override_enabled_flag = info->deblocking_filter_override_enabled_flag;
+    key->pps_deblocking_filter_disabled_flag = info->pps_deblocking_filter_disabled_flag;
+    key->pps_beta_offset_div2 = info->pps_beta_offset_div2;
+    key->pps_tc_offset_div2 = info->pps_tc_offset_div2;
+    key->lists_modification_present_flag = info->lists_modification_present_flag;
+    key->log2_parallel_merge_level_minus2 = info->log2_parallel_merge_level_minus2;
+    key->slice_segment_header_extension_present_flag = info->slice_segment_header_extension_present_flag;
+    key->scaling_list_data_present_flag = info->scaling_list_enabled_flag && hevc_scaling_list_data_present(info);
+
+    if (info->tiles_enabled_flag)
+    {
+        key->num_tile_columns_minus1 = info->num_tile_columns_minus1;
+        key->num_tile_rows_minus1 = info->num_tile_rows_minus1;
+        key->uniform_spacing_flag = info->uniform_spacing_flag;
+        memcpy(key->column_width_minus1, info->column_width_minus1, sizeof(key->column_width_minus1));
+        memcpy(key->row_height_minus1, info->row_height_minus1, sizeof(key->row_height_minus1));
+    }
+
+    if (key->scaling_list_data_present_flag)
+    {
+        memcpy(key->scaling_list_4x4, info->ScalingList4x4, sizeof(key->scaling_list_4x4));
+        memcpy(key->scaling_list_8x8, info->ScalingList8x8, sizeof(key->scaling_list_8x8));
+        memcpy(key->scaling_list_16x16, info->ScalingList16x16, sizeof(key->scaling_list_16x16));
+        memcpy(key->scaling_list_32x32, info->ScalingList32x32, sizeof(key->scaling_list_32x32));
+        memcpy(key->scaling_list_dc_16x16, info->ScalingListDCCoeff16x16, sizeof(key->scaling_list_dc_16x16));
+        memcpy(key->scaling_list_dc_32x32, info->ScalingListDCCoeff32x32, sizeof(key->scaling_list_dc_32x32));
+    }
+}
+
+// Table 7-6, in up-right diagonal scan order
+static const uint8_t default_scaling_list_intra[64] =
+{
+    16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 17, 16, 17, 16, 17, 18,
+    17, 18, 18, 17, 18, 21, 19, 20, 21, 20, 19, 21, 24, 22, 22, 24,
+    24, 22, 22, 24, 25, 25, 27, 30, 27, 25, 25, 29, 31, 35, 35, 31,
+    29, 36, 41, 44, 41, 36, 47, 54, 54, 47, 65, 70, 65, 88, 88, 115,
+};
+
+static const uint8_t default_scaling_list_inter[64] =
+{
+    16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 17, 17, 17, 17, 17, 18,
+    18, 18, 18, 18, 18, 20, 20, 20, 20, 20, 20, 20, 24, 24, 24, 24,
+    24, 24, 24, 24, 25, 25, 25, 25, 25, 25, 25, 28, 28, 28, 28, 28,
+    28, 33, 33, 33, 33, 33, 41, 41, 41, 41, 54, 54, 54, 71, 71, 91,
+};
+
+static int all_equal(const uint8_t *data, int len, uint8_t v)
+{
+    int i;
+
+    for (i = 0; i < len; i++)
+        if (data[i] != v)
+            return 0;
+
+    return 1;
+}
+
+/*
+ * VDPAU passes the lists in effect, not whether the stream coded them. The
+ * defaults are left to the decoder, and lists the application never filled
+ * in (0 is no valid scaling factor) are taken as defaults as well.
+ */
+int hevc_scaling_list_data_present(const VdpPictureInfoHEVC *info)
+{
+    int m;
+
+    if (all_equal(&info->ScalingList4x4[0][0], sizeof(info->ScalingList4x4), 0) &&
+        all_equal(&info->ScalingList8x8[0][0], sizeof(info->ScalingList8x8), 0) &&
+        all_equal(&info->ScalingList16x16[0][0], sizeof(info->ScalingList16x16), 0) &&
+        all_equal(&info->ScalingList32x32[0][0], sizeof(info->ScalingList32x32), 0))
+        return 0;
+
+    if (!all_equal(&info->ScalingList4x4[0][0], sizeof(info->ScalingList4x4), 16) ||
+        !all_equal(info->ScalingListDCCoeff16x16, sizeof(info->ScalingListDCCoeff16x16), 16) ||
+        !all_equal(info->ScalingListDCCoeff32x32, sizeof(info->ScalingListDCCoeff32x32), 16))
+        return 1;
+
+    for (m = 0; m < 6; m++)
+    {
+        const uint8_t *list = m < 3 ? default_scaling_list_intra : default_scaling_list_inter;
+
+        if (memcmp(info->ScalingList8x8[m], list, 64) || memcmp(info->ScalingList16x16[m], list, 64) ||
+            (m % 3 == 0 && memcmp(info->ScalingList32x32[m / 3], list, 64)))
+            return 1;
+    }
+
+    return 0;
+}
+
+static int profile_idc(VdpDecoderProfile profile)
+{
+    switch (profile)
+    {
+    case VDP_DECODER_PROFILE_HEVC_MAIN_10:
+        return HEVC_PROFILE_MAIN_10;
+    case VDP_DECODER_PROFILE_HEVC_MAIN_STILL:
+        return HEVC_PROFILE_MAIN_STILL;
+    default:
+        return HEVC_PROFILE_MAIN;
+    }
+}
+
+// Table A.6, the lowest level the luma picture size fits in, times 30
+static int level_idc(VdpPictureInfoHEVC *info)
+{
+    static const struct { uint32_t max_luma_ps; int level_idc; } levels[] =
+    {
+        {    36864,  30 }, {   122880,  60 }, {   245760,  63 }, {   552960,  90 },
+        {   983040,  93 }, {  2228224, 120 }, {  8912896, 150 }, { 35651584, 180 },
+    };
+    uint32_t luma_ps = info->pic_width_in_luma_samples * info->pic_height_in_luma_samples;
+    unsigned int i;
+
+    for (i = 0; i < sizeof(levels) / sizeof(levels[0]) - 1; i++)
+        if (luma_ps <= levels[i].max_luma_ps)
+            break;
+
+    return levels[i].level_idc;
+}
+
+// 7.3.3 profile_tier_level( 1, 0 )
+static void write_profile_tier_level(bs_t *b, VdpDecoderProfile profile, VdpPictureInfoHEVC *info)
+{
+    int idc = profile_idc(profile);
+    int j;
+
+    bs_write_u(b, 2, 0);                // general_profile_space
+    bs_write_u1(b, 0);                  // general_tier_flag, Main tier
+    bs_write_u(b, 5, idc);
+    for (j = 0; j < 32; j++)            // Main streams also conform to Main 10
+        bs_write_u1(b, j == idc || (idc == HEVC_PROFILE_MAIN && j == HEVC_PROFILE_MAIN_10));
+    bs_write_u1(b, 0);                  // general_progressive_source_flag, unknown
+    bs_write_u1(b, 0);                  // general_interlaced_source_flag
+    bs_write_u1(b, 0);                  // general_non_packed_constraint_flag
+    bs_write_u1(b, 0);                  // general_frame_only_constraint_flag
+    bs_write_u(b, 32, 0);               // general_reserved_zero_44bits
+    bs_write_u(b, 12, 0);
+    bs_write_u8(b, level_idc(info));
+}
+
+// 7.3.2.1 Video parameter set RBSP
+static void write_hevc_video_parameter_set_rbsp(bs_t *b, VdpDecoderProfile profile, VdpPictureInfoHEVC *info)
+{
+    bs_write_u(b, 4, 0);                // vps_video_parameter_set_id
+    bs_write_u(b, 2, 3);                // vps_reserved_three_2bits
+    bs_write_u(b, 6, 0);                // vps_max_layers_minus1
+    bs_write_u(b, 3, 0);                // vps_max_sub_layers_minus1
+    bs_write_u1(b, 1);                  // vps_temporal_id_nesting_flag
+    bs_write_u(b, 16, 0xffff);          // vps_reserved_0xffff_16bits
+    write_profile_tier_level(b, profile, info);
+    bs_write_u1(b, 1);                  // vps_sub_layer_ordering_info_present_flag
+    bs_write_ue(b, info->sps_max_dec_pic_buffering_minus1);
+    bs_write_ue(b, info->sps_max_dec_pic_buffering_minus1); // vps_max_num_reorder_pics, unknown so the upper bound
+    bs_write_ue(b, 0);                  // vps_max_latency_increase_plus1
+    bs_write_u(b, 6, 0);                // vps_max_layer_id
+    bs_write_ue(b, 0);                  // vps_num_layer_sets_minus1
+    bs_write_u1(b, 0);                  // vps_timing_info_present_flag
+    bs_write_u1(b, 0);                  // vps_extension_flag
+    write_rbsp_trailing_bits(b);
+}
+
+// 7.3.4 Scaling list data syntax, VDPAU hands the lists over in coefficient scan order
+static void write_scaling_list_data(bs_t *b, VdpPictureInfoHEVC *info)
+{
+    int size_id, matrix_id, i;
+
+    for (size_id = 0; size_id < 4; size_id++)
+    {
+        for (matrix_id = 0; matrix_id < 6; matrix_id += (size_id == 3) ? 3 : 1)
+        {
+            const uint8_t *list;
+            int coef_num = size_id ? 64 : 16;
+            int next_coef = 8;
+
+            switch (size_id)
+            {
+            case 0: list = info->ScalingList4x4[matrix_id]; break;
+            case 1: list = info->ScalingList8x8[matrix_id]; break;
+            case 2: list = info->ScalingList16x16[matrix_id]; break;
+            default: list = info->ScalingList32x32[matrix_id / 3]; break;
+            }
+
+            bs_write_u1(b, 1);          // scaling_list_pred_mode_flag, always explicit
+            if (size_id > 1)
+            {
+                next_coef = size_id == 2 ? info->ScalingListDCCoeff16x16[matrix_id] : info->ScalingListDCCoeff32x32[matrix_id / 3];
+                bs_write_se(b, next_coef - 8); // scaling_list_dc_coef_minus8
+            }
+
+            for (i = 0; i < coef_num; i++)
+            {
+                // the delta wraps around, so it always fits -128..127
+                bs_write_se(b, (int8_t)(list[i] - next_coef));
+                next_coef = list[i];
+            }
+        }
+    }
+}
+
+// 7.3.7 Short-term reference picture set syntax, always without inter RPS prediction
+static void write_st_ref_pic_set(bs_t *b, int idx, const hevc_st_rps_t *set)
+{
+    int32_t prev = 0;
+    int i;
+
+    if (idx != 0)
+        bs_write_u1(b, 0);              // inter_ref_pic_set_prediction_flag
+
+    bs_write_ue(b, set->num_negative);
+    bs_write_ue(b, set->num_positive);
+    for (i = 0; i < set->num_negative; i++)
+    {
+        bs_write_ue(b, prev - set->delta_poc[i] - 1); // delta_poc_s0_minus1
+        bs_write_u1(b, set->used[i]);
+        prev = set->delta_poc[i];
+    }
+    prev = 0;
+    for (i = set->num_negative; i < set->num_negative + set->num_positive; i++)
+    {
+        bs_write_ue(b, set->delta_poc[i] - prev - 1); // delta_poc_s1_minus1
+        bs_write_u1(b, set->used[i]);
+        prev = set->delta_poc[i];
+    }
+}
+
+// 7.3.2.2 Sequence parameter set RBSP
+static void write_hevc_seq_parameter_set_rbsp(bs_t *b, int width, int height, VdpDecoderProfile profile,
+                                              VdpPictureInfoHEVC *info, const hevc_rps_table_t *rps)
+{
+    static const hevc_st_rps_t empty_set;
+    int sub_width = (info->chroma_format_idc == 1 || info->chroma_format_idc == 2) ? 2 : 1;
+    int sub_height = info->chroma_format_idc == 1 ? 2 : 1;
+    int crop_right = 0, crop_bottom = 0;
+    int i;
+
+    // the coded size is a multiple of the minimum CB, crop it back to the decoder size
+    if (width > 0 && (uint32_t)width < info->pic_width_in_luma_samples)
+        crop_right = (info->pic_width_in_luma_samples - width) / sub_width;
+    if (height > 0 && (uint32_t)height < info->pic_height_in_luma_samples)
+        crop_bottom = (info->pic_height_in_luma_samples - height) / sub_height;
+
+    bs_write_u(b, 4, 0);                // sps_video_parameter_set_id
+    bs_write_u(b, 3, 0);                // sps_max_sub_layers_minus1
+    bs_write_u1(b, 1);                  // sps_temporal_id_nesting_flag
+    write_profile_tier_level(b, profile, info);
+    bs_write_ue(b, 0);                  // sps_seq_parameter_set_id
+    bs_write_ue(b, info->chroma_format_idc);
+    if (info->chroma_format_idc == 3)
+        bs_write_u1(b, info->separate_colour_plane_flag);
+    bs_write_ue(b, info->pic_width_in_luma_samples);
+    bs_write_ue(b, info->pic_height_in_luma_samples);
+    bs_write_u1(b, crop_right || crop_bottom); // conformance_window_flag
+    if (crop_right || crop_bottom)
+    {
+        bs_write_ue(b, 0);              // conf_win_left_offset
+        bs_write_ue(b, crop_right);
+        bs_write_ue(b, 0);              // conf_win_top_offset
+        bs_write_ue(b, crop_bottom);
+    }
+    bs_write_ue(b, info->bit_depth_luma_minus8);
+    bs_write_ue(b, info->bit_depth_chroma_minus8);
+    bs_write_ue(b, info->log2_max_pic_order_cnt_lsb_minus4);
+    bs_write_u1(b, 1);                  // sps_sub_layer_ordering_info_present_flag
+    bs_write_ue(b, info->sps_max_dec_pic_buffering_minus1);
+    bs_write_ue(b, info->sps_max_dec_pic_buffering_minus1); // sps_max_num_reorder_pics, unknown so the upper bound
+    bs_write_ue(b, 0);                  // sps_max_latency_increase_plus1
+    bs_write_ue(b, info->log2_min_luma_coding_block_size_minus3);
+    bs_write_ue(b, info->log2_diff_max_min_luma_coding_block_size);
+    bs_write_ue(b, info->log2_min_transform_block_size_minus2);
+    bs_write_ue(b, info->log2_diff_max_min_transform_block_size);
+    bs_write_ue(b, info->max_transform_hierarchy_depth_inter);
+    bs_write_ue(b, info->max_transform_hierarchy_depth_intra);
+
+    bs_write_u1(b, info->scaling_list_enabled_flag);
+    if (info->scaling_list_enabled_flag)
+    {
+        int present = hevc_scaling_list_data_present(info);
+        bs_write_u1(b, present);        // sps_scaling_list_data_present_flag
+        if (present)
+            write_scaling_list_data(b, info);
+    }
+
+    bs_write_u1(b, info->amp_enabled_flag);
+    bs_write_u1(b, info->sample_adaptive_offset_enabled_flag);
+    bs_write_u1(b, info->pcm_enabled_flag);
+    if (info->pcm_enabled_flag)
+    {
+        bs_write_u(b, 4, info->pcm_sample_bit_depth_luma_minus1);
+        bs_write_u(b, 4, info->pcm_sample_bit_depth_chroma_minus1);
+        bs_write_ue(b, info->log2_min_pcm_luma_coding_block_size_minus3);
+        bs_write_ue(b, info->log2_diff_max_min_pcm_luma_coding_block_size);
+        bs_write_u1(b, info->pcm_loop_filter_disabled_flag);
+    }
+
+    // sets not seen yet only need the right count to keep the slice header syntax intact
+    bs_write_ue(b, info->num_short_term_ref_pic_sets);
+    for (i = 0; i < info->num_short_term_ref_pic_sets && i < HEVC_MAX_ST_RPS; i++)
+        write_st_ref_pic_set(b, i, (rps && rps->known[i]) ? &rps->sets[i] : &empty_set);
+
+    bs_write_u1(b, info->long_term_ref_pics_present_flag);
+    if (info->long_term_ref_pics_present_flag)
+    {
+        bs_write_ue(b, info->num_long_term_ref_pics_sps);
+        for (i = 0; i < info->num_long_term_ref_pics_sps; i++)
+        {
+            bs_write_u(b, info->log2_max_pic_order_cnt_lsb_minus4 + 4, 0); // lt_ref_pic_poc_lsb_sps
+            bs_write_u1(b, 1);          // used_by_curr_pic_lt_sps_flag
+        }
+    }
+
+    bs_write_u1(b, info->sps_temporal_mvp_enabled_flag);
+    bs_write_u1(b, info->strong_intra_smoothing_enabled_flag);
+    bs_write_u1(b, 0);                  // vui_parameters_present_flag
+    bs_write_u1(b, 0);                  // sps_extension_present_flag
+    write_rbsp_trailing_bits(b);
+}
+
+// 7.3.2.3 Picture parameter set RBSP
+static void write_hevc_pic_parameter_set_rbsp(bs_t *b, VdpPictureInfoHEVC *info)
+{
+    int i;
+
+    bs_write_ue(b, 0);                  // pps_pic_parameter_set_id
+    bs_write_ue(b, 0);                  // pps_seq_parameter_set_id
+    bs_write_u1(b, info->dependent_slice_segments_enabled_flag);
+    bs_write_u1(b, info->output_flag_present_flag);
+    bs_write_u(b, 3, info->num_extra_slice_header_bits);
+    bs_write_u1(b, info->sign_data_hiding_enabled_flag);
+    bs_write_u1(b, info->cabac_init_present_flag);
+    bs_write_ue(b, info->num_ref_idx_l0_default_active_minus1);
+    bs_write_ue(b, info->num_ref_idx_l1_default_active_minus1);
+    bs_write_se(b, info->init_qp_minus26);
+    bs_write_u1(b, info->constrained_intra_pred_flag);
+    bs_write_u1(b, info->transform_skip_enabled_flag);
+    bs_write_u1(b, info->cu_qp_delta_enabled_flag);
+    if (info->cu_qp_delta_enabled_flag)
+        bs_write_ue(b, info->diff_cu_qp_delta_depth);
+    bs_write_se(b, info->pps_cb_qp_offset);
+    bs_write_se(b, info->pps_cr_qp_offset);
+    bs_write_u1(b, info->pps_slice_chroma_qp_offsets_present_flag);
+    bs_write_u1(b, info->weighted_pred_flag);
+    bs_write_u1(b, info->weighted_bipred_flag);
+    bs_write_u1(b, info->transquant_bypass_enabled_flag);
+    bs_write_u1(b, info->tiles_enabled_flag);
+    bs_write_u1(b, info->entropy_coding_sync_enabled_flag);
+    if (info->tiles_enabled_flag)
+    {
+        bs_write_ue(b, info->num_tile_columns_minus1);
+        bs_write_ue(b, info->num_tile_rows_minus1);
+        bs_write_u1(b, info->uniform_spacing_flag);
+        if (!info->uniform_spacing_flag)
+        {
+            for (i = 0; i < info->num_tile_columns_minus1 && i < 20; i++)
+                bs_write_ue(b, info->column_width_minus1[i]);
+            for (i = 0; i < info->num_tile_rows_minus1 && i < 22; i++)
+                bs_write_ue(b, info->row_height_minus1[i]);
+        }
+        bs_write_u1(b, info->loop_filter_across_tiles_enabled_flag);
+    }
+    bs_write_u1(b, info->pps_loop_filter_across_slices_enabled_flag);
+    bs_write_u1(b, info->deblocking_filter_control_present_flag);
+    if (info->deblocking_filter_control_present_flag)
+    {
+        bs_write_u1(b, info->deblocking_filter_override_enabled_flag);
+        bs_write_u1(b, info->pps_deblocking_filter_disabled_flag);
+        if (!info->pps_deblocking_filter_disabled_flag)
+        {
+            bs_write_se(b, info->pps_beta_offset_div2);
+            bs_write_se(b, info->pps_tc_offset_div2);
+        }
+    }
+    bs_write_u1(b, 0);                  // pps_scaling_list_data_present_flag, the lists travel in the SPS
+    bs_write_u1(b, info->lists_modification_present_flag);
+    bs_write_ue(b, info->log2_parallel_merge_level_minus2);
+    bs_write_u1(b, info->slice_segment_header_extension_present_flag);
+    bs_write_u1(b, 0);                  // pps_extension_present_flag
+    write_rbsp_trailing_bits(b);
+}
+
+static int write_hevc_nal_unit(int nal_unit_type, int width, int height, VdpDecoderProfile profile,
+                               VdpPictureInfoHEVC *info, const hevc_rps_table_t *rps, uint8_t *buf, int size)
+{
+    #define HEADER_SIZE 4
+    uint8_t rbsp_buf[HEVC_RBSP_MAX_SIZE];
+    int rbsp_size;
+    int nal_size = size - HEADER_SIZE;
+    bs_t b;
+
+    if (nal_size <= 0)
+        return -1;
+
+    bs_init(&b, rbsp_buf, sizeof(rbsp_buf));
+
+    switch (nal_unit_type)
+    {
+    case HEVC_NAL_VPS:
+        write_hevc_video_parameter_set_rbsp(&b, profile, info);
+        break;
+    case HEVC_NAL_SPS:
+        write_hevc_seq_parameter_set_rbsp(&b, width, height, profile, info, rps);
+        break;
+    case HEVC_NAL_PPS:
+        write_hevc_pic_parameter_set_rbsp(&b, info);
+        break;
+    default:
+        return 0;
+    }
+
+    if (bs_overrun(&b))
+        return -1;
+
+    rbsp_size = bs_pos(&b);
+
+    // rbsp_to_nal leaves one byte for the header, the second NAL header byte goes there
+    if (rbsp_to_nal(rbsp_buf, &rbsp_size, buf + HEADER_SIZE, &nal_size) < 0)
+        return -1;
+
+    // 7.3.1.2 NAL unit header, nuh_layer_id 0 and nuh_temporal_id_plus1 1
+    buf[0] = 0x00;
+    buf[1] = 0x00;
+    buf[2] = 0x01;
+    buf[3] = nal_unit_type << 1;
+    buf[4] = 0x01;
+
+    return nal_size + HEADER_SIZE;
+    #undef HEADER_SIZE
+}
+
+int hevc_write_parameter_sets(int width, int height, VdpDecoderProfile profile, VdpPictureInfoHEVC *info,
+                              const hevc_rps_table_t *rps, uint8_t *buf, int size)
+{
+    static const int types[] = { HEVC_NAL_VPS, HEVC_NAL_SPS, HEVC_NAL_PPS };
+    int i, len, pos = 0;
+
+    for (i = 0; i < 3; i++)
+    {
+        len = write_hevc_nal_unit(types[i], width, height, profile, info, rps, buf + pos, size - pos);
+        if (len < 0)
+            return -1;
+        pos += len;
+    }
+
+    return pos;
+}
+
+#endif
@@ -0,0 +1,167 @@
+/*
+ * Copyright (c) 2013 Jens Kuske <jenskuske@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+
+#ifndef _HEVC_STREAM_H
+#define _HEVC_STREAM_H          1
+
+#include <stdint.h>
+
+#include <vdpau/vdpau.h>
+
+#include "bs.h"
+
+// HEVC needs a VDPAU version which knows about it
+#ifdef VDP_DECODER_PROFILE_HEVC_MAIN
+
+#define HEVC_MAX_ST_RPS 64
+#define HEVC_MAX_DPB    16
+
+typedef struct
+{
+    uint8_t num_negative;
+    uint8_t num_positive;
+    uint8_t used[HEVC_MAX_DPB];
+    int32_t delta_poc[HEVC_MAX_DPB];
+} hevc_st_rps_t;
+
+/*
+ * VDPAU only passes the short-term RPS the current picture uses, not the SPS
+ * candidate sets its slice headers index into. The sets are collected here as
+ * pictures using them come by. The SPS may only change at an IRAP picture, so
+ * sets learned in between are held back until the next one takes them over,
+ * generation changes whenever it does.
+ */
+typedef struct hevc_rps_table_struct
+{
+    uint32_t generation;
+    uint8_t known[HEVC_MAX_ST_RPS];
+    hevc_st_rps_t sets[HEVC_MAX_ST_RPS];
+    // learned since the last IRAP picture
+    int pending;
+    uint8_t learned_known[HEVC_MAX_ST_RPS];
+    hevc_st_rps_t learned[HEVC_MAX_ST_RPS];
+} hevc_rps_table_t;
+
+void hevc_learn_rps(hevc_rps_table_t *table, VdpPictureInfoHEVC *info);
+
+// 0 if the lists are the defaults of Table 7-5 and 7-6 or weren't filled in at all
+int hevc_scaling_list_data_present(const VdpPictureInfoHEVC *info);
+
+// every VdpPictureInfoHEVC field the VPS/SPS/PPS writers consume, zero padded so it can be hashed
+typedef struct
+{
+    uint32_t profile;
+    uint16_t width;
+    uint16_t height;
+    uint32_t rps_generation;
+    uint32_t chroma_format_idc;
+    uint32_t pic_width_in_luma_samples;
+    uint32_t pic_height_in_luma_samples;
+    uint8_t separate_colour_plane_flag;
+    uint8_t bit_depth_luma_minus8;
+    uint8_t bit_depth_chroma_minus8;
+    uint8_t log2_max_pic_order_cnt_lsb_minus4;
+    uint8_t sps_max_dec_pic_buffering_minus1;
+    uint8_t log2_min_luma_coding_block_size_minus3;
+    uint8_t log2_diff_max_min_luma_coding_block_size;
+    uint8_t log2_min_transform_block_size_minus2;
+    uint8_t log2_diff_max_min_transform_block_size;
+    uint8_t max_transform_hierarchy_depth_inter;
+    uint8_t max_transform_hierarchy_depth_intra;
+    uint8_t scaling_list_enabled_flag;
+    uint8_t amp_enabled_flag;
+    uint8_t sample_adaptive_offset_enabled_flag;
+    uint8_t pcm_enabled_flag;
+    uint8_t pcm_sample_bit_depth_luma_minus1;
+    uint8_t pcm_sample_bit_depth_chroma_minus1;
+    uint8_t log2_min_pcm_luma_coding_block_size_minus3;
+    uint8_t log2_diff_max_min_pcm_luma_coding_block_size;
+    uint8_t pcm_loop_filter_disabled_flag;
+    uint8_t num_short_term_ref_pic_sets;
+    uint8_t long_term_ref_pics_present_flag;
+    uint8_t num_long_term_ref_pics_sps;
+    uint8_t sps_temporal_mvp_enabled_flag;
+    uint8_t strong_intra_smoothing_enabled_flag;
+    uint8_t dependent_slice_segments_enabled_flag;
+    uint8_t output_flag_present_flag;
+    uint8_t num_extra_slice_header_bits;
+    uint8_t sign_data_hiding_enabled_flag;
+    uint8_t cabac_init_present_flag;
+    uint8_t num_ref_idx_l0_default_active_minus1;
+    uint8_t num_ref_idx_l1_default_active_minus1;
+    int8_t init_qp_minus26;
+    uint8_t constrained_intra_pred_flag;
+    uint8_t transform_skip_enabled_flag;
+    uint8_t cu_qp_delta_enabled_flag;
+    uint8_t diff_cu_qp_delta_depth;
+    int8_t pps_cb_qp_offset;
+    int8_t pps_cr_qp_offset;
+    uint8_t pps_slice_chroma_qp_offsets_present_flag;
+    uint8_t weighted_pred_flag;
+    uint8_t weighted_bipred_flag;
+    uint8_t transquant_bypass_enabled_flag;
+    uint8_t tiles_enabled_flag;
+    uint8_t entropy_coding_sync_enabled_flag;
+    uint8_t num_tile_columns_minus1;
+    uint8_t num_tile_rows_minus1;
+    uint8_t uniform_spacing_flag;
+    uint8_t loop_filter_across_tiles_enabled_flag;
+    uint8_t pps_loop_filter_across_slices_enabled_flag;
+    uint8_t deblocking_filter_control_present_flag;
+    uint8_t deblocking_filter_override_enabled_flag;
+    uint8_t pps_deblocking_filter_disabled_flag;
+    int8_t pps_beta_offset_div2;
+    int8_t pps_tc_offset_div2;
+    uint8_t lists_modification_present_flag;
+    uint8_t log2_parallel_merge_level_minus2;
+    uint8_t slice_segment_header_extension_present_flag;
+    uint8_t scaling_list_data_present_flag;
+    uint16_t column_width_minus1[20];
+    uint16_t row_height_minus1[22];
+    uint8_t scaling_list_4x4[6][16];
+    uint8_t scaling_list_8x8[6][64];
+    uint8_t scaling_list_16x16[6][64];
+    uint8_t scaling_list_32x32[2][64];
+    uint8_t scaling_list_dc_16x16[6];
+    uint8_t scaling_list_dc_32x32[2];
+} hevc_header_key_t;
+
+void hevc_header_key(hevc_header_key_t *key, int width, int height, VdpDecoderProfile profile,
+                     VdpPictureInfoHEVC *info, const hevc_rps_table_t *rps);
+
+// VPS, SPS and PPS NAL units with start codes
+int hevc_write_parameter_sets(int width, int height, VdpDecoderProfile profile, VdpPictureInfoHEVC *info,
+                              const hevc_rps_table_t *rps, uint8_t *buf, int size);
+
+#endif
+
+// upper bound of a single parameter set RBSP, explicit scaling lists are the bulk of it
+#define HEVC_RBSP_MAX_SIZE 3072
+
+// Table 7-1 NAL unit type codes
+#define HEVC_NAL_VPS            32
+#define HEVC_NAL_SPS            33
+#define HEVC_NAL_PPS            34
+
+#define HEVC_PROFILE_MAIN       1
+#define HEVC_PROFILE_MAIN_10    2
+#define HEVC_PROFILE_MAIN_STILL 3
+
+#endif
@@ -0,0 +1,185 @@
+/*
+ * Copyright (c) 2013 Jens Kuske <jenskuske@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include <string.h>
+#include <signal.h>
+#include <semaphore.h>
+#include <time.h>
+#include <errno.h>
+
+#include "vdpau_private.h"
+
+typedef struct
+{
+    int64_t cur;
+    int64_t peak;
+} memstat_counter_t;
+
+typedef struct
+{
+    memstat_counter_t live;
+    memstat_counter_t bytes[MEMSTAT_KIND_COUNT];
+} memstat_entry_t;
+
+static const char *const type_names[MEMSTAT_TYPE_COUNT] =
+{
+    [MEMSTAT_VIDEO_SURFACE]   = "video surface",
+    [MEMSTAT_OUTPUT_SURFACE]  = "output surface",
+    [MEMSTAT_BITMAP_SURFACE]  = "bitmap surface",
+    [MEMSTAT_RGBA_BUFFER]     = "rgba buffer",
+    [MEMSTAT_DECODER]         = "decoder",
+    [MEMSTAT_V4L2_OUTPUT]     = "v4l2 stream buf",
+    [MEMSTAT_V4L2_CAPTURE]    = "v4l2 capture buf",
+    [MEMSTAT_V4L2_CONVERTER]  = "v4l2 convert buf",
+};
+
+static memstat_entry_t stats[MEMSTAT_TYPE_COUNT];
+
+static int enabled;
+static int period;
+static sem_t wakeup;
+static pthread_t thread;
+
+static void counter_add(memstat_counter_t *c, int64_t v)
+{
+    int64_t cur = __atomic_add_fetch(&c->cur, v, __ATOMIC_RELAXED);
+    int64_t peak = __atomic_load_n(&c->peak, __ATOMIC_RELAXED);
+
+    while (cur > peak &&
+           !__atomic_compare_exchange_n(&c->peak, &peak, cur, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        ;
+}
+
+static void memstat_update(memstat_type_t type, int count, int64_t cpu, int64_t gl, int64_t v4l2)
+{
+    memstat_entry_t *e = &stats[type];
+
+    counter_add(&e->live, count);
+    if (cpu)
+        counter_add(&e->bytes[MEMSTAT_CPU], cpu);
+    if (gl)
+        counter_add(&e->bytes[MEMSTAT_GL], gl);
+    if (v4l2)
+        counter_add(&e->bytes[MEMSTAT_V4L2], v4l2);
+}
+
+void memstat_alloc(memstat_type_t type, int count, size_t cpu, size_t gl, size_t v4l2)
+{
+    memstat_update(type, count, cpu, gl, v4l2);
+}
+
+void memstat_free(memstat_type_t type, int count, size_t cpu, size_t gl, size_t v4l2)
+{
+    memstat_update(type, -count, -(int64_t)cpu, -(int64_t)gl, -(int64_t)v4l2);
+}
+
+void memstat_dump(void)
+{
+    int64_t total[MEMSTAT_KIND_COUNT] = { 0 };
+    int i, k;
+
+    fprintf(stderr, "\e[1;32m[VDPAU ODROID]\e[0m memory usage (KiB, current/peak)\n");
+    fprintf(stderr, "  %-18s %-11s %-17s %-17s %-17s\n", "type", "live", "cpu", "gl", "v4l2");
+
+    for (i = 0; i < MEMSTAT_TYPE_COUNT; i++)
+    {
+        memstat_entry_t *e = &stats[i];
+        memstat_counter_t b[MEMSTAT_KIND_COUNT];
+
+        for (k = 0; k < MEMSTAT_KIND_COUNT; k++)
+        {
+            b[k].cur = __atomic_load_n(&e->bytes[k].cur, __ATOMIC_RELAXED);
+            b[k].peak = __atomic_load_n(&e->bytes[k].peak, __ATOMIC_RELAXED);
+            total[k] += b[k].cur;
+        }
+
+        fprintf(stderr, "  %-18s %5lld/%-5lld %8lld/%-8lld %8lld/%-8lld %8lld/%-8lld\n", type_names[i],
+                (long long)__atomic_load_n(&e->live.cur, __ATOMIC_RELAXED),
+                (long long)__atomic_load_n(&e->live.peak, __ATOMIC_RELAXED),
+                (long long)b[MEMSTAT_CPU].cur >> 10, (long long)b[MEMSTAT_CPU].peak >> 10,
+                (long long)b[MEMSTAT_GL].cur >> 10, (long long)b[MEMSTAT_GL].peak >> 10,
+                (long long)b[MEMSTAT_V4L2].cur >> 10, (long long)b[MEMSTAT_V4L2].peak >> 10);
+    }
+
+    fprintf(stderr, "  %-18s %-11s %8lld%-9s %8lld%-9s %8lld\n", "total", "",
+            (long long)total[MEMSTAT_CPU] >> 10, "", (long long)total[MEMSTAT_GL] >> 10, "",
+            (long long)total[MEMSTAT_V4L2] >> 10);
+}
+
+static void memstat_signal(int sig)
+{
+    // sem_post is async-signal-safe, the actual dump happens on the thread
+    sem_post(&wakeup);
+}
+
+static void *memstat_thread(void *arg)
+{
+    while (1)
+    {
+        int ret;
+
+        if (period > 0)
+        {
+            struct timespec ts;
+            clock_gettime(CLOCK_REALTIME, &ts);
+            ts.tv_sec += period;
+            ret = sem_timedwait(&wakeup, &ts);
+        }
+        else
+            ret = sem_wait(&wakeup);
+
+        if (ret && errno == EINTR)
+            continue;
+
+        memstat_dump();
+    }
+
+    return NULL;
+}
+
+void memstat_init(void)
+{
+    char *env = getenv("VDPAU_MEMSTAT");
+    if (!env)
+        return;
+
+    enabled = 1;
+    period = atoi(env);
+
+    if (sem_init(&wakeup, 0, 0))
+        return;
+
+    if (strstr(env, "signal") || period <= 0)
+    {
+        struct sigaction sa;
+        memset(&sa, 0, sizeof(sa));
+        sa.sa_handler = memstat_signal;
+        sa.sa_flags = SA_RESTART;
+        sigemptyset(&sa.sa_mask);
+        sigaction(SIGUSR1, &sa, NULL);
+    }
+
+    if (pthread_create(&thread, NULL, memstat_thread, NULL) == 0)
+        pthread_detach(thread);
+}
+
+int memstat_enabled(void)
+{
+    return enabled;
+}
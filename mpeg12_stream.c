@@ -1,98 +1,268 @@
+/*
+ * Copyright (c) 2013 Jens Kuske <jenskuske@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+/*
+ * VDPAU passes MPEG-1/2 pictures as slice data only, the MFC however wants an
+ * elementary stream. The headers in front of the slices are rebuilt here from
+ * VdpPictureInfoMPEG1Or2, syntax references are to ISO/IEC 13818-2.
+ */
+
 #include <stdint.h>
-#include <stdlib.h>
-#include <stdio.h>
-
-#include <vdpau/vdpau.h>
-
-#include "bs.h"
-
-mpeg12_header(int width, int height, VdpDecoderProfile profile, VdpPictureInfoH264 *vdppi, uint8_t* buf, int size) {
-    unsigned int vbv_buffer_size, fps, v;
-    int i, constraint_parameter_flag;
-    uint64_t time_code;
-    int64_t best_aspect_error = INT64_MAX;
-    AVRational aspect_ratio = s->avctx->sample_aspect_ratio;
-
-    if (aspect_ratio.num == 0 || aspect_ratio.den == 0)
-        bs_write_u8(b, 0x00);
-        bs_write_u8(b, 0x00);
-        bs_write_u8(b, 0x01);
-        bs_write_u8(b, SEQ_START_CODE);
-
-        bs_write_u(b, 12, width  & 0xFFF);
-        bs_write_u(b, 12, height & 0xFFF);
-
-        bs_write_u(b, 4, 1);
-        bs_write_u(b, 4, 1);
-
-        v = 0x3FFFF;
-        bs_write_u(b, 18, v);
-        bs_write_u(b, 1, 1);         // marker
-        bs_write_u(b, 10, 3);   //vbv_buffer_size);
-
-        constraint_parameter_flag =
-            width  <= 768                                    &&
-            height <= 576                                    &&
-            v <= 1856000 / 400                               &&
-            profile == VDP_DECODER_PROFILE_MPEG1;
-
-        put_bits(&s->pb, 1, constraint_parameter_flag);
-
-        ff_write_quant_matrix(&s->pb, s->avctx->intra_matrix);
-        ff_write_quant_matrix(&s->pb, s->avctx->inter_matrix);
-
-        if (s->codec_id == AV_CODEC_ID_MPEG2VIDEO) {
-            AVFrameSideData *side_data;
-            int width = s->width;
-            int height = s->height;
-            int use_seq_disp_ext;
-
-            put_header(s, EXT_START_CODE);
-            put_bits(&s->pb, 4, 1);                 // seq ext
-
-            put_bits(&s->pb, 1, s->avctx->profile == 0); // escx 1 for 4:2:2 profile
-
-            put_bits(&s->pb, 3, s->avctx->profile); // profile
-            put_bits(&s->pb, 4, s->avctx->level);   // level
-
-            put_bits(&s->pb, 1, s->progressive_sequence);
-            put_bits(&s->pb, 2, s->chroma_format);
-            put_bits(&s->pb, 2, s->width  >> 12);
-            put_bits(&s->pb, 2, s->height >> 12);
-            put_bits(&s->pb, 12, v >> 18);          // bitrate ext
-            put_bits(&s->pb, 1, 1);                 // marker
-            put_bits(&s->pb, 8, vbv_buffer_size >> 10); // vbv buffer ext
-            put_bits(&s->pb, 1, s->low_delay);
-            put_bits(&s->pb, 2, s->mpeg2_frame_rate_ext.num-1); // frame_rate_ext_n
-            put_bits(&s->pb, 5, s->mpeg2_frame_rate_ext.den-1); // frame_rate_ext_d
-
-            side_data = av_frame_get_side_data(s->current_picture_ptr->f, AV_FRAME_DATA_PANSCAN);
-            if (side_data) {
-                AVPanScan *pan_scan = (AVPanScan *)side_data->data;
-                if (pan_scan->width && pan_scan->height) {
-                    width = pan_scan->width >> 4;
-                    height = pan_scan->height >> 4;
-                }
-            }
-
-            use_seq_disp_ext = (width != s->width ||
-                                height != s->height ||
-                                s->avctx->color_primaries != AVCOL_PRI_UNSPECIFIED ||
-                                s->avctx->color_trc != AVCOL_TRC_UNSPECIFIED ||
-                                s->avctx->colorspace != AVCOL_SPC_UNSPECIFIED);
-
-            if (s->seq_disp_ext == 1 || (s->seq_disp_ext == -1 && use_seq_disp_ext)) {
-                put_header(s, EXT_START_CODE);
-                put_bits(&s->pb, 4, 2);                         // sequence display extension
-                put_bits(&s->pb, 3, 0);                         // video_format: 0 is components
-                put_bits(&s->pb, 1, 1);                         // colour_description
-                put_bits(&s->pb, 8, s->avctx->color_primaries); // colour_primaries
-                put_bits(&s->pb, 8, s->avctx->color_trc);       // transfer_characteristics
-                put_bits(&s->pb, 8, s->avctx->colorspace);      // matrix_coefficients
-                put_bits(&s->pb, 14, width);                    // display_horizontal_size
-                put_bits(&s->pb, 1, 1);                         // marker_bit
-                put_bits(&s->pb, 14, height);                   // display_vertical_size
-                put_bits(&s->pb, 3, 0);                         // remaining 3 bits are zero padding
-            }
-        }
+#include <string.h>
+
+#include "mpeg12_stream.h"
+
+// quantiser matrices are transmitted in zigzag order, VDPAU hands them over in raster order
+static const uint8_t zigzag[64] =
+{
+     0,  1,  8, 16,  9,  2,  3, 10, 17, 24, 32, 25, 18, 11,  4,  5,
+    12, 19, 26, 33, 40, 48, 41, 34, 27, 20, 13,  6,  7, 14, 21, 28,
+    35, 42, 49, 56, 57, 50, 43, 36, 29, 22, 15, 23, 30, 37, 44, 51,
+    58, 59, 52, 45, 38, 31, 39, 46, 53, 60, 61, 54, 47, 55, 62, 63
+};
+
+static int is_mpeg1(VdpDecoderProfile profile)
+{
+    return profile == VDP_DECODER_PROFILE_MPEG1;
+}
+
+static void write_start_code(bs_t *b, int code)
+{
+    bs_write_u8(b, 0x00);
+    bs_write_u8(b, 0x00);
+    bs_write_u8(b, 0x01);
+    bs_write_u8(b, code);
+}
+
+// 5.2.3 next_start_code(), zero stuffing up to the byte boundary
+static void write_next_start_code(bs_t *b)
+{
+    while (!bs_byte_aligned(b))
+        bs_write_u1(b, 0);
+}
+
+static int matrix_present(const uint8_t *matrix)
+{
+    int i;
+
+    // an all zero matrix means the application didn't fill it in, keep the default
+    for (i = 0; i < 64; i++)
+        if (matrix[i])
+            return 1;
+
+    return 0;
+}
+
+static void write_matrix(bs_t *b, const uint8_t *matrix)
+{
+    int i;
+
+    for (i = 0; i < 64; i++)
+        bs_write_u8(b, matrix[zigzag[i]]);
+}
+
+void mpeg12_header_key(mpeg12_header_key_t *key, int width, int height, VdpDecoderProfile profile, VdpPictureInfoMPEG1Or2 *info)
+{
+    memset(key, 0, sizeof(*key));
+
+    key->profile = profile;
+    key->width = width;
+    key->height = height;
+    memcpy(key->intra_quantizer_matrix, info->intra_quantizer_matrix, 64);
+    memcpy(key->non_intra_quantizer_matrix, info->non_intra_quantizer_matrix, 64);
+}
+
+// 6.2.2.1 Sequence header
+static void write_sequence_header(bs_t *b, int width, int height, VdpPictureInfoMPEG1Or2 *info)
+{
+    write_start_code(b, MPEG12_SEQ_START_CODE);
+    bs_write_u(b, 12, width & 0xfff);   // horizontal_size_value
+    bs_write_u(b, 12, height & 0xfff);  // vertical_size_value
+    bs_write_u(b, 4, 1);                // aspect_ratio_information, square samples
+    bs_write_u(b, 4, 3);                // frame_rate_code, VDPAU doesn't know it, 25 fps is as good as any
+    bs_write_u(b, 18, 0x3ffff);         // bit_rate_value, variable
+    bs_write_u1(b, 1);                  // marker_bit
+    bs_write_u(b, 10, 597);             // vbv_buffer_size_value, MP@HL
+    bs_write_u1(b, 0);                  // constrained_parameters_flag
+
+    bs_write_u1(b, matrix_present(info->intra_quantizer_matrix));
+    if (matrix_present(info->intra_quantizer_matrix))
+        write_matrix(b, info->intra_quantizer_matrix);
+
+    bs_write_u1(b, matrix_present(info->non_intra_quantizer_matrix));
+    if (matrix_present(info->non_intra_quantizer_matrix))
+        write_matrix(b, info->non_intra_quantizer_matrix);
+
+    write_next_start_code(b);
+}
+
+int mpeg12_profile_and_level(int width, int height, VdpDecoderProfile profile)
+{
+    int profile_idc = (profile == VDP_DECODER_PROFILE_MPEG2_SIMPLE) ? 5 : 4;
+    int level_idc;
+
+    // Table 8-8, the lowest level the picture size fits in
+    if (width <= 352 && height <= 288)
+        level_idc = 10;    // Low
+    else if (width <= 720 && height <= 576)
+        level_idc = 8;     // Main
+    else if (width <= 1440 && height <= 1152)
+        level_idc = 6;     // High 1440
+    else
+        level_idc = 4;     // High
+
+    return (profile_idc << 4) | level_idc;
+}
+
+// 6.2.2.3 Sequence extension
+static void write_sequence_extension(bs_t *b, int width, int height, VdpDecoderProfile profile)
+{
+    write_start_code(b, MPEG12_EXT_START_CODE);
+    bs_write_u(b, 4, MPEG12_SEQ_EXT_ID);
+    bs_write_u8(b, mpeg12_profile_and_level(width, height, profile)); // escape bit, profile and level
+    bs_write_u1(b, 0);                  // progressive_sequence, unknown so allow both
+    bs_write_u(b, 2, 1);                // chroma_format, 4:2:0
+    bs_write_u(b, 2, (width >> 12) & 3);  // horizontal_size_extension
+    bs_write_u(b, 2, (height >> 12) & 3); // vertical_size_extension
+    bs_write_u(b, 12, 0xfff);           // bit_rate_extension
+    bs_write_u1(b, 1);                  // marker_bit
+    bs_write_u8(b, 0);                  // vbv_buffer_size_extension
+    bs_write_u1(b, 0);                  // low_delay, B pictures may follow
+    bs_write_u(b, 2, 0);                // frame_rate_extension_n
+    bs_write_u(b, 5, 0);                // frame_rate_extension_d
+    write_next_start_code(b);
+}
+
+// 6.2.2.6 Group of pictures header
+static void write_gop_header(bs_t *b)
+{
+    write_start_code(b, MPEG12_GOP_START_CODE);
+    bs_write_u1(b, 0);                  // drop_frame_flag
+    bs_write_u(b, 5, 0);                // time_code_hours
+    bs_write_u(b, 6, 0);                // time_code_minutes
+    bs_write_u1(b, 1);                  // marker_bit
+    bs_write_u(b, 6, 0);                // time_code_seconds
+    bs_write_u(b, 6, 0);                // time_code_pictures
+    bs_write_u1(b, 0);                  // closed_gop
+    bs_write_u1(b, 0);                  // broken_link
+    write_next_start_code(b);
+}
+
+int mpeg12_write_sequence_header(int width, int height, VdpDecoderProfile profile, VdpPictureInfoMPEG1Or2 *info, uint8_t *buf, int size)
+{
+    bs_t b;
+
+    bs_init(&b, buf, size);
+
+    write_sequence_header(&b, width, height, info);
+    if (!is_mpeg1(profile))
+        write_sequence_extension(&b, width, height, profile);
+    write_gop_header(&b);
+
+    if (bs_overrun(&b))
+        return -1;
+
+    return bs_pos(&b);
+}
+
+int mpeg12_write_picture_header(VdpDecoderProfile profile, VdpPictureInfoMPEG1Or2 *info, uint8_t *buf, int size)
+{
+    int mpeg1 = is_mpeg1(profile);
+    int progressive_frame;
+    bs_t b;
+
+    bs_init(&b, buf, size);
+
+    // 6.2.3 Picture header
+    write_start_code(&b, MPEG12_PICTURE_START_CODE);
+    bs_write_u(&b, 10, 0);              // temporal_reference, not passed by VDPAU
+    bs_write_u(&b, 3, info->picture_coding_type);
+    bs_write_u(&b, 16, 0xffff);         // vbv_delay
+    if (info->picture_coding_type == 2 || info->picture_coding_type == 3)
+    {
+        // MPEG-2 moves these to the picture coding extension and requires '0' and '111' here
+        bs_write_u1(&b, mpeg1 ? info->full_pel_forward_vector : 0);
+        bs_write_u(&b, 3, mpeg1 ? info->f_code[0][0] : 7);
+    }
+    if (info->picture_coding_type == 3)
+    {
+        bs_write_u1(&b, mpeg1 ? info->full_pel_backward_vector : 0);
+        bs_write_u(&b, 3, mpeg1 ? info->f_code[1][0] : 7);
+    }
+    bs_write_u1(&b, 0);                 // extra_bit_picture
+    write_next_start_code(&b);
+
+    if (!mpeg1)
+    {
+        // frame_pred_frame_dct is mandatory for progressive frames, the best guess available
+        progressive_frame = info->picture_structure == 3 && info->frame_pred_frame_dct;
+
+        // 6.2.3.1 Picture coding extension
+        write_start_code(&b, MPEG12_EXT_START_CODE);
+        bs_write_u(&b, 4, MPEG12_PIC_CODING_EXT_ID);
+        bs_write_u(&b, 4, info->f_code[0][0]);
+        bs_write_u(&b, 4, info->f_code[0][1]);
+        bs_write_u(&b, 4, info->f_code[1][0]);
+        bs_write_u(&b, 4, info->f_code[1][1]);
+        bs_write_u(&b, 2, info->intra_dc_precision);
+        bs_write_u(&b, 2, info->picture_structure);
+        bs_write_u1(&b, info->top_field_first);
+        bs_write_u1(&b, info->frame_pred_frame_dct);
+        bs_write_u1(&b, info->concealment_motion_vectors);
+        bs_write_u1(&b, info->q_scale_type);
+        bs_write_u1(&b, info->intra_vlc_format);
+        bs_write_u1(&b, info->alternate_scan);
+        bs_write_u1(&b, 0);             // repeat_first_field
+        bs_write_u1(&b, progressive_frame); // chroma_420_type
+        bs_write_u1(&b, progressive_frame);
+        bs_write_u1(&b, 0);             // composite_display_flag
+        write_next_start_code(&b);
+    }
+
+    if (bs_overrun(&b))
+        return -1;
+
+    return bs_pos(&b);
+}
+
+// 6.3.11 default intra_quantiser_matrix, in raster order like VDPAU's
+static const uint8_t default_intra_matrix[64] =
+{
+     8, 16, 19, 22, 26, 27, 29, 34,
+    16, 16, 22, 24, 27, 29, 34, 37,
+    19, 22, 26, 27, 29, 34, 34, 38,
+    22, 22, 26, 27, 29, 34, 37, 40,
+    22, 26, 27, 29, 32, 35, 40, 48,
+    26, 27, 29, 32, 35, 40, 48, 58,
+    26, 27, 29, 34, 38, 46, 56, 69,
+    27, 29, 35, 38, 46, 56, 69, 83
+};
+
+void mpeg12_scan_matrix(const uint8_t *matrix, int intra, uint8_t *scanned)
+{
+    const uint8_t *source = matrix;
+    int i;
+
+    // the non-intra default is flat 16
+    if (!matrix_present(matrix))
+        source = intra ? default_intra_matrix : NULL;
+
+    for (i = 0; i < 64; i++)
+        scanned[i] = source ? source[zigzag[i]] : 16;
 }
@@ -0,0 +1,63 @@
+/*
+ * Copyright (c) 2013 Jens Kuske <jenskuske@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifndef _MPEG12_STREAM_H
+#define _MPEG12_STREAM_H        1
+
+#include <stdint.h>
+
+#include <vdpau/vdpau.h>
+
+#include "bs.h"
+
+// everything the sequence level headers are built from, zero padded so it can be hashed
+typedef struct
+{
+    uint32_t profile;
+    uint16_t width;
+    uint16_t height;
+    uint8_t intra_quantizer_matrix[64];
+    uint8_t non_intra_quantizer_matrix[64];
+} mpeg12_header_key_t;
+
+void mpeg12_header_key(mpeg12_header_key_t *key, int width, int height, VdpDecoderProfile profile, VdpPictureInfoMPEG1Or2 *info);
+
+// sequence header, sequence extension (MPEG-2 only) and GOP header
+int mpeg12_write_sequence_header(int width, int height, VdpDecoderProfile profile, VdpPictureInfoMPEG1Or2 *info, uint8_t *buf, int size);
+
+// picture header and picture coding extension (MPEG-2 only)
+int mpeg12_write_picture_header(VdpDecoderProfile profile, VdpPictureInfoMPEG1Or2 *info, uint8_t *buf, int size);
+
+// profile_and_level_indication, escape bit clear
+int mpeg12_profile_and_level(int width, int height, VdpDecoderProfile profile);
+
+// a VDPAU quantiser matrix in zigzag order as stateless decoders take it, the default one if left zero
+void mpeg12_scan_matrix(const uint8_t *matrix, int intra, uint8_t *scanned);
+
+#define MPEG12_PICTURE_HEADER_MAX_SIZE 32
+
+#define MPEG12_PICTURE_START_CODE  0x00
+#define MPEG12_SEQ_START_CODE      0xb3
+#define MPEG12_EXT_START_CODE      0xb5
+#define MPEG12_GOP_START_CODE      0xb8
+
+#define MPEG12_SEQ_EXT_ID          1
+#define MPEG12_PIC_CODING_EXT_ID   8
+
+#endif
@@ -0,0 +1,204 @@
+/*
+ * Copyright (c) 2013 Jens Kuske <jenskuske@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+
+/*
+ * VDPAU passes MPEG-4 Part 2 pictures starting at the VOP header, the VOL
+ * header the MFC needs to parse them is rebuilt here from
+ * VdpPictureInfoMPEG4Part2. Syntax references are to ISO/IEC 14496-2.
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#include "mpeg4_stream.h"
+
+// quantiser matrices are transmitted in zigzag order, VDPAU hands them over in raster order
+static const uint8_t zigzag[64] =
+{
+     0,  1,  8, 16,  9,  2,  3, 10, 17, 24, 32, 25, 18, 11,  4,  5,
+    12, 19, 26, 33, 40, 48, 41, 34, 27, 20, 13,  6,  7, 14, 21, 28,
+    35, 42, 49, 56, 57, 50, 43, 36, 29, 22, 15, 23, 30, 37, 44, 51,
+    58, 59, 52, 45, 38, 31, 39, 46, 53, 60, 61, 54, 47, 55, 62, 63
+};
+
+// the DivX mobile profiles are Simple Profile streams, everything else may use B-VOPs and qpel
+static int is_simple(VdpDecoderProfile profile)
+{
+    switch (profile)
+    {
+    case VDP_DECODER_PROFILE_MPEG4_PART2_SP:
+    case VDP_DECODER_PROFILE_DIVX4_QMOBILE:
+    case VDP_DECODER_PROFILE_DIVX4_MOBILE:
+    case VDP_DECODER_PROFILE_DIVX5_QMOBILE:
+    case VDP_DECODER_PROFILE_DIVX5_MOBILE:
+        return 1;
+
+    default:
+        return 0;
+    }
+}
+
+static void write_start_code(bs_t *b, int code)
+{
+    bs_write_u8(b, 0x00);
+    bs_write_u8(b, 0x00);
+    bs_write_u8(b, 0x01);
+    bs_write_u8(b, code);
+}
+
+// 5.2.4 next_start_code(), unlike MPEG-2 a zero bit followed by one bits, always at least one bit
+static void write_next_start_code(bs_t *b)
+{
+    bs_write_u1(b, 0);
+    while (!bs_byte_aligned(b))
+        bs_write_u1(b, 1);
+}
+
+static int matrix_present(const uint8_t *matrix)
+{
+    int i;
+
+    // a zero entry would terminate the matrix early, so only send complete ones
+    for (i = 0; i < 64; i++)
+        if (!matrix[i])
+            return 0;
+
+    return 1;
+}
+
+static void write_matrix(bs_t *b, const uint8_t *matrix)
+{
+    int i;
+
+    for (i = 0; i < 64; i++)
+        bs_write_u8(b, matrix[zigzag[i]]);
+}
+
+void mpeg4_header_key(mpeg4_header_key_t *key, int width, int height, VdpDecoderProfile profile, VdpPictureInfoMPEG4Part2 *info)
+{
+    memset(key, 0, sizeof(*key));
+
+    key->profile = profile;
+    key->width = width;
+    key->height = height;
+    key->vop_time_increment_resolution = info->vop_time_increment_resolution;
+    key->interlaced = info->interlaced;
+    key->quant_type = info->quant_type;
+    key->quarter_sample = info->quarter_sample;
+    key->resync_marker_disable = info->resync_marker_disable;
+    if (info->quant_type)
+    {
+        memcpy(key->intra_quantizer_matrix, info->intra_quantizer_matrix, 64);
+        memcpy(key->non_intra_quantizer_matrix, info->non_intra_quantizer_matrix, 64);
+    }
+}
+
+// 6.2.2 Visual Object Sequence and Visual Object
+static void write_visual_object(bs_t *b, int simple)
+{
+    write_start_code(b, MPEG4_VOS_START_CODE);
+    bs_write_u8(b, simple ? 0x03 : 0xf5); // profile_and_level_indication, SP@L3 or ASP@L5
+
+    write_start_code(b, MPEG4_VISUAL_OBJ_START_CODE);
+    bs_write_u1(b, 0);                  // is_visual_object_identifier
+    bs_write_u(b, 4, 1);                // visual_object_type, video ID
+    bs_write_u1(b, 0);                  // video_signal_type
+    write_next_start_code(b);
+
+    write_start_code(b, MPEG4_VO_START_CODE);
+}
+
+// 6.2.3 Video Object Layer
+static void write_video_object_layer(bs_t *b, int width, int height, int simple, VdpPictureInfoMPEG4Part2 *info)
+{
+    // version 2 syntax carries quarter_sample, Simple Profile can stay at version 1
+    int verid = simple ? 1 : 2;
+    int resolution = info->vop_time_increment_resolution ? info->vop_time_increment_resolution : 1;
+
+    write_start_code(b, MPEG4_VOL_START_CODE);
+    bs_write_u1(b, 0);                  // random_accessible_vol
+    bs_write_u8(b, simple ? 0x01 : 0x11); // video_object_type_indication, Simple or Advanced Simple
+    bs_write_u1(b, !simple);            // is_object_layer_identifier
+    if (!simple)
+    {
+        bs_write_u(b, 4, verid);        // video_object_layer_verid
+        bs_write_u(b, 3, 1);            // video_object_layer_priority
+    }
+    bs_write_u(b, 4, 1);                // aspect_ratio_info, square samples
+    bs_write_u1(b, 1);                  // vol_control_parameters
+    bs_write_u(b, 2, 1);                // chroma_format, 4:2:0
+    bs_write_u1(b, simple);             // low_delay, no B-VOPs in Simple Profile
+    bs_write_u1(b, 0);                  // vbv_parameters
+    bs_write_u(b, 2, 0);                // video_object_layer_shape, rectangular
+    bs_write_u1(b, 1);                  // marker_bit
+    bs_write_u(b, 16, resolution);      // vop_time_increment_resolution, sizes vop_time_increment in the VOPs
+    bs_write_u1(b, 1);                  // marker_bit
+    bs_write_u1(b, 0);                  // fixed_vop_rate
+    bs_write_u1(b, 1);                  // marker_bit
+    bs_write_u(b, 13, width);           // video_object_layer_width
+    bs_write_u1(b, 1);                  // marker_bit
+    bs_write_u(b, 13, height);          // video_object_layer_height
+    bs_write_u1(b, 1);                  // marker_bit
+    bs_write_u1(b, info->interlaced);
+    bs_write_u1(b, 1);                  // obmc_disable
+    bs_write_u(b, verid == 1 ? 1 : 2, 0); // sprite_enable, no GMC
+    bs_write_u1(b, 0);                  // not_8_bit
+
+    bs_write_u1(b, info->quant_type);
+    if (info->quant_type)
+    {
+        bs_write_u1(b, matrix_present(info->intra_quantizer_matrix));
+        if (matrix_present(info->intra_quantizer_matrix))
+            write_matrix(b, info->intra_quantizer_matrix);
+
+        bs_write_u1(b, matrix_present(info->non_intra_quantizer_matrix));
+        if (matrix_present(info->non_intra_quantizer_matrix))
+            write_matrix(b, info->non_intra_quantizer_matrix);
+    }
+
+    if (verid != 1)
+        bs_write_u1(b, info->quarter_sample);
+    bs_write_u1(b, 1);                  // complexity_estimation_disable
+    bs_write_u1(b, info->resync_marker_disable);
+    bs_write_u1(b, 0);                  // data_partitioned
+    if (verid != 1)
+    {
+        bs_write_u1(b, 0);              // newpred_enable
+        bs_write_u1(b, 0);              // reduced_resolution_vop_enable
+    }
+    bs_write_u1(b, 0);                  // scalability
+    write_next_start_code(b);
+}
+
+int mpeg4_write_vol_header(int width, int height, VdpDecoderProfile profile, VdpPictureInfoMPEG4Part2 *info, uint8_t *buf, int size)
+{
+    int simple = is_simple(profile);
+    bs_t b;
+
+    bs_init(&b, buf, size);
+
+    write_visual_object(&b, simple);
+    write_video_object_layer(&b, width, height, simple, info);
+
+    if (bs_overrun(&b))
+        return -1;
+
+    return bs_pos(&b);
+}
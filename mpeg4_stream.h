@@ -0,0 +1,56 @@
+/*
+ * Copyright (c) 2013 Jens Kuske <jenskuske@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+
+#ifndef _MPEG4_STREAM_H
+#define _MPEG4_STREAM_H         1
+
+#include <stdint.h>
+
+#include <vdpau/vdpau.h>
+
+#include "bs.h"
+
+// everything the VOS/VO/VOL headers are built from, zero padded so it can be hashed
+typedef struct
+{
+    uint32_t profile;
+    uint16_t width;
+    uint16_t height;
+    uint16_t vop_time_increment_resolution;
+    uint8_t interlaced;
+    uint8_t quant_type;
+    uint8_t quarter_sample;
+    uint8_t resync_marker_disable;
+    uint8_t reserved[2];
+    uint8_t intra_quantizer_matrix[64];
+    uint8_t non_intra_quantizer_matrix[64];
+} mpeg4_header_key_t;
+
+void mpeg4_header_key(mpeg4_header_key_t *key, int width, int height, VdpDecoderProfile profile, VdpPictureInfoMPEG4Part2 *info);
+
+// visual object sequence, visual object and video object layer headers
+int mpeg4_write_vol_header(int width, int height, VdpDecoderProfile profile, VdpPictureInfoMPEG4Part2 *info, uint8_t *buf, int size);
+
+#define MPEG4_VO_START_CODE        0x00
+#define MPEG4_VOL_START_CODE       0x20
+#define MPEG4_VOS_START_CODE       0xb0
+#define MPEG4_VISUAL_OBJ_START_CODE 0xb5
+
+#endif
@@ -39,7 +39,7 @@ VdpStatus vdp_presentation_queue_target_create_x11(VdpDevice device,
     if (!target || !drawable)
         return VDP_STATUS_INVALID_POINTER;
 
-    device_ctx_t *dev = handle_get(device);
+    device_ctx_t *dev = handle_get(device, HANDLE_TYPE_DEVICE);
     if (!dev)
         return VDP_STATUS_INVALID_HANDLE;
 
@@ -87,7 +87,7 @@ VdpStatus vdp_presentation_queue_target_create_x11(VdpDevice device,
 
     XSetWindowBackground(dev->display, qt->drawable, 0x000102);
 
-    int handle = handle_create(qt);
+    int handle = handle_create(qt, HANDLE_TYPE_PRESENTATION_QUEUE_TARGET);
     if (handle == -1)
         goto out_handle_create;
 
@@ -101,7 +101,7 @@ out_handle_create:
 
 VdpStatus vdp_presentation_queue_target_destroy(VdpPresentationQueueTarget presentation_queue_target)
 {
-    queue_target_ctx_t *qt = handle_get(presentation_queue_target);
+    queue_target_ctx_t *qt = handle_get(presentation_queue_target, HANDLE_TYPE_PRESENTATION_QUEUE_TARGET);
     if (!qt)
         return VDP_STATUS_INVALID_HANDLE;
 
@@ -126,11 +126,11 @@ VdpStatus vdp_presentation_queue_create(VdpDevice device,
     if (!presentation_queue)
         return VDP_STATUS_INVALID_POINTER;
 
-    device_ctx_t *dev = handle_get(device);
+    device_ctx_t *dev = handle_get(device, HANDLE_TYPE_DEVICE);
     if (!dev)
         return VDP_STATUS_INVALID_HANDLE;
 
-    queue_target_ctx_t *qt = handle_get(presentation_queue_target);
+    queue_target_ctx_t *qt = handle_get(presentation_queue_target, HANDLE_TYPE_PRESENTATION_QUEUE_TARGET);
     if (!qt)
         return VDP_STATUS_INVALID_HANDLE;
 
@@ -141,7 +141,7 @@ VdpStatus vdp_presentation_queue_create(VdpDevice device,
     q->target = qt;
     q->device = dev;
 
-    int handle = handle_create(q);
+    int handle = handle_create(q, HANDLE_TYPE_PRESENTATION_QUEUE);
     if (handle == -1)
     {
         free(q);
@@ -154,7 +154,7 @@ VdpStatus vdp_presentation_queue_create(VdpDevice device,
 
 VdpStatus vdp_presentation_queue_destroy(VdpPresentationQueue presentation_queue)
 {
-    queue_ctx_t *q = handle_get(presentation_queue);
+    queue_ctx_t *q = handle_get(presentation_queue, HANDLE_TYPE_PRESENTATION_QUEUE);
     if (!q)
         return VDP_STATUS_INVALID_HANDLE;
 
@@ -170,7 +170,7 @@ VdpStatus vdp_presentation_queue_set_background_color(VdpPresentationQueue prese
     if (!background_color)
         return VDP_STATUS_INVALID_POINTER;
 
-    queue_ctx_t *q = handle_get(presentation_queue);
+    queue_ctx_t *q = handle_get(presentation_queue, HANDLE_TYPE_PRESENTATION_QUEUE);
     if (!q)
         return VDP_STATUS_INVALID_HANDLE;
 
@@ -188,7 +188,7 @@ VdpStatus vdp_presentation_queue_get_background_color(VdpPresentationQueue prese
     if (!background_color)
         return VDP_STATUS_INVALID_POINTER;
 
-    queue_ctx_t *q = handle_get(presentation_queue);
+    queue_ctx_t *q = handle_get(presentation_queue, HANDLE_TYPE_PRESENTATION_QUEUE);
     if (!q)
         return VDP_STATUS_INVALID_HANDLE;
 
@@ -203,7 +203,7 @@ VdpStatus vdp_presentation_queue_get_background_color(VdpPresentationQueue prese
 VdpStatus vdp_presentation_queue_get_time(VdpPresentationQueue presentation_queue,
                                           VdpTime *current_time)
 {
-    queue_ctx_t *q = handle_get(presentation_queue);
+    queue_ctx_t *q = handle_get(presentation_queue, HANDLE_TYPE_PRESENTATION_QUEUE);
     if (!q)
         return VDP_STATUS_INVALID_HANDLE;
 
@@ -217,11 +217,11 @@ VdpStatus vdp_presentation_queue_display(VdpPresentationQueue presentation_queue
                                          uint32_t clip_height,
                                          VdpTime earliest_presentation_time)
 {
-    queue_ctx_t *q = handle_get(presentation_queue);
+    queue_ctx_t *q = handle_get(presentation_queue, HANDLE_TYPE_PRESENTATION_QUEUE);
     if (!q)
         return VDP_STATUS_INVALID_HANDLE;
 
-    output_surface_ctx_t *os = handle_get(surface);
+    output_surface_ctx_t *os = handle_get(surface, HANDLE_TYPE_OUTPUT_SURFACE);
     if (!os)
         return VDP_STATUS_INVALID_HANDLE;
 
@@ -385,11 +385,11 @@ VdpStatus vdp_presentation_queue_block_until_surface_idle(VdpPresentationQueue p
                                                           VdpOutputSurface surface,
                                                           VdpTime *first_presentation_time)
 {
-    queue_ctx_t *q = handle_get(presentation_queue);
+    queue_ctx_t *q = handle_get(presentation_queue, HANDLE_TYPE_PRESENTATION_QUEUE);
     if (!q)
         return VDP_STATUS_INVALID_HANDLE;
 
-    output_surface_ctx_t *out = handle_get(surface);
+    output_surface_ctx_t *out = handle_get(surface, HANDLE_TYPE_OUTPUT_SURFACE);
     if (!out)
         return VDP_STATUS_INVALID_HANDLE;
 
@@ -403,11 +403,11 @@ VdpStatus vdp_presentation_queue_query_surface_status(VdpPresentationQueue prese
                                                       VdpPresentationQueueStatus *status,
                                                       VdpTime *first_presentation_time)
 {
-    queue_ctx_t *q = handle_get(presentation_queue);
+    queue_ctx_t *q = handle_get(presentation_queue, HANDLE_TYPE_PRESENTATION_QUEUE);
     if (!q)
         return VDP_STATUS_INVALID_HANDLE;
 
-    output_surface_ctx_t *out = handle_get(surface);
+    output_surface_ctx_t *out = handle_get(surface, HANDLE_TYPE_OUTPUT_SURFACE);
     if (!out)
         return VDP_STATUS_INVALID_HANDLE;
 
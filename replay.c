@@ -0,0 +1,359 @@
+/*
+ * Copyright (c) 2013 Jens Kuske <jenskuske@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+/*
+ * Replays a capture written with VDPAU_DEBUG=raw through vdp_decoder_render
+ * and the MFC backend of v4l2decode.c, which talks to the software MFC of
+ * v4l2_mock.c through its wrapped system calls, and reports throughput,
+ * submit latency and stalls.
+ *
+ *   vdpau-replay [-r fps] [-d decode_us] [-c capture_buffers] [-l loops] <name>
+ */
+
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "vdpau_private.h"
+#include "capture.h"
+#include "v4l2_mock.h"
+
+#define NUM_SURFACES 8
+
+typedef struct
+{
+    capture_index_t index;
+    const uint32_t *sizes;
+    const void *info;
+} frame_t;
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static int compare_u64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+static void *map_file(const char *path, size_t *size)
+{
+    struct stat st;
+    void *data;
+    int fd = open(path, O_RDONLY);
+
+    if (fd < 0)
+        return NULL;
+
+    if (fstat(fd, &st) || st.st_size == 0)
+    {
+        close(fd);
+        return NULL;
+    }
+
+    data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED)
+        return NULL;
+
+    *size = st.st_size;
+    return data;
+}
+
+static frame_t *load_index(const uint8_t *idx, size_t size, size_t raw_size, int *count)
+{
+    size_t pos = sizeof(capture_file_header_t);
+    int n = 0, max = 0;
+    frame_t *frames = NULL;
+
+    while (pos + sizeof(capture_index_t) <= size)
+    {
+        frame_t f;
+
+        memcpy(&f.index, idx + pos, sizeof(f.index));
+        pos += sizeof(f.index);
+        f.sizes = (const uint32_t *)(idx + pos);
+        pos += f.index.buffer_count * sizeof(uint32_t);
+        f.info = f.index.info_size ? idx + pos : NULL;
+        pos += f.index.info_size;
+
+        if (pos > size || f.index.offset + f.index.size > raw_size)
+        {
+            fprintf(stderr, "truncated capture, using the first %d frames\n", n);
+            break;
+        }
+
+        if (n == max)
+        {
+            frame_t *grown = realloc(frames, (max ? max * 2 : 1024) * sizeof(frame_t));
+            if (!grown)
+            {
+                fprintf(stderr, "out of memory, using the first %d frames\n", n);
+                break;
+            }
+            frames = grown;
+            max = max ? max * 2 : 1024;
+        }
+        frames[n++] = f;
+    }
+
+    *count = n;
+    return frames;
+}
+
+// decoder.c drops the GL imports of a decoder on destroy, there is no GL here
+void video_surface_dmabuf_purge(device_ctx_t *dev, void *decoder)
+{
+}
+
+const decoder_backend_t *const decoder_backends[] =
+{
+    &decoder_backend_mfc,
+    NULL
+};
+
+// hands every decoded picture straight back, returns how many there were
+static int release_pictures(decoder_ctx_t *dec, uint64_t *displayed)
+{
+    int frame, count = 0;
+    void **planes;
+    VdpVideoSurface surface;
+    uint32_t generation;
+
+    while (dec->backend->get_picture(dec->private, &frame, &planes, &surface, &generation) == VDP_STATUS_OK && frame >= 0)
+    {
+        dec->backend->release_picture(dec->private, frame);
+        (*displayed)++;
+        count++;
+    }
+
+    return count;
+}
+
+static void usage(const char *name)
+{
+    fprintf(stderr, "usage: %s [-r fps] [-d decode_us] [-c capture_buffers] [-l loops] <capture name>\n"
+                    "  replays <capture name>.raw/.idx as written with VDPAU_DEBUG=raw\n"
+                    "  -r  submit at a fixed frame rate instead of as fast as possible\n"
+                    "  -d  simulated MFC decode time per frame (default 0)\n"
+                    "  -c  capture buffers the simulated MFC asks for (default %u)\n"
+                    "  -l  number of passes over the capture (default 1)\n",
+            name, v4l2_mock_config.min_buffers);
+}
+
+int main(int argc, char **argv)
+{
+    double fps = 0;
+    int loops = 1;
+    int opt, i, l, count;
+    char path[256];
+    size_t raw_size, idx_size;
+
+    while ((opt = getopt(argc, argv, "r:d:c:l:h")) != -1)
+    {
+        switch (opt)
+        {
+        case 'r': fps = atof(optarg); break;
+        case 'd': v4l2_mock_config.decode_us = atoi(optarg); break;
+        case 'c': v4l2_mock_config.min_buffers = atoi(optarg); break;
+        case 'l': loops = atoi(optarg); break;
+        default: usage(argv[0]); return 1;
+        }
+    }
+    if (optind != argc - 1 || loops < 1)
+    {
+        usage(argv[0]);
+        return 1;
+    }
+
+    snprintf(path, sizeof(path), "%s.raw", argv[optind]);
+    const uint8_t *raw = map_file(path, &raw_size);
+    snprintf(path, sizeof(path), "%s.idx", argv[optind]);
+    const uint8_t *idx = map_file(path, &idx_size);
+    if (!raw || !idx || idx_size < sizeof(capture_file_header_t))
+    {
+        fprintf(stderr, "cannot read capture %s\n", argv[optind]);
+        return 1;
+    }
+
+    capture_file_header_t header;
+    memcpy(&header, idx, sizeof(header));
+    if (memcmp(header.magic, CAPTURE_MAGIC, sizeof(CAPTURE_MAGIC)) || header.version != CAPTURE_VERSION)
+    {
+        fprintf(stderr, "%s is not a version %d capture index\n", path, CAPTURE_VERSION);
+        return 1;
+    }
+
+    frame_t *frames = load_index(idx, idx_size, raw_size, &count);
+    if (!count)
+    {
+        fprintf(stderr, "capture is empty\n");
+        return 1;
+    }
+
+    v4l2_mock_config.width = header.width;
+    v4l2_mock_config.height = header.height;
+
+    // no X11 or EGL, a bare device context is enough for the decoder
+    device_ctx_t *dev = calloc(1, sizeof(device_ctx_t));
+    int device = dev ? handle_create(dev, HANDLE_TYPE_DEVICE) : -1;
+    if (device < 0)
+    {
+        fprintf(stderr, "cannot create the device\n");
+        return 1;
+    }
+
+    int surfaces[NUM_SURFACES];
+    for (i = 0; i < NUM_SURFACES; i++)
+    {
+        video_surface_ctx_t *vs = calloc(1, sizeof(video_surface_ctx_t));
+        surfaces[i] = -1;
+        if (vs)
+        {
+            vs->device = dev;
+            vs->width = header.width;
+            vs->height = header.height;
+            vs->chroma_type = VDP_CHROMA_TYPE_420;
+            surfaces[i] = handle_create(vs, HANDLE_TYPE_VIDEO_SURFACE);
+        }
+        if (surfaces[i] < 0)
+        {
+            fprintf(stderr, "cannot create video surface %d\n", i);
+            return 1;
+        }
+    }
+
+    VdpDecoder decoder;
+    if (vdp_decoder_create(device, header.profile, header.width, header.height, 16, &decoder) != VDP_STATUS_OK)
+    {
+        fprintf(stderr, "vdp_decoder_create failed for profile %u\n", header.profile);
+        return 1;
+    }
+    decoder_ctx_t *dec = handle_get(decoder, HANDLE_TYPE_DECODER);
+    if (!dec)
+    {
+        fprintf(stderr, "decoder handle %u is invalid\n", decoder);
+        return 1;
+    }
+
+    uint64_t *latency = malloc((size_t)count * loops * sizeof(uint64_t));
+    if (!latency)
+    {
+        fprintf(stderr, "out of memory\n");
+        return 1;
+    }
+    uint64_t submitted = 0, displayed = 0, errors = 0;
+    uint64_t period = fps > 0 ? (uint64_t)(1000000000.0 / fps) : 0;
+    uint64_t start = now_ns();
+    VdpBitstreamBuffer buffers[64];
+
+    for (l = 0; l < loops; l++)
+    {
+        for (i = 0; i < count; i++)
+        {
+            frame_t *f = &frames[i];
+            uint32_t j, n, offset = 0;
+
+            // parameter sets and picture headers are synthesized again by vdp_decoder_render
+            if (f->index.flags & CAPTURE_FLAG_HEADER)
+                continue;
+            if (f->index.buffer_count > 64)
+                continue;
+
+            for (j = 0, n = 0; j < f->index.buffer_count; j++)
+            {
+                offset += f->sizes[j];
+                if (j == 0 && (f->index.flags & CAPTURE_FLAG_PREFIX))
+                    continue;
+                buffers[n].struct_version = VDP_BITSTREAM_BUFFER_VERSION;
+                buffers[n].bitstream = raw + f->index.offset + offset - f->sizes[j];
+                buffers[n].bitstream_bytes = f->sizes[j];
+                n++;
+            }
+
+            if (period)
+            {
+                uint64_t due = start + submitted * period;
+                struct timespec ts = { due / 1000000000ull, due % 1000000000ull };
+                clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+            }
+
+            uint64_t t0 = now_ns();
+            if (vdp_decoder_render(decoder, surfaces[submitted % NUM_SURFACES], f->info,
+                                   n, buffers) != VDP_STATUS_OK)
+                errors++;
+            latency[submitted++] = now_ns() - t0;
+
+            release_pictures(dec, &displayed);
+        }
+    }
+
+    uint64_t submit_end = now_ns();
+
+    /*
+     * Let the MFC finish what is queued. Renders don't map to pictures one to
+     * one, the header buffer yields none, so wait until none came for a while.
+     */
+    uint64_t idle = 200000000ull + 4000ull * v4l2_mock_config.decode_us;
+    uint64_t last = submit_end;
+    while (now_ns() - last < idle && now_ns() - submit_end < 5000000000ull)
+    {
+        usleep(100);
+        if (release_pictures(dec, &displayed))
+            last = now_ns();
+    }
+
+    uint64_t end = last;
+
+    vdp_decoder_destroy(decoder);
+
+    v4l2_mock_stats_t stats;
+    v4l2_mock_stats(&stats);
+
+    if (!submitted)
+    {
+        fprintf(stderr, "no frames to replay\n");
+        return 1;
+    }
+
+    qsort(latency, submitted, sizeof(uint64_t), compare_u64);
+
+    printf("frames        %llu submitted, %llu decoded, %llu displayed, %llu errors\n",
+           (unsigned long long)submitted, (unsigned long long)stats.pictures,
+           (unsigned long long)displayed, (unsigned long long)errors);
+    printf("bitstream     %.1f MB, %llu buffers without a picture\n",
+           stats.bytes / 1e6, (unsigned long long)stats.headers);
+    printf("throughput    %.1f renders/s submit, %.1f pictures/s end to end\n",
+           submitted * 1e9 / (submit_end - start), displayed * 1e9 / (end - start));
+    printf("submit (us)   p50 %.1f  p90 %.1f  p99 %.1f  max %.1f\n",
+           latency[submitted / 2] / 1e3, latency[submitted * 9 / 10] / 1e3,
+           latency[submitted * 99 / 100] / 1e3, latency[submitted - 1] / 1e3);
+    printf("stalls        %llu on bitstream buffers (%.1f ms), %llu on capture buffers\n",
+           (unsigned long long)stats.output_waits, stats.output_wait_ns / 1e6,
+           (unsigned long long)stats.capture_stalls);
+
+    return 0;
+}
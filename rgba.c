@@ -68,6 +68,8 @@ VdpStatus rgba_create(rgba_surface_t *rgba,
     if (!rgba->data)
         return VDP_STATUS_RESOURCES;
 
+    memstat_alloc(MEMSTAT_RGBA_BUFFER, 1, width * height * 4, 0, 0);
+
     rgba->dirty.x0 = width;
     rgba->dirty.y0 = height;
     rgba->dirty.x1 = 0;
@@ -79,6 +81,7 @@ VdpStatus rgba_create(rgba_surface_t *rgba,
 
 void rgba_destroy(rgba_surface_t *rgba)
 {
+    memstat_free(MEMSTAT_RGBA_BUFFER, 1, rgba->width * rgba->height * 4, 0, 0);
     free(rgba->data);
 }
 
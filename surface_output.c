@@ -31,7 +31,7 @@ VdpStatus vdp_output_surface_create(VdpDevice device,
     if (!surface)
         return VDP_STATUS_INVALID_POINTER;
 
-    device_ctx_t *dev = handle_get(device);
+    device_ctx_t *dev = handle_get(device, HANDLE_TYPE_DEVICE);
     if (!dev)
         return VDP_STATUS_INVALID_HANDLE;
 
@@ -49,7 +49,7 @@ VdpStatus vdp_output_surface_create(VdpDevice device,
         return ret;
     }
 
-    int handle = handle_create(out);
+    int handle = handle_create(out, HANDLE_TYPE_OUTPUT_SURFACE);
     if (handle == -1)
     {
         rgba_destroy(&out->rgba);
@@ -57,6 +57,8 @@ VdpStatus vdp_output_surface_create(VdpDevice device,
         return VDP_STATUS_RESOURCES;
     }
 
+    memstat_alloc(MEMSTAT_OUTPUT_SURFACE, 1, sizeof(output_surface_ctx_t), 0, 0);
+
     *surface = handle;
 
     return VDP_STATUS_OK;
@@ -64,11 +66,12 @@ VdpStatus vdp_output_surface_create(VdpDevice device,
 
 VdpStatus vdp_output_surface_destroy(VdpOutputSurface surface)
 {
-    output_surface_ctx_t *out = handle_get(surface);
+    output_surface_ctx_t *out = handle_get(surface, HANDLE_TYPE_OUTPUT_SURFACE);
     if (!out)
         return VDP_STATUS_INVALID_HANDLE;
 
     rgba_destroy(&out->rgba);
+    memstat_free(MEMSTAT_OUTPUT_SURFACE, 1, sizeof(output_surface_ctx_t), 0, 0);
 
     handle_destroy(surface);
     free(out);
@@ -81,7 +84,7 @@ VdpStatus vdp_output_surface_get_parameters(VdpOutputSurface surface,
                                             uint32_t *width,
                                             uint32_t *height)
 {
-    output_surface_ctx_t *out = handle_get(surface);
+    output_surface_ctx_t *out = handle_get(surface, HANDLE_TYPE_OUTPUT_SURFACE);
     if (!out)
         return VDP_STATUS_INVALID_HANDLE;
 
@@ -102,7 +105,7 @@ VdpStatus vdp_output_surface_get_bits_native(VdpOutputSurface surface,
                                              void *const *destination_data,
                                              uint32_t const *destination_pitches)
 {
-    output_surface_ctx_t *out = handle_get(surface);
+    output_surface_ctx_t *out = handle_get(surface, HANDLE_TYPE_OUTPUT_SURFACE);
     if (!out)
         return VDP_STATUS_INVALID_HANDLE;
 
@@ -114,7 +117,7 @@ VdpStatus vdp_output_surface_put_bits_native(VdpOutputSurface surface,
                                              uint32_t const *source_pitches,
                                              VdpRect const *destination_rect)
 {
-    output_surface_ctx_t *out = handle_get(surface);
+    output_surface_ctx_t *out = handle_get(surface, HANDLE_TYPE_OUTPUT_SURFACE);
     if (!out)
         return VDP_STATUS_INVALID_HANDLE;
 
@@ -129,7 +132,7 @@ VdpStatus vdp_output_surface_put_bits_indexed(VdpOutputSurface surface,
                                               VdpColorTableFormat color_table_format,
                                               void const *color_table)
 {
-    output_surface_ctx_t *out = handle_get(surface);
+    output_surface_ctx_t *out = handle_get(surface, HANDLE_TYPE_OUTPUT_SURFACE);
     if (!out)
         return VDP_STATUS_INVALID_HANDLE;
 
@@ -144,7 +147,7 @@ VdpStatus vdp_output_surface_put_bits_y_cb_cr(VdpOutputSurface surface,
                                               VdpRect const *destination_rect,
                                               VdpCSCMatrix const *csc_matrix)
 {
-    output_surface_ctx_t *out = handle_get(surface);
+    output_surface_ctx_t *out = handle_get(surface, HANDLE_TYPE_OUTPUT_SURFACE);
     if (!out)
         return VDP_STATUS_INVALID_HANDLE;
 
@@ -159,11 +162,11 @@ VdpStatus vdp_output_surface_render_output_surface(VdpOutputSurface destination_
                                                    VdpOutputSurfaceRenderBlendState const *blend_state,
                                                    uint32_t flags)
 {
-    output_surface_ctx_t *out = handle_get(destination_surface);
+    output_surface_ctx_t *out = handle_get(destination_surface, HANDLE_TYPE_OUTPUT_SURFACE);
     if (!out)
         return VDP_STATUS_INVALID_HANDLE;
 
-    output_surface_ctx_t *in = handle_get(source_surface);
+    output_surface_ctx_t *in = handle_get(source_surface, HANDLE_TYPE_OUTPUT_SURFACE);
 
     return rgba_render_surface(&out->rgba, destination_rect, in ? &in->rgba : NULL, source_rect,
                     colors, blend_state, flags);
@@ -177,11 +180,11 @@ VdpStatus vdp_output_surface_render_bitmap_surface(VdpOutputSurface destination_
                                                    VdpOutputSurfaceRenderBlendState const *blend_state,
                                                    uint32_t flags)
 {
-    output_surface_ctx_t *out = handle_get(destination_surface);
+    output_surface_ctx_t *out = handle_get(destination_surface, HANDLE_TYPE_OUTPUT_SURFACE);
     if (!out)
         return VDP_STATUS_INVALID_HANDLE;
 
-    bitmap_surface_ctx_t *in = handle_get(source_surface);
+    bitmap_surface_ctx_t *in = handle_get(source_surface, HANDLE_TYPE_BITMAP_SURFACE);
 
     return rgba_render_surface(&out->rgba, destination_rect, in ? &in->rgba : NULL, source_rect,
                     colors, blend_state, flags);
@@ -196,7 +199,7 @@ VdpStatus vdp_output_surface_query_capabilities(VdpDevice device,
     if (!is_supported || !max_width || !max_height)
         return VDP_STATUS_INVALID_POINTER;
 
-    device_ctx_t *dev = handle_get(device);
+    device_ctx_t *dev = handle_get(device, HANDLE_TYPE_DEVICE);
     if (!dev)
         return VDP_STATUS_INVALID_HANDLE;
 
@@ -214,7 +217,7 @@ VdpStatus vdp_output_surface_query_get_put_bits_native_capabilities(VdpDevice de
     if (!is_supported)
         return VDP_STATUS_INVALID_POINTER;
 
-    device_ctx_t *dev = handle_get(device);
+    device_ctx_t *dev = handle_get(device, HANDLE_TYPE_DEVICE);
     if (!dev)
         return VDP_STATUS_INVALID_HANDLE;
 
@@ -232,7 +235,7 @@ VdpStatus vdp_output_surface_query_put_bits_indexed_capabilities(VdpDevice devic
     if (!is_supported)
         return VDP_STATUS_INVALID_POINTER;
 
-    device_ctx_t *dev = handle_get(device);
+    device_ctx_t *dev = handle_get(device, HANDLE_TYPE_DEVICE);
     if (!dev)
         return VDP_STATUS_INVALID_HANDLE;
 
@@ -249,7 +252,7 @@ VdpStatus vdp_output_surface_query_put_bits_y_cb_cr_capabilities(VdpDevice devic
     if (!is_supported)
         return VDP_STATUS_INVALID_POINTER;
 
-    device_ctx_t *dev = handle_get(device);
+    device_ctx_t *dev = handle_get(device, HANDLE_TYPE_DEVICE);
     if (!dev)
         return VDP_STATUS_INVALID_HANDLE;
 
@@ -17,47 +17,83 @@
  *
  */
 
+#include <string.h>
+
 #include "vdpau_private.h"
 
-VdpStatus vdp_video_surface_create(VdpDevice device,
-                                   VdpChromaType chroma_type,
-                                   uint32_t width,
-                                   uint32_t height,
-                                   VdpVideoSurface *surface)
+// Y plus quarter size U and V textures, and the RGBA render target
+#define GL_BYTES(vs) ((vs)->width * (vs)->height * 3 / 2 + (vs)->width * (vs)->height * 4)
+
+void video_surface_pool_init(device_ctx_t *dev)
 {
-    if (!surface)
-        return VDP_STATUS_INVALID_POINTER;
+    surface_pool_t *pool = &dev->surface_pool;
 
-    if (!width || !height)
-        return VDP_STATUS_INVALID_SIZE;
+    pool->max = SURFACE_POOL_DEFAULT_SIZE;
+    char *size = getenv("VDPAU_SURFACE_POOL");
+    if (size)
+        pool->max = max(atoi(size), 0);
 
-    device_ctx_t *dev = handle_get(device);
-    if (!dev)
-        return VDP_STATUS_INVALID_HANDLE;
+    pool->surfaces = calloc(max(pool->max, 1), sizeof(video_surface_ctx_t *));
+    if (!pool->surfaces)
+        pool->max = 0;
+
+    pthread_mutex_init(&pool->mutex, NULL);
+}
 
+static void video_surface_free(video_surface_ctx_t *vs)
+{
+    device_ctx_t *dev = vs->device;
+
+    const GLuint framebuffers[] = {
+        vs->framebuffer
+    };
+
+    const GLuint textures[] = {
+        vs->y_tex,
+        vs->u_tex,
+        vs->v_tex,
+        vs->rgb_tex
+    };
+
+    if (!eglMakeCurrent(dev->egl.display, dev->egl.surface,
+                        dev->egl.surface, dev->egl.context)) {
+        VDPAU_DBG ("Could not set EGL context to current %x", eglGetError());
+    }
+
+    glDeleteFramebuffers (1, framebuffers);
+    glDeleteTextures (4, textures);
+
+    if (!eglMakeCurrent(dev->egl.display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT)) {
+        VDPAU_DBG ("Could not set EGL context to none %x", eglGetError());
+    }
+
+    memstat_free(MEMSTAT_VIDEO_SURFACE, 1, sizeof(video_surface_ctx_t), GL_BYTES(vs), 0);
+    free(vs);
+}
+
+static video_surface_ctx_t *video_surface_alloc(device_ctx_t *dev,
+                                                VdpChromaType chroma_type,
+                                                uint32_t width,
+                                                uint32_t height)
+{
     video_surface_ctx_t *vs = calloc(1, sizeof(video_surface_ctx_t));
     if (!vs)
-        return VDP_STATUS_RESOURCES;
+        return NULL;
 
     vs->device = dev;
     vs->width = width;
     vs->height = height;
     vs->chroma_type = chroma_type;
 
-    switch (chroma_type)
-    {
-    case VDP_CHROMA_TYPE_420:
-        break;
-    default:
-        free(vs);
-        return VDP_STATUS_INVALID_CHROMA_TYPE;
-    }
+    memstat_alloc(MEMSTAT_VIDEO_SURFACE, 1, sizeof(video_surface_ctx_t), GL_BYTES(vs), 0);
 
     VDPAU_DBG ("egl make context current");
     if (!eglMakeCurrent(dev->egl.display, dev->egl.surface,
                         dev->egl.surface, dev->egl.context)) {
         VDPAU_DBG ("Could not set EGL context to current %x", eglGetError());
-        return VDP_STATUS_RESOURCES;
+        memstat_free(MEMSTAT_VIDEO_SURFACE, 1, sizeof(video_surface_ctx_t), GL_BYTES(vs), 0);
+        free(vs);
+        return NULL;
     }
 
     vs->y_tex = gl_create_texture(GL_NEAREST);
@@ -81,13 +117,316 @@ VdpStatus vdp_video_surface_create(VdpDevice device,
 
     if (!eglMakeCurrent(dev->egl.display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT)) {
         VDPAU_DBG ("Could not set EGL context to none %x", eglGetError());
-        return VDP_STATUS_RESOURCES;
+        video_surface_free(vs);
+        return NULL;
+    }
+
+    return vs;
+}
+
+static video_surface_ctx_t *pool_take(device_ctx_t *dev,
+                                      VdpChromaType chroma_type,
+                                      uint32_t width,
+                                      uint32_t height)
+{
+    surface_pool_t *pool = &dev->surface_pool;
+    video_surface_ctx_t *vs = NULL;
+    int i;
+
+    pthread_mutex_lock(&pool->mutex);
+
+    // search newest first, the most recently parked surfaces are the likeliest match
+    for (i = pool->count - 1; i >= 0; i--)
+    {
+        video_surface_ctx_t *p = pool->surfaces[i];
+        if (p->width == width && p->height == height && p->chroma_type == chroma_type)
+        {
+            vs = p;
+            pool->count--;
+            memmove(&pool->surfaces[i], &pool->surfaces[i + 1],
+                    (pool->count - i) * sizeof(video_surface_ctx_t *));
+            break;
+        }
+    }
+
+    if (vs)
+        pool->hits++;
+    else
+        pool->misses++;
+
+    pthread_mutex_unlock(&pool->mutex);
+
+    return vs;
+}
+
+static void pool_put(video_surface_ctx_t *vs)
+{
+    surface_pool_t *pool = &vs->device->surface_pool;
+    video_surface_ctx_t *evicted = NULL;
+
+    pthread_mutex_lock(&pool->mutex);
+
+    if (pool->max == 0)
+    {
+        evicted = vs;
+    }
+    else
+    {
+        // drop the oldest parked surface once the pool is full
+        if (pool->count == pool->max)
+        {
+            evicted = pool->surfaces[0];
+            pool->count--;
+            memmove(&pool->surfaces[0], &pool->surfaces[1],
+                    pool->count * sizeof(video_surface_ctx_t *));
+            pool->evictions++;
+        }
+
+        vs->source_format = 0;
+        vs->backend = NULL;
+        vs->private = NULL;
+        pool->surfaces[pool->count++] = vs;
+    }
+
+    pthread_mutex_unlock(&pool->mutex);
+
+    if (evicted)
+        video_surface_free(evicted);
+}
+
+void video_surface_pool_flush(device_ctx_t *dev)
+{
+    surface_pool_t *pool = &dev->surface_pool;
+    int i;
+
+    VDPAU_DBG("video surface pool: %u hits, %u misses, %u evictions",
+              pool->hits, pool->misses, pool->evictions);
+
+    for (i = 0; i < pool->count; i++)
+        video_surface_free(pool->surfaces[i]);
+
+    pool->count = 0;
+    free(pool->surfaces);
+    pool->surfaces = NULL;
+    pthread_mutex_destroy(&pool->mutex);
+}
+
+#define DRM_FOURCC(a, b, c, d) ((uint32_t)(a) | ((uint32_t)(b) << 8) | ((uint32_t)(c) << 16) | ((uint32_t)(d) << 24))
+#define DRM_FORMAT_R8   DRM_FOURCC('R', '8', ' ', ' ')
+#define DRM_FORMAT_GR88 DRM_FOURCC('G', 'R', '8', '8')
+
+/*
+ * Decoded pictures are imported as EGLImages straight from the V4L2
+ * dma-bufs, a single channel image per plane, so the YUV shaders sample the
+ * decoder memory instead of a copy uploaded with glTexImage2D. Imports are
+ * cached per decoder buffer and dropped when the decoder reallocates them.
+ * Needs the context current.
+ */
+void video_surface_dmabuf_init(device_ctx_t *dev)
+{
+    device_egl_t *egl = &dev->egl;
+
+    pthread_mutex_init(&egl->dmabuf.mutex, NULL);
+
+    char *env = getenv("VDPAU_DMABUF");
+    if (env && strcmp(env, "0") == 0)
+        return;
+
+    const char *egl_ext = eglQueryString(egl->display, EGL_EXTENSIONS);
+    const char *gl_ext = (const char *)glGetString(GL_EXTENSIONS);
+    if (!egl_ext || !strstr(egl_ext, "EGL_EXT_image_dma_buf_import") ||
+        !gl_ext || !strstr(gl_ext, "GL_OES_EGL_image_external")) {
+        VDPAU_DBG("No dma-buf import in EGL/GLES, decoded pictures are uploaded");
+        return;
+    }
+
+    egl->create_image = (PFNEGLCREATEIMAGEKHRPROC)eglGetProcAddress("eglCreateImageKHR");
+    egl->destroy_image = (PFNEGLDESTROYIMAGEKHRPROC)eglGetProcAddress("eglDestroyImageKHR");
+    egl->image_target_texture = (PFNGLEGLIMAGETARGETTEXTURE2DOESPROC)eglGetProcAddress("glEGLImageTargetTexture2DOES");
+    if (!egl->create_image || !egl->destroy_image || !egl->image_target_texture)
+        return;
+
+    if (gl_init_shader(&egl->yuvi420_external_rgb, SHADER_YUVI420_EXTERNAL_RGB) < 0 ||
+        gl_init_shader(&egl->yuvnv12_external_rgb, SHADER_YUVNV12_EXTERNAL_RGB) < 0) {
+        VDPAU_DBG("Could not initialize the external image shaders, decoded pictures are uploaded");
+        return;
+    }
+
+    VDPAU_DBG("Decoded pictures are imported as dma-bufs");
+    egl->dmabuf.enabled = 1;
+}
+
+// caller holds the cache mutex and the context
+static void dmabuf_drop(device_egl_t *egl, dmabuf_image_t *img)
+{
+    int i;
+
+    glDeleteTextures(img->planes, img->textures);
+    for (i = 0; i < img->planes; i++)
+        egl->destroy_image(egl->display, img->images[i]);
+
+    memset(img, 0, sizeof(*img));
+}
+
+static int dmabuf_import(device_egl_t *egl, dmabuf_image_t *img, const decoder_dmabuf_t *buf)
+{
+    int i;
+
+    for (i = 0; i < buf->planes; i++) {
+        // chroma is subsampled 2x2, NV12 has Cb and Cr interleaved in one plane
+        const EGLint attribs[] =
+        {
+            EGL_WIDTH, i ? buf->width / 2 : buf->width,
+            EGL_HEIGHT, i ? buf->height / 2 : buf->height,
+            EGL_LINUX_DRM_FOURCC_EXT, (i && buf->planes == 2) ? DRM_FORMAT_GR88 : DRM_FORMAT_R8,
+            EGL_DMA_BUF_PLANE0_FD_EXT, buf->fd[i],
+            EGL_DMA_BUF_PLANE0_OFFSET_EXT, buf->offset[i],
+            EGL_DMA_BUF_PLANE0_PITCH_EXT, buf->pitch[i],
+            EGL_NONE
+        };
+
+        EGLImageKHR image = egl->create_image(egl->display, EGL_NO_CONTEXT, EGL_LINUX_DMA_BUF_EXT, NULL, attribs);
+        if (image == EGL_NO_IMAGE_KHR) {
+            VDPAU_DBG("Could not import dma-buf %d plane %d %x", buf->fd[i], i, eglGetError());
+            dmabuf_drop(egl, img);
+            return -1;
+        }
+
+        img->images[i] = image;
+        glGenTextures(1, &img->textures[i]);
+        img->planes = i + 1;
+
+        glBindTexture(GL_TEXTURE_EXTERNAL_OES, img->textures[i]);
+        CHECKEGL
+        glTexParameteri(GL_TEXTURE_EXTERNAL_OES, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_EXTERNAL_OES, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_EXTERNAL_OES, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_EXTERNAL_OES, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        egl->image_target_texture(GL_TEXTURE_EXTERNAL_OES, image);
+        CHECKEGL
+    }
+
+    return 0;
+}
+
+// caller holds the cache mutex and the context
+static dmabuf_image_t *dmabuf_lookup(device_egl_t *egl, void *decoder, int frame, const decoder_dmabuf_t *buf)
+{
+    dmabuf_cache_t *cache = &egl->dmabuf;
+    dmabuf_image_t *img = NULL;
+    int i;
+
+    for (i = 0; i < DMABUF_CACHE_SIZE; i++) {
+        dmabuf_image_t *p = &cache->images[i];
+        if (p->decoder != decoder)
+            continue;
+
+        // the decoder reallocated its buffers, e.g. on a resolution change
+        if (p->generation != buf->generation)
+            dmabuf_drop(egl, p);
+        else if (p->frame == frame)
+            img = p;
     }
 
-    int handle = handle_create(vs);
+    if (img) {
+        cache->hits++;
+        return img;
+    }
+
+    // a free entry, or evict round robin
+    for (i = 0; i < DMABUF_CACHE_SIZE && cache->images[i].decoder; i++)
+        ;
+    if (i == DMABUF_CACHE_SIZE) {
+        i = cache->next;
+        cache->next = (cache->next + 1) % DMABUF_CACHE_SIZE;
+        dmabuf_drop(egl, &cache->images[i]);
+    }
+
+    img = &cache->images[i];
+    if (dmabuf_import(egl, img, buf))
+        return NULL;
+
+    img->decoder = decoder;
+    img->frame = frame;
+    img->generation = buf->generation;
+    cache->imports++;
+
+    return img;
+}
+
+// drops the imports of a decoder, or all of them if decoder is NULL
+void video_surface_dmabuf_purge(device_ctx_t *dev, void *decoder)
+{
+    device_egl_t *egl = &dev->egl;
+    int i;
+
+    if (!egl->destroy_image)
+        return;
+
+    pthread_mutex_lock(&egl->dmabuf.mutex);
+
+    if (!eglMakeCurrent(egl->display, egl->surface, egl->surface, egl->context)) {
+        VDPAU_DBG ("Could not set EGL context to current %x", eglGetError());
+    }
+
+    for (i = 0; i < DMABUF_CACHE_SIZE; i++) {
+        dmabuf_image_t *img = &egl->dmabuf.images[i];
+        if (img->decoder && (!decoder || img->decoder == decoder))
+            dmabuf_drop(egl, img);
+    }
+
+    if (!eglMakeCurrent(egl->display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT)) {
+        VDPAU_DBG ("Could not set EGL context to none %x", eglGetError());
+    }
+
+    pthread_mutex_unlock(&egl->dmabuf.mutex);
+}
+
+void video_surface_dmabuf_flush(device_ctx_t *dev)
+{
+    dmabuf_cache_t *cache = &dev->egl.dmabuf;
+
+    if (dev->egl.destroy_image)
+        VDPAU_DBG("dma-buf imports: %u imported, %u reused", cache->imports, cache->hits);
+
+    video_surface_dmabuf_purge(dev, NULL);
+    pthread_mutex_destroy(&cache->mutex);
+}
+
+VdpStatus vdp_video_surface_create(VdpDevice device,
+                                   VdpChromaType chroma_type,
+                                   uint32_t width,
+                                   uint32_t height,
+                                   VdpVideoSurface *surface)
+{
+    if (!surface)
+        return VDP_STATUS_INVALID_POINTER;
+
+    if (!width || !height)
+        return VDP_STATUS_INVALID_SIZE;
+
+    device_ctx_t *dev = handle_get(device, HANDLE_TYPE_DEVICE);
+    if (!dev)
+        return VDP_STATUS_INVALID_HANDLE;
+
+    switch (chroma_type)
+    {
+    case VDP_CHROMA_TYPE_420:
+        break;
+    default:
+        return VDP_STATUS_INVALID_CHROMA_TYPE;
+    }
+
+    video_surface_ctx_t *vs = pool_take(dev, chroma_type, width, height);
+    if (!vs)
+        vs = video_surface_alloc(dev, chroma_type, width, height);
+    if (!vs)
+        return VDP_STATUS_RESOURCES;
+
+    int handle = handle_create(vs, HANDLE_TYPE_VIDEO_SURFACE);
     if (handle == -1)
     {
-        free(vs);
+        pool_put(vs);
         return VDP_STATUS_RESOURCES;
     }
 
@@ -98,26 +437,12 @@ VdpStatus vdp_video_surface_create(VdpDevice device,
 
 VdpStatus vdp_video_surface_destroy(VdpVideoSurface surface)
 {
-    video_surface_ctx_t *vs = handle_get(surface);
+    video_surface_ctx_t *vs = handle_get(surface, HANDLE_TYPE_VIDEO_SURFACE);
     if (!vs)
         return VDP_STATUS_INVALID_HANDLE;
 
-    const GLuint framebuffers[] = {
-        vs->framebuffer
-    };
-
-    const GLuint textures[] = {
-        vs->y_tex,
-        vs->u_tex,
-        vs->v_tex,
-        vs->rgb_tex
-    };
-
-    glDeleteFramebuffers (1, framebuffers);
-    glDeleteTextures (4, textures);
-
     handle_destroy(surface);
-    free(vs);
+    pool_put(vs);
 
     return VDP_STATUS_OK;
 }
@@ -127,7 +452,7 @@ VdpStatus vdp_video_surface_get_parameters(VdpVideoSurface surface,
                                            uint32_t *width,
                                            uint32_t *height)
 {
-    video_surface_ctx_t *vid = handle_get(surface);
+    video_surface_ctx_t *vid = handle_get(surface, HANDLE_TYPE_VIDEO_SURFACE);
     if (!vid)
         return VDP_STATUS_INVALID_HANDLE;
 
@@ -148,7 +473,7 @@ VdpStatus vdp_video_surface_get_bits_y_cb_cr(VdpVideoSurface surface,
                                              void *const *destination_data,
                                              uint32_t const *destination_pitches)
 {
-    video_surface_ctx_t *vs = handle_get(surface);
+    video_surface_ctx_t *vs = handle_get(surface, HANDLE_TYPE_VIDEO_SURFACE);
     if (!vs)
         return VDP_STATUS_INVALID_HANDLE;
 
@@ -251,7 +576,7 @@ VdpStatus vdp_video_surface_put_bits_y_cb_cr(VdpVideoSurface surface,
                                              uint32_t const *source_pitches)
 {
     shader_ctx_t *shader;
-    video_surface_ctx_t *vs = handle_get(surface);
+    video_surface_ctx_t *vs = handle_get(surface, HANDLE_TYPE_VIDEO_SURFACE);
     if (!vs)
         return VDP_STATUS_INVALID_HANDLE;
 
@@ -438,17 +763,11 @@ chroma:
     return VDP_STATUS_INVALID_CHROMA_TYPE;
 }
 
-VdpStatus video_surface_render_picture(video_surface_ctx_t *vs,
-                                             void **source_data)
+// decoders hand out YUV420 or, without a third plane, NV12
+static void render_upload(video_surface_ctx_t *vs, void **source_data)
 {
-    device_ctx_t *dev = vs->device;
-    if (!eglMakeCurrent(dev->egl.display, dev->egl.surface,
-                        dev->egl.surface, dev->egl.context)) {
-        VDPAU_ERR("Could not set EGL context to current %x", eglGetError());
-        return VDP_STATUS_ERROR;
-    }
-
-    shader_ctx_t *shader = &vs->device->egl.yuvi420_rgb;
+    int nv12 = source_data[2] == NULL;
+    shader_ctx_t *shader = nv12 ? &vs->device->egl.yuvnv12_rgb : &vs->device->egl.yuvi420_rgb;
     shader_init(vs, shader);
 
     /* y component */
@@ -463,6 +782,23 @@ VdpStatus video_surface_render_picture(video_surface_ctx_t *vs,
     glUniform1i (shader->texture[0], 0);
     CHECKEGL
 
+    if (nv12) {
+        /* uv component */
+        glActiveTexture(GL_TEXTURE1);
+        CHECKEGL
+        glBindTexture (GL_TEXTURE_2D, vs->u_tex);
+        CHECKEGL
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_LUMINANCE_ALPHA, vs->width/2,
+                     vs->height/2, 0, GL_LUMINANCE_ALPHA,
+                     GL_UNSIGNED_BYTE, source_data[1]);
+        CHECKEGL
+        glUniform1i (shader->texture[1], 1);
+        CHECKEGL
+
+        shader_draw(vs);
+        return;
+    }
+
     /* u component */
     glActiveTexture(GL_TEXTURE1);
     CHECKEGL
@@ -488,6 +824,63 @@ VdpStatus video_surface_render_picture(video_surface_ctx_t *vs,
     CHECKEGL
 
     shader_draw(vs);
+}
+
+// returns 0 if the picture was drawn from its dma-bufs, otherwise it needs uploading
+static int render_dmabuf(video_surface_ctx_t *vs, void *decoder, int frame)
+{
+    device_egl_t *egl = &vs->device->egl;
+    decoder_dmabuf_t buf;
+    dmabuf_image_t *img;
+    int i;
+
+    if (!egl->dmabuf.enabled || !vs->backend->get_dmabuf ||
+            vs->backend->get_dmabuf(decoder, frame, &buf) != VDP_STATUS_OK)
+        return -1;
+
+    pthread_mutex_lock(&egl->dmabuf.mutex);
+
+    img = dmabuf_lookup(egl, decoder, frame, &buf);
+    if (img) {
+        shader_ctx_t *shader = img->planes == 2 ? &egl->yuvnv12_external_rgb : &egl->yuvi420_external_rgb;
+        shader_init(vs, shader);
+
+        for (i = 0; i < img->planes; i++) {
+            glActiveTexture(GL_TEXTURE0 + i);
+            CHECKEGL
+            glBindTexture(GL_TEXTURE_EXTERNAL_OES, img->textures[i]);
+            CHECKEGL
+            glUniform1i(shader->texture[i], i);
+            CHECKEGL
+        }
+
+        shader_draw(vs);
+
+        // the buffer is requeued to V4L2 right after, the GPU must be done sampling it
+        glFinish();
+    } else {
+        VDPAU_ERR("dma-buf import failed, uploading decoded pictures from now on");
+        egl->dmabuf.enabled = 0;
+    }
+
+    pthread_mutex_unlock(&egl->dmabuf.mutex);
+
+    return img ? 0 : -1;
+}
+
+VdpStatus video_surface_render_picture(video_surface_ctx_t *vs,
+                                       void *decoder, int frame,
+                                       void **source_data)
+{
+    device_ctx_t *dev = vs->device;
+    if (!eglMakeCurrent(dev->egl.display, dev->egl.surface,
+                        dev->egl.surface, dev->egl.context)) {
+        VDPAU_ERR("Could not set EGL context to current %x", eglGetError());
+        return VDP_STATUS_ERROR;
+    }
+
+    if (render_dmabuf(vs, decoder, frame))
+        render_upload(vs, source_data);
 
     if (!eglMakeCurrent(vs->device->egl.display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT)) {
         VDPAU_ERR("Could not set EGL context to none %x", eglGetError());
@@ -506,7 +899,7 @@ VdpStatus vdp_video_surface_query_capabilities(VdpDevice device,
     if (!is_supported || !max_width || !max_height)
         return VDP_STATUS_INVALID_POINTER;
 
-    device_ctx_t *dev = handle_get(device);
+    device_ctx_t *dev = handle_get(device, HANDLE_TYPE_DEVICE);
     if (!dev)
         return VDP_STATUS_INVALID_HANDLE;
 
@@ -525,7 +918,7 @@ VdpStatus vdp_video_surface_query_get_put_bits_y_cb_cr_capabilities(VdpDevice de
     if (!is_supported)
         return VDP_STATUS_INVALID_POINTER;
 
-    device_ctx_t *dev = handle_get(device);
+    device_ctx_t *dev = handle_get(device, HANDLE_TYPE_DEVICE);
     if (!dev)
         return VDP_STATUS_INVALID_HANDLE;
 
@@ -0,0 +1,167 @@
+/*
+ * Copyright (c) 2013 Jens Kuske <jenskuske@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifndef __TEST_H__
+#define __TEST_H__
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+/*
+ * The few helpers the test_*.c programs share. Each of them is a program of
+ * its own that exits non-zero if a check failed, see make check.
+ */
+
+static int test_failures;
+
+#define CHECK(cond, ...) \
+    do { \
+        if (!(cond)) { \
+            test_failures++; \
+            fprintf(stderr, "%s:%d: check failed: ", __FILE__, __LINE__); \
+            fprintf(stderr, __VA_ARGS__); \
+            fputc('\n', stderr); \
+        } \
+    } while (0)
+
+static inline void test_hexdump(const char *label, const uint8_t *data, int len)
+{
+    int i;
+
+    fprintf(stderr, "  %s (%d bytes):", label, len);
+    for (i = 0; i < len; i++)
+        fprintf(stderr, "%s%02x", i % 16 ? " " : "\n    ", data[i]);
+    fputc('\n', stderr);
+}
+
+// byte for byte, both sides are dumped on a mismatch
+static inline void check_bytes(const char *name, const uint8_t *got, int got_len,
+                               const uint8_t *want, int want_len)
+{
+    if (got_len == want_len && !memcmp(got, want, want_len))
+        return;
+
+    test_failures++;
+    fprintf(stderr, "%s: output differs\n", name);
+    test_hexdump("got", got, got_len);
+    test_hexdump("expected", want, want_len);
+}
+
+/* MSB first bit reader for parsing what the writers produced */
+
+typedef struct
+{
+    const uint8_t *data;
+    int size;
+    int bits;               // read so far
+} test_bits_t;
+
+static inline void test_bits_init(test_bits_t *r, const uint8_t *data, int size)
+{
+    r->data = data;
+    r->size = size;
+    r->bits = 0;
+}
+
+// reading past the end gives zeros, check test_bits_overrun() afterwards
+static inline uint32_t test_read_u(test_bits_t *r, int n)
+{
+    uint32_t v = 0;
+
+    while (n-- > 0)
+    {
+        v <<= 1;
+        if (r->bits / 8 < r->size)
+            v |= (r->data[r->bits / 8] >> (7 - r->bits % 8)) & 1;
+        r->bits++;
+    }
+
+    return v;
+}
+
+static inline uint32_t test_read_ue(test_bits_t *r)
+{
+    int zeros = 0;
+
+    while (!test_read_u(r, 1) && zeros < 32 && r->bits <= r->size * 8)
+        zeros++;
+
+    return ((1ull << zeros) - 1) + test_read_u(r, zeros);
+}
+
+static inline int32_t test_read_se(test_bits_t *r)
+{
+    uint32_t v = test_read_ue(r);
+
+    return v & 1 ? (int32_t)((v + 1) / 2) : -(int32_t)(v / 2);
+}
+
+static inline int test_bits_overrun(const test_bits_t *r)
+{
+    return r->bits > r->size * 8;
+}
+
+static inline int test_bits_aligned(const test_bits_t *r)
+{
+    return r->bits % 8 == 0;
+}
+
+// drops the emulation prevention bytes of H.264, HEVC and VC-1, returns the new length
+static inline int test_unescape(const uint8_t *in, int len, uint8_t *out)
+{
+    int i, n = 0, zeros = 0;
+
+    for (i = 0; i < len; i++)
+    {
+        if (zeros >= 2 && in[i] == 0x03)
+        {
+            zeros = 0;
+            continue;
+        }
+        zeros = in[i] ? 0 : zeros + 1;
+        out[n++] = in[i];
+    }
+
+    return n;
+}
+
+// start code emulation, 00 00 followed by 00, 01 or 02 anywhere in the payload
+static inline int test_has_emulation(const uint8_t *data, int len)
+{
+    int i;
+
+    for (i = 0; i + 2 < len; i++)
+        if (!data[i] && !data[i + 1] && data[i + 2] <= 0x02)
+            return 1;
+
+    return 0;
+}
+
+static inline int test_done(const char *name)
+{
+    if (test_failures)
+        printf("%s: %d check%s FAILED\n", name, test_failures, test_failures == 1 ? "" : "s");
+    else
+        printf("%s: OK\n", name);
+
+    return test_failures ? 1 : 0;
+}
+
+#endif
@@ -0,0 +1,1008 @@
+/*
+ * Copyright (c) 2013 Jens Kuske <jenskuske@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+/*
+ * The synthesized stream headers of every codec, byte for byte against
+ * output recorded with the bit at a time bitstream writer bs.h had before
+ * the 64 bit accumulator, and the writer itself against a bit at a time
+ * reference on random sequences of writes.
+ *
+ *   test_headers [-d]
+ *
+ * -d prints the current output as the expected arrays, for when a header
+ * changes on purpose.
+ */
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "test.h"
+#include "h264_stream.h"
+#include "mpeg12_stream.h"
+#include "mpeg4_stream.h"
+#include "vc1_stream.h"
+#include "hevc_stream.h"
+
+#define HEADER_BUF_SIZE 4096
+
+typedef int (*header_case_fn)(uint8_t *buf, int size);
+
+typedef struct
+{
+    const char *name;
+    header_case_fn write;
+    const uint8_t *expected;
+    int expected_len;
+} header_case_t;
+
+static void flat_h264_lists(VdpPictureInfoH264 *info)
+{
+    memset(info->scaling_lists_4x4, 16, sizeof(info->scaling_lists_4x4));
+    memset(info->scaling_lists_8x8, 16, sizeof(info->scaling_lists_8x8));
+}
+
+static int h264_parameter_sets(VdpDecoderProfile profile, int width, int height, VdpPictureInfoH264 *info,
+                               int num_reorder_frames, uint8_t *buf, int size)
+{
+    int sps, pps;
+
+    sps = write_nal_unit(NAL_UNIT_TYPE_SPS, width, height, profile, info, num_reorder_frames, buf, size);
+    if (sps < 0)
+        return -1;
+    pps = write_nal_unit(NAL_UNIT_TYPE_PPS, width, height, profile, info, num_reorder_frames, buf + sps, size - sps);
+    if (pps < 0)
+        return -1;
+
+    return sps + pps;
+}
+
+static void h264_high_1080p_info(VdpPictureInfoH264 *info)
+{
+    memset(info, 0, sizeof(*info));
+    info->num_ref_frames = 4;
+    info->frame_mbs_only_flag = 1;
+    info->direct_8x8_inference_flag = 1;
+    info->entropy_coding_mode_flag = 1;
+    info->transform_8x8_mode_flag = 1;
+    info->deblocking_filter_control_present_flag = 1;
+    info->weighted_bipred_idc = 2;
+    info->pic_init_qp_minus26 = -3;
+    info->chroma_qp_index_offset = -2;
+    info->second_chroma_qp_index_offset = -2;
+    info->log2_max_frame_num_minus4 = 2;
+    info->log2_max_pic_order_cnt_lsb_minus4 = 4;
+    info->num_ref_idx_l0_active_minus1 = 2;
+    flat_h264_lists(info);
+}
+
+static int h264_high_1080p(uint8_t *buf, int size)
+{
+    VdpPictureInfoH264 info;
+
+    h264_high_1080p_info(&info);
+    return h264_parameter_sets(VDP_DECODER_PROFILE_H264_HIGH, 1920, 1080, &info, -1, buf, size);
+}
+
+// B-frames that aren't references, output runs one picture behind decoding
+static int h264_high_1080p_reorder_1(uint8_t *buf, int size)
+{
+    VdpPictureInfoH264 info;
+
+    h264_high_1080p_info(&info);
+    return h264_parameter_sets(VDP_DECODER_PROFILE_H264_HIGH, 1920, 1080, &info, 1, buf, size);
+}
+
+static void h264_high_scaling_lists_info(VdpPictureInfoH264 *info)
+{
+    int i, j;
+
+    memset(info, 0, sizeof(*info));
+    info->num_ref_frames = 2;
+    info->frame_mbs_only_flag = 1;
+    info->direct_8x8_inference_flag = 1;
+    info->transform_8x8_mode_flag = 1;
+    info->weighted_pred_flag = 1;
+    info->constrained_intra_pred_flag = 1;
+    info->pic_order_cnt_type = 1;
+    info->delta_pic_order_always_zero_flag = 1;
+    for (i = 0; i < 6; i++)
+        for (j = 0; j < 16; j++)
+            info->scaling_lists_4x4[i][j] = 6 + i * 4 + j * 3;
+    for (i = 0; i < 2; i++)
+        for (j = 0; j < 64; j++)
+            info->scaling_lists_8x8[i][j] = 8 + i * 5 + j * 2;
+}
+
+static int h264_high_scaling_lists(uint8_t *buf, int size)
+{
+    VdpPictureInfoH264 info;
+
+    h264_high_scaling_lists_info(&info);
+    return h264_parameter_sets(VDP_DECODER_PROFILE_H264_HIGH, 1280, 720, &info, -1, buf, size);
+}
+
+// without the 8x8 transform the PPS carries only the six 4x4 lists
+static int h264_high_scaling_lists_4x4(uint8_t *buf, int size)
+{
+    VdpPictureInfoH264 info;
+
+    h264_high_scaling_lists_info(&info);
+    info.transform_8x8_mode_flag = 0;
+    return h264_parameter_sets(VDP_DECODER_PROFILE_H264_HIGH, 1280, 720, &info, -1, buf, size);
+}
+
+static int h264_main_interlaced(uint8_t *buf, int size)
+{
+    VdpPictureInfoH264 info;
+
+    memset(&info, 0, sizeof(info));
+    info.num_ref_frames = 5;
+    info.mb_adaptive_frame_field_flag = 1;
+    info.direct_8x8_inference_flag = 1;
+    info.entropy_coding_mode_flag = 1;
+    info.pic_order_present_flag = 1;
+    info.deblocking_filter_control_present_flag = 1;
+    info.log2_max_frame_num_minus4 = 5;
+    info.log2_max_pic_order_cnt_lsb_minus4 = 6;
+    info.num_ref_idx_l0_active_minus1 = 4;
+    info.num_ref_idx_l1_active_minus1 = 1;
+    info.pic_init_qp_minus26 = 2;
+
+    return h264_parameter_sets(VDP_DECODER_PROFILE_H264_MAIN, 720, 576, &info, -1, buf, size);
+}
+
+static int h264_baseline_cif(uint8_t *buf, int size)
+{
+    VdpPictureInfoH264 info;
+
+    memset(&info, 0, sizeof(info));
+    info.num_ref_frames = 1;
+    info.frame_mbs_only_flag = 1;
+    info.pic_order_cnt_type = 2;
+    info.redundant_pic_cnt_present_flag = 1;
+
+    return h264_parameter_sets(VDP_DECODER_PROFILE_H264_BASELINE, 352, 288, &info, -1, buf, size);
+}
+
+static void mpeg2_matrices(VdpPictureInfoMPEG1Or2 *info)
+{
+    int i;
+
+    for (i = 0; i < 64; i++)
+    {
+        info->intra_quantizer_matrix[i] = 8 + i / 2;
+        info->non_intra_quantizer_matrix[i] = 16 + i / 4;
+    }
+}
+
+static int mpeg12_headers(VdpDecoderProfile profile, int width, int height, VdpPictureInfoMPEG1Or2 *info,
+                          uint8_t *buf, int size)
+{
+    int seq, pic;
+
+    seq = mpeg12_write_sequence_header(width, height, profile, info, buf, size);
+    if (seq < 0)
+        return -1;
+    pic = mpeg12_write_picture_header(profile, info, buf + seq, size - seq);
+    if (pic < 0)
+        return -1;
+
+    return seq + pic;
+}
+
+static int mpeg1_sif_p(uint8_t *buf, int size)
+{
+    VdpPictureInfoMPEG1Or2 info;
+
+    memset(&info, 0, sizeof(info));
+    info.picture_structure = 3;
+    info.picture_coding_type = 2;
+    info.f_code[0][0] = 2;
+    info.f_code[0][1] = 15;
+    info.f_code[1][0] = info.f_code[1][1] = 15;
+    info.full_pel_forward_vector = 1;
+    mpeg2_matrices(&info);
+
+    return mpeg12_headers(VDP_DECODER_PROFILE_MPEG1, 352, 240, &info, buf, size);
+}
+
+static int mpeg2_main_1080i_b(uint8_t *buf, int size)
+{
+    VdpPictureInfoMPEG1Or2 info;
+
+    memset(&info, 0, sizeof(info));
+    info.picture_structure = 1;
+    info.picture_coding_type = 3;
+    info.intra_dc_precision = 2;
+    info.concealment_motion_vectors = 1;
+    info.intra_vlc_format = 1;
+    info.alternate_scan = 1;
+    info.q_scale_type = 1;
+    info.top_field_first = 1;
+    info.f_code[0][0] = 4;
+    info.f_code[0][1] = 3;
+    info.f_code[1][0] = 5;
+    info.f_code[1][1] = 4;
+    mpeg2_matrices(&info);
+
+    return mpeg12_headers(VDP_DECODER_PROFILE_MPEG2_MAIN, 1920, 1080, &info, buf, size);
+}
+
+static int mpeg2_simple_default_matrices(uint8_t *buf, int size)
+{
+    VdpPictureInfoMPEG1Or2 info;
+
+    memset(&info, 0, sizeof(info));
+    info.picture_structure = 3;
+    info.picture_coding_type = 1;
+    info.frame_pred_frame_dct = 1;
+    info.f_code[0][0] = info.f_code[0][1] = 15;
+    info.f_code[1][0] = info.f_code[1][1] = 15;
+
+    return mpeg12_headers(VDP_DECODER_PROFILE_MPEG2_SIMPLE, 720, 480, &info, buf, size);
+}
+
+static int mpeg4_sp_vga(uint8_t *buf, int size)
+{
+    VdpPictureInfoMPEG4Part2 info;
+
+    memset(&info, 0, sizeof(info));
+    info.vop_time_increment_resolution = 30000;
+    info.resync_marker_disable = 1;
+
+    return mpeg4_write_vol_header(640, 480, VDP_DECODER_PROFILE_MPEG4_PART2_SP, &info, buf, size);
+}
+
+static int mpeg4_asp_720p(uint8_t *buf, int size)
+{
+    VdpPictureInfoMPEG4Part2 info;
+    int i;
+
+    memset(&info, 0, sizeof(info));
+    info.vop_time_increment_resolution = 25;
+    info.interlaced = 1;
+    info.quant_type = 1;
+    info.quarter_sample = 1;
+    for (i = 0; i < 64; i++)
+    {
+        info.intra_quantizer_matrix[i] = 8 + i / 3;
+        info.non_intra_quantizer_matrix[i] = 16 + i / 5;
+    }
+
+    return mpeg4_write_vol_header(1280, 720, VDP_DECODER_PROFILE_MPEG4_PART2_ASP, &info, buf, size);
+}
+
+static int mpeg4_divx5(uint8_t *buf, int size)
+{
+    VdpPictureInfoMPEG4Part2 info;
+
+    memset(&info, 0, sizeof(info));
+    info.vop_time_increment_resolution = 24000;
+    info.quant_type = 1;
+
+    return mpeg4_write_vol_header(720, 400, VDP_DECODER_PROFILE_DIVX5_HOME_THEATER, &info, buf, size);
+}
+
+static int vc1_headers(VdpDecoderProfile profile, int width, int height, VdpPictureInfoVC1 *info,
+                       uint32_t frame_size, const uint8_t *frame, uint8_t *buf, int size)
+{
+    int seq, pic;
+
+    seq = vc1_write_sequence_header(width, height, profile, info, buf, size);
+    if (seq < 0)
+        return -1;
+    pic = vc1_write_frame_header(profile, info, frame_size, frame, buf + seq, size - seq);
+    if (pic < 0)
+        return -1;
+
+    return seq + pic;
+}
+
+static int vc1_simple_qvga(uint8_t *buf, int size)
+{
+    VdpPictureInfoVC1 info;
+
+    memset(&info, 0, sizeof(info));
+    info.quantizer = 1;
+    info.vstransform = 1;
+    info.fastuvmc = 1;
+
+    return vc1_headers(VDP_DECODER_PROFILE_VC1_SIMPLE, 320, 240, &info, 1234, NULL, buf, size);
+}
+
+static int vc1_main_dvd(uint8_t *buf, int size)
+{
+    VdpPictureInfoVC1 info;
+
+    memset(&info, 0, sizeof(info));
+    info.picture_type = 1;
+    info.dquant = 2;
+    info.quantizer = 3;
+    info.extended_mv = 1;
+    info.overlap = 1;
+    info.loopfilter = 1;
+    info.vstransform = 1;
+    info.multires = 1;
+    info.syncmarker = 1;
+    info.rangered = 1;
+    info.maxbframes = 2;
+    info.finterpflag = 1;
+
+    return vc1_headers(VDP_DECODER_PROFILE_VC1_MAIN, 720, 480, &info, 65536, NULL, buf, size);
+}
+
+static int vc1_advanced_1080i(uint8_t *buf, int size)
+{
+    static const uint8_t frame[] = { 0xc0, 0x12, 0x34, 0x56 };
+    VdpPictureInfoVC1 info;
+
+    memset(&info, 0, sizeof(info));
+    info.postprocflag = 1;
+    info.pulldown = 1;
+    info.interlace = 1;
+    info.tfcntrflag = 1;
+    info.panscan_flag = 1;
+    info.refdist_flag = 1;
+    info.extended_mv = 1;
+    info.extended_dmv = 1;
+    info.loopfilter = 1;
+    info.dquant = 1;
+    info.vstransform = 1;
+    info.overlap = 1;
+    info.quantizer = 2;
+    info.range_mapy_flag = 1;
+    info.range_mapy = 5;
+    info.range_mapuv_flag = 1;
+    info.range_mapuv = 3;
+
+    return vc1_headers(VDP_DECODER_PROFILE_VC1_ADVANCED, 1920, 1080, &info, sizeof(frame), frame, buf, size);
+}
+
+#ifdef VDP_DECODER_PROFILE_HEVC_MAIN
+static int hevc_main_1080p(uint8_t *buf, int size)
+{
+    VdpPictureInfoHEVC info;
+    hevc_rps_table_t rps;
+    int i;
+
+    memset(&info, 0, sizeof(info));
+    info.chroma_format_idc = 1;
+    info.pic_width_in_luma_samples = 1920;
+    info.pic_height_in_luma_samples = 1088;
+    info.log2_max_pic_order_cnt_lsb_minus4 = 4;
+    info.sps_max_dec_pic_buffering_minus1 = 4;
+    info.log2_diff_max_min_luma_coding_block_size = 3;
+    info.log2_diff_max_min_transform_block_size = 3;
+    info.max_transform_hierarchy_depth_inter = 1;
+    info.amp_enabled_flag = 1;
+    info.sample_adaptive_offset_enabled_flag = 1;
+    info.num_short_term_ref_pic_sets = 2;
+    info.sps_temporal_mvp_enabled_flag = 1;
+    info.strong_intra_smoothing_enabled_flag = 1;
+    info.sign_data_hiding_enabled_flag = 1;
+    info.cu_qp_delta_enabled_flag = 1;
+    info.diff_cu_qp_delta_depth = 1;
+    info.pps_cb_qp_offset = -1;
+    info.pps_cr_qp_offset = 2;
+    info.pps_loop_filter_across_slices_enabled_flag = 1;
+    info.deblocking_filter_control_present_flag = 1;
+    info.deblocking_filter_override_enabled_flag = 1;
+    info.pps_beta_offset_div2 = -2;
+    info.pps_tc_offset_div2 = 1;
+    info.log2_parallel_merge_level_minus2 = 2;
+
+    // one set learned at a CRA picture, the second one not seen yet
+    memset(&rps, 0, sizeof(rps));
+    info.RAPPicFlag = 1;
+    info.CurrRpsIdx = 0;
+    info.CurrPicOrderCntVal = 8;
+    for (i = 0; i < 16; i++)
+        info.RefPics[i] = VDP_INVALID_HANDLE;
+    info.RefPics[0] = 1;
+    info.PicOrderCntVal[0] = 4;
+    info.RefPics[1] = 2;
+    info.PicOrderCntVal[1] = 0;
+    info.RefPics[2] = 3;
+    info.PicOrderCntVal[2] = 16;
+    info.NumPocStCurrBefore = 2;
+    info.RefPicSetStCurrBefore[0] = 0;
+    info.RefPicSetStCurrBefore[1] = 1;
+    info.NumPocStCurrAfter = 1;
+    info.RefPicSetStCurrAfter[0] = 2;
+    hevc_learn_rps(&rps, &info);
+
+    return hevc_write_parameter_sets(1920, 1080, VDP_DECODER_PROFILE_HEVC_MAIN, &info, &rps, buf, size);
+}
+
+static int hevc_main_tiles_lists(uint8_t *buf, int size)
+{
+    VdpPictureInfoHEVC info;
+    int i, j;
+
+    memset(&info, 0, sizeof(info));
+    info.chroma_format_idc = 1;
+    info.pic_width_in_luma_samples = 1280;
+    info.pic_height_in_luma_samples = 720;
+    info.log2_max_pic_order_cnt_lsb_minus4 = 2;
+    info.sps_max_dec_pic_buffering_minus1 = 2;
+    info.log2_diff_max_min_luma_coding_block_size = 2;
+    info.log2_diff_max_min_transform_block_size = 2;
+    info.scaling_list_enabled_flag = 1;
+    for (i = 0; i < 6; i++)
+    {
+        for (j = 0; j < 16; j++)
+            info.ScalingList4x4[i][j] = 16 + i + j;
+        for (j = 0; j < 64; j++)
+        {
+            info.ScalingList8x8[i][j] = 16 + i + j / 2;
+            info.ScalingList16x16[i][j] = 20 + i + j / 3;
+        }
+        info.ScalingListDCCoeff16x16[i] = 18 + i;
+    }
+    for (i = 0; i < 2; i++)
+    {
+        for (j = 0; j < 64; j++)
+            info.ScalingList32x32[i][j] = 24 + i + j / 4;
+        info.ScalingListDCCoeff32x32[i] = 22 + i;
+    }
+    info.pcm_enabled_flag = 1;
+    info.pcm_sample_bit_depth_luma_minus1 = 7;
+    info.pcm_sample_bit_depth_chroma_minus1 = 7;
+    info.log2_diff_max_min_pcm_luma_coding_block_size = 1;
+    info.long_term_ref_pics_present_flag = 1;
+    info.num_long_term_ref_pics_sps = 1;
+    info.tiles_enabled_flag = 1;
+    info.num_tile_columns_minus1 = 2;
+    info.num_tile_rows_minus1 = 1;
+    info.column_width_minus1[0] = 6;
+    info.column_width_minus1[1] = 6;
+    info.row_height_minus1[0] = 5;
+    info.loop_filter_across_tiles_enabled_flag = 1;
+    info.transquant_bypass_enabled_flag = 1;
+    info.weighted_pred_flag = 1;
+    info.init_qp_minus26 = -4;
+
+    return hevc_write_parameter_sets(1280, 720, VDP_DECODER_PROFILE_HEVC_MAIN, &info, NULL, buf, size);
+}
+#endif
+
+/* expected output, recorded with the bit at a time writer and with -d after intended changes */
+
+static const uint8_t expected_h264_high_1080p[] =
+{
+    0x00, 0x00, 0x01, 0x67, 0x64, 0x00, 0x28, 0xac, 0x72, 0x94, 0x07, 0x80,
+    0x22, 0x7e, 0x58, 0x06, 0xd0, 0x44, 0x22, 0x52, 0xc0, 0x00, 0x00, 0x01,
+    0x68, 0xeb, 0xa3, 0xcb, 0x22, 0xc0,
+};
+
+static const uint8_t expected_h264_high_1080p_reorder_1[] =
+{
+    0x00, 0x00, 0x01, 0x67, 0x64, 0x00, 0x28, 0xac, 0x72, 0x94, 0x07, 0x80,
+    0x22, 0x7e, 0x58, 0x06, 0xd0, 0x44, 0x22, 0x8b, 0x00, 0x00, 0x01, 0x68,
+    0xeb, 0xa3, 0xcb, 0x22, 0xc0,
+};
+
+static const uint8_t expected_h264_high_scaling_lists[] =
+{
+    0x00, 0x00, 0x01, 0x67, 0x64, 0x00, 0x1f, 0xac, 0xaf, 0x60, 0x28, 0x02,
+    0xdd, 0x00, 0xda, 0x08, 0x84, 0x5b, 0x80, 0x00, 0x00, 0x01, 0x68, 0xcf,
+    0x3a, 0xe5, 0x30, 0x48, 0x30, 0x13, 0x09, 0x98, 0x24, 0x12, 0x09, 0x18,
+    0x26, 0x13, 0x0c, 0x04, 0x8d, 0x21, 0x82, 0x41, 0x80, 0x98, 0x4c, 0xc1,
+    0x20, 0x90, 0x48, 0xc1, 0x30, 0x98, 0x60, 0x24, 0x68, 0xc3, 0x04, 0x83,
+    0x01, 0x30, 0x99, 0x82, 0x41, 0x20, 0x91, 0x82, 0x61, 0x30, 0xc0, 0x48,
+    0xd0, 0xa1, 0x82, 0x41, 0x80, 0x98, 0x4c, 0xc1, 0x20, 0x90, 0x48, 0xc1,
+    0x30, 0x98, 0x60, 0x24, 0x68, 0x70, 0xc1, 0x20, 0xc0, 0x4c, 0x26, 0x60,
+    0x90, 0x48, 0x24, 0x60, 0x98, 0x4c, 0x30, 0x12, 0x34, 0x12, 0x18, 0x24,
+    0x18, 0x09, 0x84, 0xcc, 0x12, 0x09, 0x04, 0x8c, 0x13, 0x09, 0x86, 0x02,
+    0x46, 0xc8, 0x1c, 0x04, 0x01, 0xd0, 0xe9, 0x03, 0x81, 0xc0, 0xe0, 0x20,
+    0x0e, 0x87, 0x43, 0xa1, 0xd2, 0x07, 0x03, 0x81, 0xc0, 0xe0, 0x70, 0x10,
+    0x07, 0x43, 0xa1, 0xd0, 0xe8, 0x74, 0x3a, 0x40, 0xe0, 0x70, 0x38, 0x1c,
+    0x0e, 0x07, 0x03, 0x84, 0x0e, 0x87, 0x43, 0xa1, 0xd0, 0xe8, 0x74, 0x10,
+    0x07, 0x03, 0x81, 0xc0, 0xe0, 0x70, 0x81, 0xd0, 0xe8, 0x74, 0x3a, 0x08,
+    0x03, 0x81, 0xc0, 0xe1, 0x03, 0xa1, 0xd0, 0x40, 0x1c, 0x24, 0x51, 0x03,
+    0x80, 0x80, 0x3a, 0x1d, 0x20, 0x70, 0x38, 0x1c, 0x04, 0x01, 0xd0, 0xe8,
+    0x74, 0x3a, 0x40, 0xe0, 0x70, 0x38, 0x1c, 0x0e, 0x02, 0x00, 0xe8, 0x74,
+    0x3a, 0x1d, 0x0e, 0x87, 0x48, 0x1c, 0x0e, 0x07, 0x03, 0x81, 0xc0, 0xe0,
+    0x70, 0x81, 0xd0, 0xe8, 0x74, 0x3a, 0x1d, 0x0e, 0x82, 0x00, 0xe0, 0x70,
+    0x38, 0x1c, 0x0e, 0x10, 0x3a, 0x1d, 0x0e, 0x87, 0x41, 0x00, 0x70, 0x38,
+    0x1c, 0x20, 0x74, 0x3a, 0x08, 0x03, 0x84, 0xc0,
+};
+
+static const uint8_t expected_h264_high_scaling_lists_4x4[] =
+{
+    0x00, 0x00, 0x01, 0x67, 0x64, 0x00, 0x1f, 0xac, 0xaf, 0x60, 0x28, 0x02,
+    0xdd, 0x00, 0xda, 0x08, 0x84, 0x5b, 0x80, 0x00, 0x00, 0x01, 0x68, 0xcf,
+    0x3a, 0x65, 0x30, 0x48, 0x30, 0x13, 0x09, 0x98, 0x24, 0x12, 0x09, 0x18,
+    0x26, 0x13, 0x0c, 0x04, 0x8d, 0x21, 0x82, 0x41, 0x80, 0x98, 0x4c, 0xc1,
+    0x20, 0x90, 0x48, 0xc1, 0x30, 0x98, 0x60, 0x24, 0x68, 0xc3, 0x04, 0x83,
+    0x01, 0x30, 0x99, 0x82, 0x41, 0x20, 0x91, 0x82, 0x61, 0x30, 0xc0, 0x48,
+    0xd0, 0xa1, 0x82, 0x41, 0x80, 0x98, 0x4c, 0xc1, 0x20, 0x90, 0x48, 0xc1,
+    0x30, 0x98, 0x60, 0x24, 0x68, 0x70, 0xc1, 0x20, 0xc0, 0x4c, 0x26, 0x60,
+    0x90, 0x48, 0x24, 0x60, 0x98, 0x4c, 0x30, 0x12, 0x34, 0x12, 0x18, 0x24,
+    0x18, 0x09, 0x84, 0xcc, 0x12, 0x09, 0x04, 0x8c, 0x13, 0x09, 0x86, 0x02,
+    0x46, 0xc0,
+};
+
+static const uint8_t expected_h264_main_interlaced[] =
+{
+    0x00, 0x00, 0x01, 0x67, 0x4d, 0x40, 0x16, 0x9a, 0x73, 0x01, 0x68, 0x49,
+    0xa0, 0x1b, 0x41, 0x10, 0x89, 0x8d, 0x00, 0x00, 0x01, 0x68, 0xf9, 0x50,
+    0x27, 0x0c,
+};
+
+static const uint8_t expected_h264_baseline_cif[] =
+{
+    0x00, 0x00, 0x01, 0x67, 0x42, 0xc0, 0x0b, 0xda, 0x05, 0x82, 0x52, 0x01,
+    0xb4, 0x11, 0x08, 0xd4, 0x00, 0x00, 0x01, 0x68, 0xce, 0x39, 0x30,
+};
+
+static const uint8_t expected_mpeg1_sif_p[] =
+{
+    0x00, 0x00, 0x01, 0xb3, 0x16, 0x00, 0xf0, 0x13, 0xff, 0xff, 0xf2, 0xaa,
+    0x10, 0x10, 0x18, 0x20, 0x18, 0x12, 0x12, 0x1a, 0x20, 0x28, 0x30, 0x28,
+    0x22, 0x1a, 0x14, 0x14, 0x1c, 0x22, 0x2a, 0x30, 0x38, 0x40, 0x38, 0x32,
+    0x2a, 0x24, 0x1c, 0x16, 0x16, 0x1e, 0x24, 0x2c, 0x32, 0x3a, 0x40, 0x48,
+    0x48, 0x42, 0x3a, 0x34, 0x2c, 0x26, 0x1e, 0x26, 0x2e, 0x34, 0x3c, 0x42,
+    0x4a, 0x4a, 0x44, 0x3c, 0x36, 0x2e, 0x36, 0x3e, 0x44, 0x4c, 0x4c, 0x46,
+    0x3e, 0x46, 0x4e, 0x4f, 0x10, 0x10, 0x12, 0x14, 0x12, 0x10, 0x10, 0x12,
+    0x14, 0x16, 0x18, 0x16, 0x14, 0x12, 0x11, 0x11, 0x13, 0x14, 0x16, 0x18,
+    0x1a, 0x1c, 0x1a, 0x18, 0x16, 0x15, 0x13, 0x11, 0x11, 0x13, 0x15, 0x17,
+    0x18, 0x1a, 0x1c, 0x1e, 0x1e, 0x1c, 0x1a, 0x19, 0x17, 0x15, 0x13, 0x15,
+    0x17, 0x19, 0x1b, 0x1c, 0x1e, 0x1e, 0x1d, 0x1b, 0x19, 0x17, 0x19, 0x1b,
+    0x1d, 0x1f, 0x1f, 0x1d, 0x1b, 0x1d, 0x1f, 0x1f, 0x00, 0x00, 0x01, 0xb8,
+    0x00, 0x08, 0x00, 0x00, 0x00, 0x00, 0x01, 0x00, 0x00, 0x17, 0xff, 0xfd,
+    0x00,
+};
+
+static const uint8_t expected_mpeg2_main_1080i_b[] =
+{
+    0x00, 0x00, 0x01, 0xb3, 0x78, 0x04, 0x38, 0x13, 0xff, 0xff, 0xf2, 0xaa,
+    0x10, 0x10, 0x18, 0x20, 0x18, 0x12, 0x12, 0x1a, 0x20, 0x28, 0x30, 0x28,
+    0x22, 0x1a, 0x14, 0x14, 0x1c, 0x22, 0x2a, 0x30, 0x38, 0x40, 0x38, 0x32,
+    0x2a, 0x24, 0x1c, 0x16, 0x16, 0x1e, 0x24, 0x2c, 0x32, 0x3a, 0x40, 0x48,
+    0x48, 0x42, 0x3a, 0x34, 0x2c, 0x26, 0x1e, 0x26, 0x2e, 0x34, 0x3c, 0x42,
+    0x4a, 0x4a, 0x44, 0x3c, 0x36, 0x2e, 0x36, 0x3e, 0x44, 0x4c, 0x4c, 0x46,
+    0x3e, 0x46, 0x4e, 0x4f, 0x10, 0x10, 0x12, 0x14, 0x12, 0x10, 0x10, 0x12,
+    0x14, 0x16, 0x18, 0x16, 0x14, 0x12, 0x11, 0x11, 0x13, 0x14, 0x16, 0x18,
+    0x1a, 0x1c, 0x1a, 0x18, 0x16, 0x15, 0x13, 0x11, 0x11, 0x13, 0x15, 0x17,
+    0x18, 0x1a, 0x1c, 0x1e, 0x1e, 0x1c, 0x1a, 0x19, 0x17, 0x15, 0x13, 0x15,
+    0x17, 0x19, 0x1b, 0x1c, 0x1e, 0x1e, 0x1d, 0x1b, 0x19, 0x17, 0x19, 0x1b,
+    0x1d, 0x1f, 0x1f, 0x1d, 0x1b, 0x1d, 0x1f, 0x1f, 0x00, 0x00, 0x01, 0xb5,
+    0x14, 0x42, 0x1f, 0xff, 0x00, 0x00, 0x00, 0x00, 0x01, 0xb8, 0x00, 0x08,
+    0x00, 0x00, 0x00, 0x00, 0x01, 0x00, 0x00, 0x1f, 0xff, 0xfb, 0xb8, 0x00,
+    0x00, 0x01, 0xb5, 0x84, 0x35, 0x49, 0xbc, 0x00,
+};
+
+static const uint8_t expected_mpeg2_simple_default_matrices[] =
+{
+    0x00, 0x00, 0x01, 0xb3, 0x2d, 0x01, 0xe0, 0x13, 0xff, 0xff, 0xf2, 0xa8,
+    0x00, 0x00, 0x01, 0xb5, 0x15, 0x82, 0x1f, 0xff, 0x00, 0x00, 0x00, 0x00,
+    0x01, 0xb8, 0x00, 0x08, 0x00, 0x00, 0x00, 0x00, 0x01, 0x00, 0x00, 0x0f,
+    0xff, 0xf8, 0x00, 0x00, 0x01, 0xb5, 0x8f, 0xff, 0xf3, 0x41, 0x80,
+};
+
+static const uint8_t expected_mpeg4_sp_vga[] =
+{
+    0x00, 0x00, 0x01, 0xb0, 0x03, 0x00, 0x00, 0x01, 0xb5, 0x09, 0x00, 0x00,
+    0x01, 0x00, 0x00, 0x00, 0x01, 0x20, 0x00, 0x86, 0xc5, 0xd4, 0xc2, 0x8a,
+    0x02, 0x1e, 0x0a, 0x31,
+};
+
+static const uint8_t expected_mpeg4_asp_720p[] =
+{
+    0x00, 0x00, 0x01, 0xb0, 0xf5, 0x00, 0x00, 0x01, 0xb5, 0x09, 0x00, 0x00,
+    0x01, 0x00, 0x00, 0x00, 0x01, 0x20, 0x08, 0xc8, 0x8d, 0x08, 0x00, 0xcd,
+    0x28, 0x04, 0x5a, 0x1c, 0x61, 0x01, 0x01, 0x41, 0xa1, 0x61, 0x01, 0x21,
+    0x61, 0xa2, 0x02, 0x42, 0x01, 0xc1, 0x61, 0x21, 0x21, 0x81, 0xc2, 0x02,
+    0x62, 0xa3, 0x02, 0xa2, 0x62, 0x21, 0xc1, 0x81, 0x41, 0x41, 0x81, 0xe2,
+    0x22, 0x62, 0xc3, 0x03, 0x43, 0x63, 0x02, 0xc2, 0x82, 0x21, 0xe1, 0xa1,
+    0xe2, 0x42, 0x82, 0xc3, 0x23, 0x63, 0x63, 0x22, 0xe2, 0x82, 0x42, 0xa2,
+    0xe3, 0x23, 0x83, 0x83, 0x42, 0xe3, 0x43, 0x83, 0xb1, 0x01, 0x01, 0x11,
+    0x31, 0x11, 0x01, 0x01, 0x21, 0x31, 0x41, 0x61, 0x51, 0x31, 0x21, 0x01,
+    0x11, 0x21, 0x31, 0x51, 0x61, 0x81, 0x91, 0x81, 0x61, 0x51, 0x41, 0x21,
+    0x11, 0x11, 0x21, 0x41, 0x51, 0x71, 0x81, 0x91, 0xb1, 0xb1, 0xa1, 0x81,
+    0x71, 0x51, 0x41, 0x31, 0x41, 0x61, 0x71, 0x81, 0xa1, 0xb1, 0xb1, 0xa1,
+    0x91, 0x71, 0x61, 0x71, 0x91, 0xa1, 0xc1, 0xc1, 0xa1, 0x91, 0xb1, 0xc1,
+    0xcc, 0x0f,
+};
+
+static const uint8_t expected_mpeg4_divx5[] =
+{
+    0x00, 0x00, 0x01, 0xb0, 0xf5, 0x00, 0x00, 0x01, 0xb5, 0x09, 0x00, 0x00,
+    0x01, 0x00, 0x00, 0x00, 0x01, 0x20, 0x08, 0xc8, 0x8d, 0x0a, 0xee, 0x05,
+    0x16, 0x84, 0x32, 0x14, 0x44, 0x0f,
+};
+
+static const uint8_t expected_vc1_simple_qvga[] =
+{
+    0xff, 0xff, 0xff, 0xc5, 0x04, 0x00, 0x00, 0x00, 0x00, 0x01, 0x88, 0x05,
+    0xf0, 0x00, 0x00, 0x00, 0x40, 0x01, 0x00, 0x00, 0x0c, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x40, 0x00, 0x00, 0x00, 0x00, 0xff, 0xff, 0xff, 0xff,
+    0xd2, 0x04, 0x00, 0x80, 0x00, 0x00, 0x00, 0x00,
+};
+
+static const uint8_t expected_vc1_main_dvd[] =
+{
+    0xff, 0xff, 0xff, 0xc5, 0x04, 0x00, 0x00, 0x00, 0x40, 0x0b, 0x6b, 0xaf,
+    0xe0, 0x01, 0x00, 0x00, 0xd0, 0x02, 0x00, 0x00, 0x0c, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x40, 0x00, 0x00, 0x00, 0x00, 0xff, 0xff, 0xff, 0xff,
+    0x00, 0x00, 0x01, 0x00, 0x00, 0x00, 0x00, 0x00,
+};
+
+static const uint8_t expected_vc1_advanced_1080i[] =
+{
+    0x00, 0x00, 0x01, 0x0f, 0xd2, 0x01, 0x3b, 0xf2, 0x1b, 0xe8, 0x80, 0x00,
+    0x00, 0x01, 0x0e, 0x7a, 0xf3, 0xb7, 0x00, 0x00, 0x01, 0x0d,
+};
+
+#ifdef VDP_DECODER_PROFILE_HEVC_MAIN
+static const uint8_t expected_hevc_main_1080p[] =
+{
+    0x00, 0x00, 0x01, 0x40, 0x01, 0x0c, 0x01, 0xff, 0xff, 0x01, 0x60, 0x00,
+    0x00, 0x03, 0x00, 0x00, 0x03, 0x00, 0x00, 0x03, 0x00, 0x00, 0x03, 0x00,
+    0x78, 0x94, 0xb0, 0x24, 0x00, 0x00, 0x01, 0x42, 0x01, 0x01, 0x01, 0x60,
+    0x00, 0x00, 0x03, 0x00, 0x00, 0x03, 0x00, 0x00, 0x03, 0x00, 0x00, 0x03,
+    0x00, 0x78, 0xa0, 0x03, 0xc0, 0x80, 0x11, 0x07, 0xcb, 0x96, 0x52, 0xe4,
+    0x91, 0x59, 0xb4, 0x49, 0x22, 0x2d, 0x90, 0x00, 0x00, 0x01, 0x44, 0x01,
+    0xc1, 0x72, 0x99, 0x00, 0xe2, 0xa1, 0x90,
+};
+
+static const uint8_t expected_hevc_main_tiles_lists[] =
+{
+    0x00, 0x00, 0x01, 0x40, 0x01, 0x0c, 0x01, 0xff, 0xff, 0x01, 0x60, 0x00,
+    0x00, 0x03, 0x00, 0x00, 0x03, 0x00, 0x00, 0x03, 0x00, 0x00, 0x03, 0x00,
+    0x5d, 0xb7, 0x02, 0x40, 0x00, 0x00, 0x01, 0x42, 0x01, 0x01, 0x01, 0x60,
+    0x00, 0x00, 0x03, 0x00, 0x00, 0x03, 0x00, 0x00, 0x03, 0x00, 0x00, 0x03,
+    0x00, 0x5d, 0xa0, 0x02, 0x80, 0x80, 0x2d, 0x16, 0xed, 0xee, 0xfe, 0x10,
+    0x49, 0x24, 0x92, 0x49, 0x24, 0x94, 0x24, 0x92, 0x49, 0x24, 0x92, 0x49,
+    0x28, 0x51, 0x24, 0x92, 0x49, 0x24, 0x92, 0x50, 0xb2, 0x49, 0x24, 0x92,
+    0x49, 0x24, 0xa1, 0x84, 0x92, 0x49, 0x24, 0x92, 0x49, 0x43, 0x49, 0x24,
+    0x92, 0x49, 0x24, 0x92, 0x84, 0x2a, 0xaa, 0xaa, 0xaa, 0xaa, 0xaa, 0xaa,
+    0xaa, 0xaa, 0xaa, 0xaa, 0xaa, 0xaa, 0xaa, 0xaa, 0xab, 0x09, 0x55, 0x55,
+    0x55, 0x55, 0x55, 0x55, 0x55, 0x55, 0x55, 0x55, 0x55, 0x55, 0x55, 0x55,
+    0x55, 0x56, 0x14, 0xaa, 0xaa, 0xaa, 0xaa, 0xaa, 0xaa, 0xaa, 0xaa, 0xaa,
+    0xaa, 0xaa, 0xaa, 0xaa, 0xaa, 0xaa, 0xac, 0x2d, 0x55, 0x55, 0x55, 0x55,
+    0x55, 0x55, 0x55, 0x55, 0x55, 0x55, 0x55, 0x55, 0x55, 0x55, 0x55, 0x58,
+    0x62, 0xaa, 0xaa, 0xaa, 0xaa, 0xaa, 0xaa, 0xaa, 0xaa, 0xaa, 0xaa, 0xaa,
+    0xaa, 0xaa, 0xaa, 0xaa, 0xb0, 0xd5, 0x55, 0x55, 0x55, 0x55, 0x55, 0x55,
+    0x55, 0x55, 0x55, 0x55, 0x55, 0x55, 0x55, 0x55, 0x55, 0x61, 0x42, 0x6b,
+    0x5a, 0xd6, 0xb5, 0xad, 0x6b, 0x5a, 0xd6, 0xb5, 0xad, 0x6b, 0x5a, 0xd6,
+    0xa1, 0x62, 0x6b, 0x5a, 0xd6, 0xb5, 0xad, 0x6b, 0x5a, 0xd6, 0xb5, 0xad,
+    0x6b, 0x5a, 0xd6, 0xa1, 0x82, 0x6b, 0x5a, 0xd6, 0xb5, 0xad, 0x6b, 0x5a,
+    0xd6, 0xb5, 0xad, 0x6b, 0x5a, 0xd6, 0xa1, 0xa2, 0x6b, 0x5a, 0xd6, 0xb5,
+    0xad, 0x6b, 0x5a, 0xd6, 0xb5, 0xad, 0x6b, 0x5a, 0xd6, 0xa1, 0xc2, 0x6b,
+    0x5a, 0xd6, 0xb5, 0xad, 0x6b, 0x5a, 0xd6, 0xb5, 0xad, 0x6b, 0x5a, 0xd6,
+    0xa1, 0xe2, 0x6b, 0x5a, 0xd6, 0xb5, 0xad, 0x6b, 0x5a, 0xd6, 0xb5, 0xad,
+    0x6b, 0x5a, 0xd6, 0xa1, 0xc2, 0x75, 0xd7, 0x5d, 0x75, 0xd7, 0x5d, 0x75,
+    0xd7, 0x5d, 0x75, 0xd7, 0x5e, 0x1e, 0x27, 0x5d, 0x75, 0xd7, 0x5d, 0x75,
+    0xd7, 0x5d, 0x75, 0xd7, 0x5d, 0x75, 0xcb, 0xbd, 0x34, 0x04, 0x20, 0x00,
+    0x00, 0x01, 0x44, 0x01, 0xc0, 0x62, 0x46, 0xb3, 0x43, 0x9c, 0xd0, 0x90,
+};
+#endif
+
+#define HEADER_CASE(name) { #name, name, expected_##name, sizeof(expected_##name) }
+
+static const header_case_t header_cases[] =
+{
+    HEADER_CASE(h264_high_1080p),
+    HEADER_CASE(h264_high_1080p_reorder_1),
+    HEADER_CASE(h264_high_scaling_lists),
+    HEADER_CASE(h264_high_scaling_lists_4x4),
+    HEADER_CASE(h264_main_interlaced),
+    HEADER_CASE(h264_baseline_cif),
+    HEADER_CASE(mpeg1_sif_p),
+    HEADER_CASE(mpeg2_main_1080i_b),
+    HEADER_CASE(mpeg2_simple_default_matrices),
+    HEADER_CASE(mpeg4_sp_vga),
+    HEADER_CASE(mpeg4_asp_720p),
+    HEADER_CASE(mpeg4_divx5),
+    HEADER_CASE(vc1_simple_qvga),
+    HEADER_CASE(vc1_main_dvd),
+    HEADER_CASE(vc1_advanced_1080i),
+#ifdef VDP_DECODER_PROFILE_HEVC_MAIN
+    HEADER_CASE(hevc_main_1080p),
+    HEADER_CASE(hevc_main_tiles_lists),
+#endif
+};
+
+static void dump_case(const header_case_t *c, const uint8_t *buf, int len)
+{
+    int i;
+
+    printf("static const uint8_t expected_%s[] =\n{", c->name);
+    for (i = 0; i < len; i++)
+        printf("%s0x%02x,", i % 12 ? " " : "\n    ", buf[i]);
+    printf("\n};\n\n");
+}
+
+// a scaling matrix change mid-sequence only touches the PPS
+static void test_scaling_sps(void)
+{
+    static uint8_t flat[HEADER_BUF_SIZE], scaled[HEADER_BUF_SIZE];
+    VdpPictureInfoH264 info;
+    h264_header_key_t flat_key, scaled_key;
+    int flat_len, scaled_len;
+
+    h264_high_scaling_lists_info(&info);
+    h264_header_key(&scaled_key, 1280, 720, VDP_DECODER_PROFILE_H264_HIGH, &info, -1);
+    scaled_len = write_nal_unit(NAL_UNIT_TYPE_SPS, 1280, 720, VDP_DECODER_PROFILE_H264_HIGH, &info, -1,
+                                scaled, sizeof(scaled));
+
+    flat_h264_lists(&info);
+    h264_header_key(&flat_key, 1280, 720, VDP_DECODER_PROFILE_H264_HIGH, &info, -1);
+    flat_len = write_nal_unit(NAL_UNIT_TYPE_SPS, 1280, 720, VDP_DECODER_PROFILE_H264_HIGH, &info, -1,
+                              flat, sizeof(flat));
+
+    CHECK(flat_len > 0 && flat_len == scaled_len && !memcmp(flat, scaled, flat_len),
+          "SPS changes with the scaling lists");
+    CHECK(!memcmp(&flat_key, &scaled_key, offsetof(h264_header_key_t, entropy_coding_mode_flag)),
+          "SPS part of the header key changes with the scaling lists");
+    CHECK(memcmp(&flat_key, &scaled_key, sizeof(flat_key)), "header key ignores the scaling lists");
+}
+
+static void reorder_picture(VdpPictureInfoH264 *info, int frame_num, int poc, int field, int bottom)
+{
+    memset(info, 0, sizeof(*info));
+    info->frame_num = frame_num;
+    info->field_pic_flag = field;
+    info->bottom_field_flag = bottom;
+    info->field_order_cnt[0] = poc;
+    info->field_order_cnt[1] = poc + (field ? 0 : 1);
+}
+
+// what the SPS announces follows the stream, and only changes at IDR pictures
+static void test_reorder(void)
+{
+    // I0 P3 B1 B2 P6 B4 B5 in decoding order, twice, then an IDR
+    static const int gop[] = { 0, 3, 1, 2, 6, 4, 5 };
+    VdpPictureInfoH264 info;
+    h264_reorder_t r;
+    int i, n;
+
+    h264_reorder_init(&r);
+    for (i = 0; i < 14; i++)
+    {
+        reorder_picture(&info, i, (gop[i % 7] + (i / 7) * 7) * 2, 0, 0);
+        n = h264_reorder_update(&r, &info, i == 0);
+        CHECK(n == -1, "picture %d: num_reorder_frames %d before the second IDR", i, n);
+    }
+    CHECK(r.observed == 1, "IBBP reorder depth %d, expected 1", r.observed);
+
+    reorder_picture(&info, 0, 0, 0, 0);
+    n = h264_reorder_update(&r, &info, 1);
+    CHECK(n == 1, "num_reorder_frames %d after the IDR, expected 1", n);
+
+    // field pairs count once, at their first field
+    h264_reorder_init(&r);
+    for (i = 0; i < 8; i++)
+    {
+        reorder_picture(&info, i / 2, (i / 2) * 4 + (i & 1), 1, i & 1);
+        h264_reorder_update(&r, &info, i == 0);
+    }
+    CHECK(r.observed == 0 && r.count == 4, "fields in output order: depth %d over %d pictures", r.observed, r.count);
+}
+
+/* bs.h against a writer that sets one bit at a time */
+
+typedef struct
+{
+    uint8_t *buf;
+    int size;
+    int bits;
+} ref_bs_t;
+
+static void ref_write_u(ref_bs_t *r, int n, uint64_t v)
+{
+    while (n-- > 0)
+    {
+        if (r->bits / 8 < r->size && ((v >> n) & 1))
+            r->buf[r->bits / 8] |= 0x80 >> (r->bits % 8);
+        r->bits++;
+    }
+}
+
+// 9.1, leadingZeroBits zeros followed by v + 1
+static void ref_write_ue(ref_bs_t *r, uint32_t v)
+{
+    uint64_t code = (uint64_t)v + 1;
+    int len = 0;
+
+    while ((code >> len) > 1)
+        len++;
+
+    ref_write_u(r, len, 0);
+    ref_write_u(r, len + 1, code);
+}
+
+static void ref_write_se(ref_bs_t *r, int32_t v)
+{
+    ref_write_ue(r, v <= 0 ? (uint32_t)(-(int64_t)v * 2) : (uint32_t)v * 2 - 1);
+}
+
+static uint32_t random_value(void)
+{
+    // mostly small values as headers have them, some across the whole range
+    switch (rand() % 4)
+    {
+    case 0: return rand() % 4;
+    case 1: return rand() % 256;
+    case 2: return rand() % 65536;
+    default: return ((uint32_t)rand() << 16) ^ (uint32_t)rand();
+    }
+}
+
+static void test_writer(int rounds)
+{
+    static uint8_t got[4096], want[4096];
+    int round, i;
+
+    srand(1);
+
+    for (round = 0; round < rounds; round++)
+    {
+        bs_t b;
+        ref_bs_t r = { want, sizeof(want), 0 };
+        int ops = 1 + rand() % 200;
+
+        memset(got, 0, sizeof(got));
+        memset(want, 0, sizeof(want));
+        bs_init(&b, got, sizeof(got));
+
+        for (i = 0; i < ops; i++)
+        {
+            uint32_t v = random_value();
+            int n = 1 + rand() % 32;
+
+            switch (rand() % 5)
+            {
+            case 0:
+                bs_write_u1(&b, v & 1);
+                ref_write_u(&r, 1, v & 1);
+                break;
+            case 1:
+                bs_write_u(&b, n, v);
+                ref_write_u(&r, n, v);
+                break;
+            case 2:
+                bs_write_u8(&b, v & 0xff);
+                ref_write_u(&r, 8, v & 0xff);
+                break;
+            case 3:
+                if (v == 0xffffffff)
+                    v--;
+                bs_write_ue(&b, v);
+                ref_write_ue(&r, v);
+                break;
+            default:
+                v &= 0x3fffffff;
+                if (rand() & 1)
+                    v = -v;
+                bs_write_se(&b, (int32_t)v);
+                ref_write_se(&r, (int32_t)v);
+                break;
+            }
+        }
+
+        CHECK(bs_pos(&b) * 8 + 8 - b.bits_left == r.bits, "round %d: %d bits written, expected %d",
+              round, bs_pos(&b) * 8 + 8 - b.bits_left, r.bits);
+        if (memcmp(got, want, (r.bits + 7) / 8))
+        {
+            CHECK(0, "round %d: written bits differ", round);
+            break;
+        }
+    }
+}
+
+// a P slice of a stream with 4 bit frame_num and POC type 2, before the slice data
+static int p_slice(uint8_t *buf, int size, int field, uint32_t num_ref_idx, int modifications)
+{
+    ref_bs_t r = { buf, size, 0 };
+    int i;
+
+    memset(buf, 0, size);
+    ref_write_u(&r, 32, 0x00000141);    // start code, nal_ref_idc 2, non-IDR slice
+    ref_write_ue(&r, 0);                // first_mb_in_slice
+    ref_write_ue(&r, 0);                // slice_type P
+    ref_write_ue(&r, 0);                // pic_parameter_set_id
+    ref_write_u(&r, 4, 1);              // frame_num
+    if (field)
+        ref_write_u(&r, 2, 2);          // field_pic_flag, bottom_field_flag
+    ref_write_u(&r, 1, 1);              // num_ref_idx_active_override_flag
+    ref_write_ue(&r, num_ref_idx - 1);
+    ref_write_u(&r, 1, modifications > 0);
+    for (i = 0; i < modifications; i++)
+    {
+        ref_write_ue(&r, 0);            // modification_of_pic_nums_idc
+        ref_write_ue(&r, 0);            // abs_diff_pic_num_minus1
+    }
+    if (modifications)
+        ref_write_ue(&r, 3);
+    ref_write_u(&r, 1, 0);              // adaptive_ref_pic_marking_mode_flag
+    ref_write_u(&r, 1, 1);              // rbsp_stop_one_bit
+
+    return (r.bits + 7) / 8;
+}
+
+// the slice may override the reference counts, which bound everything after them
+static void test_slice_header(void)
+{
+    VdpPictureInfoH264 info;
+    h264_slice_header_t sh;
+    uint8_t buf[64];
+    int len;
+
+    memset(&info, 0, sizeof(info));
+    info.pic_order_cnt_type = 2;
+    info.frame_mbs_only_flag = 1;
+
+    len = p_slice(buf, sizeof(buf), 0, 16, 16);
+    CHECK(!h264_parse_slice_header(buf, len, &info, &sh), "frame with 16 references and modifications rejected");
+    len = p_slice(buf, sizeof(buf), 0, 17, 0);
+    CHECK(h264_parse_slice_header(buf, len, &info, &sh), "frame with 17 references accepted");
+    len = p_slice(buf, sizeof(buf), 0, 4, 5);
+    CHECK(h264_parse_slice_header(buf, len, &info, &sh), "5 modifications of 4 references accepted");
+    len = p_slice(buf, sizeof(buf), 0, 0xffffffff, 0);
+    CHECK(h264_parse_slice_header(buf, len, &info, &sh), "frame with 2^32 - 1 references accepted");
+
+    info.frame_mbs_only_flag = 0;
+    len = p_slice(buf, sizeof(buf), 1, 32, 0);
+    CHECK(!h264_parse_slice_header(buf, len, &info, &sh), "field with 32 references rejected");
+    len = p_slice(buf, sizeof(buf), 1, 33, 0);
+    CHECK(h264_parse_slice_header(buf, len, &info, &sh), "field with 33 references accepted");
+
+    // the slice ends where its weights should be
+    info.weighted_pred_flag = 1;
+    len = p_slice(buf, sizeof(buf), 1, 32, 0);
+    CHECK(h264_parse_slice_header(buf, len, &info, &sh), "missing weight table not noticed");
+}
+
+int main(int argc, char **argv)
+{
+    uint8_t buf[HEADER_BUF_SIZE];
+    int dump = argc > 1 && !strcmp(argv[1], "-d");
+    unsigned int i;
+
+    for (i = 0; i < sizeof(header_cases) / sizeof(header_cases[0]); i++)
+    {
+        const header_case_t *c = &header_cases[i];
+        int len;
+
+        memset(buf, 0xaa, sizeof(buf));
+        len = c->write(buf, sizeof(buf));
+        CHECK(len > 0, "%s: writer failed", c->name);
+        if (len <= 0)
+            continue;
+
+        if (dump)
+            dump_case(c, buf, len);
+        else
+            check_bytes(c->name, buf, len, c->expected, c->expected_len);
+    }
+
+    if (dump)
+        return 0;
+
+    test_reorder();
+    test_scaling_sps();
+    test_slice_header();
+    test_writer(20000);
+
+    return test_done("test_headers");
+}
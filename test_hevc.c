@@ -0,0 +1,859 @@
+/*
+ * Copyright (c) 2013 Jens Kuske <jenskuske@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+/*
+ * Round trip of the HEVC parameter sets: hevc_stream.c writes VPS, SPS and
+ * PPS for random picture infos and RPS tables, a parser following the
+ * syntax tables of ITU-T H.265 (04/2013) reads them back into a picture
+ * info, and every field has to come back as it went in. Scaling lists are
+ * reconstructed with the prediction and default rules of 7.4.5, short-term
+ * RPS sets with the delta coding of 7.4.8.
+ */
+
+#include <stdlib.h>
+
+#include "test.h"
+#include "hevc_stream.h"
+
+#ifdef VDP_DECODER_PROFILE_HEVC_MAIN
+
+#define ROUNDS 2000
+
+// Table 7-6, in up-right diagonal scan order like VDPAU passes them
+static const uint8_t default_intra[64] =
+{
+    16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 17, 16, 17, 16, 17, 18,
+    17, 18, 18, 17, 18, 21, 19, 20, 21, 20, 19, 21, 24, 22, 22, 24,
+    24, 22, 22, 24, 25, 25, 27, 30, 27, 25, 25, 29, 31, 35, 35, 31,
+    29, 36, 41, 44, 41, 36, 47, 54, 54, 47, 65, 70, 65, 88, 88, 115,
+};
+
+static const uint8_t default_inter[64] =
+{
+    16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 17, 17, 17, 17, 17, 18,
+    18, 18, 18, 18, 18, 20, 20, 20, 20, 20, 20, 20, 24, 24, 24, 24,
+    24, 24, 24, 24, 25, 25, 25, 25, 25, 25, 25, 28, 28, 28, 28, 28,
+    28, 33, 33, 33, 33, 33, 41, 41, 41, 41, 54, 54, 54, 71, 71, 91,
+};
+
+// what the parser found beyond the fields of VdpPictureInfoHEVC
+typedef struct
+{
+    int profile_idc;
+    uint32_t compatibility;
+    int level_idc;
+    int vps_max_dec_pic_buffering_minus1;
+    int sps_max_num_reorder_pics;
+    int conf_win_right, conf_win_bottom;
+    int scaling_list_data_present;
+    hevc_st_rps_t sets[HEVC_MAX_ST_RPS];
+    int lt_ref_pic_poc_lsb[32];
+    int used_by_curr_pic_lt[32];
+} parsed_t;
+
+static void parse_trailing_bits(const char *name, test_bits_t *r)
+{
+    CHECK(test_read_u(r, 1) == 1, "%s: rbsp_stop_one_bit", name);
+    while (!test_bits_aligned(r))
+        CHECK(test_read_u(r, 1) == 0, "%s: rbsp_alignment_zero_bit", name);
+    CHECK(r->bits == r->size * 8, "%s: %d bytes after rbsp_trailing_bits", name, r->size - r->bits / 8);
+}
+
+// 7.3.3 with maxNumSubLayersMinus1 0
+static void parse_profile_tier_level(test_bits_t *r, parsed_t *p)
+{
+    int j;
+
+    CHECK(test_read_u(r, 2) == 0, "general_profile_space");
+    CHECK(test_read_u(r, 1) == 0, "general_tier_flag");
+    p->profile_idc = test_read_u(r, 5);
+    p->compatibility = 0;
+    for (j = 0; j < 32; j++)
+        p->compatibility |= test_read_u(r, 1) << j;
+    test_read_u(r, 4);                  // source and constraint flags
+    CHECK(test_read_u(r, 32) == 0 && test_read_u(r, 12) == 0, "general_reserved_zero_44bits");
+    p->level_idc = test_read_u(r, 8);
+}
+
+// 7.3.4, reconstructed with 7.4.5
+static void parse_scaling_list_data(test_bits_t *r, VdpPictureInfoHEVC *out)
+{
+    uint8_t lists[4][6][64], dc[4][6];
+    int size_id, matrix_id, i;
+
+    for (size_id = 0; size_id < 4; size_id++)
+    {
+        int step = size_id == 3 ? 3 : 1;
+        int coef_num = size_id ? 64 : 16;
+
+        for (matrix_id = 0; matrix_id < 6; matrix_id += step)
+        {
+            if (!test_read_u(r, 1))     // scaling_list_pred_mode_flag
+            {
+                int delta = test_read_ue(r);
+                if (!delta)
+                {
+                    for (i = 0; i < coef_num; i++)
+                        lists[size_id][matrix_id][i] = !size_id ? 16 : matrix_id < 3 ? default_intra[i] : default_inter[i];
+                    dc[size_id][matrix_id] = 16;
+                }
+                else
+                {
+                    int ref = matrix_id - delta * step;
+                    CHECK(ref >= 0, "scaling_list_pred_matrix_id_delta %d of matrix %d", delta, matrix_id);
+                    if (ref < 0)
+                        return;
+                    memcpy(lists[size_id][matrix_id], lists[size_id][ref], 64);
+                    dc[size_id][matrix_id] = dc[size_id][ref];
+                }
+                continue;
+            }
+
+            int next_coef = 8;
+            if (size_id > 1)
+            {
+                next_coef = test_read_se(r) + 8;
+                CHECK(next_coef > 0 && next_coef < 256, "scaling_list_dc_coef_minus8 %d", next_coef - 8);
+                dc[size_id][matrix_id] = next_coef;
+            }
+            for (i = 0; i < coef_num; i++)
+            {
+                int delta = test_read_se(r);
+                CHECK(delta >= -128 && delta <= 127, "scaling_list_delta_coef %d", delta);
+                next_coef = (next_coef + delta + 256) % 256;
+                lists[size_id][matrix_id][i] = next_coef;
+            }
+        }
+    }
+
+    for (matrix_id = 0; matrix_id < 6; matrix_id++)
+    {
+        memcpy(out->ScalingList4x4[matrix_id], lists[0][matrix_id], 16);
+        memcpy(out->ScalingList8x8[matrix_id], lists[1][matrix_id], 64);
+        memcpy(out->ScalingList16x16[matrix_id], lists[2][matrix_id], 64);
+        out->ScalingListDCCoeff16x16[matrix_id] = dc[2][matrix_id];
+    }
+    for (matrix_id = 0; matrix_id < 2; matrix_id++)
+    {
+        memcpy(out->ScalingList32x32[matrix_id], lists[3][matrix_id * 3], 64);
+        out->ScalingListDCCoeff32x32[matrix_id] = dc[3][matrix_id * 3];
+    }
+}
+
+// 7.3.4 absent, 7.4.3.2: the default lists of Table 7-5 and 7-6
+static void default_scaling_lists(VdpPictureInfoHEVC *out)
+{
+    int m;
+
+    memset(out->ScalingList4x4, 16, sizeof(out->ScalingList4x4));
+    for (m = 0; m < 6; m++)
+    {
+        memcpy(out->ScalingList8x8[m], m < 3 ? default_intra : default_inter, 64);
+        memcpy(out->ScalingList16x16[m], m < 3 ? default_intra : default_inter, 64);
+        out->ScalingListDCCoeff16x16[m] = 16;
+    }
+    memcpy(out->ScalingList32x32[0], default_intra, 64);
+    memcpy(out->ScalingList32x32[1], default_inter, 64);
+    out->ScalingListDCCoeff32x32[0] = out->ScalingListDCCoeff32x32[1] = 16;
+}
+
+// 7.3.7 in the SPS, 7.4.8 for the POC deltas
+static void parse_st_ref_pic_set(test_bits_t *r, int idx, hevc_st_rps_t *set)
+{
+    int32_t poc = 0;
+    int i;
+
+    memset(set, 0, sizeof(*set));
+
+    // inter RPS prediction would need the sets before, the writer codes every set on its own
+    if (idx != 0)
+        CHECK(test_read_u(r, 1) == 0, "inter_ref_pic_set_prediction_flag of set %d", idx);
+
+    int negative = test_read_ue(r);
+    int positive = test_read_ue(r);
+    CHECK(negative + positive <= HEVC_MAX_DPB, "set %d has %d + %d pictures", idx, negative, positive);
+    if (negative + positive > HEVC_MAX_DPB)
+        return;
+    set->num_negative = negative;
+    set->num_positive = positive;
+
+    for (i = 0; i < negative; i++)
+    {
+        poc -= test_read_ue(r) + 1;
+        set->delta_poc[i] = poc;
+        set->used[i] = test_read_u(r, 1);
+    }
+    poc = 0;
+    for (i = negative; i < negative + positive; i++)
+    {
+        poc += test_read_ue(r) + 1;
+        set->delta_poc[i] = poc;
+        set->used[i] = test_read_u(r, 1);
+    }
+}
+
+// 7.3.2.1
+static void parse_vps(test_bits_t *r, parsed_t *p)
+{
+    CHECK(test_read_u(r, 4) == 0, "vps_video_parameter_set_id");
+    CHECK(test_read_u(r, 2) == 3, "vps_reserved_three_2bits");
+    CHECK(test_read_u(r, 6) == 0, "vps_max_layers_minus1");
+    CHECK(test_read_u(r, 3) == 0, "vps_max_sub_layers_minus1");
+    CHECK(test_read_u(r, 1) == 1, "vps_temporal_id_nesting_flag");
+    CHECK(test_read_u(r, 16) == 0xffff, "vps_reserved_0xffff_16bits");
+    parse_profile_tier_level(r, p);
+    CHECK(test_read_u(r, 1) == 1, "vps_sub_layer_ordering_info_present_flag");
+    p->vps_max_dec_pic_buffering_minus1 = test_read_ue(r);
+    CHECK((int)test_read_ue(r) <= p->vps_max_dec_pic_buffering_minus1, "vps_max_num_reorder_pics");
+    test_read_ue(r);                    // vps_max_latency_increase_plus1
+    CHECK(test_read_u(r, 6) == 0, "vps_max_layer_id");
+    CHECK(test_read_ue(r) == 0, "vps_num_layer_sets_minus1");
+    CHECK(test_read_u(r, 1) == 0, "vps_timing_info_present_flag");
+    CHECK(test_read_u(r, 1) == 0, "vps_extension_flag");
+    parse_trailing_bits("VPS", r);
+}
+
+// 7.3.2.2
+static void parse_sps(test_bits_t *r, VdpPictureInfoHEVC *out, parsed_t *p)
+{
+    parsed_t ptl;
+    int i;
+
+    CHECK(test_read_u(r, 4) == 0, "sps_video_parameter_set_id");
+    CHECK(test_read_u(r, 3) == 0, "sps_max_sub_layers_minus1");
+    CHECK(test_read_u(r, 1) == 1, "sps_temporal_id_nesting_flag");
+    parse_profile_tier_level(r, &ptl);
+    CHECK(ptl.profile_idc == p->profile_idc && ptl.level_idc == p->level_idc, "SPS and VPS profile_tier_level differ");
+    CHECK(test_read_ue(r) == 0, "sps_seq_parameter_set_id");
+    out->chroma_format_idc = test_read_ue(r);
+    if (out->chroma_format_idc == 3)
+        out->separate_colour_plane_flag = test_read_u(r, 1);
+    out->pic_width_in_luma_samples = test_read_ue(r);
+    out->pic_height_in_luma_samples = test_read_ue(r);
+    if (test_read_u(r, 1))              // conformance_window_flag
+    {
+        CHECK(test_read_ue(r) == 0, "conf_win_left_offset");
+        p->conf_win_right = test_read_ue(r);
+        CHECK(test_read_ue(r) == 0, "conf_win_top_offset");
+        p->conf_win_bottom = test_read_ue(r);
+    }
+    out->bit_depth_luma_minus8 = test_read_ue(r);
+    out->bit_depth_chroma_minus8 = test_read_ue(r);
+    out->log2_max_pic_order_cnt_lsb_minus4 = test_read_ue(r);
+    CHECK(test_read_u(r, 1) == 1, "sps_sub_layer_ordering_info_present_flag");
+    out->sps_max_dec_pic_buffering_minus1 = test_read_ue(r);
+    p->sps_max_num_reorder_pics = test_read_ue(r);
+    test_read_ue(r);                    // sps_max_latency_increase_plus1
+    out->log2_min_luma_coding_block_size_minus3 = test_read_ue(r);
+    out->log2_diff_max_min_luma_coding_block_size = test_read_ue(r);
+    out->log2_min_transform_block_size_minus2 = test_read_ue(r);
+    out->log2_diff_max_min_transform_block_size = test_read_ue(r);
+    out->max_transform_hierarchy_depth_inter = test_read_ue(r);
+    out->max_transform_hierarchy_depth_intra = test_read_ue(r);
+
+    out->scaling_list_enabled_flag = test_read_u(r, 1);
+    if (out->scaling_list_enabled_flag)
+    {
+        p->scaling_list_data_present = test_read_u(r, 1);
+        if (p->scaling_list_data_present)
+            parse_scaling_list_data(r, out);
+        else
+            default_scaling_lists(out);
+    }
+
+    out->amp_enabled_flag = test_read_u(r, 1);
+    out->sample_adaptive_offset_enabled_flag = test_read_u(r, 1);
+    out->pcm_enabled_flag = test_read_u(r, 1);
+    if (out->pcm_enabled_flag)
+    {
+        out->pcm_sample_bit_depth_luma_minus1 = test_read_u(r, 4);
+        out->pcm_sample_bit_depth_chroma_minus1 = test_read_u(r, 4);
+        out->log2_min_pcm_luma_coding_block_size_minus3 = test_read_ue(r);
+        out->log2_diff_max_min_pcm_luma_coding_block_size = test_read_ue(r);
+        out->pcm_loop_filter_disabled_flag = test_read_u(r, 1);
+    }
+
+    out->num_short_term_ref_pic_sets = test_read_ue(r);
+    CHECK(out->num_short_term_ref_pic_sets <= HEVC_MAX_ST_RPS, "num_short_term_ref_pic_sets %d",
+          out->num_short_term_ref_pic_sets);
+    for (i = 0; i < out->num_short_term_ref_pic_sets && i < HEVC_MAX_ST_RPS && !test_bits_overrun(r); i++)
+        parse_st_ref_pic_set(r, i, &p->sets[i]);
+
+    out->long_term_ref_pics_present_flag = test_read_u(r, 1);
+    if (out->long_term_ref_pics_present_flag)
+    {
+        out->num_long_term_ref_pics_sps = test_read_ue(r);
+        CHECK(out->num_long_term_ref_pics_sps <= 32, "num_long_term_ref_pics_sps %d", out->num_long_term_ref_pics_sps);
+        for (i = 0; i < out->num_long_term_ref_pics_sps && i < 32; i++)
+        {
+            p->lt_ref_pic_poc_lsb[i] = test_read_u(r, out->log2_max_pic_order_cnt_lsb_minus4 + 4);
+            p->used_by_curr_pic_lt[i] = test_read_u(r, 1);
+        }
+    }
+
+    out->sps_temporal_mvp_enabled_flag = test_read_u(r, 1);
+    out->strong_intra_smoothing_enabled_flag = test_read_u(r, 1);
+    CHECK(test_read_u(r, 1) == 0, "vui_parameters_present_flag");
+    CHECK(test_read_u(r, 1) == 0, "sps_extension_present_flag");
+    parse_trailing_bits("SPS", r);
+}
+
+// 7.3.2.3
+static void parse_pps(test_bits_t *r, VdpPictureInfoHEVC *out)
+{
+    int i;
+
+    CHECK(test_read_ue(r) == 0, "pps_pic_parameter_set_id");
+    CHECK(test_read_ue(r) == 0, "pps_seq_parameter_set_id");
+    out->dependent_slice_segments_enabled_flag = test_read_u(r, 1);
+    out->output_flag_present_flag = test_read_u(r, 1);
+    out->num_extra_slice_header_bits = test_read_u(r, 3);
+    out->sign_data_hiding_enabled_flag = test_read_u(r, 1);
+    out->cabac_init_present_flag = test_read_u(r, 1);
+    out->num_ref_idx_l0_default_active_minus1 = test_read_ue(r);
+    out->num_ref_idx_l1_default_active_minus1 = test_read_ue(r);
+    out->init_qp_minus26 = test_read_se(r);
+    out->constrained_intra_pred_flag = test_read_u(r, 1);
+    out->transform_skip_enabled_flag = test_read_u(r, 1);
+    out->cu_qp_delta_enabled_flag = test_read_u(r, 1);
+    if (out->cu_qp_delta_enabled_flag)
+        out->diff_cu_qp_delta_depth = test_read_ue(r);
+    out->pps_cb_qp_offset = test_read_se(r);
+    out->pps_cr_qp_offset = test_read_se(r);
+    out->pps_slice_chroma_qp_offsets_present_flag = test_read_u(r, 1);
+    out->weighted_pred_flag = test_read_u(r, 1);
+    out->weighted_bipred_flag = test_read_u(r, 1);
+    out->transquant_bypass_enabled_flag = test_read_u(r, 1);
+    out->tiles_enabled_flag = test_read_u(r, 1);
+    out->entropy_coding_sync_enabled_flag = test_read_u(r, 1);
+    if (out->tiles_enabled_flag)
+    {
+        out->num_tile_columns_minus1 = test_read_ue(r);
+        out->num_tile_rows_minus1 = test_read_ue(r);
+        out->uniform_spacing_flag = test_read_u(r, 1);
+        if (!out->uniform_spacing_flag)
+        {
+            CHECK(out->num_tile_columns_minus1 < 20 && out->num_tile_rows_minus1 < 22, "%d x %d tiles",
+                  out->num_tile_columns_minus1 + 1, out->num_tile_rows_minus1 + 1);
+            for (i = 0; i < out->num_tile_columns_minus1 && i < 20; i++)
+                out->column_width_minus1[i] = test_read_ue(r);
+            for (i = 0; i < out->num_tile_rows_minus1 && i < 22; i++)
+                out->row_height_minus1[i] = test_read_ue(r);
+        }
+        out->loop_filter_across_tiles_enabled_flag = test_read_u(r, 1);
+    }
+    out->pps_loop_filter_across_slices_enabled_flag = test_read_u(r, 1);
+    out->deblocking_filter_control_present_flag = test_read_u(r, 1);
+    if (out->deblocking_filter_control_present_flag)
+    {
+        out->deblocking_filter_override_enabled_flag = test_read_u(r, 1);
+        out->pps_deblocking_filter_disabled_flag = test_read_u(r, 1);
+        if (!out->pps_deblocking_filter_disabled_flag)
+        {
+            out->pps_beta_offset_div2 = test_read_se(r);
+            out->pps_tc_offset_div2 = test_read_se(r);
+        }
+    }
+    CHECK(test_read_u(r, 1) == 0, "pps_scaling_list_data_present_flag");
+    out->lists_modification_present_flag = test_read_u(r, 1);
+    out->log2_parallel_merge_level_minus2 = test_read_ue(r);
+    out->slice_segment_header_extension_present_flag = test_read_u(r, 1);
+    CHECK(test_read_u(r, 1) == 0, "pps_extension_present_flag");
+    parse_trailing_bits("PPS", r);
+}
+
+// 7.3.1.2 and B.2, the three NAL units in order, returns 0 if they all parsed
+static int parse_parameter_sets(const uint8_t *buf, int len, VdpPictureInfoHEVC *out, parsed_t *p)
+{
+    static const int types[] = { HEVC_NAL_VPS, HEVC_NAL_SPS, HEVC_NAL_PPS };
+    static uint8_t rbsp[HEVC_RBSP_MAX_SIZE];
+    int start[4], count = 0, i;
+    int failures = test_failures;
+
+    memset(out, 0, sizeof(*out));
+    memset(p, 0, sizeof(*p));
+
+    for (i = 0; i + 3 < len && count < 3; i++)
+        if (!buf[i] && !buf[i + 1] && buf[i + 2] == 0x01)
+            start[count++] = i;
+    start[count] = len;
+    CHECK(count == 3 && start[0] == 0, "%d NAL units, the first at %d", count, count ? start[0] : -1);
+    if (count != 3 || start[0])
+        return -1;
+
+    for (i = 0; i < 3; i++)
+    {
+        const uint8_t *nal = buf + start[i] + 3;
+        int size = start[i + 1] - start[i] - 3;
+        test_bits_t r;
+
+        CHECK(size > 2 && size - 2 <= (int)sizeof(rbsp), "NAL unit %d of %d bytes", i, size);
+        if (size <= 2 || size - 2 > (int)sizeof(rbsp))
+            return -1;
+
+        // forbidden_zero_bit, nal_unit_type, nuh_layer_id, nuh_temporal_id_plus1
+        test_bits_init(&r, nal, 2);
+        CHECK(test_read_u(&r, 1) == 0, "forbidden_zero_bit");
+        CHECK((int)test_read_u(&r, 6) == types[i], "NAL unit %d of type %d", i, nal[0] >> 1);
+        CHECK(test_read_u(&r, 6) == 0, "nuh_layer_id");
+        CHECK(test_read_u(&r, 3) == 1, "nuh_temporal_id_plus1");
+        CHECK(!test_has_emulation(nal + 2, size - 2), "NAL unit %d emulates a start code", i);
+
+        test_bits_init(&r, rbsp, test_unescape(nal + 2, size - 2, rbsp));
+        if (i == 0)
+            parse_vps(&r, p);
+        else if (i == 1)
+            parse_sps(&r, out, p);
+        else
+            parse_pps(&r, out);
+        CHECK(!test_bits_overrun(&r), "NAL unit %d read past its end", i);
+    }
+
+    return test_failures == failures ? 0 : -1;
+}
+
+static int random_range(int lo, int hi)
+{
+    return lo + rand() % (hi - lo + 1);
+}
+
+static void random_rps(hevc_st_rps_t *set)
+{
+    int i, poc;
+
+    memset(set, 0, sizeof(*set));
+    set->num_negative = random_range(0, 8);
+    set->num_positive = random_range(0, HEVC_MAX_DPB - set->num_negative > 8 ? 8 : HEVC_MAX_DPB - set->num_negative);
+    for (i = 0, poc = 0; i < set->num_negative; i++)
+    {
+        poc -= random_range(1, 40);
+        set->delta_poc[i] = poc;
+        set->used[i] = rand() & 1;
+    }
+    for (poc = 0; i < set->num_negative + set->num_positive; i++)
+    {
+        poc += random_range(1, 40);
+        set->delta_poc[i] = poc;
+        set->used[i] = rand() & 1;
+    }
+}
+
+static void random_info(VdpPictureInfoHEVC *info, hevc_rps_table_t *rps, int *width, int *height)
+{
+    int i, j;
+
+    memset(info, 0, sizeof(*info));
+    memset(rps, 0, sizeof(*rps));
+
+    info->chroma_format_idc = random_range(0, 3);
+    if (info->chroma_format_idc == 3)
+        info->separate_colour_plane_flag = rand() & 1;
+    info->pic_width_in_luma_samples = 8 * random_range(1, 512);
+    info->pic_height_in_luma_samples = 8 * random_range(1, 288);
+
+    // the decoder size is the coded one, or cropped by whole chroma samples
+    int sub_width = (info->chroma_format_idc == 1 || info->chroma_format_idc == 2) ? 2 : 1;
+    int sub_height = info->chroma_format_idc == 1 ? 2 : 1;
+    *width = info->pic_width_in_luma_samples - (rand() & 1 ? sub_width * random_range(0, 3) : 0);
+    *height = info->pic_height_in_luma_samples - (rand() & 1 ? sub_height * random_range(0, 3) : 0);
+
+    info->bit_depth_luma_minus8 = random_range(0, 2);
+    info->bit_depth_chroma_minus8 = random_range(0, 2);
+    info->log2_max_pic_order_cnt_lsb_minus4 = random_range(0, 12);
+    info->sps_max_dec_pic_buffering_minus1 = random_range(0, 15);
+    info->log2_min_luma_coding_block_size_minus3 = random_range(0, 3);
+    info->log2_diff_max_min_luma_coding_block_size = random_range(0, 3);
+    info->log2_min_transform_block_size_minus2 = random_range(0, 3);
+    info->log2_diff_max_min_transform_block_size = random_range(0, 3);
+    info->max_transform_hierarchy_depth_inter = random_range(0, 4);
+    info->max_transform_hierarchy_depth_intra = random_range(0, 4);
+
+    info->scaling_list_enabled_flag = rand() & 1;
+    if (info->scaling_list_enabled_flag)
+    {
+        switch (rand() % 4)
+        {
+        case 0:
+            // not filled in, which the writer takes as the defaults
+            break;
+        case 1:
+            default_scaling_lists(info);
+            break;
+        default:
+            // anything but 0, which isn't a valid scaling factor
+            for (i = 0; i < 6; i++)
+            {
+                for (j = 0; j < 16; j++)
+                    info->ScalingList4x4[i][j] = random_range(1, 255);
+                for (j = 0; j < 64; j++)
+                {
+                    info->ScalingList8x8[i][j] = random_range(1, 255);
+                    info->ScalingList16x16[i][j] = random_range(1, 255);
+                    if (i < 2)
+                        info->ScalingList32x32[i][j] = random_range(1, 255);
+                }
+                info->ScalingListDCCoeff16x16[i] = random_range(1, 255);
+                if (i < 2)
+                    info->ScalingListDCCoeff32x32[i] = random_range(1, 255);
+            }
+            break;
+        }
+    }
+
+    info->amp_enabled_flag = rand() & 1;
+    info->sample_adaptive_offset_enabled_flag = rand() & 1;
+    info->pcm_enabled_flag = rand() & 1;
+    if (info->pcm_enabled_flag)
+    {
+        info->pcm_sample_bit_depth_luma_minus1 = random_range(0, 15);
+        info->pcm_sample_bit_depth_chroma_minus1 = random_range(0, 15);
+        info->log2_min_pcm_luma_coding_block_size_minus3 = random_range(0, 2);
+        info->log2_diff_max_min_pcm_luma_coding_block_size = random_range(0, 2);
+        info->pcm_loop_filter_disabled_flag = rand() & 1;
+    }
+
+    info->num_short_term_ref_pic_sets = random_range(0, HEVC_MAX_ST_RPS);
+    for (i = 0; i < info->num_short_term_ref_pic_sets; i++)
+    {
+        rps->known[i] = rand() % 4 != 0;
+        if (rps->known[i])
+            random_rps(&rps->sets[i]);
+    }
+    rps->generation = rand();
+
+    info->long_term_ref_pics_present_flag = rand() & 1;
+    if (info->long_term_ref_pics_present_flag)
+        info->num_long_term_ref_pics_sps = random_range(0, 32);
+    info->sps_temporal_mvp_enabled_flag = rand() & 1;
+    info->strong_intra_smoothing_enabled_flag = rand() & 1;
+
+    info->dependent_slice_segments_enabled_flag = rand() & 1;
+    info->output_flag_present_flag = rand() & 1;
+    info->num_extra_slice_header_bits = random_range(0, 7);
+    info->sign_data_hiding_enabled_flag = rand() & 1;
+    info->cabac_init_present_flag = rand() & 1;
+    info->num_ref_idx_l0_default_active_minus1 = random_range(0, 14);
+    info->num_ref_idx_l1_default_active_minus1 = random_range(0, 14);
+    info->init_qp_minus26 = random_range(-26, 25);
+    info->constrained_intra_pred_flag = rand() & 1;
+    info->transform_skip_enabled_flag = rand() & 1;
+    info->cu_qp_delta_enabled_flag = rand() & 1;
+    if (info->cu_qp_delta_enabled_flag)
+        info->diff_cu_qp_delta_depth = random_range(0, 3);
+    info->pps_cb_qp_offset = random_range(-12, 12);
+    info->pps_cr_qp_offset = random_range(-12, 12);
+    info->pps_slice_chroma_qp_offsets_present_flag = rand() & 1;
+    info->weighted_pred_flag = rand() & 1;
+    info->weighted_bipred_flag = rand() & 1;
+    info->transquant_bypass_enabled_flag = rand() & 1;
+    info->tiles_enabled_flag = rand() & 1;
+    info->entropy_coding_sync_enabled_flag = rand() & 1;
+    if (info->tiles_enabled_flag)
+    {
+        info->num_tile_columns_minus1 = random_range(0, 19);
+        info->num_tile_rows_minus1 = random_range(0, 21);
+        info->uniform_spacing_flag = rand() & 1;
+        if (!info->uniform_spacing_flag)
+        {
+            for (i = 0; i < info->num_tile_columns_minus1; i++)
+                info->column_width_minus1[i] = random_range(0, 30);
+            for (i = 0; i < info->num_tile_rows_minus1; i++)
+                info->row_height_minus1[i] = random_range(0, 16);
+        }
+        info->loop_filter_across_tiles_enabled_flag = rand() & 1;
+    }
+    info->pps_loop_filter_across_slices_enabled_flag = rand() & 1;
+    info->deblocking_filter_control_present_flag = rand() & 1;
+    if (info->deblocking_filter_control_present_flag)
+    {
+        info->deblocking_filter_override_enabled_flag = rand() & 1;
+        info->pps_deblocking_filter_disabled_flag = rand() & 1;
+        if (!info->pps_deblocking_filter_disabled_flag)
+        {
+            info->pps_beta_offset_div2 = random_range(-6, 6);
+            info->pps_tc_offset_div2 = random_range(-6, 6);
+        }
+    }
+    info->lists_modification_present_flag = rand() & 1;
+    info->log2_parallel_merge_level_minus2 = random_range(0, 4);
+    info->slice_segment_header_extension_present_flag = rand() & 1;
+}
+
+static int all_zero(const uint8_t *data, int len)
+{
+    int i;
+
+    for (i = 0; i < len; i++)
+        if (data[i])
+            return 0;
+
+    return 1;
+}
+
+// whether the input lists could only be sent as scaling_list_data
+static int lists_explicit(const VdpPictureInfoHEVC *info)
+{
+    VdpPictureInfoHEVC defaults;
+
+    if (all_zero(info->ScalingList4x4[0], sizeof(info->ScalingList4x4)))
+        return 0;
+
+    default_scaling_lists(&defaults);
+    return memcmp(info->ScalingList4x4, defaults.ScalingList4x4, sizeof(defaults.ScalingList4x4)) ||
+           memcmp(info->ScalingList8x8, defaults.ScalingList8x8, sizeof(defaults.ScalingList8x8)) ||
+           memcmp(info->ScalingList16x16, defaults.ScalingList16x16, sizeof(defaults.ScalingList16x16)) ||
+           memcmp(info->ScalingList32x32, defaults.ScalingList32x32, sizeof(defaults.ScalingList32x32)) ||
+           memcmp(info->ScalingListDCCoeff16x16, defaults.ScalingListDCCoeff16x16, sizeof(defaults.ScalingListDCCoeff16x16)) ||
+           memcmp(info->ScalingListDCCoeff32x32, defaults.ScalingListDCCoeff32x32, sizeof(defaults.ScalingListDCCoeff32x32));
+}
+
+#define CHECK_FIELD(field) \
+    CHECK(out->field == in->field, #field " %d, expected %d", (int)out->field, (int)in->field)
+
+static void compare_info(const VdpPictureInfoHEVC *in, const VdpPictureInfoHEVC *out)
+{
+    int i;
+
+    CHECK_FIELD(chroma_format_idc);
+    CHECK_FIELD(separate_colour_plane_flag);
+    CHECK_FIELD(pic_width_in_luma_samples);
+    CHECK_FIELD(pic_height_in_luma_samples);
+    CHECK_FIELD(bit_depth_luma_minus8);
+    CHECK_FIELD(bit_depth_chroma_minus8);
+    CHECK_FIELD(log2_max_pic_order_cnt_lsb_minus4);
+    CHECK_FIELD(sps_max_dec_pic_buffering_minus1);
+    CHECK_FIELD(log2_min_luma_coding_block_size_minus3);
+    CHECK_FIELD(log2_diff_max_min_luma_coding_block_size);
+    CHECK_FIELD(log2_min_transform_block_size_minus2);
+    CHECK_FIELD(log2_diff_max_min_transform_block_size);
+    CHECK_FIELD(max_transform_hierarchy_depth_inter);
+    CHECK_FIELD(max_transform_hierarchy_depth_intra);
+    CHECK_FIELD(scaling_list_enabled_flag);
+    if (in->scaling_list_enabled_flag && !all_zero(in->ScalingList4x4[0], sizeof(in->ScalingList4x4)))
+    {
+        CHECK(!memcmp(out->ScalingList4x4, in->ScalingList4x4, sizeof(in->ScalingList4x4)), "ScalingList4x4");
+        CHECK(!memcmp(out->ScalingList8x8, in->ScalingList8x8, sizeof(in->ScalingList8x8)), "ScalingList8x8");
+        CHECK(!memcmp(out->ScalingList16x16, in->ScalingList16x16, sizeof(in->ScalingList16x16)), "ScalingList16x16");
+        CHECK(!memcmp(out->ScalingList32x32, in->ScalingList32x32, sizeof(in->ScalingList32x32)), "ScalingList32x32");
+        CHECK(!memcmp(out->ScalingListDCCoeff16x16, in->ScalingListDCCoeff16x16, sizeof(in->ScalingListDCCoeff16x16)),
+              "ScalingListDCCoeff16x16");
+        CHECK(!memcmp(out->ScalingListDCCoeff32x32, in->ScalingListDCCoeff32x32, sizeof(in->ScalingListDCCoeff32x32)),
+              "ScalingListDCCoeff32x32");
+    }
+    CHECK_FIELD(amp_enabled_flag);
+    CHECK_FIELD(sample_adaptive_offset_enabled_flag);
+    CHECK_FIELD(pcm_enabled_flag);
+    CHECK_FIELD(pcm_sample_bit_depth_luma_minus1);
+    CHECK_FIELD(pcm_sample_bit_depth_chroma_minus1);
+    CHECK_FIELD(log2_min_pcm_luma_coding_block_size_minus3);
+    CHECK_FIELD(log2_diff_max_min_pcm_luma_coding_block_size);
+    CHECK_FIELD(pcm_loop_filter_disabled_flag);
+    CHECK_FIELD(num_short_term_ref_pic_sets);
+    CHECK_FIELD(long_term_ref_pics_present_flag);
+    CHECK_FIELD(num_long_term_ref_pics_sps);
+    CHECK_FIELD(sps_temporal_mvp_enabled_flag);
+    CHECK_FIELD(strong_intra_smoothing_enabled_flag);
+
+    CHECK_FIELD(dependent_slice_segments_enabled_flag);
+    CHECK_FIELD(output_flag_present_flag);
+    CHECK_FIELD(num_extra_slice_header_bits);
+    CHECK_FIELD(sign_data_hiding_enabled_flag);
+    CHECK_FIELD(cabac_init_present_flag);
+    CHECK_FIELD(num_ref_idx_l0_default_active_minus1);
+    CHECK_FIELD(num_ref_idx_l1_default_active_minus1);
+    CHECK_FIELD(init_qp_minus26);
+    CHECK_FIELD(constrained_intra_pred_flag);
+    CHECK_FIELD(transform_skip_enabled_flag);
+    CHECK_FIELD(cu_qp_delta_enabled_flag);
+    CHECK_FIELD(diff_cu_qp_delta_depth);
+    CHECK_FIELD(pps_cb_qp_offset);
+    CHECK_FIELD(pps_cr_qp_offset);
+    CHECK_FIELD(pps_slice_chroma_qp_offsets_present_flag);
+    CHECK_FIELD(weighted_pred_flag);
+    CHECK_FIELD(weighted_bipred_flag);
+    CHECK_FIELD(transquant_bypass_enabled_flag);
+    CHECK_FIELD(tiles_enabled_flag);
+    CHECK_FIELD(entropy_coding_sync_enabled_flag);
+    CHECK_FIELD(num_tile_columns_minus1);
+    CHECK_FIELD(num_tile_rows_minus1);
+    CHECK_FIELD(uniform_spacing_flag);
+    for (i = 0; i < 20; i++)
+        CHECK_FIELD(column_width_minus1[i]);
+    for (i = 0; i < 22; i++)
+        CHECK_FIELD(row_height_minus1[i]);
+    CHECK_FIELD(loop_filter_across_tiles_enabled_flag);
+    CHECK_FIELD(pps_loop_filter_across_slices_enabled_flag);
+    CHECK_FIELD(deblocking_filter_control_present_flag);
+    CHECK_FIELD(deblocking_filter_override_enabled_flag);
+    CHECK_FIELD(pps_deblocking_filter_disabled_flag);
+    CHECK_FIELD(pps_beta_offset_div2);
+    CHECK_FIELD(pps_tc_offset_div2);
+    CHECK_FIELD(lists_modification_present_flag);
+    CHECK_FIELD(log2_parallel_merge_level_minus2);
+    CHECK_FIELD(slice_segment_header_extension_present_flag);
+}
+
+static void compare_rps(const VdpPictureInfoHEVC *in, const hevc_rps_table_t *rps, const parsed_t *p)
+{
+    static const hevc_st_rps_t empty_set;
+    int i, j;
+
+    for (i = 0; i < in->num_short_term_ref_pic_sets; i++)
+    {
+        const hevc_st_rps_t *want = rps->known[i] ? &rps->sets[i] : &empty_set;
+        const hevc_st_rps_t *got = &p->sets[i];
+        int n = want->num_negative + want->num_positive;
+
+        CHECK(got->num_negative == want->num_negative && got->num_positive == want->num_positive,
+              "set %d: %d negative, %d positive, expected %d and %d", i,
+              got->num_negative, got->num_positive, want->num_negative, want->num_positive);
+        for (j = 0; j < n && j < HEVC_MAX_DPB; j++)
+            CHECK(got->delta_poc[j] == want->delta_poc[j] && got->used[j] == want->used[j],
+                  "set %d entry %d: delta %d used %d, expected %d and %d", i, j,
+                  got->delta_poc[j], got->used[j], want->delta_poc[j], want->used[j]);
+    }
+
+    for (i = 0; i < in->num_long_term_ref_pics_sps; i++)
+        CHECK(p->lt_ref_pic_poc_lsb[i] == 0 && p->used_by_curr_pic_lt[i] == 1, "long-term picture %d", i);
+}
+
+static void test_round_trip(void)
+{
+    static uint8_t buf[4 * HEVC_RBSP_MAX_SIZE];
+    VdpPictureInfoHEVC in, out;
+    hevc_rps_table_t rps;
+    parsed_t p;
+    int round, width, height, len;
+
+    srand(1);
+
+    for (round = 0; round < ROUNDS; round++)
+    {
+        int failures = test_failures;
+
+        random_info(&in, &rps, &width, &height);
+        len = hevc_write_parameter_sets(width, height, VDP_DECODER_PROFILE_HEVC_MAIN, &in, &rps, buf, sizeof(buf));
+        CHECK(len > 0, "writer failed");
+        if (len <= 0 || parse_parameter_sets(buf, len, &out, &p) < 0)
+        {
+            fprintf(stderr, "  in round %d\n", round);
+            return;
+        }
+
+        CHECK(p.profile_idc == HEVC_PROFILE_MAIN, "general_profile_idc %d", p.profile_idc);
+        CHECK(p.compatibility == ((1u << HEVC_PROFILE_MAIN) | (1u << HEVC_PROFILE_MAIN_10)),
+              "general_profile_compatibility_flag 0x%08x", p.compatibility);
+        CHECK(p.level_idc >= 30 && p.level_idc <= 186 && p.level_idc % 3 == 0, "general_level_idc %d", p.level_idc);
+        CHECK(p.vps_max_dec_pic_buffering_minus1 == in.sps_max_dec_pic_buffering_minus1, "vps_max_dec_pic_buffering_minus1");
+        CHECK(p.sps_max_num_reorder_pics <= in.sps_max_dec_pic_buffering_minus1, "sps_max_num_reorder_pics %d",
+              p.sps_max_num_reorder_pics);
+
+        int sub_width = (in.chroma_format_idc == 1 || in.chroma_format_idc == 2) ? 2 : 1;
+        int sub_height = in.chroma_format_idc == 1 ? 2 : 1;
+        CHECK(in.pic_width_in_luma_samples - p.conf_win_right * sub_width == (uint32_t)width &&
+              in.pic_height_in_luma_samples - p.conf_win_bottom * sub_height == (uint32_t)height,
+              "conformance window of %ux%u gives %ux%u, expected %dx%d",
+              in.pic_width_in_luma_samples, in.pic_height_in_luma_samples,
+              in.pic_width_in_luma_samples - p.conf_win_right * sub_width,
+              in.pic_height_in_luma_samples - p.conf_win_bottom * sub_height, width, height);
+
+        if (in.scaling_list_enabled_flag)
+            CHECK(p.scaling_list_data_present == lists_explicit(&in), "sps_scaling_list_data_present_flag %d",
+                  p.scaling_list_data_present);
+        compare_info(&in, &out);
+        compare_rps(&in, &rps, &p);
+
+        if (test_failures != failures)
+        {
+            fprintf(stderr, "  in round %d\n", round);
+            return;
+        }
+    }
+}
+
+// a set learned from the DPB of a picture comes back from the SPS, from the next IRAP picture on
+static void test_learned_rps(void)
+{
+    static uint8_t buf[4 * HEVC_RBSP_MAX_SIZE];
+    static const int32_t pocs[] = { 8, 4, 16, 6, 12 };
+    VdpPictureInfoHEVC in, out;
+    hevc_rps_table_t rps;
+    parsed_t p;
+    int width, height, i, len;
+
+    srand(2);
+    random_info(&in, &rps, &width, &height);
+    memset(&rps, 0, sizeof(rps));
+    in.num_short_term_ref_pic_sets = 4;
+    in.CurrRpsIdx = 2;
+    in.CurrPicOrderCntVal = 10;
+    for (i = 0; i < 16; i++)
+        in.RefPics[i] = i < 5 ? i + 1 : VDP_INVALID_HANDLE;
+    memcpy(in.PicOrderCntVal, pocs, sizeof(pocs));
+    // 8 and 12 are referenced by the picture, the others only kept
+    in.NumPocStCurrBefore = 1;
+    in.RefPicSetStCurrBefore[0] = 0;
+    in.NumPocStCurrAfter = 1;
+    in.RefPicSetStCurrAfter[0] = 4;
+
+    // a trailing picture doesn't change the SPS
+    hevc_learn_rps(&rps, &in);
+    CHECK(rps.generation == 0 && !rps.known[2], "set taken over at a trailing picture");
+
+    // the next CRA does, even if it uses none of the sets itself
+    in.RAPPicFlag = 1;
+    in.CurrRpsIdx = 4;
+    hevc_learn_rps(&rps, &in);
+    CHECK(rps.generation == 1 && rps.known[2], "set not taken over at the CRA picture");
+    hevc_learn_rps(&rps, &in);
+    CHECK(rps.generation == 1, "SPS changes again without a new set");
+
+    len = hevc_write_parameter_sets(width, height, VDP_DECODER_PROFILE_HEVC_MAIN, &in, &rps, buf, sizeof(buf));
+    CHECK(len > 0, "writer failed");
+    if (len <= 0 || parse_parameter_sets(buf, len, &out, &p) < 0)
+        return;
+
+    static const int32_t deltas[] = { -2, -4, -6, 2, 6 };
+    static const uint8_t used[] = { 1, 0, 0, 1, 0 };
+    const hevc_st_rps_t *set = &p.sets[2];
+    CHECK(set->num_negative == 3 && set->num_positive == 2, "learned set: %d negative, %d positive",
+          set->num_negative, set->num_positive);
+    for (i = 0; i < 5; i++)
+        CHECK(set->delta_poc[i] == deltas[i] && set->used[i] == used[i], "learned set entry %d: delta %d used %d",
+              i, set->delta_poc[i], set->used[i]);
+    CHECK(!p.sets[0].num_negative && !p.sets[0].num_positive, "unknown set 0 isn't empty");
+}
+
+int main(int argc, char **argv)
+{
+    test_round_trip();
+    test_learned_rps();
+
+    return test_done("test_hevc");
+}
+
+#else
+
+int main(int argc, char **argv)
+{
+    printf("test_hevc: skipped, VDPAU without HEVC\n");
+    return 0;
+}
+
+#endif
@@ -0,0 +1,92 @@
+/*
+ * Copyright (c) 2013 Jens Kuske <jenskuske@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+/*
+ * A source in error stays readable for level-triggered epoll, like a V4L2
+ * queue without buffers returning POLLERR. The write end of a pipe whose
+ * read end is closed does the same. A handler that disarms it must not be
+ * called again until reactor_arm(), and once after that.
+ */
+
+#include <unistd.h>
+#include <sys/epoll.h>
+
+#include "test.h"
+#include "v4l2_reactor.h"
+
+static volatile int calls;
+static volatile uint32_t seen;
+
+static int on_error(void *arg, uint32_t events)
+{
+    calls++;
+    seen |= events;
+    return REACTOR_DISARM;
+}
+
+static volatile int rearm_id = -1;
+
+// reactor_arm() from a handler, with the reactor lock held, must not deadlock
+static int rearm_once(void *arg, uint32_t events)
+{
+    // may run before reactor_add() returned the id
+    while (rearm_id < 0)
+        ;
+
+    if (++calls == 1) {
+        reactor_arm(rearm_id);
+        return REACTOR_KEEP;
+    }
+    return REACTOR_DISARM;
+}
+
+int main(int argc, char **argv)
+{
+    int fds[2], id;
+
+    if (pipe(fds))
+        return 1;
+    close(fds[0]);
+
+    id = reactor_add(fds[1], EPOLLOUT, on_error, NULL);
+    CHECK(id >= 0, "reactor_add failed");
+    usleep(50000);
+    CHECK(calls == 1, "handler called %d times while disarmed", calls);
+    CHECK(seen & EPOLLERR, "no EPOLLERR in events 0x%x", seen);
+
+    reactor_arm(id);
+    usleep(50000);
+    CHECK(calls == 2, "handler called %d times after one reactor_arm()", calls);
+
+    reactor_remove(id);
+    reactor_arm(id);
+    usleep(50000);
+    CHECK(calls == 2, "handler called after reactor_remove()");
+
+    calls = 0;
+    rearm_id = reactor_add(fds[1], EPOLLOUT, rearm_once, NULL);
+    CHECK(rearm_id >= 0, "reactor_add failed");
+    usleep(50000);
+    CHECK(calls == 2, "handler arming itself called %d times", calls);
+    reactor_remove(rearm_id);
+
+    close(fds[1]);
+
+    return test_done("test_reactor");
+}
@@ -0,0 +1,137 @@
+/*
+ * Copyright (c) 2013 Jens Kuske <jenskuske@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+/*
+ * Runs the MFC backend of v4l2decode.c against the software MFC of
+ * v4l2_mock.c through a resolution change. The mock holds pictures back like
+ * a DPB, so the pictures of the old size are only all returned if the backend
+ * drains CAPTURE up to V4L2_BUF_FLAG_LAST or EPIPE before it sets it up
+ * again. Every picture has to come out once, in order, at its own size.
+ */
+
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "test.h"
+#include "vdpau_private.h"
+#include "v4l2_mock.h"
+
+#define PICTURES        40
+#define CHANGE_AFTER    10
+#define DPB_DELAY       2
+#define DECODE_US       2000
+
+static const uint8_t header[] = { 0x00, 0x00, 0x00, 0x01, 0x67, 0x4d, 0x40, 0x28,
+                                  0x00, 0x00, 0x00, 0x01, 0x68, 0xee, 0x3c, 0x80 };
+static const uint8_t slice[] = { 0x00, 0x00, 0x00, 0x01, 0x65, 0x88, 0x84, 0x00, 0x33 };
+
+static uint32_t received;
+
+// hands back every picture that is ready within timeout_ms, checking each
+static void collect(void *dec, int timeout_ms)
+{
+    int frame, idle = 0;
+    void **output;
+    VdpVideoSurface surface;
+    uint32_t generation;
+
+    for (;;) {
+        CHECK(decoder_backend_mfc.get_picture(dec, &frame, &output, &surface, &generation) == VDP_STATUS_OK,
+              "get_picture failed after %u pictures", received);
+        if (frame < 0) {
+            if (idle++ >= timeout_ms)
+                break;
+            usleep(1000);
+            continue;
+        }
+        idle = 0;
+
+        v4l2_mock_picture_t picture;
+        memcpy(&picture, output[0], sizeof(picture));
+        CHECK(picture.sequence == received, "picture %u came as number %u", picture.sequence, received);
+        if (picture.sequence < CHANGE_AFTER)
+            CHECK(picture.width == 1280 && picture.height == 720,
+                  "picture %u is %ux%u, expected the old size", picture.sequence, picture.width, picture.height);
+        else
+            CHECK(picture.width == 1920 && picture.height == 1080,
+                  "picture %u is %ux%u, expected the new size", picture.sequence, picture.width, picture.height);
+        CHECK(surface == picture.sequence + 1 && generation == 1, "picture %u was decoded for surface %u, render %u",
+              picture.sequence, surface, generation);
+        received = picture.sequence + 1;
+
+        CHECK(decoder_backend_mfc.release_picture(dec, frame) == VDP_STATUS_OK,
+              "release_picture %d failed", frame);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    VdpBitstreamBuffer buffer = { VDP_BITSTREAM_BUFFER_VERSION };
+    v4l2_mock_stats_t stats;
+    uint32_t i;
+
+    v4l2_mock_config.decode_us = DECODE_US;
+    v4l2_mock_config.width = 1280;
+    v4l2_mock_config.height = 720;
+    v4l2_mock_config.dpb_delay = DPB_DELAY;
+    v4l2_mock_config.change_after = CHANGE_AFTER;
+    v4l2_mock_config.change_width = 1920;
+    v4l2_mock_config.change_height = 1080;
+
+    void *dec = decoder_backend_mfc.open(VDP_DECODER_PROFILE_H264_MAIN, 1280, 720, 4);
+    CHECK(dec, "cannot open the MFC backend on the mock device");
+    if (!dec)
+        return test_done("test_source_change");
+
+    buffer.bitstream = header;
+    buffer.bitstream_bytes = sizeof(header);
+    CHECK(decoder_backend_mfc.decode(dec, 1, &buffer, VDP_INVALID_HANDLE, 0) == VDP_STATUS_OK,
+          "decoding the header failed");
+
+    buffer.bitstream = slice;
+    buffer.bitstream_bytes = sizeof(slice);
+    for (i = 0; i < PICTURES; i++) {
+        // surfaces are plain tags here, 1 based so none is VDP_INVALID_HANDLE
+        CHECK(decoder_backend_mfc.decode(dec, 1, &buffer, i + 1, 1) == VDP_STATUS_OK,
+              "decoding picture %u failed", i);
+        // a player's mixer keeps asking, the MFC stalls at the change until it was drained
+        collect(dec, 10 * DECODE_US / 1000);
+    }
+    collect(dec, 500);
+
+    v4l2_mock_stats(&stats);
+    CHECK(stats.source_changes == 1, "%u resolution changes", stats.source_changes);
+    CHECK(stats.pictures == PICTURES, "the mock decoded %llu of %u pictures",
+          (unsigned long long)stats.pictures, PICTURES);
+    // the last DPB_DELAY wait for pictures that never come
+    CHECK(received == PICTURES - DPB_DELAY, "%u of %u pictures came out", received, PICTURES - DPB_DELAY);
+
+    // exported at the new size, and nothing past the buffers
+    decoder_dmabuf_t dmabuf;
+    CHECK(decoder_backend_mfc.get_dmabuf(dec, 0, &dmabuf) == VDP_STATUS_OK, "cannot export picture 0");
+    CHECK(dmabuf.planes == 2 && dmabuf.width == 1920 && dmabuf.height == 1080 && dmabuf.pitch[0] == 1920 &&
+          dmabuf.pitch[1] == 1920 && dmabuf.offset[1] == 0, "exported %d planes of %ux%u, pitch %u/%u",
+          dmabuf.planes, dmabuf.width, dmabuf.height, dmabuf.pitch[0], dmabuf.pitch[1]);
+    CHECK(decoder_backend_mfc.get_dmabuf(dec, -1, &dmabuf) != VDP_STATUS_OK, "exported picture -1");
+    CHECK(decoder_backend_mfc.get_dmabuf(dec, 64, &dmabuf) != VDP_STATUS_OK, "exported picture 64");
+
+    decoder_backend_mfc.close(dec);
+
+    return test_done("test_source_change");
+}
@@ -0,0 +1,192 @@
+/*
+ * Copyright (c) 2013 Jens Kuske <jenskuske@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+/*
+ * Runs the generic stateful backend of v4l2_stateful.c against the
+ * mock-m2m-dec node of v4l2_mock.c, once for every CAPTURE layout the
+ * backend negotiates. The first bitstream buffer holds the header and a
+ * picture, which only decodes once the backend set CAPTURE up on the
+ * SOURCE_CHANGE event. Later the size changes, and the pictures of the old
+ * size only all come out if the backend drains CAPTURE up to the empty
+ * V4L2_BUF_FLAG_LAST buffer before it reallocates. Every picture has to
+ * come out once, in order, at its own size, with the chroma planes where
+ * the mock put them.
+ */
+
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "test.h"
+#include "vdpau_private.h"
+#include "v4l2_mock.h"
+
+#define PICTURES        30
+#define CHANGE_AFTER    10
+#define DPB_DELAY       2
+#define DECODE_US       1000
+
+static const uint8_t header_slice[] = { 0x00, 0x00, 0x00, 0x01, 0x67, 0x4d, 0x40, 0x28,
+                                        0x00, 0x00, 0x00, 0x01, 0x68, 0xee, 0x3c, 0x80,
+                                        0x00, 0x00, 0x00, 0x01, 0x65, 0x88, 0x84, 0x00, 0x33 };
+static const uint8_t slice[] = { 0x00, 0x00, 0x00, 0x01, 0x41, 0x9a, 0x02, 0x00, 0x33 };
+
+static const struct
+{
+    __u32 fourcc;
+    const char *name;
+    int planes;
+} formats[] =
+{
+    { V4L2_PIX_FMT_YUV420M, "YUV420M", 3 },
+    { V4L2_PIX_FMT_YUV420, "YUV420", 3 },
+    { V4L2_PIX_FMT_NV12M, "NV12M", 2 },
+    { V4L2_PIX_FMT_NV12, "NV12", 2 },
+};
+
+static uint32_t received;
+static uint32_t generations[2];
+
+// the picture in frame against what the mock decoded into it
+static void check_picture(void *dec, const char *name, int planes, int frame, void **output,
+                          VdpVideoSurface surface)
+{
+    v4l2_mock_picture_t picture;
+    decoder_dmabuf_t dmabuf;
+    uint32_t width, height;
+    int changed;
+
+    memcpy(&picture, output[0], sizeof(picture));
+    CHECK(picture.sequence == received, "%s: picture %u came as number %u", name, picture.sequence, received);
+    changed = picture.sequence >= CHANGE_AFTER;
+    width = changed ? 1280 : 1920;
+    height = changed ? 720 : 1080;
+    CHECK(picture.width == width && picture.height == height, "%s: picture %u is %ux%u, expected %ux%u",
+          name, picture.sequence, picture.width, picture.height, width, height);
+    CHECK(surface == picture.sequence + 1, "%s: picture %u was decoded for surface %u", name, picture.sequence, surface);
+
+    CHECK(((uint8_t *)output[1])[0] == 0x81, "%s: picture %u has no Cb%s plane where expected",
+          name, picture.sequence, planes == 2 ? "Cr" : "");
+    if (planes == 3)
+        CHECK(output[2] && ((uint8_t *)output[2])[0] == 0x82, "%s: picture %u has no Cr plane where expected",
+              name, picture.sequence);
+    else
+        CHECK(!output[2], "%s: NV12 picture %u has a third plane", name, picture.sequence);
+
+    // the visible size, not the coded 1088 lines
+    CHECK(decoder_backend_v4l2.get_dmabuf(dec, frame, &dmabuf) == VDP_STATUS_OK, "%s: cannot export picture %u",
+          name, picture.sequence);
+    CHECK(dmabuf.planes == planes && dmabuf.width == width && dmabuf.height == height,
+          "%s: picture %u exported as %d planes of %ux%u", name, picture.sequence, dmabuf.planes, dmabuf.width, dmabuf.height);
+    CHECK(dmabuf.pitch[0] == width && dmabuf.pitch[1] == (planes == 3 ? width / 2 : width),
+          "%s: picture %u exported with pitch %u/%u", name, picture.sequence, dmabuf.pitch[0], dmabuf.pitch[1]);
+    if (generations[changed] && generations[changed] != dmabuf.generation)
+        CHECK(0, "%s: picture %u from buffers of generation %u, not %u", name, picture.sequence,
+              dmabuf.generation, generations[changed]);
+    generations[changed] = dmabuf.generation;
+
+    received = picture.sequence + 1;
+}
+
+// hands back every picture that is ready within timeout_ms, checking each
+static void collect(void *dec, const char *name, int planes, int timeout_ms)
+{
+    int frame, idle = 0;
+    void **output;
+    VdpVideoSurface surface;
+    uint32_t generation;
+
+    for (;;) {
+        CHECK(decoder_backend_v4l2.get_picture(dec, &frame, &output, &surface, &generation) == VDP_STATUS_OK,
+              "%s: get_picture failed after %u pictures", name, received);
+        if (frame < 0) {
+            if (idle++ >= timeout_ms)
+                break;
+            usleep(1000);
+            continue;
+        }
+        idle = 0;
+
+        check_picture(dec, name, planes, frame, output, surface);
+        CHECK(decoder_backend_v4l2.release_picture(dec, frame) == VDP_STATUS_OK,
+              "%s: release_picture %d failed", name, frame);
+    }
+}
+
+static void run(__u32 fourcc, const char *name, int planes)
+{
+    VdpBitstreamBuffer buffer = { VDP_BITSTREAM_BUFFER_VERSION };
+    v4l2_mock_stats_t before, after;
+    uint32_t i;
+
+    v4l2_mock_config.capture_format = fourcc;
+    received = 0;
+    generations[0] = generations[1] = 0;
+    v4l2_mock_stats(&before);
+
+    void *dec = decoder_backend_v4l2.open(VDP_DECODER_PROFILE_H264_MAIN, 1920, 1080, 4);
+    CHECK(dec, "%s: cannot open the stateful backend on the mock device", name);
+    if (!dec)
+        return;
+
+    // header and first picture together, the picture has to wait for CAPTURE
+    buffer.bitstream = header_slice;
+    buffer.bitstream_bytes = sizeof(header_slice);
+    CHECK(decoder_backend_v4l2.decode(dec, 1, &buffer, 1, 1) == VDP_STATUS_OK, "%s: decoding picture 0 failed", name);
+    collect(dec, name, planes, 10 * DECODE_US / 1000);
+
+    buffer.bitstream = slice;
+    buffer.bitstream_bytes = sizeof(slice);
+    for (i = 1; i < PICTURES; i++) {
+        // surfaces are plain tags here, 1 based so none is VDP_INVALID_HANDLE
+        CHECK(decoder_backend_v4l2.decode(dec, 1, &buffer, i + 1, 1) == VDP_STATUS_OK,
+              "%s: decoding picture %u failed", name, i);
+        collect(dec, name, planes, 10 * DECODE_US / 1000);
+    }
+    collect(dec, name, planes, 200);
+
+    v4l2_mock_stats(&after);
+    CHECK(after.source_changes - before.source_changes == 1, "%s: %u resolution changes", name,
+          after.source_changes - before.source_changes);
+    CHECK(after.pictures - before.pictures == PICTURES, "%s: the mock decoded %llu of %u pictures", name,
+          (unsigned long long)(after.pictures - before.pictures), PICTURES);
+    // the last DPB_DELAY wait for pictures that never come
+    CHECK(received == PICTURES - DPB_DELAY, "%s: %u of %u pictures came out", name, received, PICTURES - DPB_DELAY);
+    CHECK(generations[0] && generations[1] && generations[0] != generations[1],
+          "%s: CAPTURE wasn't reallocated at the change", name);
+
+    decoder_backend_v4l2.close(dec);
+}
+
+int main(int argc, char **argv)
+{
+    unsigned int i;
+
+    v4l2_mock_config.decode_us = DECODE_US;
+    v4l2_mock_config.width = 1920;
+    v4l2_mock_config.height = 1080;
+    v4l2_mock_config.dpb_delay = DPB_DELAY;
+    v4l2_mock_config.change_after = CHANGE_AFTER;
+    v4l2_mock_config.change_width = 1280;
+    v4l2_mock_config.change_height = 720;
+
+    for (i = 0; i < sizeof(formats) / sizeof(formats[0]); i++)
+        run(formats[i].fourcc, formats[i].name, formats[i].planes);
+
+    return test_done("test_stateful");
+}
@@ -0,0 +1,384 @@
+/*
+ * Copyright (c) 2013 Jens Kuske <jenskuske@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+/*
+ * Runs the stateless backend of v4l2_stateless.c against the
+ * mock-stateless-dec node of v4l2_mock.c, with H.264 handed over the way
+ * VDPAU does: a VdpPictureInfoH264 and the slices of each picture. An
+ * IDR-P-B-B stream runs long enough for frame_num to wrap and for every
+ * request to be refilled many times, while the pictures are released as soon
+ * as they come out, so a buffer a reference lives in is always free to be
+ * picked. The mock counts any picture decoded over a reference. A field pair
+ * has to come out once, as one picture, and after a flush no picture decoded
+ * before it may be referenced any more.
+ */
+
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "test.h"
+#include "vdpau_private.h"
+#include "h264_stream.h"
+#include "v4l2_mock.h"
+
+#ifdef V4L2_CID_STATELESS_H264_DECODE_PARAMS
+
+#define PICTURES        60
+#define NUM_REFS        2
+#define MAX_FRAME_NUM   16      // log2_max_frame_num_minus4 0
+#define DECODE_US       500
+
+static const decoder_backend_t *backend = &decoder_backend_stateless;
+
+static struct
+{
+    void *dec;
+    int frame_mbs_only;
+    // the sliding window of reference frames, oldest first
+    VdpReferenceFrameH264 refs[NUM_REFS];
+    int ref_count;
+    uint32_t frame_num;             // of the next picture
+    int32_t poc;
+    VdpVideoSurface surface;        // the last one decoded into
+    VdpVideoSurface shown;          // the last one that came out
+    VdpVideoSurface flushed;        // the last one decoded into before the flush
+    uint32_t decoded, received;
+    uint32_t wrapped;               // references with a negative pic_num
+} stream;
+
+// a slice of a stream with 4 bit frame_num and POC type 2, up to where the slice data would start
+static int write_slice(uint8_t *buf, int size, int idr, int nal_ref_idc, int slice_type, int field, int bottom)
+{
+    bs_t b;
+
+    memset(buf, 0, size);
+    bs_init(&b, buf, size);
+    bs_write_u(&b, 24, 0x000001);
+    bs_write_u(&b, 8, (nal_ref_idc << 5) | (idr ? NAL_UNIT_TYPE_CODED_SLICE_IDR : NAL_UNIT_TYPE_CODED_SLICE_NON_IDR));
+    bs_write_ue(&b, 0);                 // first_mb_in_slice
+    bs_write_ue(&b, slice_type);
+    bs_write_ue(&b, 0);                 // pic_parameter_set_id
+    bs_write_u(&b, 4, stream.frame_num % MAX_FRAME_NUM);
+    if (!stream.frame_mbs_only)
+    {
+        bs_write_u1(&b, field);         // field_pic_flag
+        if (field)
+            bs_write_u1(&b, bottom);
+    }
+    if (idr)
+        bs_write_ue(&b, 0);             // idr_pic_id
+    if (slice_type == V4L2_H264_SLICE_TYPE_B)
+        bs_write_u1(&b, 1);             // direct_spatial_mv_pred_flag
+    if (slice_type != V4L2_H264_SLICE_TYPE_I)
+    {
+        bs_write_u1(&b, 0);             // num_ref_idx_active_override_flag
+        bs_write_u1(&b, 0);             // ref_pic_list_modification_flag_l0
+    }
+    if (slice_type == V4L2_H264_SLICE_TYPE_B)
+        bs_write_u1(&b, 0);             // ref_pic_list_modification_flag_l1
+    if (nal_ref_idc && idr)
+        bs_write_u(&b, 2, 0);           // no_output_of_prior_pics_flag, long_term_reference_flag
+    else if (nal_ref_idc)
+        bs_write_u1(&b, 0);             // adaptive_ref_pic_marking_mode_flag
+    bs_write_u1(&b, 1);
+
+    return bs_pos(&b) + 4;
+}
+
+// hands back every picture that is ready within timeout_ms, returns how many
+static uint32_t collect(int timeout_ms)
+{
+    v4l2_mock_picture_t picture;
+    VdpVideoSurface surface;
+    uint32_t generation, count = 0;
+    void **output;
+    int frame, idle = 0;
+
+    for (;;)
+    {
+        CHECK(backend->get_picture(stream.dec, &frame, &output, &surface, &generation) == VDP_STATUS_OK,
+              "get_picture failed after %u pictures", stream.received);
+        if (frame < 0)
+        {
+            if (idle++ >= timeout_ms)
+                break;
+            usleep(1000);
+            continue;
+        }
+        idle = 0;
+
+        memcpy(&picture, output[0], sizeof(picture));
+        CHECK(surface > stream.shown, "surface %u came out after %u", surface, stream.shown);
+        CHECK(picture.fields == 3, "surface %u came out with fields %u", surface, picture.fields);
+        CHECK(picture.width == 1920 && picture.height == 1080, "surface %u is %ux%u", surface,
+              picture.width, picture.height);
+        stream.shown = surface;
+        stream.received++;
+        count++;
+
+        CHECK(backend->release_picture(stream.dec, frame) == VDP_STATUS_OK, "release_picture %d failed", frame);
+    }
+
+    return count;
+}
+
+static void picture_info(VdpPictureInfoH264 *info, int reference)
+{
+    int i;
+
+    memset(info, 0, sizeof(*info));
+    info->slice_count = 1;
+    info->num_ref_frames = NUM_REFS;
+    info->frame_mbs_only_flag = stream.frame_mbs_only;
+    info->pic_order_cnt_type = 2;
+    info->direct_8x8_inference_flag = 1;
+    info->is_reference = reference;
+    info->frame_num = stream.frame_num % MAX_FRAME_NUM;
+    info->field_order_cnt[0] = stream.poc;
+    info->field_order_cnt[1] = stream.poc + 1;
+
+    for (i = 0; i < 16; i++)
+        info->referenceFrames[i].surface = VDP_INVALID_HANDLE;
+    for (i = 0; i < stream.ref_count; i++)
+        info->referenceFrames[i] = stream.refs[i];
+}
+
+// the decode parameters the backend put into the request against what VDPAU said
+static void check_decode(VdpPictureInfoH264 *info, int idr, int slice_type)
+{
+    struct v4l2_ctrl_h264_decode_params dp;
+    __u32 flags = 0;
+    int i;
+
+    CHECK(v4l2_mock_h264_decode(&dp), "surface %u: no decode parameters in the request", stream.surface);
+    CHECK(dp.frame_num == info->frame_num, "surface %u: frame_num %u, expected %u", stream.surface,
+          dp.frame_num, info->frame_num);
+    CHECK(dp.nal_ref_idc == (info->is_reference ? 2 : 0), "surface %u: nal_ref_idc %u", stream.surface, dp.nal_ref_idc);
+
+    if (idr)
+        flags |= V4L2_H264_DECODE_PARAM_FLAG_IDR_PIC;
+    if (slice_type == V4L2_H264_SLICE_TYPE_P)
+        flags |= V4L2_H264_DECODE_PARAM_FLAG_PFRAME;
+    if (slice_type == V4L2_H264_SLICE_TYPE_B)
+        flags |= V4L2_H264_DECODE_PARAM_FLAG_BFRAME;
+    if (info->field_pic_flag)
+        flags |= V4L2_H264_DECODE_PARAM_FLAG_FIELD_PIC;
+    if (info->bottom_field_flag)
+        flags |= V4L2_H264_DECODE_PARAM_FLAG_BOTTOM_FIELD;
+    CHECK(dp.flags == flags, "surface %u: decode flags %#x, expected %#x", stream.surface, dp.flags, flags);
+
+    for (i = 0; i < V4L2_H264_NUM_DPB_ENTRIES; i++)
+    {
+        VdpReferenceFrameH264 *ref = &info->referenceFrames[i];
+        struct v4l2_h264_dpb_entry *e = &dp.dpb[i];
+        __u32 fields = (ref->top_is_reference ? V4L2_H264_TOP_FIELD_REF : 0) |
+                       (ref->bottom_is_reference ? V4L2_H264_BOTTOM_FIELD_REF : 0);
+        // 8.2.4.1, frames with a larger frame_num are from before the wrap
+        int32_t pic_num = ref->frame_idx > info->frame_num ? (int32_t)ref->frame_idx - MAX_FRAME_NUM : ref->frame_idx;
+
+        if (ref->surface == VDP_INVALID_HANDLE)
+        {
+            CHECK(!e->flags, "surface %u: unused DPB entry %d has flags %#x", stream.surface, i, e->flags);
+            continue;
+        }
+
+        flags = V4L2_H264_DPB_ENTRY_FLAG_VALID | V4L2_H264_DPB_ENTRY_FLAG_ACTIVE;
+        if (fields != V4L2_H264_FRAME_REF)
+            flags |= V4L2_H264_DPB_ENTRY_FLAG_FIELD;
+        CHECK(e->flags == flags, "surface %u: DPB entry %d has flags %#x, expected %#x", stream.surface, i,
+              e->flags, flags);
+        CHECK(e->fields == fields, "surface %u: DPB entry %d has fields %u, expected %u", stream.surface, i,
+              e->fields, fields);
+        CHECK(e->frame_num == ref->frame_idx && e->pic_num == pic_num,
+              "surface %u: DPB entry %d has frame_num %u and pic_num %d, expected %u and %d", stream.surface, i,
+              e->frame_num, e->pic_num, ref->frame_idx, pic_num);
+        CHECK(e->top_field_order_cnt == ref->field_order_cnt[0] && e->bottom_field_order_cnt == ref->field_order_cnt[1],
+              "surface %u: DPB entry %d has POC %d/%d", stream.surface, i, e->top_field_order_cnt, e->bottom_field_order_cnt);
+        // nothing from before the flush is left to predict from
+        CHECK(ref->surface > stream.flushed ? e->reference_ts != 0 : e->reference_ts == 0,
+              "surface %u: DPB entry %d for surface %u has reference_ts %llu", stream.surface, i, ref->surface,
+              (unsigned long long)e->reference_ts);
+        if (pic_num < 0)
+            stream.wrapped++;
+    }
+}
+
+/*
+ * One frame, or one field with field set, into the next surface or, for a
+ * second field, into the one of the first. The DPB slides after reference
+ * frames, with the next frame_num.
+ */
+static void decode(int idr, int slice_type, int reference, int field, int bottom)
+{
+    VdpBitstreamBuffer buffer = { VDP_BITSTREAM_BUFFER_VERSION };
+    VdpPictureInfoH264 info;
+    uint8_t slice[64];
+    int second = field && bottom;
+
+    if (idr)
+    {
+        stream.ref_count = 0;
+        stream.frame_num = 0;
+    }
+    picture_info(&info, reference);
+    info.field_pic_flag = field;
+    info.bottom_field_flag = bottom;
+
+    if (!second)
+        stream.surface++;
+    buffer.bitstream = slice;
+    buffer.bitstream_bytes = write_slice(slice, sizeof(slice), idr, reference ? 2 : 0, slice_type, field, bottom);
+    CHECK(backend->decode_picture(stream.dec, (VdpPictureInfo *)&info, 1, &buffer, stream.surface, 1) == VDP_STATUS_OK,
+          "decoding surface %u failed", stream.surface);
+    check_decode(&info, idr, slice_type);
+    stream.poc += 2;
+
+    // the first field waits for the second
+    if (field && !bottom)
+        return;
+    stream.decoded++;
+
+    if (reference)
+    {
+        VdpReferenceFrameH264 *ref;
+
+        if (stream.ref_count == NUM_REFS)
+            memmove(&stream.refs[0], &stream.refs[1], sizeof(stream.refs[0]) * --stream.ref_count);
+        ref = &stream.refs[stream.ref_count++];
+        memset(ref, 0, sizeof(*ref));
+        ref->surface = stream.surface;
+        ref->top_is_reference = ref->bottom_is_reference = VDP_TRUE;
+        ref->field_order_cnt[0] = info.field_order_cnt[0];
+        ref->field_order_cnt[1] = info.field_order_cnt[1];
+        ref->frame_idx = info.frame_num;
+        stream.frame_num++;
+    }
+}
+
+// IDR P B B P B B ..., the pictures are released right away but the requests run out
+static void test_gop(void)
+{
+    uint32_t i;
+
+    stream.frame_mbs_only = 1;
+    decode(1, V4L2_H264_SLICE_TYPE_I, 1, 0, 0);
+    for (i = 1; i < PICTURES; i++)
+    {
+        if (i % 3 == 1)
+            decode(0, V4L2_H264_SLICE_TYPE_P, 1, 0, 0);
+        else
+            decode(0, V4L2_H264_SLICE_TYPE_B, 0, 0, 0);
+        collect(0);
+    }
+    collect(200);
+
+    CHECK(stream.received == stream.decoded, "%u of %u pictures came out", stream.received, stream.decoded);
+    CHECK(stream.wrapped, "frame_num never wrapped in %u pictures", PICTURES);
+}
+
+// an interlaced IDR as a top and bottom field, then a frame predicting from both
+static void test_fields(void)
+{
+    VdpReferenceFrameH264 *ref;
+    uint32_t received = stream.received;
+
+    stream.frame_mbs_only = 0;
+    decode(1, V4L2_H264_SLICE_TYPE_I, 1, 1, 0);
+    CHECK(!collect(20), "the first field of surface %u came out on its own", stream.surface);
+
+    // the second field predicts from the first
+    stream.refs[0].surface = stream.surface;
+    stream.refs[0].top_is_reference = VDP_TRUE;
+    stream.refs[0].bottom_is_reference = VDP_FALSE;
+    stream.refs[0].frame_idx = 0;
+    stream.refs[0].field_order_cnt[0] = stream.poc - 2;
+    stream.refs[0].field_order_cnt[1] = 0;
+    stream.ref_count = 1;
+    decode(0, V4L2_H264_SLICE_TYPE_P, 1, 1, 1);
+    CHECK(collect(20) == 1, "surface %u didn't come out once as a field pair", stream.surface);
+
+    stream.ref_count = 1;
+    ref = &stream.refs[0];
+    ref->surface = stream.surface;
+    ref->top_is_reference = ref->bottom_is_reference = VDP_TRUE;
+    ref->field_order_cnt[1] = ref->field_order_cnt[0] + 1;
+    decode(0, V4L2_H264_SLICE_TYPE_P, 1, 0, 0);
+    collect(20);
+
+    CHECK(stream.received - received == 2, "%u of 2 pictures came out", stream.received - received);
+}
+
+// pictures in flight at the flush are dropped, their references forgotten
+static void test_flush(void)
+{
+    uint32_t i, received;
+
+    stream.frame_mbs_only = 1;
+    decode(1, V4L2_H264_SLICE_TYPE_I, 1, 0, 0);
+    decode(0, V4L2_H264_SLICE_TYPE_P, 1, 0, 0);
+    decode(0, V4L2_H264_SLICE_TYPE_P, 1, 0, 0);
+    CHECK(backend->flush(stream.dec) == VDP_STATUS_OK, "flush failed");
+    stream.flushed = stream.surface;
+    collect(20);
+
+    // the first two still list the frames from before
+    received = stream.received;
+    for (i = 0; i < 9; i++)
+        decode(0, V4L2_H264_SLICE_TYPE_P, 1, 0, 0);
+    collect(200);
+
+    CHECK(stream.received - received == 9, "%u of 9 pictures after the flush came out", stream.received - received);
+}
+
+int main(int argc, char **argv)
+{
+    v4l2_mock_stats_t before, after;
+
+    v4l2_mock_config.decode_us = DECODE_US;
+
+    v4l2_mock_stats(&before);
+    stream.dec = backend->open(VDP_DECODER_PROFILE_H264_MAIN, 1920, 1080, NUM_REFS);
+    CHECK(stream.dec, "cannot open the stateless backend on the mock device");
+    if (!stream.dec)
+        return test_done("test_stateless");
+
+    test_gop();
+    test_fields();
+    test_flush();
+
+    backend->close(stream.dec);
+    v4l2_mock_stats(&after);
+
+    CHECK(after.reference_errors == before.reference_errors, "%u pictures were decoded over a reference or predicted from none",
+          after.reference_errors - before.reference_errors);
+    CHECK(after.requests - before.requests == PICTURES + 3 + 3 + 9,
+          "%u requests queued, the backend didn't refill them", after.requests - before.requests);
+
+    return test_done("test_stateless");
+}
+
+#else
+
+// built against kernel headers without the stateless controls, there is no backend to test
+int main(int argc, char **argv)
+{
+    return test_done("test_stateless");
+}
+
+#endif
@@ -0,0 +1,351 @@
+/*
+ * Copyright (c) 2013 Jens Kuske <jenskuske@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+/*
+ * Parses the VC-1 sequence layer vc1_stream.c writes, field by field as
+ * SMPTE 421M lays it out, and checks every field against the picture info
+ * it was built from: the Annex L RCV sequence layer with STRUCT_A, B and C
+ * for Simple/Main, the sequence and entry-point BDUs for Advanced, and the
+ * frame layer of both.
+ */
+
+#include <stdlib.h>
+
+#include "test.h"
+#include "vc1_stream.h"
+
+#define ROUNDS 2000
+
+static uint32_t le32(const uint8_t *p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static void random_info(VdpPictureInfoVC1 *info)
+{
+    memset(info, 0, sizeof(*info));
+    info->picture_type = rand() % 5;
+    info->postprocflag = rand() & 1;
+    info->pulldown = rand() & 1;
+    info->interlace = rand() & 1;
+    info->tfcntrflag = rand() & 1;
+    info->finterpflag = rand() & 1;
+    info->psf = rand() & 1;
+    info->dquant = rand() % 3;
+    info->panscan_flag = rand() & 1;
+    info->refdist_flag = rand() & 1;
+    info->quantizer = rand() % 4;
+    info->extended_mv = rand() & 1;
+    info->extended_dmv = rand() & 1;
+    info->overlap = rand() & 1;
+    info->vstransform = rand() & 1;
+    info->loopfilter = rand() & 1;
+    info->fastuvmc = rand() & 1;
+    info->range_mapy_flag = rand() & 1;
+    info->range_mapy = rand() % 8;
+    info->range_mapuv_flag = rand() & 1;
+    info->range_mapuv = rand() % 8;
+    info->multires = rand() & 1;
+    info->syncmarker = rand() & 1;
+    info->rangered = rand() & 1;
+    info->maxbframes = rand() % 8;
+}
+
+// Table 253, the smallest level of the profile the picture fits in
+static int expected_level(VdpDecoderProfile profile, int width, int height)
+{
+    static const int simple[] = { 99, 396 };
+    static const int main_[] = { 396, 1620, 8192 };
+    static const int advanced[] = { 396, 1620, 8192, 16384, 32768 };
+    int mbs = ((width + 15) / 16) * ((height + 15) / 16);
+    int i;
+
+    // STRUCT_B codes Low, Medium and High as 0, 2 and 4
+    if (profile == VDP_DECODER_PROFILE_VC1_SIMPLE)
+        return mbs <= simple[0] ? 0 : 2;
+    if (profile == VDP_DECODER_PROFILE_VC1_MAIN)
+    {
+        for (i = 0; i < 2 && mbs > main_[i]; i++)
+            ;
+        return i * 2;
+    }
+    for (i = 0; i < 4 && mbs > advanced[i]; i++)
+        ;
+    return i;
+}
+
+// L.2, then J.1.1 for STRUCT_C
+static void check_rcv(const char *name, const uint8_t *buf, int len, VdpDecoderProfile profile,
+                      int width, int height, const VdpPictureInfoVC1 *info)
+{
+    test_bits_t r;
+
+    CHECK(len == 36, "%s: sequence layer of %d bytes, expected 36", name, len);
+    if (len != 36)
+        return;
+
+    CHECK(buf[3] == 0xc5, "%s: marker 0x%02x", name, buf[3]);
+    CHECK((le32(buf) & 0xffffff) == 0xffffff, "%s: NUMFRAMES 0x%06x", name, le32(buf) & 0xffffff);
+    CHECK(le32(buf + 4) == VC1_RCV_STRUCT_C_SIZE, "%s: STRUCT_C size %u", name, le32(buf + 4));
+
+    // STRUCT_C is a bitstream, most significant bit first
+    test_bits_init(&r, buf + 8, 4);
+    CHECK(test_read_u(&r, 2) == (profile == VDP_DECODER_PROFILE_VC1_MAIN ? 1u : 0u), "%s: PROFILE", name);
+    CHECK(test_read_u(&r, 1) == 0, "%s: RES_Y411", name);
+    CHECK(test_read_u(&r, 1) == 0, "%s: RES_SPRITE", name);
+    CHECK(test_read_u(&r, 3) == 0, "%s: FRMRTQ_POSTPROC", name);
+    CHECK(test_read_u(&r, 5) == 0, "%s: BITRTQ_POSTPROC", name);
+    CHECK(test_read_u(&r, 1) == info->loopfilter, "%s: LOOPFILTER", name);
+    CHECK(test_read_u(&r, 1) == 0, "%s: RES_X8", name);
+    CHECK(test_read_u(&r, 1) == info->multires, "%s: MULTIRES", name);
+    CHECK(test_read_u(&r, 1) == 1, "%s: RES_FASTTX", name);
+    CHECK(test_read_u(&r, 1) == info->fastuvmc, "%s: FASTUVMC", name);
+    CHECK(test_read_u(&r, 1) == info->extended_mv, "%s: EXTENDED_MV", name);
+    CHECK(test_read_u(&r, 2) == info->dquant, "%s: DQUANT", name);
+    CHECK(test_read_u(&r, 1) == info->vstransform, "%s: VSTRANSFORM", name);
+    CHECK(test_read_u(&r, 1) == 0, "%s: RES_TRANSTAB", name);
+    CHECK(test_read_u(&r, 1) == info->overlap, "%s: OVERLAP", name);
+    CHECK(test_read_u(&r, 1) == info->syncmarker, "%s: SYNCMARKER", name);
+    CHECK(test_read_u(&r, 1) == info->rangered, "%s: RANGERED", name);
+    CHECK(test_read_u(&r, 3) == info->maxbframes, "%s: MAXBFRAMES", name);
+    CHECK(test_read_u(&r, 2) == info->quantizer, "%s: QUANTIZER", name);
+    CHECK(test_read_u(&r, 1) == info->finterpflag, "%s: FINTERPFLAG", name);
+    CHECK(test_read_u(&r, 1) == 1, "%s: RES_RTM_FLAG", name);
+    CHECK(r.bits == 32, "%s: STRUCT_C of %d bits", name, r.bits);
+
+    CHECK(le32(buf + 12) == (uint32_t)height, "%s: STRUCT_A VERT_SIZE %u", name, le32(buf + 12));
+    CHECK(le32(buf + 16) == (uint32_t)width, "%s: STRUCT_A HORIZ_SIZE %u", name, le32(buf + 16));
+    CHECK(le32(buf + 20) == VC1_RCV_STRUCT_B_SIZE, "%s: STRUCT_B size %u", name, le32(buf + 20));
+
+    uint32_t b = le32(buf + 24);
+    CHECK((int)(b >> 29) == expected_level(profile, width, height), "%s: LEVEL %u for %dx%d",
+          name, b >> 29, width, height);
+    CHECK(!((b >> 28) & 1), "%s: CBR", name);
+    CHECK(!(b & 0xffffff), "%s: HRD_BUFFER", name);
+    CHECK(le32(buf + 28) == 0, "%s: HRD_RATE", name);
+    CHECK(le32(buf + 32) == 0xffffffff, "%s: FRAMERATE", name);
+}
+
+// E.5, a one followed by zeros to the end of the BDU
+static void check_flushing_bits(const char *name, test_bits_t *r)
+{
+    CHECK(test_read_u(r, 1) == 1, "%s: flushing bit", name);
+    while (!test_bits_aligned(r))
+        CHECK(test_read_u(r, 1) == 0, "%s: flushing zeros", name);
+    CHECK(r->bits == r->size * 8, "%s: %d bytes after the flushing bits", name, r->size - r->bits / 8);
+}
+
+// 6.1.1
+static void check_sequence_bdu(const char *name, const uint8_t *rbsp, int len, int width, int height,
+                               const VdpPictureInfoVC1 *info)
+{
+    test_bits_t r;
+
+    test_bits_init(&r, rbsp, len);
+    CHECK(test_read_u(&r, 2) == 3, "%s: PROFILE", name);
+    CHECK((int)test_read_u(&r, 3) == expected_level(VDP_DECODER_PROFILE_VC1_ADVANCED, width, height),
+          "%s: LEVEL", name);
+    CHECK(test_read_u(&r, 2) == 1, "%s: COLORDIFF_FORMAT", name);
+    CHECK(test_read_u(&r, 3) == 0, "%s: FRMRTQ_POSTPROC", name);
+    CHECK(test_read_u(&r, 5) == 0, "%s: BITRTQ_POSTPROC", name);
+    CHECK(test_read_u(&r, 1) == info->postprocflag, "%s: POSTPROCFLAG", name);
+    CHECK(test_read_u(&r, 12) == (uint32_t)(width / 2 - 1), "%s: MAX_CODED_WIDTH", name);
+    CHECK(test_read_u(&r, 12) == (uint32_t)(height / 2 - 1), "%s: MAX_CODED_HEIGHT", name);
+    CHECK(test_read_u(&r, 1) == info->pulldown, "%s: PULLDOWN", name);
+    CHECK(test_read_u(&r, 1) == info->interlace, "%s: INTERLACE", name);
+    CHECK(test_read_u(&r, 1) == info->tfcntrflag, "%s: TFCNTRFLAG", name);
+    CHECK(test_read_u(&r, 1) == info->finterpflag, "%s: FINTERPFLAG", name);
+    CHECK(test_read_u(&r, 1) == 1, "%s: RESERVED", name);
+    CHECK(test_read_u(&r, 1) == info->psf, "%s: PSF", name);
+    CHECK(test_read_u(&r, 1) == 0, "%s: DISPLAY_EXT", name);
+    CHECK(test_read_u(&r, 1) == 0, "%s: HRD_PARAM_FLAG", name);
+    check_flushing_bits(name, &r);
+}
+
+// 6.2.1, without HRD_PARAM_FLAG there is no HRD_FULLNESS
+static void check_entry_point_bdu(const char *name, const uint8_t *rbsp, int len, const VdpPictureInfoVC1 *info)
+{
+    test_bits_t r;
+
+    test_bits_init(&r, rbsp, len);
+    CHECK(test_read_u(&r, 1) == 0, "%s: BROKEN_LINK", name);
+    CHECK(test_read_u(&r, 1) == 1, "%s: CLOSED_ENTRY", name);
+    CHECK(test_read_u(&r, 1) == info->panscan_flag, "%s: PANSCAN_FLAG", name);
+    CHECK(test_read_u(&r, 1) == info->refdist_flag, "%s: REFDIST_FLAG", name);
+    CHECK(test_read_u(&r, 1) == info->loopfilter, "%s: LOOPFILTER", name);
+    CHECK(test_read_u(&r, 1) == info->fastuvmc, "%s: FASTUVMC", name);
+    CHECK(test_read_u(&r, 1) == info->extended_mv, "%s: EXTENDED_MV", name);
+    CHECK(test_read_u(&r, 2) == info->dquant, "%s: DQUANT", name);
+    CHECK(test_read_u(&r, 1) == info->vstransform, "%s: VSTRANSFORM", name);
+    CHECK(test_read_u(&r, 1) == info->overlap, "%s: OVERLAP", name);
+    CHECK(test_read_u(&r, 2) == info->quantizer, "%s: QUANTIZER", name);
+    CHECK(test_read_u(&r, 1) == 0, "%s: CODED_SIZE_FLAG", name);
+    if (info->extended_mv)
+        CHECK(test_read_u(&r, 1) == info->extended_dmv, "%s: EXTENDED_DMV", name);
+    CHECK(test_read_u(&r, 1) == info->range_mapy_flag, "%s: RANGE_MAPY_FLAG", name);
+    if (info->range_mapy_flag)
+        CHECK(test_read_u(&r, 3) == info->range_mapy, "%s: RANGE_MAPY", name);
+    CHECK(test_read_u(&r, 1) == info->range_mapuv_flag, "%s: RANGE_MAPUV_FLAG", name);
+    if (info->range_mapuv_flag)
+        CHECK(test_read_u(&r, 3) == info->range_mapuv, "%s: RANGE_MAPUV", name);
+    check_flushing_bits(name, &r);
+}
+
+// Annex E, the BDUs are split at their start codes and unescaped
+static void check_advanced(const char *name, const uint8_t *buf, int len, int width, int height,
+                           const VdpPictureInfoVC1 *info)
+{
+    static const int types[] = { VC1_SEQ_START_CODE, VC1_ENTRY_START_CODE };
+    uint8_t rbsp[64];
+    int start[3], count = 0, i;
+
+    for (i = 0; i + 3 < len && count < 2; i++)
+        if (!buf[i] && !buf[i + 1] && buf[i + 2] == 0x01)
+            start[count++] = i;
+    start[count] = len;
+
+    CHECK(count == 2 && start[0] == 0, "%s: %d BDUs, the first at %d", name, count, count ? start[0] : -1);
+    if (count != 2 || start[0])
+        return;
+
+    for (i = 0; i < 2; i++)
+    {
+        const uint8_t *payload = buf + start[i] + 4;
+        int size = start[i + 1] - start[i] - 4;
+
+        CHECK(buf[start[i] + 3] == types[i], "%s: BDU %d of type 0x%02x", name, i, buf[start[i] + 3]);
+        CHECK(size > 0 && size <= (int)sizeof(rbsp), "%s: BDU %d of %d bytes", name, i, size);
+        if (size <= 0 || size > (int)sizeof(rbsp))
+            return;
+        CHECK(!test_has_emulation(payload, size), "%s: BDU %d emulates a start code", name, i);
+
+        size = test_unescape(payload, size, rbsp);
+        if (i == 0)
+            check_sequence_bdu(name, rbsp, size, width, height, info);
+        else
+            check_entry_point_bdu(name, rbsp, size, info);
+    }
+}
+
+static void random_size(VdpDecoderProfile profile, int *width, int *height)
+{
+    // anything from QCIF up to the largest the profile allows, in even sizes
+    int max_width = profile == VDP_DECODER_PROFILE_VC1_ADVANCED ? 4096 : 1920;
+    int max_height = profile == VDP_DECODER_PROFILE_VC1_ADVANCED ? 2304 : 1088;
+
+    *width = 16 + 2 * (rand() % ((max_width - 16) / 2 + 1));
+    *height = 16 + 2 * (rand() % ((max_height - 16) / 2 + 1));
+}
+
+static void test_sequence_layers(void)
+{
+    static const VdpDecoderProfile profiles[] =
+    {
+        VDP_DECODER_PROFILE_VC1_SIMPLE, VDP_DECODER_PROFILE_VC1_MAIN, VDP_DECODER_PROFILE_VC1_ADVANCED
+    };
+    static const char *names[] = { "simple", "main", "advanced" };
+    uint8_t buf[256];
+    int round, p, width, height, len;
+
+    srand(1);
+
+    for (round = 0; round < ROUNDS; round++)
+    {
+        for (p = 0; p < 3; p++)
+        {
+            VdpPictureInfoVC1 info;
+            int failures = test_failures;
+
+            random_info(&info);
+            random_size(profiles[p], &width, &height);
+
+            len = vc1_write_sequence_header(width, height, profiles[p], &info, buf, sizeof(buf));
+            CHECK(len > 0, "%s: writer failed for %dx%d", names[p], width, height);
+            if (len <= 0)
+                continue;
+
+            if (p < 2)
+                check_rcv(names[p], buf, len, profiles[p], width, height, &info);
+            else
+                check_advanced(names[p], buf, len, width, height, &info);
+
+            // one broken field tends to break all rounds, report the first
+            if (test_failures != failures)
+            {
+                fprintf(stderr, "  in round %d, %dx%d\n", round, width, height);
+                test_hexdump("header", buf, len);
+                return;
+            }
+        }
+    }
+
+    // too small a buffer fails instead of writing a truncated header
+    VdpPictureInfoVC1 info;
+    random_info(&info);
+    CHECK(vc1_write_sequence_header(720, 480, VDP_DECODER_PROFILE_VC1_MAIN, &info, buf, 35) < 0,
+          "truncated RCV sequence layer");
+    CHECK(vc1_write_sequence_header(1920, 1080, VDP_DECODER_PROFILE_VC1_ADVANCED, &info, buf, 8) < 0,
+          "truncated advanced sequence layer");
+}
+
+// L.3 frame layer for Simple/Main, the frame start code for Advanced
+static void test_frame_layers(void)
+{
+    static const uint8_t with_start_code[] = { 0x00, 0x00, 0x01, 0x0d, 0xc0 };
+    static const uint8_t without_start_code[] = { 0xc0, 0x12, 0x34 };
+    VdpPictureInfoVC1 info;
+    uint8_t buf[VC1_FRAME_HEADER_MAX_SIZE];
+    int len, type;
+
+    memset(&info, 0, sizeof(info));
+    for (type = 0; type < 5; type++)
+    {
+        info.picture_type = type;
+        len = vc1_write_frame_header(VDP_DECODER_PROFILE_VC1_MAIN, &info, 0x123456, NULL, buf, sizeof(buf));
+        CHECK(len == 8, "frame layer of %d bytes", len);
+        CHECK(le32(buf) >> 31 == (type == 0), "KEY %u for picture type %d", le32(buf) >> 31, type);
+        CHECK((le32(buf) & 0x7fffffff) == 0x123456, "FRAMESIZE 0x%x", le32(buf) & 0x7fffffff);
+        CHECK(le32(buf + 4) == 0, "TIMESTAMP %u", le32(buf + 4));
+    }
+
+    // FRAMESIZE has 24 bits, the bits above never leak into KEY
+    info.picture_type = 1;
+    len = vc1_write_frame_header(VDP_DECODER_PROFILE_VC1_SIMPLE, &info, 0xff000001, NULL, buf, sizeof(buf));
+    CHECK(len == 8 && le32(buf) == 0x000001, "oversized FRAMESIZE gives 0x%08x", le32(buf));
+
+    len = vc1_write_frame_header(VDP_DECODER_PROFILE_VC1_ADVANCED, &info, sizeof(without_start_code),
+                                 without_start_code, buf, sizeof(buf));
+    CHECK(len == 4 && !buf[0] && !buf[1] && buf[2] == 0x01 && buf[3] == VC1_FRAME_START_CODE,
+          "frame start code for a stripped frame");
+
+    len = vc1_write_frame_header(VDP_DECODER_PROFILE_VC1_ADVANCED, &info, sizeof(with_start_code),
+                                 with_start_code, buf, sizeof(buf));
+    CHECK(len == 0, "%d bytes in front of a frame with its start code", len);
+
+    CHECK(vc1_write_frame_header(VDP_DECODER_PROFILE_VC1_MAIN, &info, 100, NULL, buf, 7) < 0,
+          "truncated frame layer");
+}
+
+int main(int argc, char **argv)
+{
+    test_sequence_layers();
+    test_frame_layers();
+
+    return test_done("test_vc1");
+}
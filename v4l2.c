@@ -148,6 +148,8 @@ v4l2_buffer_t *FreeBuffers(int count, v4l2_buffer_t *v4l2Buffers)
         {
           munmap(buffer->cPlane[j], buffer->iSize[j]);
         }
+        if(buffer->bExported)
+          close(buffer->iFd[j]);
       }
     }
     free(v4l2Buffers);
@@ -155,7 +157,51 @@ v4l2_buffer_t *FreeBuffers(int count, v4l2_buffer_t *v4l2Buffers)
   return NULL;
 }
 
+int ExportBuffer(int device, enum v4l2_buf_type type, v4l2_buffer_t *buffer)
+{
+  struct v4l2_exportbuffer expbuf;
+  int j;
+
+  if(device < 0 || !buffer)
+    return FALSE;
+
+  if(buffer->bExported)
+    return TRUE;
+
+  for (j = 0; j < buffer->iNumPlanes; j++)
+  {
+    memzero(expbuf);
+    expbuf.type  = type;
+    expbuf.index = buffer->iIndex;
+    expbuf.plane = j;
+    expbuf.flags = O_RDONLY | O_CLOEXEC;
+
+    if (ioctl(device, VIDIOC_EXPBUF, &expbuf))
+    {
+      VDPAU_DBG("export buffer %d plane %d, errno = %d", buffer->iIndex, j, errno);
+      while (j-- > 0)
+        close(buffer->iFd[j]);
+      return FALSE;
+    }
+    buffer->iFd[j] = expbuf.fd;
+  }
+  buffer->bExported = TRUE;
+
+  return TRUE;
+}
+
 int DequeueBuffer(int device, enum v4l2_buf_type type, enum v4l2_memory memory)
+{
+  return DequeueBufferTimestamp(device, type, memory, NULL);
+}
+
+int DequeueBufferTimestamp(int device, enum v4l2_buf_type type, enum v4l2_memory memory, struct timeval *timestamp)
+{
+  return DequeueBufferInfo(device, type, memory, timestamp, NULL, NULL);
+}
+
+int DequeueBufferInfo(int device, enum v4l2_buf_type type, enum v4l2_memory memory, struct timeval *timestamp,
+    __u32 *flags, int *bytesUsed)
 {
   struct v4l2_buffer vbuf;
   struct v4l2_plane  vplanes[V4L2_NUM_MAX_PLANES];
@@ -175,15 +221,31 @@ int DequeueBuffer(int device, enum v4l2_buf_type type, enum v4l2_memory memory)
   if (ret) {
     if (errno == EAGAIN)
       return -EAGAIN;
+    // a stateful decoder past its last buffer before a resolution change or drain
+    if (errno == EPIPE)
+      return -EPIPE;
     VDPAU_DBG("dequeue input buffer");
     return V4L2_ERROR;
   }
 
+  if (timestamp)
+    *timestamp = vbuf.timestamp;
+  if (flags)
+    *flags = vbuf.flags;
+  if (bytesUsed)
+    *bytesUsed = vplanes[0].bytesused;
+
   return vbuf.index;
 }
 
 int QueueBuffer(int device, enum v4l2_buf_type type,
     enum v4l2_memory memory, v4l2_buffer_t *buffer)
+{
+  return QueueBufferRequest(device, type, memory, buffer, -1);
+}
+
+int QueueBufferRequest(int device, enum v4l2_buf_type type,
+    enum v4l2_memory memory, v4l2_buffer_t *buffer, int requestFd)
 {
   struct v4l2_buffer vbuf;
   struct v4l2_plane  vplanes[V4L2_NUM_MAX_PLANES];
@@ -200,6 +262,16 @@ int QueueBuffer(int device, enum v4l2_buf_type type,
   vbuf.index    = buffer->iIndex;
   vbuf.m.planes = vplanes;
   vbuf.length   = buffer->iNumPlanes;
+  vbuf.timestamp = buffer->timestamp;
+  if (requestFd >= 0) {
+#ifdef V4L2_BUF_FLAG_REQUEST_FD
+    vbuf.flags |= V4L2_BUF_FLAG_REQUEST_FD;
+    vbuf.request_fd = requestFd;
+#else
+    // headers older than the Request API (Linux 4.20), nothing uses requests then
+    return V4L2_ERROR;
+#endif
+  }
 
   for (i = 0; i < buffer->iNumPlanes; i++)
   {
@@ -262,3 +334,41 @@ int PollOutput(int device, int timeout)
 
   return V4L2_READY;
 }
+
+struct timeval TimestampTag(v4l2_timestamp_map_t *map, uint32_t surface, uint32_t generation)
+{
+  struct timeval tv;
+  uint32_t seq = ++map->iSeq;
+
+  // 0 is what untagged buffers carry
+  if (!seq)
+    seq = ++map->iSeq;
+
+  map->iTag[seq % V4L2_TIMESTAMP_SLOTS] = seq;
+  map->iSurface[seq % V4L2_TIMESTAMP_SLOTS] = surface;
+  map->iGeneration[seq % V4L2_TIMESTAMP_SLOTS] = generation;
+
+  tv.tv_sec = seq / 1000000;
+  tv.tv_usec = seq % 1000000;
+  return tv;
+}
+
+int TimestampLookup(v4l2_timestamp_map_t *map, struct timeval timestamp, uint32_t *surface, uint32_t *generation)
+{
+  uint32_t seq = timestamp.tv_sec * 1000000 + timestamp.tv_usec;
+
+  if (!seq || map->iTag[seq % V4L2_TIMESTAMP_SLOTS] != seq)
+    return V4L2_ERROR;
+
+  *surface = map->iSurface[seq % V4L2_TIMESTAMP_SLOTS];
+  if (generation)
+    *generation = map->iGeneration[seq % V4L2_TIMESTAMP_SLOTS];
+  return V4L2_OK;
+}
+
+uint32_t NextBufferGeneration(void)
+{
+  static uint32_t generation;
+
+  return __sync_add_and_fetch(&generation, 1);
+}
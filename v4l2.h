@@ -20,8 +20,15 @@
  *
  */
 
+#include <stdint.h>
+#include <sys/time.h>
 #include "linux/videodev2.h"
 
+// older kernel headers, the ABI is the same
+#ifndef V4L2_BUF_FLAG_LAST
+#define V4L2_BUF_FLAG_LAST 0x00100000
+#endif
+
 #define V4L2_ERROR -1
 #define V4L2_BUSY  1
 #define V4L2_READY 2
@@ -29,6 +36,8 @@
 
 #define V4L2_NUM_MAX_PLANES 3
 
+#define V4L2_TIMESTAMP_SLOTS 32   // bitstream buffers remembered for mapping pictures back to surfaces, covers the decoder reorder depth
+
 #define TRUE    1
 #define FALSE   0
 
@@ -43,19 +52,48 @@ typedef struct
   int   iNumPlanes;
   int   iIndex;
   int   bQueue;
+  struct timeval timestamp;
+  int   iFd[V4L2_NUM_MAX_PLANES];   // dma-buf per plane, valid once bExported
+  int   bExported;
 } v4l2_buffer_t;
 
+/*
+ * Every bitstream buffer carries a sequence number as its timestamp, which
+ * the decoder (and converter) copy to the picture decoded from it. The last
+ * V4L2_TIMESTAMP_SLOTS numbers remember the surface the application rendered to,
+ * and which of its renders, so a picture of an earlier one can be told apart.
+ */
+typedef struct
+{
+  uint32_t iSeq;
+  uint32_t iTag[V4L2_TIMESTAMP_SLOTS];
+  uint32_t iSurface[V4L2_TIMESTAMP_SLOTS];
+  uint32_t iGeneration[V4L2_TIMESTAMP_SLOTS];
+} v4l2_timestamp_map_t;
+
 int RequestBuffer(int device, enum v4l2_buf_type type, enum v4l2_memory memory, int numBuffers);
 int StreamOn(int device, enum v4l2_buf_type type, int onoff);
 int MmapBuffers(int device, int count, v4l2_buffer_t *v4l2Buffers, enum v4l2_buf_type type, enum v4l2_memory memory, int queue);
 v4l2_buffer_t *FreeBuffers(int count, v4l2_buffer_t *v4l2Buffers);
+int ExportBuffer(int device, enum v4l2_buf_type type, v4l2_buffer_t *buffer);
 
 int DequeueBuffer(int device, enum v4l2_buf_type type, enum v4l2_memory memory);
+int DequeueBufferTimestamp(int device, enum v4l2_buf_type type, enum v4l2_memory memory, struct timeval *timestamp);
+int DequeueBufferInfo(int device, enum v4l2_buf_type type, enum v4l2_memory memory, struct timeval *timestamp,
+    __u32 *flags, int *bytesUsed);
 int QueueBuffer(int device, enum v4l2_buf_type type, enum v4l2_memory memory, v4l2_buffer_t *buffer);
+// queued as part of a media request, applied once the request is queued
+int QueueBufferRequest(int device, enum v4l2_buf_type type, enum v4l2_memory memory, v4l2_buffer_t *buffer, int requestFd);
 
 int PollInput(int device, int timeout);
 int PollOutput(int device, int timeout);
 
+struct timeval TimestampTag(v4l2_timestamp_map_t *map, uint32_t surface, uint32_t generation);
+int TimestampLookup(v4l2_timestamp_map_t *map, struct timeval timestamp, uint32_t *surface, uint32_t *generation);
+
+// unique across decoders, so GL imports of freed buffers never match reused ones
+uint32_t NextBufferGeneration(void);
+
 static inline int v4l2_align(int v, int a) {
   return ((v + a - 1) / a) * a;
 }
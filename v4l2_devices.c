@@ -0,0 +1,295 @@
+/*
+ * Copyright (c) 2013 Jens Kuske <jenskuske@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <limits.h>
+#include <sys/ioctl.h>
+#include <sys/inotify.h>
+
+#include "vdpau_private.h"
+#include "v4l2.h"
+#include "v4l2_devices.h"
+
+static struct
+{
+    v4l2_device_t devices[V4L2_DEVICES_MAX];
+    int count;
+    int valid;
+    int inotify;
+    pthread_mutex_t mutex;
+} table = { .inotify = -1, .mutex = PTHREAD_MUTEX_INITIALIZER };
+
+static int read_name(const char *node, char *name, int size)
+{
+    char path[PATH_MAX];
+    char *p;
+
+    snprintf(path, sizeof(path), "/sys/class/video4linux/%s/name", node);
+
+    FILE *fp = fopen(path, "r");
+    if (!fp)
+        return -1;
+
+    if (!fgets(name, size, fp)) {
+        fclose(fp);
+        return -1;
+    }
+    fclose(fp);
+
+    p = strchr(name, '\n');
+    if (p != NULL)
+        *p = '\0';
+
+    return 0;
+}
+
+// the media controller registered for the same device, if any, stateless decoders need it for requests
+static void read_media(const char *node, char *media, int size)
+{
+    char path[PATH_MAX];
+    struct dirent *ent;
+    DIR *dir;
+
+    snprintf(path, sizeof(path), "/sys/class/video4linux/%s/device", node);
+    if ((dir = opendir(path)) == NULL)
+        return;
+
+    while ((ent = readdir(dir)) != NULL) {
+        // a node name that doesn't fit is no node we could open
+        if (strncmp(ent->d_name, "media", 5) == 0) {
+            if (snprintf(media, size, "/dev/%s", ent->d_name) >= size)
+                media[0] = '\0';
+            break;
+        }
+    }
+    closedir(dir);
+}
+
+static void probe_frame_sizes(int fd, v4l2_format_caps_t *caps)
+{
+    struct v4l2_frmsizeenum size;
+
+    memzero(size);
+    size.pixel_format = caps->fourcc;
+    while (!ioctl(fd, VIDIOC_ENUM_FRAMESIZES, &size)) {
+        if (size.type == V4L2_FRMSIZE_TYPE_DISCRETE) {
+            caps->max_width = max(caps->max_width, size.discrete.width);
+            caps->max_height = max(caps->max_height, size.discrete.height);
+        } else {
+            caps->max_width = size.stepwise.max_width;
+            caps->max_height = size.stepwise.max_height;
+            break;
+        }
+        size.index++;
+    }
+}
+
+// dev->path and dev->name are set
+static int probe_device(v4l2_device_t *dev)
+{
+    struct v4l2_capability cap;
+    struct v4l2_fmtdesc desc;
+    struct v4l2_format fmt;
+
+    int fd = open(dev->path, O_RDWR | O_NONBLOCK, 0);
+    if (fd < 0)
+        return -1;
+
+    memzero(cap);
+    if (ioctl(fd, VIDIOC_QUERYCAP, &cap) || !(cap.capabilities & V4L2_CAP_STREAMING) ||
+            !((cap.capabilities & V4L2_CAP_VIDEO_M2M_MPLANE) ||
+            (cap.capabilities & (V4L2_CAP_VIDEO_CAPTURE_MPLANE | V4L2_CAP_VIDEO_OUTPUT_MPLANE)))) {
+        close(fd);
+        return -1;
+    }
+
+    dev->converter = strstr(dev->name, "fimc") != NULL && strstr(dev->name, "m2m") != NULL;
+    dev->mfc = strstr(dev->name, "s5p-mfc") != NULL;
+
+    memzero(desc);
+    desc.type = V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE;
+    while (dev->output_count < V4L2_DEVICE_MAX_FORMATS && !ioctl(fd, VIDIOC_ENUM_FMT, &desc)) {
+        v4l2_format_caps_t *caps = &dev->output[dev->output_count++];
+        caps->fourcc = desc.pixelformat;
+        probe_frame_sizes(fd, caps);
+        desc.index++;
+    }
+
+    memzero(desc);
+    desc.type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
+    while (dev->capture_count < V4L2_DEVICE_MAX_FORMATS && !ioctl(fd, VIDIOC_ENUM_FMT, &desc)) {
+        dev->capture[dev->capture_count++] = desc.pixelformat;
+        desc.index++;
+    }
+
+    // Only need FIMC if we cannot set this capture pixel format to NV12M
+    memzero(fmt);
+    fmt.type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
+    fmt.fmt.pix_mp.pixelformat = V4L2_PIX_FMT_NV12M;
+    dev->direct = !ioctl(fd, VIDIOC_TRY_FMT, &fmt);
+
+    close(fd);
+    return 0;
+}
+
+static void scan(void)
+{
+    DIR *dir;
+    struct dirent *ent;
+
+    table.count = 0;
+
+    if ((dir = opendir("/sys/class/video4linux/")) == NULL)
+        return;
+
+    while ((ent = readdir(dir)) != NULL && table.count < V4L2_DEVICES_MAX) {
+        v4l2_device_t *dev = &table.devices[table.count];
+        if (strncmp(ent->d_name, "video", 5) != 0)
+            continue;
+
+        memset(dev, 0, sizeof(*dev));
+        if (read_name(ent->d_name, dev->name, sizeof(dev->name)))
+            continue;
+
+        if (snprintf(dev->path, sizeof(dev->path), "/dev/%s", ent->d_name) >= (int)sizeof(dev->path))
+            continue;
+        if (probe_device(dev))
+            continue;
+        read_media(ent->d_name, dev->media, sizeof(dev->media));
+
+        VDPAU_DBG("Found %s %s, %d coded formats, %s", dev->name, dev->path, dev->output_count,
+                  dev->converter ? "converter" : dev->direct ? "NV12M capture" : "tiled capture");
+        table.count++;
+    }
+    closedir(dir);
+}
+
+// drains pending inotify events, returns 1 if any concerned a video node
+static int changed(void)
+{
+    char buf[sizeof(struct inotify_event) + NAME_MAX + 1] __attribute__((aligned(__alignof__(struct inotify_event))));
+    int ret = 0;
+    ssize_t len;
+
+    while ((len = read(table.inotify, buf, sizeof(buf))) > 0) {
+        char *p = buf;
+        while (p < buf + len) {
+            struct inotify_event *ev = (struct inotify_event *)p;
+            if ((ev->mask & IN_Q_OVERFLOW) || (ev->len && strncmp(ev->name, "video", 5) == 0))
+                ret = 1;
+            p += sizeof(struct inotify_event) + ev->len;
+        }
+    }
+
+    return ret;
+}
+
+// caller holds table.mutex
+static void refresh(void)
+{
+    if (table.inotify < 0 && !table.valid) {
+        table.inotify = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        if (table.inotify >= 0 && inotify_add_watch(table.inotify, "/dev", IN_CREATE | IN_DELETE | IN_ATTRIB) < 0) {
+            close(table.inotify);
+            table.inotify = -1;
+        }
+        if (table.inotify < 0)
+            VDPAU_DBG("inotify on /dev failed, V4L2 nodes are only rescanned after open errors");
+    }
+
+    if (table.valid && table.inotify >= 0 && changed())
+        table.valid = 0;
+
+    if (!table.valid) {
+        scan();
+        table.valid = 1;
+    }
+}
+
+const v4l2_format_caps_t *v4l2_device_format(const v4l2_device_t *device, __u32 codec)
+{
+    int i;
+
+    for (i = 0; i < device->output_count; i++)
+        if (device->output[i].fourcc == codec)
+            return &device->output[i];
+
+    return NULL;
+}
+
+int v4l2_find_decoder(__u32 codec, int mfc, v4l2_device_t *device)
+{
+    const v4l2_device_t *best = NULL;
+    int i;
+
+    pthread_mutex_lock(&table.mutex);
+    refresh();
+
+    // a decoder listing the codec, preferably one that needs no converter
+    for (i = 0; i < table.count; i++) {
+        const v4l2_device_t *dev = &table.devices[i];
+        if (dev->converter || dev->mfc != !!mfc || !v4l2_device_format(dev, codec))
+            continue;
+        if (!best || (dev->direct && !best->direct))
+            best = dev;
+    }
+
+    // older MFC drivers don't enumerate all the formats they decode
+    for (i = 0; i < table.count && mfc && !best; i++)
+        if (strstr(table.devices[i].name, "s5p-mfc-dec") != NULL)
+            best = &table.devices[i];
+
+    if (best)
+        *device = *best;
+
+    pthread_mutex_unlock(&table.mutex);
+
+    return best ? 0 : -1;
+}
+
+int v4l2_find_converter(v4l2_device_t *device)
+{
+    int i, ret = -1;
+
+    pthread_mutex_lock(&table.mutex);
+    refresh();
+
+    for (i = 0; i < table.count; i++) {
+        if (table.devices[i].converter) {
+            *device = table.devices[i];
+            ret = 0;
+            break;
+        }
+    }
+
+    pthread_mutex_unlock(&table.mutex);
+
+    return ret;
+}
+
+void v4l2_devices_invalidate(void)
+{
+    pthread_mutex_lock(&table.mutex);
+    table.valid = 0;
+    pthread_mutex_unlock(&table.mutex);
+}
@@ -0,0 +1,68 @@
+/*
+ * Copyright (c) 2013 Jens Kuske <jenskuske@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifndef __V4L2_DEVICES_H__
+#define __V4L2_DEVICES_H__
+
+#include <stdint.h>
+#include <linux/videodev2.h>
+
+/*
+ * Process wide table of the V4L2 memory-to-memory nodes, built on first use
+ * and rebuilt only after inotify reported a video node appearing, vanishing
+ * or changing permissions in /dev.
+ */
+
+#define V4L2_DEVICES_MAX        16
+#define V4L2_DEVICE_MAX_FORMATS 32
+
+typedef struct
+{
+    __u32 fourcc;
+    // from VIDIOC_ENUM_FRAMESIZES, 0 if the driver doesn't tell
+    uint32_t max_width;
+    uint32_t max_height;
+} v4l2_format_caps_t;
+
+typedef struct
+{
+    char path[32];
+    char name[32];
+    int converter;          // FIMC m2m, used to untile the MFC output
+    int mfc;                // s5p-mfc, which needs its own backend
+    int direct;             // CAPTURE takes NV12M, no converter needed
+    char media[32];         // media controller node, empty if the driver has none
+    int output_count;
+    v4l2_format_caps_t output[V4L2_DEVICE_MAX_FORMATS];
+    int capture_count;
+    __u32 capture[V4L2_DEVICE_MAX_FORMATS];
+} v4l2_device_t;
+
+// copy out the best decoder for the coded format, an MFC or any other,
+// returns 0 if one exists. Stateless decoders list the *_SLICE formats
+// instead of the stream ones, so stateful lookups never find them.
+int v4l2_find_decoder(__u32 codec, int mfc, v4l2_device_t *device);
+int v4l2_find_converter(v4l2_device_t *device);
+
+const v4l2_format_caps_t *v4l2_device_format(const v4l2_device_t *device, __u32 codec);
+
+// force a rescan on the next lookup, e.g. when a listed node failed to open
+void v4l2_devices_invalidate(void);
+
+#endif
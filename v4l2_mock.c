@@ -0,0 +1,1465 @@
+/*
+ * Copyright (c) 2013 Jens Kuske <jenskuske@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include <string.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <linux/media.h>
+
+#include "vdpau_private.h"
+#include "v4l2.h"
+#include "v4l2_devices.h"
+#include "v4l2_mock.h"
+
+#define MOCK_PATH "/dev/video-mock"
+#define MOCK_M2M_PATH "/dev/video-mock-m2m"
+#define MOCK_STATELESS_PATH "/dev/video-mock-stateless"
+#define MOCK_MEDIA_PATH "/dev/media-mock"
+#define MOCK_MAX_DEVICES 16
+#define MOCK_MAX_BUFFERS 32
+#define MOCK_MAX_REQUESTS 64
+#define MOCK_PAGE 4096
+
+v4l2_mock_config_t v4l2_mock_config = { 0, 4, 0, 0, 0, 0, 0, 0, 0 };
+
+int __real_open(const char *path, int flags, ...);
+int __real_close(int fd);
+int __real_ioctl(int fd, unsigned long request, ...);
+void *__real_mmap(void *addr, size_t length, int prot, int flags, int fd, off_t offset);
+int __real_munmap(void *addr, size_t length);
+int __real_poll(struct pollfd *fds, nfds_t nfds, int timeout);
+
+typedef struct
+{
+    int index;
+    uint32_t length[3];
+    uint32_t bytesused;
+    uint8_t *data[3];       // allocated for MMAP, the application's for USERPTR
+    struct timeval timestamp;
+    int fields;             // of the picture in it on the stateless node, 1 top, 2 bottom
+} mock_buffer_t;
+
+// indices in queue order
+typedef struct
+{
+    int index[MOCK_MAX_BUFFERS];
+    int head, count;
+} mock_fifo_t;
+
+typedef struct mock_request mock_request_t;
+
+typedef struct
+{
+    int fd;
+    int m2m;                // the generic stateful node, not the MFC
+    int stateless;          // the request based node, every picture comes with a request
+    v4l2_mock_config_t config;
+    pthread_t thread;
+    pthread_cond_t cond;
+    int stop;
+
+    __u32 codec;
+    uint32_t output_size;
+    enum v4l2_memory output_memory;
+    int output_count;
+    mock_buffer_t output[MOCK_MAX_BUFFERS];
+    int output_streaming;
+    mock_fifo_t output_queued, output_done;
+    mock_request_t *output_request[MOCK_MAX_BUFFERS];  // bound by QBUF on the stateless node
+
+    __u32 capture_format;
+    int capture_count;
+    int capture_planes;     // buffers per picture, 1 for the single buffer formats
+    mock_buffer_t capture[MOCK_MAX_BUFFERS];
+    int capture_streaming;
+    int capture_free[MOCK_MAX_BUFFERS];
+    mock_fifo_t capture_held, capture_ready;
+    mock_fifo_t capture_queued;     // stateless, in the order the requests decode into them
+
+    // bumped by STREAMOFF, a picture decoded across it is dropped
+    uint32_t generation;
+    int header_parsed;
+    uint32_t width, height;
+    uint32_t sequence;
+    int changed;            // the size change happened
+    int flushing;           // returning the held pictures of the old size
+    int drained;            // CAPTURE is at EPIPE until set up again
+    int events;
+    int stalled;
+} mock_device_t;
+
+typedef enum
+{
+    REQUEST_IDLE = 0,
+    REQUEST_QUEUED,
+    REQUEST_COMPLETE
+} mock_request_state_t;
+
+// a media request, the OUTPUT buffer and controls of one picture
+struct mock_request
+{
+    int fd;
+    mock_request_state_t state;
+    mock_device_t *device;  // of the bound buffer
+    int output;             // the bound OUTPUT buffer, -1 if none
+#ifdef V4L2_CID_STATELESS_H264_DECODE_PARAMS
+    int has_decode;
+    struct v4l2_ctrl_h264_decode_params decode;
+#endif
+};
+
+static struct
+{
+    mock_device_t *devices[MOCK_MAX_DEVICES];
+    mock_request_t *requests[MOCK_MAX_REQUESTS];
+    int media[MOCK_MAX_DEVICES];
+    int media_count;
+    v4l2_mock_stats_t stats;
+#ifdef V4L2_CID_STATELESS_H264_DECODE_PARAMS
+    struct v4l2_ctrl_h264_decode_params h264_decode;
+    int h264_decode_set;
+#endif
+    pthread_mutex_t mutex;
+} mock = { .mutex = PTHREAD_MUTEX_INITIALIZER };
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void fifo_push(mock_fifo_t *f, int index)
+{
+    f->index[(f->head + f->count++) % MOCK_MAX_BUFFERS] = index;
+}
+
+static int fifo_pop(mock_fifo_t *f)
+{
+    int index = f->index[f->head];
+
+    f->head = (f->head + 1) % MOCK_MAX_BUFFERS;
+    f->count--;
+    return index;
+}
+
+static int fifo_peek(const mock_fifo_t *f)
+{
+    return f->count ? f->index[f->head] : -1;
+}
+
+static void fifo_clear(mock_fifo_t *f)
+{
+    f->head = f->count = 0;
+}
+
+// caller holds mock.mutex
+static mock_device_t *find_device(int fd)
+{
+    int i;
+
+    for (i = 0; i < MOCK_MAX_DEVICES; i++)
+        if (mock.devices[i] && mock.devices[i]->fd == fd)
+            return mock.devices[i];
+
+    return NULL;
+}
+
+// caller holds mock.mutex, requests and media nodes belong to no device
+static mock_request_t *find_request(int fd)
+{
+    int i;
+
+    for (i = 0; i < MOCK_MAX_REQUESTS; i++)
+        if (mock.requests[i] && mock.requests[i]->fd == fd)
+            return mock.requests[i];
+
+    return NULL;
+}
+
+static int find_media(int fd)
+{
+    int i;
+
+    for (i = 0; i < mock.media_count; i++)
+        if (mock.media[i] == fd)
+            return i;
+
+    return -1;
+}
+
+static int is_mock(int fd)
+{
+    pthread_mutex_lock(&mock.mutex);
+    int ret = fd >= 0 && (find_device(fd) || find_request(fd) || find_media(fd) >= 0);
+    pthread_mutex_unlock(&mock.mutex);
+
+    return ret;
+}
+
+void v4l2_mock_stats(v4l2_mock_stats_t *stats)
+{
+    pthread_mutex_lock(&mock.mutex);
+    *stats = mock.stats;
+    pthread_mutex_unlock(&mock.mutex);
+}
+
+/*
+ * Whether the bitstream holds a coded picture, or only what decoder.c
+ * synthesized ahead of one: parameter sets, sequence and entry point headers.
+ */
+static int has_picture(__u32 codec, const uint8_t *data, uint32_t size)
+{
+    uint32_t i;
+
+    // Annex L RCV sequence header, frames start with their size instead
+    if (codec == V4L2_PIX_FMT_VC1_ANNEX_L)
+        return !(size >= 4 && data[3] == 0xc5);
+
+    for (i = 0; i + 3 < size; i++)
+    {
+        if (data[i] || data[i + 1] || data[i + 2] != 0x01)
+            continue;
+
+        uint8_t code = data[i + 3];
+        switch (codec)
+        {
+        case V4L2_PIX_FMT_H264:
+            if ((code & 0x1f) >= 1 && (code & 0x1f) <= 5)
+                return 1;
+            break;
+#ifdef V4L2_PIX_FMT_HEVC
+        case V4L2_PIX_FMT_HEVC:
+            if (((code >> 1) & 0x3f) < 32)
+                return 1;
+            break;
+#endif
+        case V4L2_PIX_FMT_MPEG1:
+        case V4L2_PIX_FMT_MPEG2:
+            if (code == 0x00)
+                return 1;
+            break;
+        case V4L2_PIX_FMT_VC1_ANNEX_G:
+            if (code == 0x0d || code == 0x0c)
+                return 1;
+            break;
+        default:
+            // MPEG-4 and XviD VOPs
+            if (code == 0xb6)
+                return 1;
+            break;
+        }
+    }
+
+    return 0;
+}
+
+static void capture_layout(mock_device_t *m, uint32_t *width, uint32_t *height, uint32_t *luma)
+{
+    *width = v4l2_align(m->width, 16);
+    *height = v4l2_align(m->height, 16);
+    *luma = *width * *height;
+}
+
+// the sizes and pitches of the planes of a CAPTURE buffer, returns how many
+static int capture_planes(mock_device_t *m, uint32_t *length, uint32_t *pitch)
+{
+    uint32_t width, height, luma;
+
+    capture_layout(m, &width, &height, &luma);
+    switch (m->capture_format)
+    {
+    case V4L2_PIX_FMT_YUV420M:
+        length[0] = luma;
+        length[1] = length[2] = luma / 4;
+        pitch[0] = width;
+        pitch[1] = pitch[2] = width / 2;
+        return 3;
+    case V4L2_PIX_FMT_YUV420:
+    case V4L2_PIX_FMT_NV12:
+        length[0] = luma * 3 / 2;
+        pitch[0] = width;
+        return 1;
+    default:
+        length[0] = luma;
+        length[1] = luma / 2;
+        pitch[0] = pitch[1] = width;
+        return 2;
+    }
+}
+
+// marks the start of every chroma plane, so the tests see where the backend expects them
+static void mark_chroma(mock_device_t *m, mock_buffer_t *b)
+{
+    uint32_t width, height, luma;
+
+    capture_layout(m, &width, &height, &luma);
+    if (m->capture_planes > 1)
+    {
+        b->data[1][0] = 0x81;
+        if (m->capture_planes > 2)
+            b->data[2][0] = 0x82;
+    }
+    else
+    {
+        b->data[0][luma] = 0x81;
+        if (m->capture_format == V4L2_PIX_FMT_YUV420)
+            b->data[0][luma + luma / 4] = 0x82;
+    }
+}
+
+static void fill_format(mock_device_t *m, struct v4l2_format *fmt)
+{
+    uint32_t width, height, luma, length[3], pitch[3];
+    int i;
+
+    capture_layout(m, &width, &height, &luma);
+    memset(&fmt->fmt, 0, sizeof(fmt->fmt));
+    fmt->fmt.pix_mp.width = width;
+    fmt->fmt.pix_mp.height = height;
+    fmt->fmt.pix_mp.pixelformat = m->capture_format;
+    fmt->fmt.pix_mp.num_planes = capture_planes(m, length, pitch);
+    for (i = 0; i < fmt->fmt.pix_mp.num_planes; i++)
+    {
+        fmt->fmt.pix_mp.plane_fmt[i].sizeimage = length[i];
+        fmt->fmt.pix_mp.plane_fmt[i].bytesperline = pitch[i];
+    }
+}
+
+static void release_capture(mock_device_t *m)
+{
+    int i, j;
+
+    for (i = 0; i < m->capture_count; i++)
+        for (j = 0; j < 3; j++)
+            free(m->capture[i].data[j]);
+    m->capture_count = 0;
+    memset(m->capture_free, 0, sizeof(m->capture_free));
+    fifo_clear(&m->capture_held);
+    fifo_clear(&m->capture_ready);
+}
+
+static void release_output(mock_device_t *m)
+{
+    int i;
+
+    if (m->output_memory == V4L2_MEMORY_MMAP)
+        for (i = 0; i < m->output_count; i++)
+            free(m->output[i].data[0]);
+    m->output_count = 0;
+    fifo_clear(&m->output_queued);
+    fifo_clear(&m->output_done);
+}
+
+static int free_capture(mock_device_t *m)
+{
+    int i;
+
+    for (i = 0; i < m->capture_count; i++)
+        if (m->capture_free[i])
+            return i;
+
+    return -1;
+}
+
+// one held picture at a time, as the decoder finishes its DPB
+static void output_held(mock_device_t *m, unsigned int keep)
+{
+    while ((unsigned int)m->capture_held.count > keep)
+        fifo_push(&m->capture_ready, fifo_pop(&m->capture_held));
+}
+
+// requests still queued complete without being decoded, their buffers come back
+static void cancel_requests(mock_device_t *m)
+{
+    int i;
+
+    for (i = 0; i < m->output_queued.count; i++)
+    {
+        mock_request_t *r = m->output_request[m->output_queued.index[(m->output_queued.head + i) % MOCK_MAX_BUFFERS]];
+        if (r)
+            r->state = REQUEST_COMPLETE;
+    }
+}
+
+#ifdef V4L2_CID_STATELESS_H264_DECODE_PARAMS
+
+/*
+ * Caller holds mock.mutex. Decodes the request of OUTPUT buffer output into
+ * the CAPTURE buffer queued for it. A reference has to name the timestamp of
+ * a picture some other buffer holds, or that of the first field when this is
+ * the second, anything else counts as a reference error. 0 names none.
+ */
+static void decode_request(mock_device_t *m, int output, int index)
+{
+    mock_buffer_t *out = &m->output[output], *cap = &m->capture[index];
+    mock_request_t *r = m->output_request[output];
+    struct v4l2_ctrl_h264_decode_params *dp = &r->decode;
+    v4l2_mock_picture_t picture;
+    int fields = 3, second = 0, i, j;
+
+    if (r->has_decode && (dp->flags & V4L2_H264_DECODE_PARAM_FLAG_FIELD_PIC))
+    {
+        fields = dp->flags & V4L2_H264_DECODE_PARAM_FLAG_BOTTOM_FIELD ? 2 : 1;
+        second = cap->fields == (3 ^ fields);
+    }
+
+    for (i = 0; r->has_decode && i < V4L2_H264_NUM_DPB_ENTRIES; i++)
+    {
+        const struct v4l2_h264_dpb_entry *e = &dp->dpb[i];
+        if (!(e->flags & V4L2_H264_DPB_ENTRY_FLAG_VALID) || !e->reference_ts)
+            continue;
+        for (j = 0; j < m->capture_count; j++)
+            if (m->capture[j].fields && v4l2_timeval_to_ns(&m->capture[j].timestamp) == e->reference_ts)
+                break;
+        if (j == m->capture_count || (j == index && !second))
+            mock.stats.reference_errors++;
+    }
+
+    if (second)
+    {
+        memcpy(&picture, cap->data[0], sizeof(picture));
+        cap->fields = 3;
+    }
+    else
+    {
+        picture.width = m->width;
+        picture.height = m->height;
+        picture.sequence = m->sequence++;
+        cap->fields = fields;
+    }
+    picture.fields = cap->fields;
+    memcpy(cap->data[0], &picture, sizeof(picture));
+    mark_chroma(m, cap);
+    cap->timestamp = out->timestamp;
+    cap->bytesused = cap->length[0];
+
+    m->capture_free[index] = 0;
+    fifo_pop(&m->capture_queued);
+    fifo_push(&m->capture_ready, index);
+    r->state = REQUEST_COMPLETE;
+
+    mock.stats.pictures++;
+    mock.stats.bytes += out->bytesused;
+    fifo_push(&m->output_done, fifo_pop(&m->output_queued));
+    pthread_cond_broadcast(&m->cond);
+}
+
+// QBUF only binds the buffer to its request, MEDIA_REQUEST_IOC_QUEUE queues both
+static int bind_request(mock_device_t *m, struct v4l2_buffer *buf)
+{
+    mock_request_t *r;
+
+    if (!(buf->flags & V4L2_BUF_FLAG_REQUEST_FD))
+        return EBADR;
+    if (!(r = find_request(buf->request_fd)))
+        return EINVAL;
+    if (r->state != REQUEST_IDLE || r->output >= 0)
+        return EBUSY;
+
+    r->device = m;
+    r->output = buf->index;
+    m->output_request[buf->index] = r;
+    return 0;
+}
+
+// settings outside a request are taken as they come, a request keeps its H.264 decode parameters
+static int set_controls(mock_device_t *m, struct v4l2_ext_controls *ctrls)
+{
+    mock_request_t *r = NULL;
+    uint32_t i;
+
+    if (ctrls->which == V4L2_CTRL_WHICH_REQUEST_VAL)
+    {
+        if (!(r = find_request(ctrls->request_fd)))
+            return EINVAL;
+        if (r->state != REQUEST_IDLE)
+            return EBUSY;
+    }
+    else if (ctrls->which != V4L2_CTRL_WHICH_CUR_VAL)
+    {
+        return EINVAL;
+    }
+
+    for (i = 0; i < ctrls->count; i++)
+    {
+        struct v4l2_ext_control *c = &ctrls->controls[i];
+        if (c->id != V4L2_CID_STATELESS_H264_DECODE_PARAMS)
+            continue;
+        if (!r || c->size != sizeof(r->decode))
+        {
+            ctrls->error_idx = i;
+            return EINVAL;
+        }
+        memcpy(&r->decode, c->ptr, sizeof(r->decode));
+        r->has_decode = 1;
+        mock.h264_decode = r->decode;
+        mock.h264_decode_set = 1;
+    }
+
+    return 0;
+}
+
+// MEDIA_IOC_REQUEST_ALLOC on the media node, the rest on the requests it handed out
+static int media_ioctl(int fd, unsigned long request, void *arg)
+{
+    mock_request_t *r = find_request(fd);
+    int i;
+
+    switch (request)
+    {
+    case MEDIA_IOC_REQUEST_ALLOC:
+        if (r)
+            return ENOTTY;
+        for (i = 0; i < MOCK_MAX_REQUESTS && mock.requests[i]; i++)
+            ;
+        if (i == MOCK_MAX_REQUESTS || !(r = calloc(1, sizeof(mock_request_t))))
+            return ENOMEM;
+        if ((r->fd = __real_open("/dev/null", O_RDWR | O_CLOEXEC)) < 0)
+        {
+            free(r);
+            return errno;
+        }
+        r->output = -1;
+        mock.requests[i] = r;
+        *(int *)arg = r->fd;
+        return 0;
+
+    case MEDIA_REQUEST_IOC_QUEUE:
+        if (!r)
+            return ENOTTY;
+        if (r->state != REQUEST_IDLE)
+            return EBUSY;
+        if (r->output < 0 || !r->device)
+            return ENOENT;
+        r->state = REQUEST_QUEUED;
+        fifo_push(&r->device->output_queued, r->output);
+        mock.stats.requests++;
+        pthread_cond_broadcast(&r->device->cond);
+        return 0;
+
+    case MEDIA_REQUEST_IOC_REINIT:
+        if (!r)
+            return ENOTTY;
+        if (r->state == REQUEST_QUEUED)
+            return EBUSY;
+        if (r->device && r->output >= 0 && r->device->output_request[r->output] == r)
+            r->device->output_request[r->output] = NULL;
+        r->state = REQUEST_IDLE;
+        r->output = -1;
+        r->has_decode = 0;
+        return 0;
+    }
+
+    return ENOTTY;
+}
+
+int v4l2_mock_h264_decode(struct v4l2_ctrl_h264_decode_params *decode)
+{
+    pthread_mutex_lock(&mock.mutex);
+    int ret = mock.h264_decode_set;
+    if (ret)
+        *decode = mock.h264_decode;
+    pthread_mutex_unlock(&mock.mutex);
+
+    return ret;
+}
+
+#endif
+
+static void *device_thread(void *arg)
+{
+    mock_device_t *m = arg;
+
+    pthread_mutex_lock(&mock.mutex);
+    while (!m->stop)
+    {
+        if (m->flushing)
+        {
+            // the held pictures come out one by one, as fast as they decoded
+            if (m->capture_held.count && m->config.decode_us)
+            {
+                uint32_t generation = m->generation;
+                pthread_mutex_unlock(&mock.mutex);
+                usleep(m->config.decode_us);
+                pthread_mutex_lock(&mock.mutex);
+                if (m->stop)
+                    break;
+                if (generation != m->generation)
+                    continue;
+            }
+            if (m->capture_held.count)
+            {
+                output_held(m, m->capture_held.count - 1);
+            }
+            else
+            {
+                // stateful drivers end the drain with an empty buffer, if they have one
+                int index = m->m2m ? free_capture(m) : -1;
+                if (index >= 0)
+                {
+                    m->capture[index].bytesused = 0;
+                    m->capture_free[index] = 0;
+                    fifo_push(&m->capture_ready, index);
+                }
+                m->flushing = 0;
+                m->drained = 1;
+            }
+            pthread_cond_broadcast(&m->cond);
+            continue;
+        }
+
+        if (!m->output_streaming || !m->output_queued.count || m->drained)
+        {
+            pthread_cond_wait(&m->cond, &mock.mutex);
+            continue;
+        }
+
+        mock_buffer_t *out = &m->output[m->output_queued.index[m->output_queued.head]];
+
+        // the MFC only parses the header from the first buffer, a picture in it is lost,
+        // other stateful decoders announce the size with an event and decode it once
+        // CAPTURE is set up, stateless ones got the size with the OUTPUT format
+        if (!m->stateless && (!m->header_parsed || !has_picture(m->codec, out->data[0], out->bytesused)))
+        {
+            if (!m->header_parsed)
+            {
+                m->width = m->config.width;
+                m->height = m->config.height;
+                m->header_parsed = 1;
+                if (m->m2m)
+                {
+                    m->events++;
+                    pthread_cond_broadcast(&m->cond);
+                    if (has_picture(m->codec, out->data[0], out->bytesused))
+                        continue;
+                }
+            }
+            mock.stats.headers++;
+            mock.stats.bytes += out->bytesused;
+            fifo_push(&m->output_done, fifo_pop(&m->output_queued));
+            pthread_cond_broadcast(&m->cond);
+            continue;
+        }
+
+        // the new size is parsed with the picture, which waits for the new CAPTURE
+        if (m->config.change_after && !m->changed && m->sequence == m->config.change_after)
+        {
+            m->changed = 1;
+            m->width = m->config.change_width;
+            m->height = m->config.change_height;
+            m->events++;
+            m->flushing = 1;
+            mock.stats.source_changes++;
+            pthread_cond_broadcast(&m->cond);
+            continue;
+        }
+
+        // a request decodes into the buffer queued for it, the others into any free one
+        int index = !m->capture_streaming ? -1 : m->stateless ? fifo_peek(&m->capture_queued) : free_capture(m);
+        if (index < 0)
+        {
+            if (!m->stalled)
+                mock.stats.capture_stalls++;
+            m->stalled = 1;
+            pthread_cond_wait(&m->cond, &mock.mutex);
+            continue;
+        }
+        m->stalled = 0;
+
+        uint32_t generation = m->generation;
+        if (m->config.decode_us)
+        {
+            pthread_mutex_unlock(&mock.mutex);
+            usleep(m->config.decode_us);
+            pthread_mutex_lock(&mock.mutex);
+            if (m->stop)
+                break;
+        }
+        // STREAMOFF took the buffers back meanwhile
+        if (generation != m->generation || !m->capture_free[index])
+            continue;
+
+#ifdef V4L2_CID_STATELESS_H264_DECODE_PARAMS
+        if (m->stateless)
+        {
+            decode_request(m, m->output_queued.index[m->output_queued.head], index);
+            continue;
+        }
+#endif
+
+        mock_buffer_t *cap = &m->capture[index];
+        v4l2_mock_picture_t picture = { m->width, m->height, m->sequence++, 3 };
+        memcpy(cap->data[0], &picture, sizeof(picture));
+        mark_chroma(m, cap);
+        cap->timestamp = out->timestamp;
+        cap->bytesused = cap->length[0];
+        m->capture_free[index] = 0;
+        fifo_push(&m->capture_held, index);
+        output_held(m, m->config.dpb_delay);
+
+        mock.stats.pictures++;
+        mock.stats.bytes += out->bytesused;
+        fifo_push(&m->output_done, fifo_pop(&m->output_queued));
+        pthread_cond_broadcast(&m->cond);
+    }
+    pthread_mutex_unlock(&mock.mutex);
+
+    return NULL;
+}
+
+static int mock_open(int m2m, int stateless)
+{
+    mock_device_t *m = calloc(1, sizeof(mock_device_t));
+    int i;
+
+    if (!m)
+    {
+        errno = ENOMEM;
+        return -1;
+    }
+
+    // a real descriptor keeps the number from being handed out twice
+    m->fd = __real_open("/dev/null", O_RDWR);
+    if (m->fd < 0)
+    {
+        free(m);
+        return -1;
+    }
+    m->m2m = m2m;
+    m->stateless = stateless;
+    m->config = v4l2_mock_config;
+    m->capture_format = m->config.capture_format ? m->config.capture_format : V4L2_PIX_FMT_NV12M;
+    m->output_memory = V4L2_MEMORY_MMAP;
+    pthread_cond_init(&m->cond, NULL);
+
+    pthread_mutex_lock(&mock.mutex);
+    for (i = 0; i < MOCK_MAX_DEVICES && mock.devices[i]; i++)
+        ;
+    if (i == MOCK_MAX_DEVICES || pthread_create(&m->thread, NULL, device_thread, m))
+    {
+        pthread_mutex_unlock(&mock.mutex);
+        __real_close(m->fd);
+        pthread_cond_destroy(&m->cond);
+        free(m);
+        errno = EBUSY;
+        return -1;
+    }
+    mock.devices[i] = m;
+    mock.stats.opens++;
+    pthread_mutex_unlock(&mock.mutex);
+
+    return m->fd;
+}
+
+static int media_open(void)
+{
+    int fd = __real_open("/dev/null", O_RDWR);
+
+    pthread_mutex_lock(&mock.mutex);
+    if (fd >= 0 && mock.media_count == MOCK_MAX_DEVICES)
+    {
+        __real_close(fd);
+        fd = -1;
+        errno = EBUSY;
+    }
+    if (fd >= 0)
+        mock.media[mock.media_count++] = fd;
+    pthread_mutex_unlock(&mock.mutex);
+
+    return fd;
+}
+
+static int mock_close(int fd)
+{
+    mock_device_t *m = NULL;
+    int i;
+
+    pthread_mutex_lock(&mock.mutex);
+    for (i = 0; i < MOCK_MAX_DEVICES; i++)
+    {
+        if (mock.devices[i] && mock.devices[i]->fd == fd)
+        {
+            m = mock.devices[i];
+            mock.devices[i] = NULL;
+            break;
+        }
+    }
+    if (!m)
+    {
+        mock_request_t *r = find_request(fd);
+        int media = find_media(fd);
+
+        for (i = 0; r && i < MOCK_MAX_REQUESTS; i++)
+            if (mock.requests[i] == r)
+                mock.requests[i] = NULL;
+        free(r);
+        if (media >= 0)
+            mock.media[media] = mock.media[--mock.media_count];
+        pthread_mutex_unlock(&mock.mutex);
+        return __real_close(fd);
+    }
+    // requests outlive the device, they just lose their buffer
+    for (i = 0; i < MOCK_MAX_REQUESTS; i++)
+    {
+        mock_request_t *r = mock.requests[i];
+        if (r && r->device == m)
+        {
+            r->device = NULL;
+            r->output = -1;
+            if (r->state == REQUEST_QUEUED)
+                r->state = REQUEST_COMPLETE;
+        }
+    }
+    m->stop = 1;
+    pthread_cond_broadcast(&m->cond);
+    pthread_mutex_unlock(&mock.mutex);
+
+    pthread_join(m->thread, NULL);
+    release_capture(m);
+    release_output(m);
+    pthread_cond_destroy(&m->cond);
+    free(m);
+
+    return __real_close(fd);
+}
+
+static int reqbufs(mock_device_t *m, struct v4l2_requestbuffers *req)
+{
+    int count = min((int)req->count, MOCK_MAX_BUFFERS);
+    int i, j;
+
+#ifdef V4L2_CID_STATELESS_H264_DECODE_PARAMS
+    req->capabilities = V4L2_BUF_CAP_SUPPORTS_MMAP;
+    if (m->stateless && req->type == V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE)
+        req->capabilities |= V4L2_BUF_CAP_SUPPORTS_REQUESTS;
+#endif
+
+    if (req->type == V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE)
+    {
+        if (m->output_streaming)
+            return EBUSY;
+        release_output(m);
+        if (req->memory != V4L2_MEMORY_MMAP && req->memory != V4L2_MEMORY_USERPTR)
+            return EINVAL;
+        m->output_memory = req->memory;
+        for (i = 0; i < count; i++)
+        {
+            memset(&m->output[i], 0, sizeof(mock_buffer_t));
+            m->output[i].index = i;
+            m->output[i].length[0] = m->output_size;
+            m->output_request[i] = NULL;
+            if (req->memory == V4L2_MEMORY_MMAP && !(m->output[i].data[0] = calloc(1, m->output_size)))
+                return ENOMEM;
+        }
+        m->output_count = req->count = count;
+        return 0;
+    }
+
+    if (req->type != V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE || req->memory != V4L2_MEMORY_MMAP)
+        return EINVAL;
+    if (m->capture_streaming)
+        return EBUSY;
+
+    release_capture(m);
+    if (count)
+        count = max(count, (int)m->config.min_buffers);
+    for (i = 0; i < count; i++)
+    {
+        uint32_t pitch[3];
+
+        memset(&m->capture[i], 0, sizeof(mock_buffer_t));
+        m->capture[i].index = i;
+        m->capture_planes = capture_planes(m, m->capture[i].length, pitch);
+        for (j = 0; j < m->capture_planes; j++)
+            if (!(m->capture[i].data[j] = calloc(1, m->capture[i].length[j])))
+                return ENOMEM;
+        m->capture_count = i + 1;
+    }
+    req->count = count;
+
+    return 0;
+}
+
+// mmap offsets name the buffer and plane
+static uint32_t mem_offset(int capture, int index, int plane)
+{
+    return ((capture << 12) | (index << 4) | plane) * MOCK_PAGE;
+}
+
+static int querybuf(mock_device_t *m, struct v4l2_buffer *buf)
+{
+    int capture = buf->type == V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
+    int count = capture ? m->capture_count : m->output_count;
+    int planes = capture ? m->capture_planes : 1, i;
+
+    if (buf->index >= (uint32_t)count || buf->length < (uint32_t)planes)
+        return EINVAL;
+
+    mock_buffer_t *b = capture ? &m->capture[buf->index] : &m->output[buf->index];
+    buf->length = planes;
+    for (i = 0; i < planes; i++)
+    {
+        buf->m.planes[i].length = b->length[i];
+        buf->m.planes[i].bytesused = 0;
+        buf->m.planes[i].m.mem_offset = mem_offset(capture, buf->index, i);
+    }
+
+    return 0;
+}
+
+static int qbuf(mock_device_t *m, struct v4l2_buffer *buf)
+{
+    if (buf->type == V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE)
+    {
+        if (buf->index >= (uint32_t)m->output_count || buf->memory != m->output_memory || !buf->length)
+            return EINVAL;
+
+        mock_buffer_t *b = &m->output[buf->index];
+        if (m->output_memory == V4L2_MEMORY_USERPTR)
+        {
+            b->data[0] = (uint8_t *)buf->m.planes[0].m.userptr;
+            b->length[0] = buf->m.planes[0].length;
+        }
+        if (!b->data[0] || buf->m.planes[0].bytesused > b->length[0])
+            return EINVAL;
+        b->bytesused = buf->m.planes[0].bytesused;
+        b->timestamp = buf->timestamp;
+#ifdef V4L2_CID_STATELESS_H264_DECODE_PARAMS
+        if (m->stateless)
+            return bind_request(m, buf);
+#endif
+        fifo_push(&m->output_queued, buf->index);
+    }
+    else if (buf->type == V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE)
+    {
+        if (buf->index >= (uint32_t)m->capture_count || m->capture_free[buf->index])
+            return EINVAL;
+        m->capture_free[buf->index] = 1;
+        if (m->stateless)
+            fifo_push(&m->capture_queued, buf->index);
+    }
+    else
+    {
+        return EINVAL;
+    }
+
+    pthread_cond_broadcast(&m->cond);
+    return 0;
+}
+
+static int dqbuf(mock_device_t *m, struct v4l2_buffer *buf)
+{
+    mock_buffer_t *b;
+
+    if (buf->type == V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE)
+    {
+        if (!m->output_done.count)
+            return EAGAIN;
+        b = &m->output[fifo_pop(&m->output_done)];
+        buf->flags = 0;
+    }
+    else if (buf->type == V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE)
+    {
+        if (!m->capture_ready.count)
+            return m->drained ? EPIPE : EAGAIN;
+        b = &m->capture[fifo_pop(&m->capture_ready)];
+        // the last picture before a resolution change is flagged
+        buf->flags = m->drained && !m->capture_ready.count ? V4L2_BUF_FLAG_LAST : 0;
+    }
+    else
+    {
+        return EINVAL;
+    }
+
+    buf->index = b->index;
+    buf->timestamp = b->timestamp;
+    if (buf->length)
+        buf->m.planes[0].bytesused = b->bytesused;
+
+    return 0;
+}
+
+static int streamon(mock_device_t *m, enum v4l2_buf_type type, int on)
+{
+    int i;
+
+    if (type == V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE)
+    {
+        m->output_streaming = on;
+        if (!on)
+        {
+            // everything queued comes back unprocessed
+            m->generation++;
+            cancel_requests(m);
+            fifo_clear(&m->output_queued);
+            fifo_clear(&m->output_done);
+            fifo_clear(&m->capture_held);
+            m->flushing = 0;
+        }
+    }
+    else if (type == V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE)
+    {
+        if (on && !m->capture_count)
+            return EINVAL;
+        m->capture_streaming = on;
+        if (!on)
+        {
+            m->generation++;
+            for (i = 0; i < MOCK_MAX_BUFFERS; i++)
+                m->capture_free[i] = 0;
+            // references into pictures from before are errors from now on
+            for (i = 0; i < m->capture_count; i++)
+                m->capture[i].fields = 0;
+            fifo_clear(&m->capture_held);
+            fifo_clear(&m->capture_ready);
+            fifo_clear(&m->capture_queued);
+            m->flushing = 0;
+            m->drained = 0;
+        }
+    }
+    else
+    {
+        return EINVAL;
+    }
+
+    pthread_cond_broadcast(&m->cond);
+    return 0;
+}
+
+// G_FMT waits for the header like the MFC does
+static int wait_header(mock_device_t *m)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    ts.tv_sec += 1;
+    while (!m->header_parsed)
+        if (pthread_cond_timedwait(&m->cond, &mock.mutex, &ts))
+            return EINVAL;
+
+    return 0;
+}
+
+static int device_ioctl(mock_device_t *m, unsigned long request, void *arg)
+{
+    switch (request)
+    {
+    case VIDIOC_S_FMT:
+    {
+        struct v4l2_format *fmt = arg;
+        if (fmt->type == V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE)
+        {
+            m->codec = fmt->fmt.pix_mp.pixelformat;
+            m->output_size = fmt->fmt.pix_mp.plane_fmt[0].sizeimage ? fmt->fmt.pix_mp.plane_fmt[0].sizeimage : 1 << 20;
+            // there are no headers to parse, the application knows the size
+            if (m->stateless)
+            {
+                m->width = fmt->fmt.pix_mp.width;
+                m->height = fmt->fmt.pix_mp.height;
+                m->header_parsed = 1;
+            }
+            return 0;
+        }
+        // the one CAPTURE layout the node decodes to, the MFC backend sets it before the header
+        if (fmt->type != V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE || fmt->fmt.pix_mp.pixelformat != m->capture_format)
+            return EINVAL;
+        if (m->header_parsed)
+            fill_format(m, fmt);
+        return 0;
+    }
+
+    case VIDIOC_G_FMT:
+    {
+        struct v4l2_format *fmt = arg;
+
+        if (fmt->type != V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE || wait_header(m))
+            return EINVAL;
+        fill_format(m, fmt);
+        return 0;
+    }
+
+    case VIDIOC_G_SELECTION:
+    {
+        struct v4l2_selection *sel = arg;
+        if ((sel->type != V4L2_BUF_TYPE_VIDEO_CAPTURE && sel->type != V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE) ||
+                sel->target != V4L2_SEL_TGT_COMPOSE || wait_header(m))
+            return EINVAL;
+        memset(&sel->r, 0, sizeof(sel->r));
+        sel->r.width = m->width;
+        sel->r.height = m->height;
+        return 0;
+    }
+
+    case VIDIOC_G_CROP:
+    {
+        struct v4l2_crop *crop = arg;
+        if (wait_header(m))
+            return EINVAL;
+        memset(&crop->c, 0, sizeof(crop->c));
+        crop->c.width = m->width;
+        crop->c.height = m->height;
+        return 0;
+    }
+
+    case VIDIOC_G_CTRL:
+    {
+        struct v4l2_control *ctrl = arg;
+        if (ctrl->id != V4L2_CID_MIN_BUFFERS_FOR_CAPTURE)
+            return EINVAL;
+        ctrl->value = m->config.min_buffers;
+        return 0;
+    }
+
+    case VIDIOC_SUBSCRIBE_EVENT:
+        return ((struct v4l2_event_subscription *)arg)->type == V4L2_EVENT_SOURCE_CHANGE ? 0 : EINVAL;
+
+    case VIDIOC_DQEVENT:
+    {
+        struct v4l2_event *ev = arg;
+        if (!m->events)
+            return ENOENT;
+        m->events--;
+        memset(ev, 0, sizeof(*ev));
+        ev->type = V4L2_EVENT_SOURCE_CHANGE;
+        ev->u.src_change.changes = V4L2_EVENT_SRC_CH_RESOLUTION;
+        return 0;
+    }
+
+#ifdef V4L2_CID_STATELESS_H264_DECODE_PARAMS
+    case VIDIOC_S_EXT_CTRLS:
+        return m->stateless ? set_controls(m, arg) : ENOTTY;
+#endif
+
+    case VIDIOC_REQBUFS:
+        return reqbufs(m, arg);
+    case VIDIOC_QUERYBUF:
+        return querybuf(m, arg);
+    case VIDIOC_QBUF:
+        return qbuf(m, arg);
+    case VIDIOC_DQBUF:
+        return dqbuf(m, arg);
+    case VIDIOC_STREAMON:
+        return streamon(m, *(enum v4l2_buf_type *)arg, 1);
+    case VIDIOC_STREAMOFF:
+        return streamon(m, *(enum v4l2_buf_type *)arg, 0);
+
+    case VIDIOC_EXPBUF:
+    {
+        // pictures are read through the mappings, the fd only has to be closable
+        struct v4l2_exportbuffer *expbuf = arg;
+        if (expbuf->type != V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE)
+            return EINVAL;
+        expbuf->fd = __real_open("/dev/null", O_RDONLY | O_CLOEXEC);
+        return expbuf->fd < 0 ? errno : 0;
+    }
+    }
+
+    return ENOTTY;
+}
+
+int __wrap_open(const char *path, int flags, ...)
+{
+    va_list ap;
+    mode_t mode;
+
+    if (!strcmp(path, MOCK_PATH))
+        return mock_open(0, 0);
+    if (!strcmp(path, MOCK_M2M_PATH))
+        return mock_open(1, 0);
+    if (!strcmp(path, MOCK_STATELESS_PATH))
+        return mock_open(0, 1);
+    if (!strcmp(path, MOCK_MEDIA_PATH))
+        return media_open();
+
+    va_start(ap, flags);
+    mode = va_arg(ap, mode_t);
+    va_end(ap);
+
+    return __real_open(path, flags, mode);
+}
+
+int __wrap_close(int fd)
+{
+    return mock_close(fd);
+}
+
+int __wrap_ioctl(int fd, unsigned long request, ...)
+{
+    va_list ap;
+    void *arg;
+    int ret;
+
+    va_start(ap, request);
+    arg = va_arg(ap, void *);
+    va_end(ap);
+
+    pthread_mutex_lock(&mock.mutex);
+    mock_device_t *m = find_device(fd);
+    if (m)
+    {
+        ret = device_ioctl(m, request, arg);
+    }
+#ifdef V4L2_CID_STATELESS_H264_DECODE_PARAMS
+    else if (find_request(fd) || find_media(fd) >= 0)
+    {
+        ret = media_ioctl(fd, request, arg);
+    }
+#endif
+    else
+    {
+        pthread_mutex_unlock(&mock.mutex);
+        return __real_ioctl(fd, request, arg);
+    }
+    pthread_mutex_unlock(&mock.mutex);
+
+    if (ret)
+    {
+        errno = ret;
+        return -1;
+    }
+    return 0;
+}
+
+void *__wrap_mmap(void *addr, size_t length, int prot, int flags, int fd, off_t offset)
+{
+    void *data = MAP_FAILED;
+
+    pthread_mutex_lock(&mock.mutex);
+    mock_device_t *m = find_device(fd);
+    if (!m)
+    {
+        pthread_mutex_unlock(&mock.mutex);
+        return __real_mmap(addr, length, prot, flags, fd, offset);
+    }
+
+    uint32_t page = offset / MOCK_PAGE;
+    int capture = page >> 12, index = (page >> 4) & 0xff, plane = page & 0xf;
+    if (capture && index < m->capture_count && plane < m->capture_planes)
+        data = m->capture[index].data[plane];
+    else if (!capture && index < m->output_count && !plane && m->output_memory == V4L2_MEMORY_MMAP)
+        data = m->output[index].data[0];
+    pthread_mutex_unlock(&mock.mutex);
+
+    if (data == MAP_FAILED)
+        errno = EINVAL;
+    return data;
+}
+
+// the buffers belong to the device until REQBUFS or close
+int __wrap_munmap(void *addr, size_t length)
+{
+    int i, j, k;
+
+    pthread_mutex_lock(&mock.mutex);
+    for (i = 0; i < MOCK_MAX_DEVICES; i++)
+    {
+        mock_device_t *m = mock.devices[i];
+        for (j = 0; m && j < MOCK_MAX_BUFFERS; j++)
+        {
+            for (k = 0; k < 3; k++)
+            {
+                if (addr && (m->capture[j].data[k] == addr || m->output[j].data[k] == addr))
+                {
+                    pthread_mutex_unlock(&mock.mutex);
+                    return 0;
+                }
+            }
+        }
+    }
+    pthread_mutex_unlock(&mock.mutex);
+
+    return __real_munmap(addr, length);
+}
+
+static short device_revents(mock_device_t *m, short events)
+{
+    short revents = 0;
+
+    if (m->output_done.count)
+        revents |= POLLOUT;
+    if (m->capture_ready.count || m->drained)
+        revents |= POLLIN;
+    if (m->events)
+        revents |= POLLPRI;
+
+    return revents & (events | POLLERR);
+}
+
+// done once completed, an idle request has nothing to wait for
+static short request_revents(mock_request_t *r, short events)
+{
+    if (r->state == REQUEST_COMPLETE)
+        return POLLPRI & events;
+
+    return r->state == REQUEST_IDLE ? POLLERR : 0;
+}
+
+int __wrap_poll(struct pollfd *fds, nfds_t nfds, int timeout)
+{
+    struct timespec ts;
+    uint64_t start;
+    int ret = 1;
+
+    if (nfds != 1 || !is_mock(fds[0].fd))
+        return __real_poll(fds, nfds, timeout);
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    if (timeout > 0)
+    {
+        ts.tv_sec += timeout / 1000;
+        ts.tv_nsec += (timeout % 1000) * 1000000;
+        if (ts.tv_nsec >= 1000000000)
+        {
+            ts.tv_sec++;
+            ts.tv_nsec -= 1000000000;
+        }
+    }
+
+    pthread_mutex_lock(&mock.mutex);
+    mock_device_t *m = find_device(fds[0].fd);
+    // a request is waited for on the device it was queued to
+    mock_request_t *r = m ? NULL : find_request(fds[0].fd);
+    if (r)
+        m = r->device;
+    start = now_ns();
+    while ((m || r) && !(fds[0].revents = r ? request_revents(r, fds[0].events) : device_revents(m, fds[0].events)))
+    {
+        if (!m || !timeout || (timeout > 0 && pthread_cond_timedwait(&m->cond, &mock.mutex, &ts)))
+        {
+            ret = 0;
+            break;
+        }
+        if (timeout < 0)
+            pthread_cond_wait(&m->cond, &mock.mutex);
+    }
+    // a full bitstream queue, what VdpDecoderRender waited for
+    if (m && now_ns() - start > 1000 && (fds[0].events & POLLOUT))
+    {
+        mock.stats.output_waits++;
+        mock.stats.output_wait_ns += now_ns() - start;
+    }
+    pthread_mutex_unlock(&mock.mutex);
+
+    return ret;
+}
+
+/* the device table of v4l2_devices.c, with the mock MFC, a generic stateful and a stateless node */
+
+static const v4l2_device_t mock_mfc =
+{
+    .path = MOCK_PATH,
+    .name = "s5p-mfc-dec",
+    .mfc = 1,
+    .direct = 1,
+    .output_count = 8,
+    .output =
+    {
+        { V4L2_PIX_FMT_H264, 1920, 1080 },
+        { V4L2_PIX_FMT_MPEG1, 1920, 1080 },
+        { V4L2_PIX_FMT_MPEG2, 1920, 1080 },
+        { V4L2_PIX_FMT_MPEG4, 1920, 1080 },
+        { V4L2_PIX_FMT_XVID, 1920, 1080 },
+        { V4L2_PIX_FMT_VC1_ANNEX_G, 1920, 1080 },
+        { V4L2_PIX_FMT_VC1_ANNEX_L, 1920, 1080 },
+#ifdef V4L2_PIX_FMT_HEVC
+        { V4L2_PIX_FMT_HEVC, 4096, 2304 },
+#endif
+    },
+    .capture_count = 1,
+    .capture = { V4L2_PIX_FMT_NV12M },
+};
+
+// what the stateful backend maps, CAPTURE as configured
+static const v4l2_device_t mock_m2m =
+{
+    .path = MOCK_M2M_PATH,
+    .name = "mock-m2m-dec",
+    .direct = 1,
+    .output_count = 3,
+    .output =
+    {
+        { V4L2_PIX_FMT_H264, 1920, 1088 },
+        { V4L2_PIX_FMT_MPEG2, 1920, 1088 },
+#ifdef V4L2_PIX_FMT_HEVC
+        { V4L2_PIX_FMT_HEVC, 1920, 1088 },
+#endif
+    },
+    .capture_count = 4,
+    .capture = { V4L2_PIX_FMT_YUV420M, V4L2_PIX_FMT_YUV420, V4L2_PIX_FMT_NV12M, V4L2_PIX_FMT_NV12 },
+};
+
+#ifdef V4L2_CID_STATELESS_H264_DECODE_PARAMS
+// a request API decoder with its media node, for the stateless backend
+static const v4l2_device_t mock_stateless =
+{
+    .path = MOCK_STATELESS_PATH,
+    .name = "mock-stateless-dec",
+    .direct = 1,
+    .media = MOCK_MEDIA_PATH,
+    .output_count = 1,
+    .output =
+    {
+        { V4L2_PIX_FMT_H264_SLICE, 1920, 1088 },
+    },
+    .capture_count = 4,
+    .capture = { V4L2_PIX_FMT_YUV420M, V4L2_PIX_FMT_YUV420, V4L2_PIX_FMT_NV12M, V4L2_PIX_FMT_NV12 },
+};
+#endif
+
+const v4l2_format_caps_t *v4l2_device_format(const v4l2_device_t *device, __u32 codec)
+{
+    int i;
+
+    for (i = 0; i < device->output_count; i++)
+        if (device->output[i].fourcc == codec)
+            return &device->output[i];
+
+    return NULL;
+}
+
+int v4l2_find_decoder(__u32 codec, int mfc, v4l2_device_t *device)
+{
+    const v4l2_device_t *node = mfc ? &mock_mfc : &mock_m2m;
+
+#ifdef V4L2_CID_STATELESS_H264_DECODE_PARAMS
+    // only the stateless node lists the *_SLICE formats
+    if (!mfc && !v4l2_device_format(node, codec))
+        node = &mock_stateless;
+#endif
+    if (!v4l2_device_format(node, codec))
+        return -1;
+
+    *device = *node;
+    return 0;
+}
+
+int v4l2_find_converter(v4l2_device_t *device)
+{
+    return -1;
+}
+
+void v4l2_devices_invalidate(void)
+{
+}
@@ -0,0 +1,102 @@
+/*
+ * Copyright (c) 2013 Jens Kuske <jenskuske@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifndef __V4L2_MOCK_H__
+#define __V4L2_MOCK_H__
+
+#include <stdint.h>
+#include <linux/videodev2.h>
+
+/*
+ * Software MFC behind the system calls, for vdpau-replay and the tests. Linked
+ * with -Wl,--wrap for open, close, ioctl, mmap, munmap and poll (see
+ * MOCK_LDFLAGS in the Makefile), so the real v4l2decode.c, v4l2_stateful.c,
+ * v4l2_stateless.c and v4l2.c run unchanged against it. It also stands in for
+ * the device table of v4l2_devices.c with an s5p-mfc-dec, a generic stateful
+ * decoder, mock-m2m-dec, for H.264, MPEG-2 and HEVC, and a stateless H.264
+ * decoder, mock-stateless-dec, with its media node.
+ *
+ * Like the stateful MFC it parses the header from the first bitstream
+ * buffer, then turns every buffer holding picture data into one picture
+ * after decode_us, and buffers without (parameter sets, sequence headers)
+ * into none. A resolution change is announced with V4L2_EVENT_SOURCE_CHANGE,
+ * the pictures still held back are returned one per decode_us, the last with
+ * V4L2_BUF_FLAG_LAST, then CAPTURE fails with EPIPE until it was set up again.
+ *
+ * mock-m2m-dec behaves like the kernel's stateful decoder interface instead:
+ * the header raises V4L2_EVENT_SOURCE_CHANGE too, a picture in the same
+ * buffer is decoded once CAPTURE is set up, and a drain ends with an empty
+ * buffer flagged V4L2_BUF_FLAG_LAST. The visible size is reported through
+ * VIDIOC_G_SELECTION, and the start of every chroma plane is marked with
+ * 0x81 (Cb or CbCr) and 0x82 (Cr).
+ *
+ * mock-stateless-dec takes the size from the OUTPUT format and decodes a
+ * picture per media request, into the CAPTURE buffers in the order they were
+ * queued.
+ * Requests can only be refilled once complete, as with the kernel. A field
+ * lands in the buffer holding its complementary first field, and every H.264
+ * reference has to name the timestamp of a picture another buffer still
+ * holds, or the first field of the same frame, see reference_errors. STREAMOFF
+ * completes the queued requests and forgets what CAPTURE held.
+ */
+
+typedef struct
+{
+    unsigned int decode_us;
+    unsigned int min_buffers;       // V4L2_CID_MIN_BUFFERS_FOR_CAPTURE
+    unsigned int width, height;     // coded size the header announces
+    unsigned int dpb_delay;         // pictures held back before they are output
+    unsigned int change_after;      // pictures decoded before the size changes, 0 never
+    unsigned int change_width, change_height;
+    __u32 capture_format;           // the one CAPTURE layout taken, 0 for the MFC's NV12M
+} v4l2_mock_config_t;
+
+typedef struct
+{
+    uint64_t pictures;              // decoded into a capture buffer, a field each on the stateless node
+    uint64_t headers;               // bitstream buffers without picture data
+    uint64_t bytes;
+    uint64_t output_waits;          // poll for a free bitstream buffer had to wait
+    uint64_t output_wait_ns;
+    uint64_t capture_stalls;        // decoding waited for a capture buffer to come back
+    uint32_t source_changes;
+    uint32_t opens;
+    uint32_t requests;              // queued on the stateless node
+    uint32_t reference_errors;      // stateless references to no picture, or to the one decoded over
+} v4l2_mock_stats_t;
+
+// written to the start of the first plane of every decoded picture
+typedef struct
+{
+    uint32_t width, height;
+    uint32_t sequence;              // of the picture in decoding order, from 0
+    uint32_t fields;                // decoded into it, 1 top, 2 bottom, 3 both or a frame
+} v4l2_mock_picture_t;
+
+// read when a device is opened
+extern v4l2_mock_config_t v4l2_mock_config;
+
+void v4l2_mock_stats(v4l2_mock_stats_t *stats);
+
+#ifdef V4L2_CID_STATELESS_H264_DECODE_PARAMS
+// the H.264 decode parameters last set for a request, 0 if there were none yet
+int v4l2_mock_h264_decode(struct v4l2_ctrl_h264_decode_params *decode);
+#endif
+
+#endif
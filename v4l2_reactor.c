@@ -0,0 +1,274 @@
+/*
+ * Copyright (c) 2013 Jens Kuske <jenskuske@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include <errno.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+
+#include "vdpau_private.h"
+#include "v4l2_reactor.h"
+
+#define CONTROL_ID UINT64_MAX
+
+typedef struct
+{
+    int used;
+    int armed;
+    int fd;
+    uint32_t events;
+    int generation;
+    reactor_handler_t handler;
+    void *arg;
+} source_t;
+
+static struct
+{
+    source_t sources[REACTOR_MAX_SOURCES];
+    int count;
+    int epoll;
+    int control;
+    int running;
+    int stop;
+    pthread_t thread;
+    uint64_t wakeups;
+    uint64_t disarms;
+    // sources and stop, held while handlers run
+    pthread_mutex_t mutex;
+    // serializes starting and stopping the thread
+    pthread_mutex_t lifecycle;
+} reactor = { .epoll = -1, .control = -1,
+              .mutex = PTHREAD_MUTEX_INITIALIZER, .lifecycle = PTHREAD_MUTEX_INITIALIZER };
+
+// handlers run with reactor.mutex held, reactor_arm() from them must not take it again
+static __thread int on_reactor_thread;
+
+static void remove_locked(int slot)
+{
+    source_t *s = &reactor.sources[slot];
+
+    if (s->armed)
+        epoll_ctl(reactor.epoll, EPOLL_CTL_DEL, s->fd, NULL);
+    s->used = s->armed = 0;
+    reactor.count--;
+}
+
+static void disarm_locked(int slot)
+{
+    source_t *s = &reactor.sources[slot];
+
+    epoll_ctl(reactor.epoll, EPOLL_CTL_DEL, s->fd, NULL);
+    s->armed = 0;
+    reactor.disarms++;
+}
+
+static void *reactor_thread(void *arg)
+{
+    struct epoll_event events[REACTOR_MAX_SOURCES + 1];
+    int n, i, ret;
+
+    on_reactor_thread = 1;
+
+    while (1) {
+        n = epoll_wait(reactor.epoll, events, REACTOR_MAX_SOURCES + 1, -1);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            VDPAU_ERR("epoll_wait failed, errno = %d", errno);
+            break;
+        }
+
+        pthread_mutex_lock(&reactor.mutex);
+        if (reactor.stop) {
+            pthread_mutex_unlock(&reactor.mutex);
+            break;
+        }
+
+        reactor.wakeups++;
+        for (i = 0; i < n; i++) {
+            uint64_t id = events[i].data.u64;
+
+            if (id == CONTROL_ID) {
+                uint64_t value;
+                if (read(reactor.control, &value, sizeof(value)) < 0)
+                    VDPAU_DBG("eventfd read failed, errno = %d", errno);
+                continue;
+            }
+
+            // a source removed and maybe reused while epoll_wait returned
+            source_t *s = &reactor.sources[id % REACTOR_MAX_SOURCES];
+            if (!s->used || !s->armed || s->generation != id / REACTOR_MAX_SOURCES)
+                continue;
+
+            ret = s->handler(s->arg, events[i].events);
+            if (ret == REACTOR_DISARM)
+                disarm_locked(id % REACTOR_MAX_SOURCES);
+            else if (ret)
+                remove_locked(id % REACTOR_MAX_SOURCES);
+        }
+        pthread_mutex_unlock(&reactor.mutex);
+    }
+
+    return NULL;
+}
+
+static int start(void)
+{
+    struct epoll_event ev;
+
+    reactor.epoll = epoll_create1(EPOLL_CLOEXEC);
+    reactor.control = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (reactor.epoll < 0 || reactor.control < 0)
+        goto err;
+
+    ev.events = EPOLLIN;
+    ev.data.u64 = CONTROL_ID;
+    if (epoll_ctl(reactor.epoll, EPOLL_CTL_ADD, reactor.control, &ev))
+        goto err;
+
+    reactor.stop = 0;
+    reactor.wakeups = reactor.disarms = 0;
+    if (pthread_create(&reactor.thread, NULL, reactor_thread, NULL))
+        goto err;
+
+    reactor.running = 1;
+    return 0;
+
+err:
+    VDPAU_ERR("Failed to start the V4L2 event reactor, errno = %d", errno);
+    if (reactor.control >= 0)
+        close(reactor.control);
+    if (reactor.epoll >= 0)
+        close(reactor.epoll);
+    reactor.control = reactor.epoll = -1;
+    return -1;
+}
+
+static void stop(void)
+{
+    uint64_t value = 1;
+
+    pthread_mutex_lock(&reactor.mutex);
+    reactor.stop = 1;
+    pthread_mutex_unlock(&reactor.mutex);
+
+    if (write(reactor.control, &value, sizeof(value)) < 0)
+        VDPAU_ERR("eventfd write failed, errno = %d", errno);
+    pthread_join(reactor.thread, NULL);
+
+    VDPAU_DBG("V4L2 event reactor stopped after %llu wakeups, %llu queues disarmed on errors",
+              (unsigned long long)reactor.wakeups, (unsigned long long)reactor.disarms);
+
+    close(reactor.control);
+    close(reactor.epoll);
+    reactor.control = reactor.epoll = -1;
+    reactor.running = 0;
+}
+
+int reactor_add(int fd, uint32_t events, reactor_handler_t handler, void *arg)
+{
+    struct epoll_event ev;
+    int slot, id = -1;
+
+    pthread_mutex_lock(&reactor.lifecycle);
+    if (!reactor.running && start()) {
+        pthread_mutex_unlock(&reactor.lifecycle);
+        return -1;
+    }
+
+    pthread_mutex_lock(&reactor.mutex);
+    for (slot = 0; slot < REACTOR_MAX_SOURCES; slot++)
+        if (!reactor.sources[slot].used)
+            break;
+
+    if (slot < REACTOR_MAX_SOURCES) {
+        source_t *s = &reactor.sources[slot];
+
+        s->fd = fd;
+        s->events = events;
+        s->handler = handler;
+        s->arg = arg;
+        // ids stay positive ints, a source is only ever compared against its recent ids
+        s->generation = (s->generation + 1) % (INT_MAX / REACTOR_MAX_SOURCES);
+
+        ev.events = events;
+        ev.data.u64 = s->generation * REACTOR_MAX_SOURCES + slot;
+        if (!epoll_ctl(reactor.epoll, EPOLL_CTL_ADD, fd, &ev)) {
+            s->used = s->armed = 1;
+            reactor.count++;
+            id = ev.data.u64;
+        } else {
+            VDPAU_ERR("epoll_ctl failed on fd %d, errno = %d", fd, errno);
+        }
+    } else {
+        VDPAU_ERR("Too many V4L2 queues for the event reactor");
+    }
+    pthread_mutex_unlock(&reactor.mutex);
+
+    pthread_mutex_unlock(&reactor.lifecycle);
+    return id;
+}
+
+void reactor_remove(int id)
+{
+    int last;
+
+    if (id < 0)
+        return;
+
+    pthread_mutex_lock(&reactor.lifecycle);
+
+    pthread_mutex_lock(&reactor.mutex);
+    source_t *s = &reactor.sources[id % REACTOR_MAX_SOURCES];
+    // the handler may have asked for removal already
+    if (s->used && s->generation == id / REACTOR_MAX_SOURCES)
+        remove_locked(id % REACTOR_MAX_SOURCES);
+    last = reactor.count == 0;
+    pthread_mutex_unlock(&reactor.mutex);
+
+    if (last && reactor.running)
+        stop();
+
+    pthread_mutex_unlock(&reactor.lifecycle);
+}
+
+void reactor_arm(int id)
+{
+    struct epoll_event ev;
+
+    if (id < 0)
+        return;
+
+    if (!on_reactor_thread)
+        pthread_mutex_lock(&reactor.mutex);
+
+    source_t *s = &reactor.sources[id % REACTOR_MAX_SOURCES];
+    if (s->used && !s->armed && s->generation == id / REACTOR_MAX_SOURCES) {
+        ev.events = s->events;
+        ev.data.u64 = id;
+        if (!epoll_ctl(reactor.epoll, EPOLL_CTL_ADD, s->fd, &ev))
+            s->armed = 1;
+        else
+            VDPAU_ERR("epoll_ctl failed on fd %d, errno = %d", s->fd, errno);
+    }
+
+    if (!on_reactor_thread)
+        pthread_mutex_unlock(&reactor.mutex);
+}
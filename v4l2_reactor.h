@@ -0,0 +1,50 @@
+/*
+ * Copyright (c) 2013 Jens Kuske <jenskuske@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifndef __V4L2_REACTOR_H__
+#define __V4L2_REACTOR_H__
+
+#include <stdint.h>
+
+/*
+ * One thread waiting in epoll on the queues of all open decoders, in place
+ * of a polling thread per queue. It runs while anything is registered.
+ */
+
+#define REACTOR_MAX_SOURCES 32
+
+#define REACTOR_KEEP    0
+#define REACTOR_REMOVE  1
+// sources are level-triggered, a queue in error (POLLERR) would wake us up
+// until it got buffers again, so it leaves epoll until reactor_arm()
+#define REACTOR_DISARM  2
+
+// called on the reactor thread with the epoll events, returns one of the above
+typedef int (*reactor_handler_t)(void *arg, uint32_t events);
+
+// returns a registration id >= 0, or -1
+int reactor_add(int fd, uint32_t events, reactor_handler_t handler, void *arg);
+
+// once this returns the handler is not running and won't be called again
+void reactor_remove(int id);
+
+// puts a disarmed source back into epoll, also from handlers
+void reactor_arm(int id);
+
+#endif
@@ -0,0 +1,536 @@
+/*
+ * Copyright (c) 2013 Jens Kuske <jenskuske@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+/*
+ * Backend for any V4L2 memory-to-memory decoder implementing the kernel's
+ * stateful decoder interface, e.g. coda, venus, hantro or vicodec. The
+ * bitstream goes in on OUTPUT, the driver parses it and reports the picture
+ * size with a SOURCE_CHANGE event, after which CAPTURE is allocated in
+ * whichever 4:2:0 layout the driver offers. Unlike the MFC backend there is
+ * no converter, pool or submit thread, those work around MFC behaviour.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+
+#include "vdpau_private.h"
+#include "vdpau_odroid.h"
+#include "v4l2.h"
+#include "v4l2_devices.h"
+#include "v4l2decode.h"
+
+// older kernel headers, the ABI is the same
+#ifndef V4L2_EVENT_SOURCE_CHANGE
+#define V4L2_EVENT_SOURCE_CHANGE 5
+#endif
+
+#define STATEFUL_STREAM_BUFFER_CNT 4       //no header is held back like on the MFC, one more keeps the decoder fed
+
+typedef struct
+{
+    uint32_t width;
+    uint32_t height;
+    __u32 codec;
+    int handle;
+
+    int outputBuffersCount;
+    v4l2_buffer_t *outputBuffers;
+
+    int captureBuffersCount;
+    v4l2_buffer_t *captureBuffers;
+    // plane pointers handed out per buffer, carved out of plane 0 for single buffer formats
+    void *(*pictureData)[DECODER_MAX_PLANES];
+
+    // CAPTURE layout, see setup_capture()
+    capture_layout_t layout;
+
+    // CAPTURE is allocated once the first SOURCE_CHANGE arrived
+    int captureReady;
+    int sourceChanged;
+
+    uint32_t maxReferences;
+    uint32_t buffering;
+
+    v4l2_timestamp_map_t timestamps;
+
+    uint32_t pictures;
+    uint32_t outputStalls;
+    uint32_t pictureMisses;
+
+    // the capture side, set up by decode for the first size and by get_picture on changes
+    pthread_mutex_t mutex;
+} stateful_decoder_t;
+
+static VdpStatus decoder_query_capabilities(VdpDecoderProfile profile, VdpBool *is_supported,
+                    uint32_t *max_width, uint32_t *max_height)
+{
+    return query_decoder(stream_codec(profile, FALSE), FALSE, FALSE, is_supported, max_width, max_height);
+}
+
+// returns 1 once the decoder reported a new coded size
+static int poll_source_change(stateful_decoder_t *ctx)
+{
+    struct v4l2_event ev;
+    int changed = 0;
+
+    memzero(ev);
+    while (!ioctl(ctx->handle, VIDIOC_DQEVENT, &ev))
+        if (ev.type == V4L2_EVENT_SOURCE_CHANGE)
+            changed = 1;
+
+    return changed;
+}
+
+// caller holds the mutex
+static int setup_capture(stateful_decoder_t *ctx)
+{
+    struct v4l2_format fmt;
+    struct v4l2_selection sel;
+    struct v4l2_control ctrl;
+
+    if (capture_negotiate(ctx->handle, &ctx->layout, &fmt))
+        return -1;
+
+    // the visible part of the coded picture
+    memzero(sel);
+    sel.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    sel.target = V4L2_SEL_TGT_COMPOSE;
+    if (!ioctl(ctx->handle, VIDIOC_G_SELECTION, &sel)) {
+        ctx->layout.width = sel.r.width;
+        ctx->layout.height = sel.r.height;
+    }
+
+    VDPAU_DBG("CAPTURE %.4s %dx%d, visible %dx%d", (char *)&ctx->layout.pixelformat, fmt.fmt.pix_mp.width, fmt.fmt.pix_mp.height,
+              ctx->layout.width, ctx->layout.height);
+
+    memzero(ctrl);
+    ctrl.id = V4L2_CID_MIN_BUFFERS_FOR_CAPTURE;
+    if (ioctl(ctx->handle, VIDIOC_G_CTRL, &ctrl))
+        ctrl.value = 0;
+
+    ctx->captureBuffersCount = RequestBuffer(ctx->handle, V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE, V4L2_MEMORY_MMAP,
+                                             capture_depth(ctrl.value, ctx->maxReferences, ctx->buffering, ctx->width, ctx->height));
+    if (ctx->captureBuffersCount == V4L2_ERROR || ctx->captureBuffersCount <= 0) {
+        VDPAU_ERR("REQBUFS failed on CAPTURE");
+        return -1;
+    }
+
+    ctx->captureBuffers = (v4l2_buffer_t *)calloc(ctx->captureBuffersCount, sizeof(v4l2_buffer_t));
+    ctx->pictureData = calloc(ctx->captureBuffersCount, sizeof(*ctx->pictureData));
+    if (!ctx->captureBuffers || !ctx->pictureData) {
+        VDPAU_ERR("cannot allocate buffers");
+        return -1;
+    }
+
+    if (!MmapBuffers(ctx->handle, ctx->captureBuffersCount, ctx->captureBuffers, V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE, V4L2_MEMORY_MMAP, TRUE)) {
+        VDPAU_ERR("cannot mmap capture buffers");
+        return -1;
+    }
+    memstat_alloc(MEMSTAT_V4L2_CAPTURE, ctx->captureBuffersCount, 0, 0, buffers_size(ctx->captureBuffersCount, ctx->captureBuffers));
+
+    capture_map(&ctx->layout, ctx->captureBuffersCount, ctx->captureBuffers, ctx->pictureData);
+    ctx->layout.generation = NextBufferGeneration();
+
+    if (!StreamOn(ctx->handle, V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE, VIDIOC_STREAMON)) {
+        VDPAU_ERR("Failed to Stream ON CAPTURE");
+        return -1;
+    }
+
+    VDPAU_DBG("%d CAPTURE buffers", ctx->captureBuffersCount);
+    ctx->captureReady = TRUE;
+    return 0;
+}
+
+// caller holds the mutex
+static void teardown_capture(stateful_decoder_t *ctx)
+{
+    StreamOn(ctx->handle, V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE, VIDIOC_STREAMOFF);
+    if (ctx->captureBuffers) {
+        memstat_free(MEMSTAT_V4L2_CAPTURE, ctx->captureBuffersCount, 0, 0, buffers_size(ctx->captureBuffersCount, ctx->captureBuffers));
+        ctx->captureBuffers = FreeBuffers(ctx->captureBuffersCount, ctx->captureBuffers);
+    }
+    RequestBuffer(ctx->handle, V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE, V4L2_MEMORY_MMAP, 0);
+
+    free(ctx->pictureData);
+    ctx->pictureData = NULL;
+    ctx->captureBuffersCount = 0;
+    ctx->captureReady = FALSE;
+}
+
+/*
+ * The first SOURCE_CHANGE sets CAPTURE up right away. Later ones only mark
+ * it, the pictures of the old size are still to come and get_picture()
+ * reallocates once the driver returned the last of them.
+ */
+static int handle_events(stateful_decoder_t *ctx)
+{
+    int ret = 0;
+
+    if (!poll_source_change(ctx))
+        return 0;
+
+    pthread_mutex_lock(&ctx->mutex);
+    if (!ctx->captureReady)
+        ret = setup_capture(ctx);
+    else
+        ctx->sourceChanged = TRUE;
+    pthread_mutex_unlock(&ctx->mutex);
+
+    return ret;
+}
+
+static void decoder_close(void *private);
+
+static void *decoder_open(VdpDecoderProfile profile, uint32_t width, uint32_t height, uint32_t max_references)
+{
+    struct v4l2_event_subscription sub;
+    struct v4l2_format fmt;
+    v4l2_device_t dec;
+
+    stateful_decoder_t *ctx = calloc(1, sizeof(stateful_decoder_t));
+    if (!ctx)
+        return NULL;
+    memstat_alloc(MEMSTAT_DECODER, 1, sizeof(stateful_decoder_t), 0, 0);
+
+    ctx->width = width;
+    ctx->height = height;
+    ctx->codec = stream_codec(profile, FALSE);
+    ctx->maxReferences = max_references;
+    ctx->buffering = VDP_DECODER_BUFFERING_BALANCED_ODROID;
+    ctx->handle = -1;
+    pthread_mutex_init(&ctx->mutex, NULL);
+
+    ctx->handle = open_decoder_device(ctx->codec, FALSE, &dec, NULL);
+    if (ctx->handle == -ENODEV)
+        VDPAU_ERR("No V4L2 stateful decoder for %.4s", (char *)&ctx->codec);
+    if (ctx->handle < 0)
+        goto err;
+    VDPAU_DBG("Using %s %s", dec.name, dec.path);
+
+    // without the event there is no telling when CAPTURE can be set up
+    memzero(sub);
+    sub.type = V4L2_EVENT_SOURCE_CHANGE;
+    if (ioctl(ctx->handle, VIDIOC_SUBSCRIBE_EVENT, &sub)) {
+        VDPAU_ERR("%s has no SOURCE_CHANGE event, errno = %d", dec.name, errno);
+        goto err;
+    }
+
+    memzero(fmt);
+    fmt.type = V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE;
+    fmt.fmt.pix_mp.pixelformat = ctx->codec;
+    fmt.fmt.pix_mp.width = width;
+    fmt.fmt.pix_mp.height = height;
+    fmt.fmt.pix_mp.num_planes = 1;
+    fmt.fmt.pix_mp.plane_fmt[0].sizeimage = STREAM_BUFFER_SIZE;
+    if (ioctl(ctx->handle, VIDIOC_S_FMT, &fmt)) {
+        VDPAU_ERR("Failed to set OUTPUT format %.4s, errno = %d", (char *)&ctx->codec, errno);
+        goto err;
+    }
+
+    ctx->outputBuffersCount = RequestBuffer(ctx->handle, V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE, V4L2_MEMORY_MMAP, STATEFUL_STREAM_BUFFER_CNT);
+    if (ctx->outputBuffersCount == V4L2_ERROR || ctx->outputBuffersCount <= 0) {
+        VDPAU_ERR("REQBUFS failed on OUTPUT");
+        goto err;
+    }
+
+    ctx->outputBuffers = (v4l2_buffer_t *)calloc(ctx->outputBuffersCount, sizeof(v4l2_buffer_t));
+    if (!ctx->outputBuffers) {
+        VDPAU_ERR("cannot allocate buffers");
+        goto err;
+    }
+    if (!MmapBuffers(ctx->handle, ctx->outputBuffersCount, ctx->outputBuffers, V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE, V4L2_MEMORY_MMAP, FALSE)) {
+        VDPAU_ERR("cannot mmap output buffers");
+        goto err;
+    }
+    memstat_alloc(MEMSTAT_V4L2_OUTPUT, ctx->outputBuffersCount, 0, 0, buffers_size(ctx->outputBuffersCount, ctx->outputBuffers));
+
+    if (!StreamOn(ctx->handle, V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE, VIDIOC_STREAMON)) {
+        VDPAU_ERR("Failed to Stream ON OUTPUT");
+        goto err;
+    }
+
+    return ctx;
+
+err:
+    decoder_close(ctx);
+    return NULL;
+}
+
+static void decoder_close(void *private)
+{
+    stateful_decoder_t *ctx = (stateful_decoder_t *)private;
+
+    if (!ctx)
+        return;
+
+    VDPAU_DBG("%u pictures, %u bitstream stalls, %u pictures not ready in time, %d capture buffers",
+              ctx->pictures, ctx->outputStalls, ctx->pictureMisses, ctx->captureBuffersCount);
+
+    if (ctx->handle >= 0) {
+        pthread_mutex_lock(&ctx->mutex);
+        teardown_capture(ctx);
+        pthread_mutex_unlock(&ctx->mutex);
+
+        StreamOn(ctx->handle, V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE, VIDIOC_STREAMOFF);
+        if (ctx->outputBuffers) {
+            memstat_free(MEMSTAT_V4L2_OUTPUT, ctx->outputBuffersCount, 0, 0, buffers_size(ctx->outputBuffersCount, ctx->outputBuffers));
+            ctx->outputBuffers = FreeBuffers(ctx->outputBuffersCount, ctx->outputBuffers);
+        }
+        close(ctx->handle);
+    }
+
+    pthread_mutex_destroy(&ctx->mutex);
+    memstat_free(MEMSTAT_DECODER, 1, sizeof(stateful_decoder_t), 0, 0);
+    free(ctx);
+}
+
+// a free OUTPUT buffer, waiting for the decoder to consume one if needed
+static int get_output(stateful_decoder_t *ctx)
+{
+    struct pollfd p;
+    int index, tries;
+
+    for (index = 0; index < ctx->outputBuffersCount; index++)
+        if (!ctx->outputBuffers[index].bQueue)
+            return index;
+
+    ctx->outputStalls++;
+    for (tries = 0; tries < 10; tries++) {
+        index = DequeueBuffer(ctx->handle, V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE, V4L2_MEMORY_MMAP);
+        if (index >= 0) {
+            ctx->outputBuffers[index].bQueue = FALSE;
+            return index;
+        }
+        if (index != -EAGAIN)
+            break;
+
+        // the decoder may be waiting for CAPTURE to be set up before it takes more
+        p.fd = ctx->handle;
+        p.events = POLLOUT | POLLPRI;
+        if (poll(&p, 1, 100) < 0)
+            break;
+        if ((p.revents & POLLPRI) && handle_events(ctx))
+            return -1;
+    }
+
+    VDPAU_ERR("Decoder didn't release a bitstream buffer, errno = %d", errno);
+    return -1;
+}
+
+static VdpStatus decoder_decode(void *private, uint32_t buffer_count,
+                    VdpBitstreamBuffer const *buffers, VdpVideoSurface output, uint32_t generation)
+{
+    stateful_decoder_t *ctx = (stateful_decoder_t *)private;
+    v4l2_buffer_t *buffer;
+    uint32_t size = 0, i;
+    int index;
+
+    if (handle_events(ctx))
+        return VDP_STATUS_ERROR;
+
+    index = get_output(ctx);
+    if (index < 0)
+        return VDP_STATUS_ERROR;
+    buffer = &ctx->outputBuffers[index];
+
+    for (i = 0; i < buffer_count; i++)
+        size += buffers[i].bitstream_bytes;
+    if (size > buffer->iSize[0]) {
+        VDPAU_ERR("Bitstream of %u bytes doesn't fit the %d byte buffer", size, buffer->iSize[0]);
+        return VDP_STATUS_ERROR;
+    }
+
+    for (i = 0, size = 0; i < buffer_count; i++) {
+        memcpy((uint8_t *)buffer->cPlane[0] + size, buffers[i].bitstream, buffers[i].bitstream_bytes);
+        size += buffers[i].bitstream_bytes;
+    }
+    buffer->iBytesUsed[0] = size;
+
+    // tagged so the picture finds its way back to output
+    buffer->timestamp = TimestampTag(&ctx->timestamps, output, generation);
+    if (QueueBuffer(ctx->handle, V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE, V4L2_MEMORY_MMAP, buffer) == V4L2_ERROR) {
+        VDPAU_ERR("Failed to queue buffer with index %d, errno %d", index, errno);
+        return VDP_STATUS_ERROR;
+    }
+
+    return VDP_STATUS_OK;
+}
+
+// caller holds the mutex, the decoder returned the last picture of the old size
+static VdpStatus reconfigure_capture(stateful_decoder_t *ctx)
+{
+    int oldWidth = ctx->layout.width, oldHeight = ctx->layout.height;
+
+    ctx->sourceChanged = FALSE;
+    teardown_capture(ctx);
+    if (setup_capture(ctx)) {
+        VDPAU_ERR("Failed to set up capture after resolution change");
+        return VDP_STATUS_ERROR;
+    }
+
+    VDPAU_DBG("Resolution change %dx%d -> %dx%d", oldWidth, oldHeight, ctx->layout.width, ctx->layout.height);
+    return VDP_STATUS_OK;
+}
+
+static VdpStatus decoder_get_picture(void *context, int *frame, void ***output, VdpVideoSurface *surface,
+                    uint32_t *generation)
+{
+    stateful_decoder_t *ctx = (stateful_decoder_t *)context;
+    VdpStatus ret = VDP_STATUS_OK;
+    struct timeval timestamp;
+    int index, bytesUsed;
+    __u32 flags;
+
+    *frame = -1;
+    *output = NULL;
+    *surface = VDP_INVALID_HANDLE;
+    *generation = 0;
+
+    if (handle_events(ctx))
+        return VDP_STATUS_ERROR;
+
+    pthread_mutex_lock(&ctx->mutex);
+    if (!ctx->captureReady) {
+        ctx->pictureMisses++;
+        goto out;
+    }
+
+    index = DequeueBufferInfo(ctx->handle, V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE, V4L2_MEMORY_MMAP, &timestamp, &flags, &bytesUsed);
+    if (index == -EAGAIN) {
+        ctx->pictureMisses++;
+        goto out;
+    }
+    // EPIPE once the last buffer went out, an empty last buffer carries no picture
+    if (index == -EPIPE || (index >= 0 && (flags & V4L2_BUF_FLAG_LAST) && !bytesUsed)) {
+        if (ctx->sourceChanged)
+            ret = reconfigure_capture(ctx);
+        else if (index >= 0)
+            QueueBuffer(ctx->handle, V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE, V4L2_MEMORY_MMAP, &ctx->captureBuffers[index]);
+        goto out;
+    }
+    if (index < 0) {
+        VDPAU_ERR("error dequeue capture buffer, got number %d, errno %d", index, errno);
+        ret = VDP_STATUS_ERROR;
+        goto out;
+    }
+
+    *output = ctx->pictureData[index];
+    *frame = index;
+    TimestampLookup(&ctx->timestamps, timestamp, surface, generation);
+    ctx->pictures++;
+
+out:
+    pthread_mutex_unlock(&ctx->mutex);
+    return ret;
+}
+
+static VdpStatus decoder_release_picture(void *context, int frame)
+{
+    stateful_decoder_t *ctx = (stateful_decoder_t *)context;
+    VdpStatus ret = VDP_STATUS_OK;
+
+    pthread_mutex_lock(&ctx->mutex);
+    if (frame < 0 || frame >= ctx->captureBuffersCount ||
+            QueueBuffer(ctx->handle, V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE, V4L2_MEMORY_MMAP, &ctx->captureBuffers[frame]) == V4L2_ERROR) {
+        VDPAU_ERR("Failed to queue buffer with index %d, errno = %d", frame, errno);
+        ret = VDP_STATUS_ERROR;
+    }
+    pthread_mutex_unlock(&ctx->mutex);
+
+    return ret;
+}
+
+static VdpStatus decoder_get_dmabuf(void *context, int frame, decoder_dmabuf_t *dmabuf)
+{
+    stateful_decoder_t *ctx = (stateful_decoder_t *)context;
+    VdpStatus ret;
+
+    pthread_mutex_lock(&ctx->mutex);
+    ret = capture_dmabuf(ctx->handle, &ctx->layout, ctx->captureBuffersCount, ctx->captureBuffers, frame, dmabuf);
+    pthread_mutex_unlock(&ctx->mutex);
+
+    return ret;
+}
+
+// STREAMOFF hands every buffer back without decoding it, the stream headers come again
+static VdpStatus decoder_flush(void *private)
+{
+    stateful_decoder_t *ctx = (stateful_decoder_t *)private;
+    VdpStatus ret = VDP_STATUS_OK;
+    int i;
+
+    if (!ctx)
+        return VDP_STATUS_OK;
+
+    if (!StreamOn(ctx->handle, V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE, VIDIOC_STREAMOFF) ||
+            !StreamOn(ctx->handle, V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE, VIDIOC_STREAMON)) {
+        VDPAU_ERR("Failed to flush OUTPUT");
+        return VDP_STATUS_ERROR;
+    }
+    for (i = 0; i < ctx->outputBuffersCount; i++)
+        ctx->outputBuffers[i].bQueue = FALSE;
+
+    pthread_mutex_lock(&ctx->mutex);
+    if (ctx->captureReady && ctx->sourceChanged) {
+        ret = reconfigure_capture(ctx);
+    } else if (ctx->captureReady) {
+        if (!StreamOn(ctx->handle, V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE, VIDIOC_STREAMOFF))
+            ret = VDP_STATUS_ERROR;
+        for (i = 0; i < ctx->captureBuffersCount && ret == VDP_STATUS_OK; i++)
+            if (QueueBuffer(ctx->handle, V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE, V4L2_MEMORY_MMAP, &ctx->captureBuffers[i]) == V4L2_ERROR)
+                ret = VDP_STATUS_ERROR;
+        if (ret == VDP_STATUS_OK && !StreamOn(ctx->handle, V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE, VIDIOC_STREAMON))
+            ret = VDP_STATUS_ERROR;
+        if (ret != VDP_STATUS_OK)
+            VDPAU_ERR("Failed to flush CAPTURE");
+    }
+    pthread_mutex_unlock(&ctx->mutex);
+
+    return ret;
+}
+
+static VdpStatus decoder_set_buffering(void *private, uint32_t buffering)
+{
+    stateful_decoder_t *ctx = (stateful_decoder_t *)private;
+
+    if (!ctx)
+        return VDP_STATUS_ERROR;
+
+    ctx->buffering = buffering;
+    return VDP_STATUS_OK;
+}
+
+const decoder_backend_t decoder_backend_v4l2 =
+{
+    .name = "v4l2",
+    .query_capabilities = decoder_query_capabilities,
+    .open = decoder_open,
+    .close = decoder_close,
+    .decode = decoder_decode,
+    .get_picture = decoder_get_picture,
+    .release_picture = decoder_release_picture,
+    .get_dmabuf = decoder_get_dmabuf,
+    .flush = decoder_flush,
+    .set_buffering = decoder_set_buffering,
+};
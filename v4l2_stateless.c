@@ -0,0 +1,1079 @@
+/*
+ * Copyright (c) 2013 Jens Kuske <jenskuske@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+/*
+ * Backend for V4L2 stateless decoders driven through media requests, e.g.
+ * hantro, rkvdec or the visl virtual driver. VDPAU already parsed the stream,
+ * so VdpPictureInfo goes straight into the V4L2_CID_STATELESS_* controls of
+ * the picture's request instead of being turned back into headers.
+ *
+ * CAPTURE buffers are not handed to the driver up front. Every picture is
+ * queued together with the buffer picked for it, and references are named by
+ * the timestamp of the buffer their surface was decoded into. A buffer stays
+ * out of the driver for as long as the pictures decoded after it list its
+ * surface as a reference, so VDPAU surfaces are the reference frames.
+ *
+ * H.264 is decoded frame based with Annex B start codes, VDPAU leaves out the
+ * per slice fields slice based decoders such as cedrus need.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <linux/media.h>
+
+#include "vdpau_private.h"
+#include "vdpau_odroid.h"
+#include "v4l2.h"
+#include "v4l2_devices.h"
+#include "v4l2decode.h"
+
+// the stateless controls arrived with Linux 5.11 headers
+#ifdef V4L2_CID_STATELESS_H264_DECODE_PARAMS
+
+#include "h264_stream.h"
+#include "mpeg12_stream.h"
+
+#define STATELESS_STREAM_BUFFER_CNT 4       //pictures in flight, every bitstream buffer has its own request
+#define STATELESS_MAX_CONTROLS      4
+
+typedef enum
+{
+    PICTURE_FREE = 0,   // ours, a decode target unless still referenced
+    PICTURE_QUEUED,     // in the driver
+    PICTURE_FIELD,      // holds a first field, goes back to the driver for the second
+    PICTURE_DONE,       // decoded, waiting for get_picture()
+    PICTURE_SHOWN       // handed to the mixer until release_picture()
+} picture_state_t;
+
+typedef struct
+{
+    picture_state_t state;
+    int reference;              // listed by the last picture, must not be decoded over
+    int firstField;             // queued with the first of two fields
+    VdpVideoSurface surface;    // the surface decoded into it, reference lookups go by this
+    uint64_t timestamp;         // of the picture in it, as the controls name references
+    uint32_t sequence;          // decode order, get_picture() hands out the oldest first
+} picture_t;
+
+typedef struct
+{
+    uint32_t width;
+    uint32_t height;
+    VdpDecoderProfile profile;
+    __u32 codec;
+    int handle;
+    int mediaHandle;
+
+    int outputBuffersCount;
+    v4l2_buffer_t *outputBuffers;
+    int requests[STATELESS_STREAM_BUFFER_CNT];
+
+    int captureBuffersCount;
+    v4l2_buffer_t *captureBuffers;
+    picture_t *pictures;
+    // plane pointers handed out per buffer, carved out of plane 0 for single buffer formats
+    void *(*pictureData)[DECODER_MAX_PLANES];
+
+    // CAPTURE layout, see setup_capture()
+    capture_layout_t layout;
+
+    uint32_t maxReferences;
+    uint32_t buffering;
+    uint32_t sequence;
+
+    v4l2_timestamp_map_t timestamps;
+
+    uint32_t decoded;
+    uint32_t outputStalls;
+    uint32_t pictureMisses;
+    uint32_t pictureDrops;
+    uint32_t decodeErrors;
+
+    // the capture side, shared between decode and the mixer
+    pthread_mutex_t mutex;
+} stateless_decoder_t;
+
+// the controls of one request, the payloads live next to them
+typedef struct
+{
+    struct v4l2_ext_control controls[STATELESS_MAX_CONTROLS];
+    int count;
+    union
+    {
+        struct
+        {
+            struct v4l2_ctrl_h264_sps sps;
+            struct v4l2_ctrl_h264_pps pps;
+            struct v4l2_ctrl_h264_scaling_matrix scaling;
+            struct v4l2_ctrl_h264_decode_params decode;
+        } h264;
+        struct
+        {
+            struct v4l2_ctrl_mpeg2_sequence sequence;
+            struct v4l2_ctrl_mpeg2_picture picture;
+            struct v4l2_ctrl_mpeg2_quantisation quantisation;
+        } mpeg2;
+    };
+} picture_controls_t;
+
+// MPEG-1 has no stateless format, MPEG-4 Part 2 and VC-1 no controls
+static __u32 get_codec(VdpDecoderProfile profile)
+{
+    switch (profile)
+    {
+    case VDP_DECODER_PROFILE_MPEG2_SIMPLE:
+    case VDP_DECODER_PROFILE_MPEG2_MAIN:
+        return V4L2_PIX_FMT_MPEG2_SLICE;
+
+    case VDP_DECODER_PROFILE_H264_BASELINE:
+    case VDP_DECODER_PROFILE_H264_MAIN:
+    case VDP_DECODER_PROFILE_H264_HIGH:
+        return V4L2_PIX_FMT_H264_SLICE;
+    }
+
+    return 0;
+}
+
+static uint64_t timestamp_ns(struct timeval tv)
+{
+    return (uint64_t)tv.tv_sec * 1000000000ull + (uint64_t)tv.tv_usec * 1000ull;
+}
+
+// requests are allocated on the media node, without one there is no decoding
+static VdpStatus decoder_query_capabilities(VdpDecoderProfile profile, VdpBool *is_supported,
+                    uint32_t *max_width, uint32_t *max_height)
+{
+    return query_decoder(get_codec(profile), FALSE, TRUE, is_supported, max_width, max_height);
+}
+
+static int set_controls(stateless_decoder_t *ctx, int request, struct v4l2_ext_control *controls, int count)
+{
+    struct v4l2_ext_controls ctrls;
+
+    memzero(ctrls);
+    ctrls.which = request < 0 ? V4L2_CTRL_WHICH_CUR_VAL : V4L2_CTRL_WHICH_REQUEST_VAL;
+    ctrls.request_fd = request < 0 ? 0 : request;
+    ctrls.count = count;
+    ctrls.controls = controls;
+
+    if (ioctl(ctx->handle, VIDIOC_S_EXT_CTRLS, &ctrls)) {
+        VDPAU_ERR("Failed to set %d controls, control %u failed, errno = %d", count, ctrls.error_idx, errno);
+        return -1;
+    }
+
+    return 0;
+}
+
+static void add_control(picture_controls_t *c, __u32 id, void *payload, __u32 size)
+{
+    struct v4l2_ext_control *ctrl = &c->controls[c->count++];
+
+    memzero(*ctrl);
+    ctrl->id = id;
+    ctrl->ptr = payload;
+    ctrl->size = size;
+}
+
+// caller holds the mutex
+static uint64_t reference_timestamp(stateless_decoder_t *ctx, VdpVideoSurface surface)
+{
+    int i;
+
+    if (surface == VDP_INVALID_HANDLE)
+        return 0;
+
+    for (i = 0; i < ctx->captureBuffersCount; i++)
+        if (ctx->pictures[i].surface == surface)
+            return ctx->pictures[i].timestamp;
+
+    // not decoded here, e.g. right after a flush, drivers then predict from the picture itself
+    return 0;
+}
+
+static void h264_fill_sps(stateless_decoder_t *ctx, VdpPictureInfoH264 *info, struct v4l2_ctrl_h264_sps *sps)
+{
+    int mb_width = (ctx->width + 15) / 16;
+    int mb_height = (ctx->height + 15) / 16;
+    int max_dpb_frames;
+
+    if (!info->frame_mbs_only_flag)
+        mb_height = (mb_height + 1) & ~1;
+
+    // the same guesses the SPS writer makes, see write_seq_parameter_set_rbsp()
+    memset(sps, 0, sizeof(*sps));
+    switch (ctx->profile) {
+    case VDP_DECODER_PROFILE_H264_BASELINE:
+        sps->profile_idc = H264_PROFILE_BASELINE;
+        sps->constraint_set_flags = V4L2_H264_SPS_CONSTRAINT_SET0_FLAG | V4L2_H264_SPS_CONSTRAINT_SET1_FLAG;
+        break;
+    case VDP_DECODER_PROFILE_H264_MAIN:
+        sps->profile_idc = H264_PROFILE_MAIN;
+        sps->constraint_set_flags = V4L2_H264_SPS_CONSTRAINT_SET1_FLAG;
+        break;
+    default:
+        sps->profile_idc = H264_PROFILE_HIGH;
+        break;
+    }
+    sps->level_idc = h264_level(mb_width, mb_height, info->num_ref_frames, &max_dpb_frames);
+    sps->chroma_format_idc = 1;
+    sps->log2_max_frame_num_minus4 = info->log2_max_frame_num_minus4;
+    sps->pic_order_cnt_type = info->pic_order_cnt_type;
+    sps->log2_max_pic_order_cnt_lsb_minus4 = info->log2_max_pic_order_cnt_lsb_minus4;
+    sps->max_num_ref_frames = info->num_ref_frames;
+    sps->pic_width_in_mbs_minus1 = mb_width - 1;
+    sps->pic_height_in_map_units_minus1 = (info->frame_mbs_only_flag ? mb_height : mb_height / 2) - 1;
+
+    if (info->frame_mbs_only_flag)
+        sps->flags |= V4L2_H264_SPS_FLAG_FRAME_MBS_ONLY;
+    if (info->mb_adaptive_frame_field_flag)
+        sps->flags |= V4L2_H264_SPS_FLAG_MB_ADAPTIVE_FRAME_FIELD;
+    if (info->direct_8x8_inference_flag)
+        sps->flags |= V4L2_H264_SPS_FLAG_DIRECT_8X8_INFERENCE;
+    if (info->delta_pic_order_always_zero_flag)
+        sps->flags |= V4L2_H264_SPS_FLAG_DELTA_PIC_ORDER_ALWAYS_ZERO;
+}
+
+static void h264_fill_pps(VdpPictureInfoH264 *info, struct v4l2_ctrl_h264_pps *pps)
+{
+    memset(pps, 0, sizeof(*pps));
+    pps->num_ref_idx_l0_default_active_minus1 = info->num_ref_idx_l0_active_minus1;
+    pps->num_ref_idx_l1_default_active_minus1 = info->num_ref_idx_l1_active_minus1;
+    pps->weighted_bipred_idc = info->weighted_bipred_idc;
+    pps->pic_init_qp_minus26 = info->pic_init_qp_minus26;
+    pps->chroma_qp_index_offset = info->chroma_qp_index_offset;
+    pps->second_chroma_qp_index_offset = info->second_chroma_qp_index_offset;
+
+    if (info->entropy_coding_mode_flag)
+        pps->flags |= V4L2_H264_PPS_FLAG_ENTROPY_CODING_MODE;
+    if (info->pic_order_present_flag)
+        pps->flags |= V4L2_H264_PPS_FLAG_BOTTOM_FIELD_PIC_ORDER_IN_FRAME_PRESENT;
+    if (info->weighted_pred_flag)
+        pps->flags |= V4L2_H264_PPS_FLAG_WEIGHTED_PRED;
+    if (info->deblocking_filter_control_present_flag)
+        pps->flags |= V4L2_H264_PPS_FLAG_DEBLOCKING_FILTER_CONTROL_PRESENT;
+    if (info->constrained_intra_pred_flag)
+        pps->flags |= V4L2_H264_PPS_FLAG_CONSTRAINED_INTRA_PRED;
+    if (info->redundant_pic_cnt_present_flag)
+        pps->flags |= V4L2_H264_PPS_FLAG_REDUNDANT_PIC_CNT_PRESENT;
+    if (info->transform_8x8_mode_flag)
+        pps->flags |= V4L2_H264_PPS_FLAG_TRANSFORM_8X8_MODE;
+    if (h264_scaling_lists_present(info))
+        pps->flags |= V4L2_H264_PPS_FLAG_SCALING_MATRIX_PRESENT;
+}
+
+// caller holds the mutex
+static int h264_controls(stateless_decoder_t *ctx, VdpPictureInfoH264 *info, const uint8_t *bitstream, uint32_t size,
+                         picture_controls_t *c)
+{
+    struct v4l2_ctrl_h264_decode_params *dp = &c->h264.decode;
+    uint32_t max_frame_num = 1u << (info->log2_max_frame_num_minus4 + 4);
+    h264_slice_header_t sh;
+    int i;
+
+    if (h264_parse_slice_header(bitstream, size, info, &sh)) {
+        VDPAU_ERR("No parsable H.264 slice in %u bytes", size);
+        return -1;
+    }
+
+    h264_fill_sps(ctx, info, &c->h264.sps);
+    add_control(c, V4L2_CID_STATELESS_H264_SPS, &c->h264.sps, sizeof(c->h264.sps));
+    h264_fill_pps(info, &c->h264.pps);
+    add_control(c, V4L2_CID_STATELESS_H264_PPS, &c->h264.pps, sizeof(c->h264.pps));
+
+    // both are raster order already, 4:2:0 only uses the luma 8x8 lists, the chroma ones fall back to them
+    if (c->h264.pps.flags & V4L2_H264_PPS_FLAG_SCALING_MATRIX_PRESENT) {
+        memcpy(c->h264.scaling.scaling_list_4x4, info->scaling_lists_4x4, sizeof(info->scaling_lists_4x4));
+        for (i = 0; i < 6; i++)
+            memcpy(c->h264.scaling.scaling_list_8x8[i], info->scaling_lists_8x8[i & 1], 64);
+        add_control(c, V4L2_CID_STATELESS_H264_SCALING_MATRIX, &c->h264.scaling, sizeof(c->h264.scaling));
+    }
+
+    memset(dp, 0, sizeof(*dp));
+    for (i = 0; i < V4L2_H264_NUM_DPB_ENTRIES; i++) {
+        VdpReferenceFrameH264 *ref = &info->referenceFrames[i];
+        struct v4l2_h264_dpb_entry *e = &dp->dpb[i];
+
+        if (ref->surface == VDP_INVALID_HANDLE)
+            continue;
+
+        e->reference_ts = reference_timestamp(ctx, ref->surface);
+        e->frame_num = ref->frame_idx;
+        // 8.2.4.1 FrameNumWrap, LongTermFrameIdx for long term references
+        e->pic_num = (!ref->is_long_term && ref->frame_idx > info->frame_num) ? ref->frame_idx - max_frame_num : ref->frame_idx;
+        e->fields = (ref->top_is_reference ? V4L2_H264_TOP_FIELD_REF : 0) |
+                    (ref->bottom_is_reference ? V4L2_H264_BOTTOM_FIELD_REF : 0);
+        e->top_field_order_cnt = ref->field_order_cnt[0];
+        e->bottom_field_order_cnt = ref->field_order_cnt[1];
+
+        e->flags = V4L2_H264_DPB_ENTRY_FLAG_VALID;
+        if (e->fields)
+            e->flags |= V4L2_H264_DPB_ENTRY_FLAG_ACTIVE;
+        if (ref->is_long_term)
+            e->flags |= V4L2_H264_DPB_ENTRY_FLAG_LONG_TERM;
+        if (e->fields && e->fields != V4L2_H264_FRAME_REF)
+            e->flags |= V4L2_H264_DPB_ENTRY_FLAG_FIELD;
+    }
+
+    dp->nal_ref_idc = sh.nal_ref_idc;
+    dp->frame_num = info->frame_num;
+    dp->top_field_order_cnt = info->field_order_cnt[0];
+    dp->bottom_field_order_cnt = info->field_order_cnt[1];
+    dp->idr_pic_id = sh.idr_pic_id;
+    dp->pic_order_cnt_lsb = sh.pic_order_cnt_lsb;
+    dp->delta_pic_order_cnt_bottom = sh.delta_pic_order_cnt_bottom;
+    dp->delta_pic_order_cnt0 = sh.delta_pic_order_cnt0;
+    dp->delta_pic_order_cnt1 = sh.delta_pic_order_cnt1;
+    dp->dec_ref_pic_marking_bit_size = sh.dec_ref_pic_marking_bit_size;
+    dp->pic_order_cnt_bit_size = sh.pic_order_cnt_bit_size;
+
+    if (sh.nal_unit_type == NAL_UNIT_TYPE_CODED_SLICE_IDR)
+        dp->flags |= V4L2_H264_DECODE_PARAM_FLAG_IDR_PIC;
+    if (info->field_pic_flag)
+        dp->flags |= V4L2_H264_DECODE_PARAM_FLAG_FIELD_PIC;
+    if (info->bottom_field_flag)
+        dp->flags |= V4L2_H264_DECODE_PARAM_FLAG_BOTTOM_FIELD;
+    if (sh.slice_type == V4L2_H264_SLICE_TYPE_P || sh.slice_type == V4L2_H264_SLICE_TYPE_SP)
+        dp->flags |= V4L2_H264_DECODE_PARAM_FLAG_PFRAME;
+    if (sh.slice_type == V4L2_H264_SLICE_TYPE_B)
+        dp->flags |= V4L2_H264_DECODE_PARAM_FLAG_BFRAME;
+
+    add_control(c, V4L2_CID_STATELESS_H264_DECODE_PARAMS, dp, sizeof(*dp));
+    return 0;
+}
+
+// caller holds the mutex
+static int mpeg2_controls(stateless_decoder_t *ctx, VdpPictureInfoMPEG1Or2 *info, picture_controls_t *c)
+{
+    struct v4l2_ctrl_mpeg2_sequence *seq = &c->mpeg2.sequence;
+    struct v4l2_ctrl_mpeg2_picture *pic = &c->mpeg2.picture;
+    struct v4l2_ctrl_mpeg2_quantisation *quant = &c->mpeg2.quantisation;
+
+    // progressive_sequence is unknown, as in the sequence extension the MFC gets
+    memset(seq, 0, sizeof(*seq));
+    seq->horizontal_size = ctx->width;
+    seq->vertical_size = ctx->height;
+    seq->vbv_buffer_size = STREAM_BUFFER_SIZE;
+    seq->profile_and_level_indication = mpeg12_profile_and_level(ctx->width, ctx->height, ctx->profile);
+    seq->chroma_format = 1;
+    add_control(c, V4L2_CID_STATELESS_MPEG2_SEQUENCE, seq, sizeof(*seq));
+
+    memset(pic, 0, sizeof(*pic));
+    pic->forward_ref_ts = reference_timestamp(ctx, info->forward_reference);
+    pic->backward_ref_ts = reference_timestamp(ctx, info->backward_reference);
+    memcpy(pic->f_code, info->f_code, sizeof(pic->f_code));
+    pic->picture_coding_type = info->picture_coding_type;
+    pic->picture_structure = info->picture_structure;
+    pic->intra_dc_precision = info->intra_dc_precision;
+
+    if (info->top_field_first)
+        pic->flags |= V4L2_MPEG2_PIC_FLAG_TOP_FIELD_FIRST;
+    if (info->frame_pred_frame_dct)
+        pic->flags |= V4L2_MPEG2_PIC_FLAG_FRAME_PRED_DCT;
+    if (info->concealment_motion_vectors)
+        pic->flags |= V4L2_MPEG2_PIC_FLAG_CONCEALMENT_MV;
+    if (info->q_scale_type)
+        pic->flags |= V4L2_MPEG2_PIC_FLAG_Q_SCALE_TYPE;
+    if (info->intra_vlc_format)
+        pic->flags |= V4L2_MPEG2_PIC_FLAG_INTRA_VLC;
+    if (info->alternate_scan)
+        pic->flags |= V4L2_MPEG2_PIC_FLAG_ALT_SCAN;
+    // the best guess available, see mpeg12_write_picture_header()
+    if (info->picture_structure == V4L2_MPEG2_PIC_FRAME && info->frame_pred_frame_dct)
+        pic->flags |= V4L2_MPEG2_PIC_FLAG_PROGRESSIVE;
+    add_control(c, V4L2_CID_STATELESS_MPEG2_PICTURE, pic, sizeof(*pic));
+
+    mpeg12_scan_matrix(info->intra_quantizer_matrix, TRUE, quant->intra_quantiser_matrix);
+    mpeg12_scan_matrix(info->non_intra_quantizer_matrix, FALSE, quant->non_intra_quantiser_matrix);
+    memcpy(quant->chroma_intra_quantiser_matrix, quant->intra_quantiser_matrix, 64);
+    memcpy(quant->chroma_non_intra_quantiser_matrix, quant->non_intra_quantiser_matrix, 64);
+    add_control(c, V4L2_CID_STATELESS_MPEG2_QUANTISATION, quant, sizeof(*quant));
+
+    return 0;
+}
+
+/*
+ * The surfaces the picture predicts from, whether it is a field and whether
+ * later pictures may reference it. Returns the number of references.
+ */
+static int picture_references(stateless_decoder_t *ctx, VdpPictureInfo const *info, VdpVideoSurface *refs,
+                              int *field, int *reference)
+{
+    int i, count = 0;
+
+    if (ctx->codec == V4L2_PIX_FMT_H264_SLICE) {
+        VdpPictureInfoH264 *h264 = (VdpPictureInfoH264 *)info;
+
+        for (i = 0; i < V4L2_H264_NUM_DPB_ENTRIES; i++)
+            if (h264->referenceFrames[i].surface != VDP_INVALID_HANDLE)
+                refs[count++] = h264->referenceFrames[i].surface;
+        *field = h264->field_pic_flag;
+        *reference = h264->is_reference;
+    } else {
+        VdpPictureInfoMPEG1Or2 *mpeg2 = (VdpPictureInfoMPEG1Or2 *)info;
+
+        if (mpeg2->forward_reference != VDP_INVALID_HANDLE)
+            refs[count++] = mpeg2->forward_reference;
+        if (mpeg2->backward_reference != VDP_INVALID_HANDLE)
+            refs[count++] = mpeg2->backward_reference;
+        *field = mpeg2->picture_structure != V4L2_MPEG2_PIC_FRAME;
+        *reference = mpeg2->picture_coding_type != V4L2_MPEG2_PIC_CODING_TYPE_B;
+    }
+
+    return count;
+}
+
+// caller holds the mutex, collects whatever the driver finished decoding
+static void reap_pictures(stateless_decoder_t *ctx)
+{
+    struct timeval timestamp;
+    __u32 flags;
+    int index;
+
+    while ((index = DequeueBufferInfo(ctx->handle, V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE, V4L2_MEMORY_MMAP,
+                                      &timestamp, &flags, NULL)) >= 0) {
+        picture_t *picture;
+
+        if (index >= ctx->captureBuffersCount)
+            continue;
+        picture = &ctx->pictures[index];
+
+        // shown all the same, the surface would keep the previous picture otherwise
+        if (flags & V4L2_BUF_FLAG_ERROR)
+            ctx->decodeErrors++;
+
+        ctx->captureBuffers[index].bQueue = FALSE;
+        ctx->captureBuffers[index].timestamp = timestamp;
+        picture->state = picture->firstField ? PICTURE_FIELD : PICTURE_DONE;
+    }
+}
+
+// caller holds the mutex, the second field has to wait for the first to come back
+static int wait_picture(stateless_decoder_t *ctx, int index)
+{
+    struct pollfd p;
+    int tries;
+
+    for (tries = 0; tries < 10 && ctx->pictures[index].state == PICTURE_QUEUED; tries++) {
+        p.fd = ctx->handle;
+        p.events = POLLIN;
+        if (poll(&p, 1, 100) < 0)
+            break;
+        reap_pictures(ctx);
+    }
+
+    return ctx->pictures[index].state == PICTURE_QUEUED ? -1 : 0;
+}
+
+/*
+ * Caller holds the mutex. A second field goes into the buffer holding the
+ * first, anything else into a buffer neither referenced nor still waiting to
+ * be shown. If the mixer fell that far behind, its oldest unfetched picture
+ * is dropped.
+ */
+static int pick_capture(stateless_decoder_t *ctx, VdpVideoSurface output, int field)
+{
+    int i, oldest = -1;
+
+    for (i = 0; field && i < ctx->captureBuffersCount; i++) {
+        picture_t *picture = &ctx->pictures[i];
+        if (picture->surface != output || !picture->firstField)
+            continue;
+        if (picture->state == PICTURE_QUEUED && wait_picture(ctx, i)) {
+            VDPAU_ERR("First field didn't come back from the decoder");
+            return -1;
+        }
+        if (picture->state == PICTURE_FIELD)
+            return i;
+    }
+
+    for (i = 0; i < ctx->captureBuffersCount; i++)
+        if (ctx->pictures[i].state == PICTURE_FREE && !ctx->pictures[i].reference)
+            return i;
+
+    for (i = 0; i < ctx->captureBuffersCount; i++) {
+        picture_t *picture = &ctx->pictures[i];
+        if (picture->state == PICTURE_DONE && !picture->reference &&
+                (oldest < 0 || (int32_t)(picture->sequence - ctx->pictures[oldest].sequence) < 0))
+            oldest = i;
+    }
+    if (oldest >= 0) {
+        ctx->pictureDrops++;
+        return oldest;
+    }
+
+    VDPAU_ERR("All %d CAPTURE buffers are referenced or in use", ctx->captureBuffersCount);
+    return -1;
+}
+
+/*
+ * Caller holds the mutex. Runs on the first picture, after the buffering was
+ * set and, for H.264, after the driver saw an SPS to pick formats from.
+ */
+static int setup_capture(stateless_decoder_t *ctx)
+{
+    struct v4l2_format fmt;
+    int i;
+
+    if (capture_negotiate(ctx->handle, &ctx->layout, &fmt))
+        return -1;
+
+    // the coded size is macroblock aligned, VDPAU told us the visible one
+    ctx->layout.width = min(fmt.fmt.pix_mp.width, ctx->width);
+    ctx->layout.height = min(fmt.fmt.pix_mp.height, ctx->height);
+
+    VDPAU_DBG("CAPTURE %.4s %dx%d, visible %dx%d", (char *)&ctx->layout.pixelformat, fmt.fmt.pix_mp.width, fmt.fmt.pix_mp.height,
+              ctx->layout.width, ctx->layout.height);
+
+    // the driver holds no pictures of its own, but every picture in flight takes a buffer next to the references
+    ctx->captureBuffersCount = RequestBuffer(ctx->handle, V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE, V4L2_MEMORY_MMAP,
+                                             capture_depth(ctx->maxReferences + ctx->outputBuffersCount, ctx->maxReferences,
+                                                           ctx->buffering, ctx->width, ctx->height));
+    if (ctx->captureBuffersCount == V4L2_ERROR || ctx->captureBuffersCount <= 0) {
+        VDPAU_ERR("REQBUFS failed on CAPTURE");
+        ctx->captureBuffersCount = 0;
+        return -1;
+    }
+
+    ctx->captureBuffers = (v4l2_buffer_t *)calloc(ctx->captureBuffersCount, sizeof(v4l2_buffer_t));
+    ctx->pictures = calloc(ctx->captureBuffersCount, sizeof(picture_t));
+    ctx->pictureData = calloc(ctx->captureBuffersCount, sizeof(*ctx->pictureData));
+    if (!ctx->captureBuffers || !ctx->pictures || !ctx->pictureData) {
+        VDPAU_ERR("cannot allocate buffers");
+        return -1;
+    }
+
+    // nothing is queued, every picture brings its buffer along
+    if (!MmapBuffers(ctx->handle, ctx->captureBuffersCount, ctx->captureBuffers, V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE, V4L2_MEMORY_MMAP, FALSE)) {
+        VDPAU_ERR("cannot mmap capture buffers");
+        return -1;
+    }
+    memstat_alloc(MEMSTAT_V4L2_CAPTURE, ctx->captureBuffersCount, 0, 0, buffers_size(ctx->captureBuffersCount, ctx->captureBuffers));
+
+    capture_map(&ctx->layout, ctx->captureBuffersCount, ctx->captureBuffers, ctx->pictureData);
+    for (i = 0; i < ctx->captureBuffersCount; i++)
+        ctx->pictures[i].surface = VDP_INVALID_HANDLE;
+    ctx->layout.generation = NextBufferGeneration();
+
+    if (!StreamOn(ctx->handle, V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE, VIDIOC_STREAMON)) {
+        VDPAU_ERR("Failed to Stream ON CAPTURE");
+        return -1;
+    }
+
+    VDPAU_DBG("%d CAPTURE buffers", ctx->captureBuffersCount);
+    return 0;
+}
+
+// caller holds the mutex
+static void teardown_capture(stateless_decoder_t *ctx)
+{
+    StreamOn(ctx->handle, V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE, VIDIOC_STREAMOFF);
+    if (ctx->captureBuffers) {
+        memstat_free(MEMSTAT_V4L2_CAPTURE, ctx->captureBuffersCount, 0, 0, buffers_size(ctx->captureBuffersCount, ctx->captureBuffers));
+        ctx->captureBuffers = FreeBuffers(ctx->captureBuffersCount, ctx->captureBuffers);
+    }
+    RequestBuffer(ctx->handle, V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE, V4L2_MEMORY_MMAP, 0);
+
+    free(ctx->pictures);
+    ctx->pictures = NULL;
+    free(ctx->pictureData);
+    ctx->pictureData = NULL;
+    ctx->captureBuffersCount = 0;
+}
+
+// a request can be refilled once the driver completed it
+static int reinit_request(stateless_decoder_t *ctx, int index)
+{
+    struct pollfd p;
+
+    p.fd = ctx->requests[index];
+    p.events = POLLPRI;
+    if (poll(&p, 1, 1000) <= 0)
+        VDPAU_DBG("Request %d didn't complete in time", index);
+
+    if (ioctl(ctx->requests[index], MEDIA_REQUEST_IOC_REINIT, NULL)) {
+        VDPAU_ERR("Failed to reinit request %d, errno = %d", index, errno);
+        return -1;
+    }
+
+    return 0;
+}
+
+static void decoder_close(void *private);
+
+static void *decoder_open(VdpDecoderProfile profile, uint32_t width, uint32_t height, uint32_t max_references)
+{
+    struct v4l2_requestbuffers reqbufs;
+    struct v4l2_ext_control ctrls[2];
+    struct v4l2_format fmt;
+    v4l2_device_t dec;
+    int i;
+
+    stateless_decoder_t *ctx = calloc(1, sizeof(stateless_decoder_t));
+    if (!ctx)
+        return NULL;
+    memstat_alloc(MEMSTAT_DECODER, 1, sizeof(stateless_decoder_t), 0, 0);
+
+    ctx->width = width;
+    ctx->height = height;
+    ctx->profile = profile;
+    ctx->codec = get_codec(profile);
+    ctx->maxReferences = max_references;
+    ctx->buffering = VDP_DECODER_BUFFERING_BALANCED_ODROID;
+    ctx->handle = -1;
+    ctx->mediaHandle = -1;
+    for (i = 0; i < STATELESS_STREAM_BUFFER_CNT; i++)
+        ctx->requests[i] = -1;
+    pthread_mutex_init(&ctx->mutex, NULL);
+
+    ctx->handle = open_decoder_device(ctx->codec, FALSE, &dec, &ctx->mediaHandle);
+    if (ctx->handle == -ENODEV)
+        VDPAU_ERR("No V4L2 stateless decoder for %.4s", (char *)&ctx->codec);
+    if (ctx->handle < 0)
+        goto err;
+    VDPAU_DBG("Using %s %s with %s", dec.name, dec.path, dec.media);
+
+    memzero(fmt);
+    fmt.type = V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE;
+    fmt.fmt.pix_mp.pixelformat = ctx->codec;
+    fmt.fmt.pix_mp.width = width;
+    fmt.fmt.pix_mp.height = height;
+    fmt.fmt.pix_mp.num_planes = 1;
+    fmt.fmt.pix_mp.plane_fmt[0].sizeimage = STREAM_BUFFER_SIZE;
+    if (ioctl(ctx->handle, VIDIOC_S_FMT, &fmt)) {
+        VDPAU_ERR("Failed to set OUTPUT format %.4s, errno = %d", (char *)&ctx->codec, errno);
+        goto err;
+    }
+
+    // VDPAU hands over whole pictures with start codes, but not the slice parameters
+    if (ctx->codec == V4L2_PIX_FMT_H264_SLICE) {
+        memzero(ctrls);
+        ctrls[0].id = V4L2_CID_STATELESS_H264_DECODE_MODE;
+        ctrls[0].value = V4L2_STATELESS_H264_DECODE_MODE_FRAME_BASED;
+        ctrls[1].id = V4L2_CID_STATELESS_H264_START_CODE;
+        ctrls[1].value = V4L2_STATELESS_H264_START_CODE_ANNEX_B;
+        if (set_controls(ctx, -1, ctrls, 2)) {
+            VDPAU_ERR("%s doesn't decode whole H.264 frames with start codes", dec.name);
+            goto err;
+        }
+    }
+
+    memzero(reqbufs);
+    reqbufs.type = V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE;
+    reqbufs.memory = V4L2_MEMORY_MMAP;
+    if (ioctl(ctx->handle, VIDIOC_REQBUFS, &reqbufs) || !(reqbufs.capabilities & V4L2_BUF_CAP_SUPPORTS_REQUESTS)) {
+        VDPAU_ERR("%s doesn't support requests", dec.name);
+        goto err;
+    }
+
+    ctx->outputBuffersCount = RequestBuffer(ctx->handle, V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE, V4L2_MEMORY_MMAP, STATELESS_STREAM_BUFFER_CNT);
+    if (ctx->outputBuffersCount == V4L2_ERROR || ctx->outputBuffersCount <= 0) {
+        VDPAU_ERR("REQBUFS failed on OUTPUT");
+        ctx->outputBuffersCount = 0;
+        goto err;
+    }
+    ctx->outputBuffersCount = min(ctx->outputBuffersCount, STATELESS_STREAM_BUFFER_CNT);
+
+    ctx->outputBuffers = (v4l2_buffer_t *)calloc(ctx->outputBuffersCount, sizeof(v4l2_buffer_t));
+    if (!ctx->outputBuffers) {
+        VDPAU_ERR("cannot allocate buffers");
+        goto err;
+    }
+    if (!MmapBuffers(ctx->handle, ctx->outputBuffersCount, ctx->outputBuffers, V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE, V4L2_MEMORY_MMAP, FALSE)) {
+        VDPAU_ERR("cannot mmap output buffers");
+        goto err;
+    }
+    memstat_alloc(MEMSTAT_V4L2_OUTPUT, ctx->outputBuffersCount, 0, 0, buffers_size(ctx->outputBuffersCount, ctx->outputBuffers));
+
+    for (i = 0; i < ctx->outputBuffersCount; i++) {
+        if (ioctl(ctx->mediaHandle, MEDIA_IOC_REQUEST_ALLOC, &ctx->requests[i])) {
+            VDPAU_ERR("Failed to allocate a request on %s, errno = %d", dec.media, errno);
+            ctx->requests[i] = -1;
+            goto err;
+        }
+    }
+
+    if (!StreamOn(ctx->handle, V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE, VIDIOC_STREAMON)) {
+        VDPAU_ERR("Failed to Stream ON OUTPUT");
+        goto err;
+    }
+
+    return ctx;
+
+err:
+    decoder_close(ctx);
+    return NULL;
+}
+
+static void decoder_close(void *private)
+{
+    stateless_decoder_t *ctx = (stateless_decoder_t *)private;
+    int i;
+
+    if (!ctx)
+        return;
+
+    VDPAU_DBG("%u pictures, %u decode errors, %u bitstream stalls, %u pictures not ready in time, %u dropped, %d capture buffers",
+              ctx->decoded, ctx->decodeErrors, ctx->outputStalls, ctx->pictureMisses, ctx->pictureDrops, ctx->captureBuffersCount);
+
+    if (ctx->handle >= 0) {
+        StreamOn(ctx->handle, V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE, VIDIOC_STREAMOFF);
+
+        pthread_mutex_lock(&ctx->mutex);
+        teardown_capture(ctx);
+        pthread_mutex_unlock(&ctx->mutex);
+
+        if (ctx->outputBuffers) {
+            memstat_free(MEMSTAT_V4L2_OUTPUT, ctx->outputBuffersCount, 0, 0, buffers_size(ctx->outputBuffersCount, ctx->outputBuffers));
+            ctx->outputBuffers = FreeBuffers(ctx->outputBuffersCount, ctx->outputBuffers);
+        }
+        close(ctx->handle);
+    }
+
+    for (i = 0; i < STATELESS_STREAM_BUFFER_CNT; i++)
+        if (ctx->requests[i] >= 0)
+            close(ctx->requests[i]);
+    if (ctx->mediaHandle >= 0)
+        close(ctx->mediaHandle);
+
+    pthread_mutex_destroy(&ctx->mutex);
+    memstat_free(MEMSTAT_DECODER, 1, sizeof(stateless_decoder_t), 0, 0);
+    free(ctx);
+}
+
+// a free OUTPUT buffer with an empty request, waiting for the decoder to finish one if needed
+static int get_output(stateless_decoder_t *ctx)
+{
+    struct pollfd p;
+    int index, tries;
+
+    for (index = 0; index < ctx->outputBuffersCount; index++)
+        if (!ctx->outputBuffers[index].bQueue)
+            return index;
+
+    ctx->outputStalls++;
+    for (tries = 0; tries < 10; tries++) {
+        index = DequeueBuffer(ctx->handle, V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE, V4L2_MEMORY_MMAP);
+        if (index >= 0 && index < ctx->outputBuffersCount) {
+            ctx->outputBuffers[index].bQueue = FALSE;
+            return reinit_request(ctx, index) ? -1 : index;
+        }
+        if (index != -EAGAIN)
+            break;
+
+        p.fd = ctx->handle;
+        p.events = POLLOUT;
+        if (poll(&p, 1, 100) < 0)
+            break;
+    }
+
+    VDPAU_ERR("Decoder didn't release a bitstream buffer, errno = %d", errno);
+    return -1;
+}
+
+/*
+ * Caller holds the mutex. STREAMOFF returns every buffer and cancels the
+ * requests still queued, afterwards no picture is referenced any more.
+ */
+static VdpStatus reset_queues(stateless_decoder_t *ctx)
+{
+    VdpStatus ret = VDP_STATUS_OK;
+    int i;
+
+    if (!StreamOn(ctx->handle, V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE, VIDIOC_STREAMOFF) ||
+            !StreamOn(ctx->handle, V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE, VIDIOC_STREAMOFF))
+        ret = VDP_STATUS_ERROR;
+
+    for (i = 0; i < ctx->outputBuffersCount; i++) {
+        if (ctx->outputBuffers[i].bQueue && reinit_request(ctx, i))
+            ret = VDP_STATUS_ERROR;
+        ctx->outputBuffers[i].bQueue = FALSE;
+    }
+
+    for (i = 0; i < ctx->captureBuffersCount; i++) {
+        ctx->captureBuffers[i].bQueue = FALSE;
+        memset(&ctx->pictures[i], 0, sizeof(picture_t));
+        ctx->pictures[i].surface = VDP_INVALID_HANDLE;
+    }
+
+    if (!StreamOn(ctx->handle, V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE, VIDIOC_STREAMON) ||
+            (ctx->captureBuffers && !StreamOn(ctx->handle, V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE, VIDIOC_STREAMON)))
+        ret = VDP_STATUS_ERROR;
+
+    if (ret != VDP_STATUS_OK)
+        VDPAU_ERR("Failed to reset the decoder queues");
+    return ret;
+}
+
+static VdpStatus decoder_decode_picture(void *private, VdpPictureInfo const *info, uint32_t buffer_count,
+                    VdpBitstreamBuffer const *buffers, VdpVideoSurface output, uint32_t generation)
+{
+    stateless_decoder_t *ctx = (stateless_decoder_t *)private;
+    VdpVideoSurface refs[V4L2_H264_NUM_DPB_ENTRIES];
+    picture_controls_t controls;
+    v4l2_buffer_t *buffer;
+    picture_t *picture;
+    int index, target, field, reference, count, i, j;
+    uint32_t size = 0;
+
+    if (!ctx)
+        return VDP_STATUS_ERROR;
+
+    index = get_output(ctx);
+    if (index < 0)
+        return VDP_STATUS_ERROR;
+    buffer = &ctx->outputBuffers[index];
+
+    for (i = 0; i < (int)buffer_count; i++)
+        size += buffers[i].bitstream_bytes;
+    if (size > buffer->iSize[0]) {
+        VDPAU_ERR("Bitstream of %u bytes doesn't fit the %d byte buffer", size, buffer->iSize[0]);
+        return VDP_STATUS_ERROR;
+    }
+
+    for (i = 0, size = 0; i < (int)buffer_count; i++) {
+        memcpy((uint8_t *)buffer->cPlane[0] + size, buffers[i].bitstream, buffers[i].bitstream_bytes);
+        size += buffers[i].bitstream_bytes;
+    }
+    buffer->iBytesUsed[0] = size;
+
+    // tagged so the picture finds its way back to output, and later pictures to it
+    buffer->timestamp = TimestampTag(&ctx->timestamps, output, generation);
+
+    pthread_mutex_lock(&ctx->mutex);
+
+    memset(&controls, 0, sizeof(controls));
+    if (ctx->codec == V4L2_PIX_FMT_H264_SLICE) {
+        if (h264_controls(ctx, (VdpPictureInfoH264 *)info, buffer->cPlane[0], size, &controls))
+            goto err;
+    } else {
+        mpeg2_controls(ctx, (VdpPictureInfoMPEG1Or2 *)info, &controls);
+    }
+
+    // the SPS lets the driver choose a CAPTURE format matching the stream
+    if (!ctx->captureBuffers) {
+        if (ctx->codec == V4L2_PIX_FMT_H264_SLICE && set_controls(ctx, -1, controls.controls, 1))
+            goto err;
+        if (setup_capture(ctx)) {
+            teardown_capture(ctx);
+            goto err;
+        }
+    }
+
+    reap_pictures(ctx);
+
+    // whatever this picture doesn't predict from is free to be decoded over
+    count = picture_references(ctx, info, refs, &field, &reference);
+    for (i = 0; i < ctx->captureBuffersCount; i++) {
+        ctx->pictures[i].reference = FALSE;
+        for (j = 0; j < count; j++)
+            if (ctx->pictures[i].surface == refs[j])
+                ctx->pictures[i].reference = TRUE;
+    }
+
+    target = pick_capture(ctx, output, field);
+    if (target < 0)
+        goto err;
+    picture = &ctx->pictures[target];
+
+    if (set_controls(ctx, ctx->requests[index], controls.controls, controls.count))
+        goto err;
+
+    if (QueueBufferRequest(ctx->handle, V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE, V4L2_MEMORY_MMAP, buffer, ctx->requests[index]) == V4L2_ERROR) {
+        VDPAU_ERR("Failed to queue buffer with index %d, errno %d", index, errno);
+        goto err_request;
+    }
+
+    if (QueueBuffer(ctx->handle, V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE, V4L2_MEMORY_MMAP, &ctx->captureBuffers[target]) == V4L2_ERROR) {
+        VDPAU_ERR("Failed to queue capture buffer with index %d, errno %d", target, errno);
+        goto err_request;
+    }
+
+    if (picture->state == PICTURE_FIELD) {
+        picture->firstField = FALSE;
+    } else {
+        // an older picture of the surface is no reference any more, the application decodes over it
+        for (i = 0; i < ctx->captureBuffersCount; i++)
+            if (ctx->pictures[i].surface == output)
+                ctx->pictures[i].surface = VDP_INVALID_HANDLE;
+        picture->surface = output;
+        picture->firstField = field;
+        picture->sequence = ++ctx->sequence;
+    }
+    picture->state = PICTURE_QUEUED;
+    picture->reference = reference;
+    picture->timestamp = timestamp_ns(buffer->timestamp);
+
+    if (ioctl(ctx->requests[index], MEDIA_REQUEST_IOC_QUEUE, NULL)) {
+        // the CAPTURE buffer would take the next picture, start over instead
+        VDPAU_ERR("Failed to queue request %d, errno %d", index, errno);
+        reset_queues(ctx);
+        goto err;
+    }
+
+    ctx->decoded++;
+    pthread_mutex_unlock(&ctx->mutex);
+    return VDP_STATUS_OK;
+
+err_request:
+    // drops the controls and the bitstream buffer again
+    reinit_request(ctx, index);
+    buffer->bQueue = FALSE;
+err:
+    pthread_mutex_unlock(&ctx->mutex);
+    return VDP_STATUS_ERROR;
+}
+
+static VdpStatus decoder_get_picture(void *context, int *frame, void ***output, VdpVideoSurface *surface,
+                    uint32_t *generation)
+{
+    stateless_decoder_t *ctx = (stateless_decoder_t *)context;
+    int i, index = -1;
+
+    *frame = -1;
+    *output = NULL;
+    *surface = VDP_INVALID_HANDLE;
+    *generation = 0;
+
+    pthread_mutex_lock(&ctx->mutex);
+    if (!ctx->captureBuffers)
+        goto out;
+
+    reap_pictures(ctx);
+
+    // in decode order, the mixer maps them to their surfaces
+    for (i = 0; i < ctx->captureBuffersCount; i++)
+        if (ctx->pictures[i].state == PICTURE_DONE &&
+                (index < 0 || (int32_t)(ctx->pictures[i].sequence - ctx->pictures[index].sequence) < 0))
+            index = i;
+
+    if (index < 0) {
+        ctx->pictureMisses++;
+        goto out;
+    }
+
+    ctx->pictures[index].state = PICTURE_SHOWN;
+    *output = ctx->pictureData[index];
+    *frame = index;
+    TimestampLookup(&ctx->timestamps, ctx->captureBuffers[index].timestamp, surface, generation);
+
+out:
+    pthread_mutex_unlock(&ctx->mutex);
+    return VDP_STATUS_OK;
+}
+
+// the buffer is not queued again here, the next picture decoding into it does that
+static VdpStatus decoder_release_picture(void *context, int frame)
+{
+    stateless_decoder_t *ctx = (stateless_decoder_t *)context;
+    VdpStatus ret = VDP_STATUS_OK;
+
+    pthread_mutex_lock(&ctx->mutex);
+    if (frame < 0 || frame >= ctx->captureBuffersCount) {
+        VDPAU_ERR("Released unknown picture %d", frame);
+        ret = VDP_STATUS_ERROR;
+    } else if (ctx->pictures[frame].state == PICTURE_SHOWN) {
+        ctx->pictures[frame].state = PICTURE_FREE;
+    }
+    pthread_mutex_unlock(&ctx->mutex);
+
+    return ret;
+}
+
+static VdpStatus decoder_get_dmabuf(void *context, int frame, decoder_dmabuf_t *dmabuf)
+{
+    stateless_decoder_t *ctx = (stateless_decoder_t *)context;
+    VdpStatus ret;
+
+    pthread_mutex_lock(&ctx->mutex);
+    ret = capture_dmabuf(ctx->handle, &ctx->layout, ctx->captureBuffersCount, ctx->captureBuffers, frame, dmabuf);
+    pthread_mutex_unlock(&ctx->mutex);
+
+    return ret;
+}
+
+// pictures still in flight belong to the old position, so do the references
+static VdpStatus decoder_flush(void *private)
+{
+    stateless_decoder_t *ctx = (stateless_decoder_t *)private;
+    VdpStatus ret;
+
+    if (!ctx)
+        return VDP_STATUS_OK;
+
+    pthread_mutex_lock(&ctx->mutex);
+    ret = reset_queues(ctx);
+    pthread_mutex_unlock(&ctx->mutex);
+
+    return ret;
+}
+
+// takes effect if set before the first picture, CAPTURE is allocated then
+static VdpStatus decoder_set_buffering(void *private, uint32_t buffering)
+{
+    stateless_decoder_t *ctx = (stateless_decoder_t *)private;
+
+    if (!ctx)
+        return VDP_STATUS_ERROR;
+
+    ctx->buffering = buffering;
+    return VDP_STATUS_OK;
+}
+
+const decoder_backend_t decoder_backend_stateless =
+{
+    .name = "stateless",
+    .query_capabilities = decoder_query_capabilities,
+    .open = decoder_open,
+    .close = decoder_close,
+    .decode_picture = decoder_decode_picture,
+    .get_picture = decoder_get_picture,
+    .release_picture = decoder_release_picture,
+    .get_dmabuf = decoder_get_dmabuf,
+    .flush = decoder_flush,
+    .set_buffering = decoder_set_buffering,
+};
+
+#else
+
+static VdpStatus decoder_query_capabilities(VdpDecoderProfile profile, VdpBool *is_supported,
+                    uint32_t *max_width, uint32_t *max_height)
+{
+    *is_supported = VDP_FALSE;
+    return VDP_STATUS_OK;
+}
+
+static void *decoder_open(VdpDecoderProfile profile, uint32_t width, uint32_t height, uint32_t max_references)
+{
+    return NULL;
+}
+
+// built against kernel headers without the stateless controls, never picked
+const decoder_backend_t decoder_backend_stateless =
+{
+    .name = "stateless",
+    .query_capabilities = decoder_query_capabilities,
+    .open = decoder_open,
+};
+
+#endif
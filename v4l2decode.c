@@ -13,74 +13,240 @@
 #include <sys/types.h>
 #include <sys/ioctl.h>
 #include <sys/time.h>
+#include <sys/epoll.h>
 
 #include <linux/videodev2.h>
 
 #include "vdpau_private.h"
 
 #include "v4l2.h"
+#include "v4l2_devices.h"
 #include "v4l2decode.h"
+#include "v4l2_reactor.h"
+#include "vdpau_odroid.h"
 
 static int openDevices(v4l2_decoder_t *ctx);
+static int open_device(int (*find)(__u32 codec, int mfc, v4l2_device_t *device), __u32 codec, int mfc,
+                    v4l2_device_t *device, int *media);
+static int find_converter(__u32 codec, int mfc, v4l2_device_t *device);
 static void cleanup(v4l2_decoder_t *ctx);
-static void *pumpFIMC(void *arg);
-static void *pumpMFC(void *arg);
-
-static __u32 get_codec(VdpDecoderProfile profile)
-{
-    switch (profile)
-    {
-    case VDP_DECODER_PROFILE_MPEG1:
-        return V4L2_PIX_FMT_MPEG1;
-
-    case VDP_DECODER_PROFILE_MPEG2_SIMPLE:
-    case VDP_DECODER_PROFILE_MPEG2_MAIN:
-        return V4L2_PIX_FMT_MPEG2;
-
-    case VDP_DECODER_PROFILE_H264_BASELINE:
-    case VDP_DECODER_PROFILE_H264_MAIN:
-    case VDP_DECODER_PROFILE_H264_HIGH:
-        return V4L2_PIX_FMT_H264;
-
-    case VDP_DECODER_PROFILE_MPEG4_PART2_SP:
-    case VDP_DECODER_PROFILE_MPEG4_PART2_ASP:
-        return V4L2_PIX_FMT_MPEG4;
-    }
-//    VDP_DECODER_PROFILE_VC1_SIMPLE
-//    VDP_DECODER_PROFILE_VC1_MAIN
-//    VDP_DECODER_PROFILE_VC1_ADVANCED
-//    VDP_DECODER_PROFILE_MPEG4_PART2_SP
-//    VDP_DECODER_PROFILE_MPEG4_PART2_ASP
-//    VDP_DECODER_PROFILE_DIVX4_QMOBILE
-//    VDP_DECODER_PROFILE_DIVX4_MOBILE
-//    VDP_DECODER_PROFILE_DIVX4_HOME_THEATER
-//    VDP_DECODER_PROFILE_DIVX4_HD_1080P
-//    VDP_DECODER_PROFILE_DIVX5_QMOBILE
-//    VDP_DECODER_PROFILE_DIVX5_MOBILE
-//    VDP_DECODER_PROFILE_DIVX5_HOME_THEATER
-//    VDP_DECODER_PROFILE_DIVX5_HD_1080P
-
-    //            return V4L2_PIX_FMT_H263;
-    //            return V4L2_PIX_FMT_XVID;
-    return V4L2_PIX_FMT_H264;
-}
-
-void *decoder_open(VdpDecoderProfile profile, uint32_t width, uint32_t height)
+static int startPumps(v4l2_decoder_t *ctx);
+static void stopPumps(v4l2_decoder_t *ctx);
+static int setup_capture(v4l2_decoder_t *ctx);
+static void teardown_capture(v4l2_decoder_t *ctx);
+static int submit_start(v4l2_decoder_t *ctx);
+static void submit_stop(v4l2_decoder_t *ctx);
+static void submit_discard(v4l2_decoder_t *ctx);
+
+/*
+ * Process wide pool of closed decoders. Opening one costs a sysfs scan, S_FMT,
+ * REQBUFS and mapping the stream buffers, and once the header is processed
+ * also the capture side, while players like MythTV recreate the decoder on
+ * every channel change. decoder_close() parks the context with all queues
+ * streamed off but buffers kept, decoder_open() revives a parked one of the
+ * same codec and size. Sized by VDPAU_DECODER_POOL. A reaper thread, started
+ * with the first parked decoder, destroys them as their TTL runs out, and
+ * decoder_pool_drain() empties the pool when the device goes or we unload.
+ */
+typedef struct
+{
+    v4l2_decoder_t *parked[DECODER_POOL_MAX_SIZE];
+    int count;
+    int max;
+    uint64_t ttl;
+    uint32_t hits;
+    uint32_t misses;
+    uint32_t expired;
+    uint32_t evictions;
+    // [0] cold, [1] warm opens
+    uint64_t openTime[2];
+    uint32_t opens[2];
+    uint64_t firstPictureTime[2];
+    uint32_t firstPictures[2];
+    pthread_t reaper;
+    int reaperRunning;
+    int stopping;
+    pthread_cond_t cond;            // CLOCK_MONOTONIC, signalled on park and drain
+    pthread_mutex_t mutex;
+    pthread_once_t once;
+} decoder_pool_t;
+
+static decoder_pool_t pool = { .mutex = PTHREAD_MUTEX_INITIALIZER, .once = PTHREAD_ONCE_INIT };
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+// bytes of all planes actually mapped, partially mapped sets are accounted correctly
+size_t buffers_size(int count, v4l2_buffer_t *buffers)
+{
+    size_t size = 0;
+    int i, j;
+
+    if (!buffers)
+        return 0;
+
+    for (i = 0; i < count; i++)
+        for (j = 0; j < buffers[i].iNumPlanes; j++)
+            size += buffers[i].iSize[j];
+
+    return size;
+}
+
+/*
+ * Coded format of the stream decoders for each profile, shared with the
+ * stateful backend. DivX 5 muxes B-VOPs as packed bitstreams, which the MFC
+ * only unpacks in XviD mode; for other decoders that is up to the driver.
+ */
+static const struct
+{
+    VdpDecoderProfile profile;
+    __u32 codec;
+    __u32 mfc;              // if the MFC needs another one
+} streamCodecs[] =
+{
+    { VDP_DECODER_PROFILE_MPEG1,                V4L2_PIX_FMT_MPEG1,         0 },
+    { VDP_DECODER_PROFILE_MPEG2_SIMPLE,         V4L2_PIX_FMT_MPEG2,         0 },
+    { VDP_DECODER_PROFILE_MPEG2_MAIN,           V4L2_PIX_FMT_MPEG2,         0 },
+    { VDP_DECODER_PROFILE_H264_BASELINE,        V4L2_PIX_FMT_H264,          0 },
+    { VDP_DECODER_PROFILE_H264_MAIN,            V4L2_PIX_FMT_H264,          0 },
+    { VDP_DECODER_PROFILE_H264_HIGH,            V4L2_PIX_FMT_H264,          0 },
+    { VDP_DECODER_PROFILE_MPEG4_PART2_SP,       V4L2_PIX_FMT_MPEG4,         0 },
+    { VDP_DECODER_PROFILE_MPEG4_PART2_ASP,      V4L2_PIX_FMT_MPEG4,         0 },
+    { VDP_DECODER_PROFILE_DIVX4_QMOBILE,        V4L2_PIX_FMT_MPEG4,         0 },
+    { VDP_DECODER_PROFILE_DIVX4_MOBILE,         V4L2_PIX_FMT_MPEG4,         0 },
+    { VDP_DECODER_PROFILE_DIVX4_HOME_THEATER,   V4L2_PIX_FMT_MPEG4,         0 },
+    { VDP_DECODER_PROFILE_DIVX4_HD_1080P,       V4L2_PIX_FMT_MPEG4,         0 },
+    { VDP_DECODER_PROFILE_DIVX5_QMOBILE,        V4L2_PIX_FMT_MPEG4,         V4L2_PIX_FMT_XVID },
+    { VDP_DECODER_PROFILE_DIVX5_MOBILE,         V4L2_PIX_FMT_MPEG4,         V4L2_PIX_FMT_XVID },
+    { VDP_DECODER_PROFILE_DIVX5_HOME_THEATER,   V4L2_PIX_FMT_MPEG4,         V4L2_PIX_FMT_XVID },
+    { VDP_DECODER_PROFILE_DIVX5_HD_1080P,       V4L2_PIX_FMT_MPEG4,         V4L2_PIX_FMT_XVID },
+    { VDP_DECODER_PROFILE_VC1_SIMPLE,           V4L2_PIX_FMT_VC1_ANNEX_L,   0 },
+    { VDP_DECODER_PROFILE_VC1_MAIN,             V4L2_PIX_FMT_VC1_ANNEX_L,   0 },
+    { VDP_DECODER_PROFILE_VC1_ADVANCED,         V4L2_PIX_FMT_VC1_ANNEX_G,   0 },
+#if defined(VDP_DECODER_PROFILE_HEVC_MAIN) && defined(V4L2_PIX_FMT_HEVC)
+    { VDP_DECODER_PROFILE_HEVC_MAIN,            V4L2_PIX_FMT_HEVC,          0 },
+#endif
+};
+
+__u32 stream_codec(VdpDecoderProfile profile, int mfc)
+{
+    unsigned int i;
+
+    for (i = 0; i < ARRAY_SIZE(streamCodecs); i++)
+        if (streamCodecs[i].profile == profile)
+            return mfc && streamCodecs[i].mfc ? streamCodecs[i].mfc : streamCodecs[i].codec;
+
+    return 0;
+}
+
+static VdpStatus decoder_query_capabilities(VdpDecoderProfile profile, VdpBool *is_supported,
+                    uint32_t *max_width, uint32_t *max_height)
+{
+    return query_decoder(stream_codec(profile, TRUE), TRUE, FALSE, is_supported, max_width, max_height);
+}
+
+static int setup_output(v4l2_decoder_t *ctx)
+{
+    int ret, i;
+    char *env = getenv("VDPAU_BITSTREAM");
+
+    ctx->outputMemory = V4L2_MEMORY_MMAP;
+    if (env && strcmp(env, "userptr") == 0) {
+        ctx->outputBuffersCount = RequestBuffer(ctx->decoderHandle, V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE, V4L2_MEMORY_USERPTR, STREAM_BUFFER_CNT);
+        if (ctx->outputBuffersCount != V4L2_ERROR)
+            ctx->outputMemory = V4L2_MEMORY_USERPTR;
+        else
+            VDPAU_DBG("USERPTR bitstream buffers not supported, copying into mmapped ones");
+    }
+
+    if (ctx->outputMemory == V4L2_MEMORY_USERPTR) {
+        VDPAU_DBG("REQBUFS Number of MFC USERPTR buffers is %d (requested %d)", ctx->outputBuffersCount, STREAM_BUFFER_CNT);
+
+        ctx->outputBuffers = (v4l2_buffer_t *)calloc(ctx->outputBuffersCount, sizeof(v4l2_buffer_t));
+        ctx->gatherBuffers = (gather_buffer_t *)calloc(ctx->outputBuffersCount, sizeof(gather_buffer_t));
+        if (!ctx->outputBuffers || !ctx->gatherBuffers) {
+            VDPAU_ERR("cannot allocate buffers");
+            return -1;
+        }
+        // planes are pointed at the bitstream on every queue, see fill_output()
+        for (i = 0; i < ctx->outputBuffersCount; i++) {
+            ctx->outputBuffers[i].iIndex = i;
+            ctx->outputBuffers[i].iNumPlanes = 1;
+        }
+        memstat_alloc(MEMSTAT_V4L2_OUTPUT, ctx->outputBuffersCount, 0, 0, 0);
+        return 0;
+    }
+
+    // Request mfc output buffers
+    ctx->outputBuffersCount = RequestBuffer(ctx->decoderHandle, V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE, V4L2_MEMORY_MMAP, STREAM_BUFFER_CNT);
+    if (ctx->outputBuffersCount == V4L2_ERROR) {
+        VDPAU_ERR("REQBUFS failed on queue of MFC");
+        return -1;
+    }
+    VDPAU_DBG("REQBUFS Number of MFC buffers is %d (requested %d)", ctx->outputBuffersCount, STREAM_BUFFER_CNT);
+
+    // Memory Map mfc output buffers
+    ctx->outputBuffers = (v4l2_buffer_t *)calloc(ctx->outputBuffersCount, sizeof(v4l2_buffer_t));
+    if(!ctx->outputBuffers) {
+        VDPAU_ERR("cannot allocate buffers\n");
+        return -1;
+    }
+    ret = MmapBuffers(ctx->decoderHandle, ctx->outputBuffersCount, ctx->outputBuffers, V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE, V4L2_MEMORY_MMAP, FALSE);
+    memstat_alloc(MEMSTAT_V4L2_OUTPUT, ctx->outputBuffersCount, 0, 0, buffers_size(ctx->outputBuffersCount, ctx->outputBuffers));
+    if(!ret) {
+        VDPAU_ERR("cannot mmap output buffers\n");
+        return -1;
+    }
+    VDPAU_DBG("Succesfully mmapped %d buffers", ctx->outputBuffersCount);
+
+    return 0;
+}
+
+static void free_output(v4l2_decoder_t *ctx)
+{
+    int i;
+
+    if (ctx->outputMemory == V4L2_MEMORY_USERPTR) {
+        // nothing is mapped, the planes point at gathered or application memory
+        memstat_free(MEMSTAT_V4L2_OUTPUT, ctx->outputBuffersCount, 0, 0, 0);
+        for (i = 0; ctx->gatherBuffers && i < ctx->outputBuffersCount; i++) {
+            memstat_free(MEMSTAT_V4L2_OUTPUT, 0, ctx->gatherBuffers[i].size, 0, 0);
+            free(ctx->gatherBuffers[i].data);
+        }
+        free(ctx->gatherBuffers);
+        free(ctx->outputBuffers);
+        ctx->gatherBuffers = NULL;
+        ctx->outputBuffers = NULL;
+        return;
+    }
+
+    memstat_free(MEMSTAT_V4L2_OUTPUT, ctx->outputBuffersCount, 0, 0, buffers_size(ctx->outputBuffersCount, ctx->outputBuffers));
+    ctx->outputBuffers = FreeBuffers(ctx->outputBuffersCount, ctx->outputBuffers);
+}
+
+static v4l2_decoder_t *open_decoder(__u32 codec, uint32_t width, uint32_t height)
 {
     v4l2_decoder_t *ctx = calloc(1, sizeof(v4l2_decoder_t));
     struct v4l2_format fmt;
 
     ctx->width = width;
     ctx->height = height;
+    pthread_mutex_init(&ctx->mutex, NULL);
 
     ctx->decoderHandle = -1;
     ctx->converterHandle = -1;
+    ctx->mfcPump = -1;
+    ctx->fimcPump = -1;
 
     ctx->outputBuffersCount = -1;
     ctx->captureBuffersCount = -1;
     ctx->converterBuffersCount = -1;
 
-    ctx->codec = get_codec(profile);
+    ctx->codec = codec;
     if(openDevices(ctx)) {
         cleanup(ctx);
         return NULL;
@@ -98,6 +264,14 @@ void *decoder_open(VdpDecoderProfile profile, uint32_t width, uint32_t height)
         return NULL;
     }
 
+#ifdef V4L2_EVENT_SOURCE_CHANGE
+    // older MFC drivers have no events, resolution changes then need a new decoder
+    struct v4l2_event_subscription sub;
+    memzero(sub);
+    sub.type = V4L2_EVENT_SOURCE_CHANGE;
+    ctx->sourceChangeEvents = !ioctl(ctx->decoderHandle, VIDIOC_SUBSCRIBE_EVENT, &sub);
+#endif
+
     // Setup MFC CAPTURE format if we don't need FIMC conversion
     if (!ctx->needConvert) {
         memzero(fmt);
@@ -110,217 +284,936 @@ void *decoder_open(VdpDecoderProfile profile, uint32_t width, uint32_t height)
         }
     }
 
-    // Request mfc output buffers
-    ctx->outputBuffersCount = RequestBuffer(ctx->decoderHandle, V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE, V4L2_MEMORY_MMAP, STREAM_BUFFER_CNT);
-    if (ctx->outputBuffersCount == V4L2_ERROR) {
-        VDPAU_ERR("REQBUFS failed on queue of MFC");
+    if (setup_output(ctx) || submit_start(ctx)) {
         cleanup(ctx);
         return NULL;
     }
-    VDPAU_DBG("REQBUFS Number of MFC buffers is %d (requested %d)", ctx->outputBuffersCount, STREAM_BUFFER_CNT);
 
-    // Memory Map mfc output buffers
-    ctx->outputBuffers = (v4l2_buffer_t *)calloc(ctx->outputBuffersCount, sizeof(v4l2_buffer_t));
-    if(!ctx->outputBuffers) {
-        VDPAU_ERR("cannot allocate buffers\n");
-        cleanup(ctx);
-        return NULL;
+    memstat_alloc(MEMSTAT_DECODER, 1, sizeof(v4l2_decoder_t), 0, 0);
+    return ctx;
+}
+
+static void destroy_decoder(v4l2_decoder_t *ctx)
+{
+    if (ctx->needConvert)
+        VDPAU_DBG("reactor wakeups: %u MFC capture, %u FIMC output, %u spurious",
+                  ctx->mfcWakeups, ctx->fimcWakeups, ctx->spuriousWakeups);
+
+    submit_stop(ctx);
+    cleanup(ctx);
+    pthread_mutex_destroy(&ctx->mutex);
+
+    memstat_free(MEMSTAT_DECODER, 1, sizeof(v4l2_decoder_t), 0, 0);
+    free(ctx);
+}
+
+static void pool_init(void)
+{
+    int size = DECODER_POOL_DEFAULT_SIZE, ttl = DECODER_POOL_DEFAULT_TTL;
+
+    // VDPAU_DECODER_POOL=size[,ttl seconds]
+    char *env = getenv("VDPAU_DECODER_POOL");
+    if (env)
+        sscanf(env, "%d,%d", &size, &ttl);
+
+    pool.max = min(max(size, 0), DECODER_POOL_MAX_SIZE);
+    pool.ttl = (uint64_t)max(ttl, 0) * 1000000000ull;
+
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&pool.cond, &attr);
+    pthread_condattr_destroy(&attr);
+}
+
+// removes parked decoders older than the TTL, the caller destroys them outside the lock
+static int pool_expire(uint64_t now, v4l2_decoder_t **expired)
+{
+    int i, j, n = 0;
+
+    for (i = 0, j = 0; i < pool.count; i++) {
+        if (now - pool.parked[i]->parkedAt > pool.ttl)
+            expired[n++] = pool.parked[i];
+        else
+            pool.parked[j++] = pool.parked[i];
     }
-    if(!MmapBuffers(ctx->decoderHandle, ctx->outputBuffersCount, ctx->outputBuffers, V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE, V4L2_MEMORY_MMAP, FALSE)) {
-        VDPAU_ERR("cannot mmap output buffers\n");
-        cleanup(ctx);
-        return NULL;
+    pool.count = j;
+    pool.expired += n;
+
+    return n;
+}
+
+// sleeps until the oldest parked decoder runs out of TTL, parked[] is in parking order
+static void *pool_reaper(void *arg)
+{
+    v4l2_decoder_t *expired[DECODER_POOL_MAX_SIZE];
+    int i, n;
+
+    pthread_mutex_lock(&pool.mutex);
+    while (!pool.stopping) {
+        if (!pool.count) {
+            pthread_cond_wait(&pool.cond, &pool.mutex);
+            continue;
+        }
+
+        uint64_t deadline = pool.parked[0]->parkedAt + pool.ttl + 1;
+        struct timespec ts = { deadline / 1000000000ull, deadline % 1000000000ull };
+        if (pthread_cond_timedwait(&pool.cond, &pool.mutex, &ts) != ETIMEDOUT)
+            continue;
+
+        n = pool_expire(now_ns(), expired);
+        if (!n)
+            continue;
+
+        pthread_mutex_unlock(&pool.mutex);
+        for (i = 0; i < n; i++)
+            destroy_decoder(expired[i]);
+        pthread_mutex_lock(&pool.mutex);
     }
-    VDPAU_DBG("Succesfully mmapped %d buffers", ctx->outputBuffersCount);
+    pthread_mutex_unlock(&pool.mutex);
+
+    return NULL;
+}
+
+static void decoder_pool_drain(void)
+{
+    v4l2_decoder_t *parked[DECODER_POOL_MAX_SIZE];
+    pthread_t reaper;
+    int i, n, join = 0;
+
+    pthread_once(&pool.once, pool_init);
+
+    pthread_mutex_lock(&pool.mutex);
+    n = pool.count;
+    memcpy(parked, pool.parked, n * sizeof(v4l2_decoder_t *));
+    pool.count = 0;
+    if (pool.reaperRunning) {
+        reaper = pool.reaper;
+        pool.reaperRunning = 0;
+        pool.stopping = join = 1;
+        pthread_cond_broadcast(&pool.cond);
+    }
+    pthread_mutex_unlock(&pool.mutex);
+
+    if (join) {
+        pthread_join(reaper, NULL);
+        pthread_mutex_lock(&pool.mutex);
+        pool.stopping = 0;
+        pthread_mutex_unlock(&pool.mutex);
+    }
+
+    for (i = 0; i < n; i++)
+        destroy_decoder(parked[i]);
+}
+
+// parked decoders hold V4L2 devices open and buffers mapped, don't leave them to the kernel
+__attribute__((destructor))
+static
+void
+pool_destructor(void)
+{
+    decoder_pool_drain();
+}
+
+// STREAMON with every buffer back where process_header() left it
+static int resume_streaming(v4l2_decoder_t *ctx)
+{
+    int i;
+
+    for (i = 0; i < ctx->outputBuffersCount; i++)
+        ctx->outputBuffers[i].bQueue = FALSE;
+
+    // a resolution change noticed before parking belonged to the previous stream
+    ctx->sourceChanged = 0;
+
+    if (!ctx->headerProcessed)
+        return 0;
+
+    for (i = 0; i < ctx->captureBuffersCount; i++)
+        if (QueueBuffer(ctx->decoderHandle, V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE, V4L2_MEMORY_MMAP, &ctx->captureBuffers[i]) == V4L2_ERROR)
+            return -1;
+
+    if (!StreamOn(ctx->decoderHandle, V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE, VIDIOC_STREAMON) ||
+        !StreamOn(ctx->decoderHandle, V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE, VIDIOC_STREAMON))
+        return -1;
+
+    if (ctx->needConvert) {
+        for (i = 0; i < ctx->converterBuffersCount; i++)
+            if (QueueBuffer(ctx->converterHandle, V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE, V4L2_MEMORY_MMAP, &ctx->converterBuffers[i]) == V4L2_ERROR)
+                return -1;
+
+        if (!StreamOn(ctx->converterHandle, V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE, VIDIOC_STREAMON) ||
+            !StreamOn(ctx->converterHandle, V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE, VIDIOC_STREAMON))
+            return -1;
+
+        if (startPumps(ctx))
+            return -1;
+    }
+
+    return 0;
+}
+
+// STREAMOFF returns all buffers to us, the MFC flushes its DPB but keeps the instance
+static int suspend_streaming(v4l2_decoder_t *ctx)
+{
+    int ok = 1;
+
+    stopPumps(ctx);
+
+    if (!ctx->headerProcessed)
+        return 0;
+
+    ok &= StreamOn(ctx->decoderHandle, V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE, VIDIOC_STREAMOFF);
+    ok &= StreamOn(ctx->decoderHandle, V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE, VIDIOC_STREAMOFF);
+    if (ctx->needConvert) {
+        ok &= StreamOn(ctx->converterHandle, V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE, VIDIOC_STREAMOFF);
+        ok &= StreamOn(ctx->converterHandle, V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE, VIDIOC_STREAMOFF);
+    }
+
+    return ok ? 0 : -1;
+}
+
+static v4l2_decoder_t *pool_take(__u32 codec, uint32_t width, uint32_t height)
+{
+    v4l2_decoder_t *expired[DECODER_POOL_MAX_SIZE];
+    v4l2_decoder_t *ctx = NULL;
+    int i, n;
+
+    pthread_mutex_lock(&pool.mutex);
+
+    n = pool_expire(now_ns(), expired);
+
+    // newest first, it is the likeliest to still have the right capture setup
+    for (i = pool.count - 1; i >= 0; i--) {
+        v4l2_decoder_t *p = pool.parked[i];
+        if (p->codec == codec && p->width == width && p->height == height) {
+            ctx = p;
+            pool.count--;
+            memmove(&pool.parked[i], &pool.parked[i + 1], (pool.count - i) * sizeof(v4l2_decoder_t *));
+            break;
+        }
+    }
+
+    if (ctx)
+        pool.hits++;
+    else if (pool.max)
+        pool.misses++;
+
+    pthread_mutex_unlock(&pool.mutex);
+
+    for (i = 0; i < n; i++)
+        destroy_decoder(expired[i]);
 
     return ctx;
 }
 
-void decoder_close(void *private)
+// returns 0 if the pool took the decoder
+static int pool_put(v4l2_decoder_t *ctx)
+{
+    v4l2_decoder_t *expired[DECODER_POOL_MAX_SIZE + 1];
+    int i, n;
+
+    if (!pool.max || suspend_streaming(ctx))
+        return -1;
+
+    pthread_mutex_lock(&pool.mutex);
+
+    ctx->parkedAt = now_ns();
+    n = pool_expire(ctx->parkedAt, expired);
+
+    // drop the oldest parked decoder once the pool is full
+    if (pool.count == pool.max) {
+        expired[n++] = pool.parked[0];
+        pool.count--;
+        memmove(&pool.parked[0], &pool.parked[1], pool.count * sizeof(v4l2_decoder_t *));
+        pool.evictions++;
+    }
+    pool.parked[pool.count++] = ctx;
+
+    // the reaper exits only on drain, if it can't be started take() and put() still expire
+    if (!pool.reaperRunning && !pool.stopping &&
+        !pthread_create(&pool.reaper, NULL, pool_reaper, NULL))
+        pool.reaperRunning = 1;
+    pthread_cond_broadcast(&pool.cond);
+
+    VDPAU_DBG("decoder pool: %u hits, %u misses, %u expired, %u evictions, "
+              "open %.1f/%.1f ms, first picture %.1f/%.1f ms (cold/warm average)",
+              pool.hits, pool.misses, pool.expired, pool.evictions,
+              pool.opens[0] ? pool.openTime[0] / 1e6 / pool.opens[0] : 0.0,
+              pool.opens[1] ? pool.openTime[1] / 1e6 / pool.opens[1] : 0.0,
+              pool.firstPictures[0] ? pool.firstPictureTime[0] / 1e6 / pool.firstPictures[0] : 0.0,
+              pool.firstPictures[1] ? pool.firstPictureTime[1] / 1e6 / pool.firstPictures[1] : 0.0);
+
+    pthread_mutex_unlock(&pool.mutex);
+
+    for (i = 0; i < n; i++)
+        destroy_decoder(expired[i]);
+
+    return 0;
+}
+
+static void *decoder_open(VdpDecoderProfile profile, uint32_t width, uint32_t height, uint32_t max_references)
+{
+    __u32 codec = stream_codec(profile, TRUE);
+    uint64_t start = now_ns();
+    v4l2_decoder_t *ctx;
+
+    pthread_once(&pool.once, pool_init);
+
+    ctx = pool_take(codec, width, height);
+    if (ctx && resume_streaming(ctx)) {
+        VDPAU_ERR("Failed to revive pooled decoder, opening a new one");
+        destroy_decoder(ctx);
+        ctx = NULL;
+    }
+
+    // sized for the previous stream, decode_now() re-sizes once buffering is known too
+    if (ctx)
+        ctx->warm = ctx->checkCaptureDepth = 1;
+    else if (!(ctx = open_decoder(codec, width, height)))
+        return NULL;
+
+    ctx->openedAt = start;
+    ctx->firstPictureSeen = 0;
+    ctx->maxReferences = max_references;
+    ctx->buffering = VDP_DECODER_BUFFERING_BALANCED_ODROID;
+    ctx->outputStalls = ctx->pictureMisses = ctx->pictures = 0;
+
+    pthread_mutex_lock(&pool.mutex);
+    pool.openTime[ctx->warm] += now_ns() - start;
+    pool.opens[ctx->warm]++;
+    pthread_mutex_unlock(&pool.mutex);
+
+    return ctx;
+}
+
+static void decoder_close(void *private)
+{
+    v4l2_decoder_t *ctx = (v4l2_decoder_t*)private;
+
+    if (!ctx)
+        return;
+
+    // many misses with few stalls means the capture depth starves the display, see VDPAU_BUFFERING
+    VDPAU_DBG("%u pictures, %u bitstream stalls, %u pictures not ready in time, %d capture buffers",
+              ctx->pictures, ctx->outputStalls, ctx->pictureMisses, ctx->captureBuffersCount);
+    VDPAU_DBG("bitstream: %llu bytes copied, %llu bytes queued in place, %llu bytes copied to the submit queue "
+              "of which %llu queued from it in place",
+              (unsigned long long)ctx->bytesCopied, (unsigned long long)ctx->bytesInPlace,
+              (unsigned long long)ctx->submit.bytes, (unsigned long long)ctx->submit.bytesInPlace);
+
+    // what is still waiting for the MFC belongs to the closed stream
+    submit_discard(ctx);
+
+    if (pool_put(ctx))
+        destroy_decoder(ctx);
+}
+
+static VdpStatus decoder_set_buffering(void *private, uint32_t buffering)
+{
+    v4l2_decoder_t *ctx = (v4l2_decoder_t*)private;
+
+    if (!ctx)
+        return VDP_STATUS_ERROR;
+
+    ctx->buffering = buffering;
+    return VDP_STATUS_OK;
+}
+
+static VdpStatus decoder_flush(void *private)
+{
+    v4l2_decoder_t *ctx = (v4l2_decoder_t*)private;
+    int ret;
+
+    if (!ctx)
+        return VDP_STATUS_OK;
+
+    submit_discard(ctx);
+
+    // before the header nothing but the header itself has been queued
+    if (!ctx->headerProcessed)
+        return VDP_STATUS_OK;
+
+    // the same round trip as parking and reviving, STREAMOFF hands every buffer back
+    pthread_mutex_lock(&ctx->mutex);
+    ret = suspend_streaming(ctx) || resume_streaming(ctx);
+    pthread_mutex_unlock(&ctx->mutex);
+    if (ret) {
+        VDPAU_ERR("Failed to flush decoder");
+        return VDP_STATUS_ERROR;
+    }
+
+    return VDP_STATUS_OK;
+}
+
+static int process_header(v4l2_decoder_t *ctx, uint32_t buffer_count,
+                    VdpBitstreamBuffer const *buffers);
+
+static VdpStatus process_frames(v4l2_decoder_t *ctx, uint32_t buffer_count,
+                    VdpBitstreamBuffer const *buffers, VdpVideoSurface output, uint32_t generation);
+
+static int pollSourceChange(v4l2_decoder_t *ctx);
+
+/*
+ * A revived decoder kept the capture buffers of the previous stream, which may
+ * have had fewer references or another buffering mode. Nothing is decoded yet,
+ * so the capture side is simply set up again like after a resolution change.
+ * Caller holds the mutex.
+ */
+static int resize_capture(v4l2_decoder_t *ctx)
+{
+    ctx->checkCaptureDepth = 0;
+
+    if (capture_depth(ctx->captureRequired, ctx->maxReferences, ctx->buffering, ctx->width, ctx->height) == ctx->captureDepth)
+        return 0;
+
+    teardown_capture(ctx);
+    if (setup_capture(ctx)) {
+        VDPAU_ERR("Failed to re-size capture of revived decoder");
+        return -1;
+    }
+
+    return 0;
+}
+
+/*
+ * Runs on the submit thread while the mixer calls decoder_get_picture(), which
+ * may set CAPTURE up again. Everything touching the capture side is done under
+ * the mutex, but not the wait for a free OUTPUT buffer in process_frames(),
+ * which at a resolution change needs the mixer to drain CAPTURE first.
+ */
+static VdpStatus decode_now(v4l2_decoder_t *ctx, uint32_t buffer_count,
+                    VdpBitstreamBuffer const *buffers, VdpVideoSurface output, uint32_t generation)
+{
+    VdpStatus status = VDP_STATUS_OK;
+
+    pthread_mutex_lock(&ctx->mutex);
+    if (!ctx->headerProcessed) {
+        int ret = process_header(ctx, buffer_count, buffers);
+        if (ret)
+            status = ret < 0 ? VDP_STATUS_ERROR : VDP_STATUS_OK;
+        if (ret || ctx->codec != V4L2_PIX_FMT_H263) {
+            pthread_mutex_unlock(&ctx->mutex);
+            return status;
+        }
+    }
+
+    if (ctx->checkCaptureDepth && resize_capture(ctx))
+        status = VDP_STATUS_ERROR;
+
+    // the switch itself waits for decoder_get_picture() to drain the old size
+    if (status == VDP_STATUS_OK && pollSourceChange(ctx))
+        ctx->sourceChanged = 1;
+    pthread_mutex_unlock(&ctx->mutex);
+
+    if (status != VDP_STATUS_OK)
+        return status;
+
+    return process_frames(ctx, buffer_count, buffers, output, generation);
+}
+
+/*
+ * Submission queue between VdpDecoderRender and the MFC. The caller only
+ * copies the bitstream into the next free entry, a thread per decoder feeds
+ * the entries to decode_now() and is the one that waits for OUTPUT buffers,
+ * for the header and for USERPTR bitstreams to be released. The caller only
+ * blocks once VDPAU_SUBMIT_QUEUE pictures are queued. Errors are returned by
+ * the next VdpDecoderRender.
+ */
+static const uint64_t submitLatencyLimits[SUBMIT_LATENCY_BUCKETS - 1] = {
+    100000, 1000000, 4000000, 16000000, 64000000
+};
+
+static void *submit_thread(void *arg)
+{
+    v4l2_decoder_t *ctx = (v4l2_decoder_t *)arg;
+    submit_queue_t *q = &ctx->submit;
+    VdpBitstreamBuffer buffer;
+    VdpStatus ret;
+    uint64_t latency;
+    int i;
+
+    pthread_mutex_lock(&q->mutex);
+    while (1) {
+        while (!q->stop && !q->count)
+            pthread_cond_wait(&q->cond, &q->mutex);
+        if (q->stop)
+            break;
+
+        // the head stays queued while in flight, so neither the caller nor a discard reuse it
+        submit_entry_t *e = &q->entries[q->head];
+        q->busy = 1;
+        pthread_mutex_unlock(&q->mutex);
+
+        buffer.struct_version = VDP_BITSTREAM_BUFFER_VERSION;
+        buffer.bitstream = e->data;
+        buffer.bitstream_bytes = e->size;
+        ret = decode_now(ctx, 1, &buffer, e->surface, e->generation);
+        latency = now_ns() - e->queuedAt;
+
+        pthread_mutex_lock(&q->mutex);
+        for (i = 0; i < SUBMIT_LATENCY_BUCKETS - 1 && latency >= submitLatencyLimits[i]; i++)
+            ;
+        q->latency[i]++;
+        if (ret != VDP_STATUS_OK && q->error == VDP_STATUS_OK)
+            q->error = ret;
+
+        q->busy = 0;
+        q->head = (q->head + 1) % q->depth;
+        q->count--;
+        pthread_cond_broadcast(&q->cond);
+    }
+    pthread_mutex_unlock(&q->mutex);
+
+    return NULL;
+}
+
+static VdpStatus submit_enqueue(v4l2_decoder_t *ctx, uint32_t buffer_count,
+                    VdpBitstreamBuffer const *buffers, VdpVideoSurface output, uint32_t generation)
+{
+    submit_queue_t *q = &ctx->submit;
+    VdpStatus ret;
+    uint32_t size = 0, offset = 0, i;
+
+    for (i = 0; i < buffer_count; i++)
+        size += buffers[i].bitstream_bytes;
+
+    pthread_mutex_lock(&q->mutex);
+
+    q->depthSeen[q->count]++;
+    if (q->count == q->depth) {
+        uint64_t start = now_ns();
+        q->blocked++;
+        while (q->count == q->depth)
+            pthread_cond_wait(&q->cond, &q->mutex);
+        q->blockedTime += now_ns() - start;
+    }
+
+    // an earlier picture failed, this one is queued all the same
+    ret = q->error;
+    q->error = VDP_STATUS_OK;
+
+    /*
+     * The application owns its bitstream again once we return, so it is always
+     * copied, VDPAU_BITSTREAM=userptr never queues application memory here.
+     */
+    submit_entry_t *e = &q->entries[(q->head + q->count) % q->depth];
+    if (size > e->capacity) {
+        // aligned, so that USERPTR decoders queue the entry without another copy
+        uint32_t grown = v4l2_align(size, STREAM_GATHER_GRANULE);
+        void *data;
+        if (posix_memalign(&data, STREAM_USERPTR_ALIGN, grown)) {
+            pthread_mutex_unlock(&q->mutex);
+            return VDP_STATUS_RESOURCES;
+        }
+        memstat_free(MEMSTAT_V4L2_OUTPUT, 0, e->capacity, 0, 0);
+        memstat_alloc(MEMSTAT_V4L2_OUTPUT, 0, grown, 0, 0);
+        free(e->data);
+        e->data = data;
+        e->capacity = grown;
+    }
+
+    for (i = 0; i < buffer_count; i++) {
+        memcpy(e->data + offset, buffers[i].bitstream, buffers[i].bitstream_bytes);
+        offset += buffers[i].bitstream_bytes;
+    }
+    e->size = size;
+    e->surface = output;
+    e->generation = generation;
+    e->queuedAt = now_ns();
+    q->bytes += size;
+
+    q->count++;
+    pthread_cond_broadcast(&q->cond);
+    pthread_mutex_unlock(&q->mutex);
+
+    return ret;
+}
+
+static int submit_start(v4l2_decoder_t *ctx)
+{
+    submit_queue_t *q = &ctx->submit;
+    char *env = getenv("VDPAU_SUBMIT_QUEUE");
+
+    q->depth = env ? min(max(atoi(env), 0), SUBMIT_QUEUE_MAX) : SUBMIT_QUEUE_DEFAULT;
+    if (!q->depth)
+        return 0;
+
+    pthread_mutex_init(&q->mutex, NULL);
+    pthread_cond_init(&q->cond, NULL);
+    if (pthread_create(&q->thread, NULL, submit_thread, ctx)) {
+        VDPAU_ERR("Failed to start the submit thread, submitting synchronously");
+        pthread_cond_destroy(&q->cond);
+        pthread_mutex_destroy(&q->mutex);
+        q->depth = 0;
+    }
+
+    return 0;
+}
+
+// drops the queued pictures and waits for the one in flight
+static void submit_discard(v4l2_decoder_t *ctx)
+{
+    submit_queue_t *q = &ctx->submit;
+
+    if (!q->depth)
+        return;
+
+    pthread_mutex_lock(&q->mutex);
+    q->count = q->busy;
+    while (q->busy)
+        pthread_cond_wait(&q->cond, &q->mutex);
+    q->error = VDP_STATUS_OK;
+    pthread_mutex_unlock(&q->mutex);
+}
+
+static void submit_stop(v4l2_decoder_t *ctx)
+{
+    submit_queue_t *q = &ctx->submit;
+    char depths[SUBMIT_QUEUE_MAX * 12 + 1], latency[SUBMIT_LATENCY_BUCKETS * 12 + 1];
+    int i, n;
+
+    if (!q->depth)
+        return;
+
+    pthread_mutex_lock(&q->mutex);
+    q->stop = 1;
+    pthread_cond_broadcast(&q->cond);
+    pthread_mutex_unlock(&q->mutex);
+    pthread_join(q->thread, NULL);
+
+    for (i = 0, n = 0; i <= q->depth; i++)
+        n += snprintf(depths + n, sizeof(depths) - n, " %u", q->depthSeen[i]);
+    for (i = 0, n = 0; i < SUBMIT_LATENCY_BUCKETS; i++)
+        n += snprintf(latency + n, sizeof(latency) - n, " %u", q->latency[i]);
+    VDPAU_DBG("submit queue: depth at render 0..%d:%s, submit latency <0.1/1/4/16/64/more ms:%s, "
+              "%u renders blocked for %.1f ms", q->depth, depths, latency,
+              q->blocked, q->blockedTime / 1e6);
+
+    for (i = 0; i < q->depth; i++) {
+        memstat_free(MEMSTAT_V4L2_OUTPUT, 0, q->entries[i].capacity, 0, 0);
+        free(q->entries[i].data);
+    }
+    pthread_cond_destroy(&q->cond);
+    pthread_mutex_destroy(&q->mutex);
+    q->depth = 0;
+}
+
+static VdpStatus decoder_decode(void *private, uint32_t buffer_count,
+                    VdpBitstreamBuffer const *buffers, VdpVideoSurface output, uint32_t generation)
+{
+    v4l2_decoder_t *ctx = (v4l2_decoder_t*)private;
+
+    if (!ctx->submit.depth)
+        return decode_now(ctx, buffer_count, buffers, output, generation);
+
+    return submit_enqueue(ctx, buffer_count, buffers, output, generation);
+}
+
+
+
+
+static int openDevices(v4l2_decoder_t *ctx)
+{
+    v4l2_device_t dec, conv;
+
+    if (!ctx->codec) {
+        VDPAU_ERR("Profile not supported by the MFC backend");
+        return -1;
+    }
+
+    ctx->decoderHandle = open_decoder_device(ctx->codec, TRUE, &dec, NULL);
+    if (ctx->decoderHandle == -ENODEV)
+        VDPAU_ERR("No MFC decoder for %.4s", (char *)&ctx->codec);
+    if (ctx->decoderHandle < 0)
+        return -1;
+    VDPAU_DBG("Using %s %s", dec.name, dec.path);
+
+    ctx->needConvert = !dec.direct;
+    if (!ctx->needConvert) {
+        VDPAU_DBG("Direct decoding to untiled picture is supported, no conversion needed");
+        return 0;
+    }
+    VDPAU_DBG("Direct decoding to untiled picture is NOT supported, FIMC conversion needed");
+
+    ctx->converterHandle = open_device(find_converter, 0, FALSE, &conv, NULL);
+    if (ctx->converterHandle == -ENODEV)
+        VDPAU_ERR("No FIMC m2m device to untile the decoder output");
+    if (ctx->converterHandle < 0)
+        return -1;
+    VDPAU_DBG("Using %s %s", conv.name, conv.path);
+
+    return 0;
+}
+
+static void cleanup(v4l2_decoder_t *ctx)
+{
+    stopPumps(ctx);
+
+    if (ctx->decoderHandle >= 0) {
+        if (ctx->outputBuffers)
+            free_output(ctx);
+        if (ctx->captureBuffers) {
+            memstat_free(MEMSTAT_V4L2_CAPTURE, ctx->captureBuffersCount, 0, 0, buffers_size(ctx->captureBuffersCount, ctx->captureBuffers));
+            ctx->captureBuffers = FreeBuffers(ctx->captureBuffersCount, ctx->captureBuffers);
+        }
+        if (StreamOn(ctx->decoderHandle, V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE, VIDIOC_STREAMOFF))
+            VDPAU_ERR("Stream OFF");
+        if (StreamOn(ctx->decoderHandle, V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE, VIDIOC_STREAMOFF))
+            VDPAU_ERR("Stream OFF");
+        close(ctx->decoderHandle);
+    }
+    if (ctx->converterHandle >= 0) {
+        if (ctx->converterBuffers) {
+            memstat_free(MEMSTAT_V4L2_CONVERTER, ctx->converterBuffersCount, 0, 0, buffers_size(ctx->converterBuffersCount, ctx->converterBuffers));
+            ctx->converterBuffers = FreeBuffers(ctx->converterBuffersCount, ctx->converterBuffers);
+        }
+        if (StreamOn(ctx->converterHandle, V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE, VIDIOC_STREAMOFF))
+            VDPAU_ERR("Stream OFF");
+        if (StreamOn(ctx->converterHandle, V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE, VIDIOC_STREAMOFF))
+            VDPAU_ERR("Stream OFF");
+        close(ctx->converterHandle);
+    }
+}
+
+/*
+ * The decoder needs the required buffers for the DPB of the stream, which its level bounds.
+ * Whatever comes on top is the decode-ahead the FIMC and the application
+ * consume from. Balanced is the 1.5x this driver always used, above 1080p it
+ * is capped at 2 extra pictures since each costs 12 MB of CMA at 4K.
+ */
+int capture_depth(int required, uint32_t maxReferences, uint32_t buffering, uint32_t width, uint32_t height)
+{
+    int extra;
+
+    // older drivers may not know yet, the application told us what the stream needs
+    if (required <= 0)
+        required = maxReferences + 1;
+
+    switch (buffering) {
+    case VDP_DECODER_BUFFERING_LOW_LATENCY_ODROID:
+        extra = 1;
+        break;
+    case VDP_DECODER_BUFFERING_SMOOTH_ODROID:
+        extra = required;
+        break;
+    default:
+        extra = required / 2;
+        if (width * height > 1920 * 1088)
+            extra = min(extra, 2);
+        break;
+    }
+
+    VDPAU_DBG("capture depth %d + %d (buffering %u, max_references %u)", required, max(extra, 1), buffering, maxReferences);
+    return required + max(extra, 1);
+}
+
+/*
+ * Opens the node find() picks, and with media its media controller node too.
+ * The table may be stale if a node went away without inotify noticing, so a
+ * failed open rescans once. Returns the handle, -ENODEV if there is no such
+ * device, -1 if it can't be opened.
+ */
+static int open_device(int (*find)(__u32 codec, int mfc, v4l2_device_t *device), __u32 codec, int mfc,
+                    v4l2_device_t *device, int *media)
 {
-    v4l2_decoder_t *ctx = (v4l2_decoder_t*)private;
-    cleanup(ctx);
+    int retry, handle;
 
-    free(ctx);
+    for (retry = 0; retry < 2; retry++) {
+        if (retry)
+            v4l2_devices_invalidate();
+
+        if (find(codec, mfc, device) || (media && !device->media[0]))
+            return -ENODEV;
+
+        handle = open(device->path, O_RDWR | O_NONBLOCK, 0);
+        if (handle < 0)
+            continue;
+        if (!media)
+            return handle;
+
+        *media = open(device->media, O_RDWR | O_NONBLOCK, 0);
+        if (*media >= 0)
+            return handle;
+        close(handle);
+    }
+
+    VDPAU_ERR("Cannot open %s, errno = %d", device->path, errno);
+    return -1;
 }
 
-static int process_header(v4l2_decoder_t *ctx, uint32_t buffer_count,
-                    VdpBitstreamBuffer const *buffers);
+int open_decoder_device(__u32 codec, int mfc, v4l2_device_t *device, int *media)
+{
+    return open_device(v4l2_find_decoder, codec, mfc, device, media);
+}
 
-static VdpStatus process_frames(v4l2_decoder_t *ctx, uint32_t buffer_count,
-                    VdpBitstreamBuffer const *buffers, VdpVideoSurface output);
+static int find_converter(__u32 codec, int mfc, v4l2_device_t *device)
+{
+    return v4l2_find_converter(device);
+}
 
-VdpStatus decoder_decode(void *private, uint32_t buffer_count,
-                    VdpBitstreamBuffer const *buffers, VdpVideoSurface output)
+VdpStatus query_decoder(__u32 codec, int mfc, int media, VdpBool *is_supported,
+                    uint32_t *max_width, uint32_t *max_height)
 {
-    v4l2_decoder_t *ctx = (v4l2_decoder_t*)private;
+    const v4l2_format_caps_t *caps;
+    v4l2_device_t dec;
 
-    if (!ctx->headerProcessed) {
-        int ret = process_header(ctx, buffer_count, buffers);
-        if(ret)
-            return ret < 0 ? VDP_STATUS_ERROR : VDP_STATUS_OK;
-        if (ctx->codec != V4L2_PIX_FMT_H263)
-            return VDP_STATUS_OK;
+    *is_supported = codec && !v4l2_find_decoder(codec, mfc, &dec) && (!media || dec.media[0]);
+    if (!*is_supported)
+        return VDP_STATUS_OK;
+
+    caps = v4l2_device_format(&dec, codec);
+    if (caps && caps->max_width && caps->max_height) {
+        *max_width = caps->max_width;
+        *max_height = caps->max_height;
     }
 
-    return process_frames(ctx, buffer_count, buffers, output);
+    return VDP_STATUS_OK;
 }
 
+// the 4:2:0 layouts the mixer samples, in order of preference
+static const struct
+{
+    __u32 fourcc;
+    int planes;
+    int contiguous;
+} captureFormats[] = {
+    { V4L2_PIX_FMT_YUV420M, 3, FALSE },
+    { V4L2_PIX_FMT_YUV420,  3, TRUE },
+    { V4L2_PIX_FMT_NV12M,   2, FALSE },
+    { V4L2_PIX_FMT_NV12,    2, TRUE },
+};
+
+int capture_negotiate(int handle, capture_layout_t *layout, struct v4l2_format *fmt)
+{
+    struct v4l2_format current;
+    uint32_t pitch;
+    unsigned int i;
+    int j;
+
+    memzero(current);
+    current.type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
+    if (ioctl(handle, VIDIOC_G_FMT, &current)) {
+        VDPAU_ERR("Failed to get CAPTURE format, errno = %d", errno);
+        return -1;
+    }
 
+    for (i = 0; i < ARRAY_SIZE(captureFormats); i++) {
+        *fmt = current;
+        fmt->fmt.pix_mp.pixelformat = captureFormats[i].fourcc;
+        if (!ioctl(handle, VIDIOC_S_FMT, fmt) && fmt->fmt.pix_mp.pixelformat == captureFormats[i].fourcc)
+            break;
+    }
+    if (i == ARRAY_SIZE(captureFormats)) {
+        VDPAU_ERR("Decoder offers no YUV420 or NV12 CAPTURE format, only %.4s", (char *)&current.fmt.pix_mp.pixelformat);
+        return -1;
+    }
 
+    layout->pixelformat = captureFormats[i].fourcc;
+    layout->planes = captureFormats[i].planes;
+    layout->contiguous = captureFormats[i].contiguous;
 
-static int openDevices(v4l2_decoder_t *ctx)
-{
-    DIR *dir;
-    struct dirent *ent;
-
-    if ((dir = opendir ("/sys/class/video4linux/")) != NULL) {
-        while ((ent = readdir (dir)) != NULL) {
-            if (strncmp(ent->d_name, "video", 5) == 0) {
-                char *p;
-                char name[64];
-                char devname[64];
-                char sysname[64];
-                char drivername[32];
-                char target[1024];
-                int ret;
-
-                snprintf(sysname, 64, "/sys/class/video4linux/%s", ent->d_name);
-                snprintf(name, 64, "/sys/class/video4linux/%s/name", ent->d_name);
-
-                FILE* fp = fopen(name, "r");
-                if (fgets(drivername, 32, fp) != NULL) {
-                    p = strchr(drivername, '\n');
-                    if (p != NULL)
-                        *p = '\0';
-                } else {
-                    fclose(fp);
-                    continue;
-                }
-                fclose(fp);
-
-                ret = readlink(sysname, target, sizeof(target));
-                if (ret < 0)
-                    continue;
-                target[ret] = '\0';
-                p = strrchr(target, '/');
-                if (p == NULL)
-                    continue;
-
-                sprintf(devname, "/dev/%s", ++p);
-
-                if (ctx->decoderHandle < 0 && strstr(drivername, "s5p-mfc-dec") != NULL) {
-                    struct v4l2_capability cap;
-                    int fd = open(devname, O_RDWR | O_NONBLOCK, 0);
-                    if (fd > 0) {
-                        memzero(cap);
-                        if (!ioctl(fd, VIDIOC_QUERYCAP, &cap))
-                            if ((cap.capabilities & V4L2_CAP_STREAMING) &&
-                                    ((cap.capabilities & V4L2_CAP_VIDEO_M2M_MPLANE) ||
-                                    (cap.capabilities & (V4L2_CAP_VIDEO_CAPTURE_MPLANE | V4L2_CAP_VIDEO_OUTPUT_MPLANE)))) {
-                                ctx->decoderHandle = fd;
-                                VDPAU_DBG("Found %s %s", drivername, devname);
-
-                                // Only need FIMC if we cannot set this capture pixel format to NV12M
-                                struct v4l2_format fmt;
-                                memzero(fmt);
-                                fmt.type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
-                                fmt.fmt.pix_mp.pixelformat = V4L2_PIX_FMT_NV12M;
-                                if(ioctl(ctx->decoderHandle, VIDIOC_TRY_FMT, &fmt)) {
-                                    ctx->needConvert = 1;
-                                    VDPAU_DBG("Direct decoding to untiled picture is NOT supported, FIMC conversion needed");
-                                } else {
-                                    ctx->needConvert = 0;
-                                    VDPAU_DBG("Direct decoding to untiled picture is supported, no conversion needed");
-                                    if (ctx->converterHandle >= 0)
-                                        close(ctx->converterHandle);
-                                }
-
-                            }
-                  }
-                  if (ctx->decoderHandle < 0)
-                      close(fd);
-                }
-                if (ctx->needConvert && ctx->converterHandle < 0 && strstr(drivername, "fimc") != NULL && strstr(drivername, "m2m") != NULL) {
-                    struct v4l2_capability cap;
-                    int fd = open(devname, O_RDWR | O_NONBLOCK, 0);
-                    if (fd > 0) {
-                        memzero(cap);
-                        if (!ioctl(fd, VIDIOC_QUERYCAP, &cap))
-                            if ((cap.capabilities & V4L2_CAP_STREAMING) &&
-                                    ((cap.capabilities & V4L2_CAP_VIDEO_M2M_MPLANE) ||
-                                    (cap.capabilities & (V4L2_CAP_VIDEO_CAPTURE_MPLANE | V4L2_CAP_VIDEO_OUTPUT_MPLANE)))) {
-                                ctx->converterHandle = fd;
-                                VDPAU_DBG("Found %s %s", drivername, devname);
-                            }
-                    }
-                    if (ctx->converterHandle < 0)
-                        close(fd);
-                }
-            }
+    // single buffer formats keep the chroma planes right after luma, at half the pitch for YUV420
+    memset(layout->offset, 0, sizeof(layout->offset));
+    for (j = 0; j < layout->planes; j++) {
+        if (!layout->contiguous) {
+            layout->pitch[j] = fmt->fmt.pix_mp.plane_fmt[j].bytesperline;
+        } else {
+            pitch = fmt->fmt.pix_mp.plane_fmt[0].bytesperline;
+            layout->pitch[j] = (j && layout->planes == 3) ? pitch / 2 : pitch;
+            if (j)
+                layout->offset[j] = layout->offset[j - 1] + layout->pitch[j - 1] * (j == 1 ? fmt->fmt.pix_mp.height : fmt->fmt.pix_mp.height / 2);
         }
-        closedir (dir);
     }
+
+    layout->width = fmt->fmt.pix_mp.width;
+    layout->height = fmt->fmt.pix_mp.height;
     return 0;
 }
 
-static void cleanup(v4l2_decoder_t *ctx)
+void capture_map(const capture_layout_t *layout, int count, v4l2_buffer_t *buffers,
+                    void *(*pictureData)[DECODER_MAX_PLANES])
 {
-    if (ctx->decoderHandle >= 0) {
-        if (ctx->outputBuffers)
-            ctx->outputBuffers = FreeBuffers(ctx->outputBuffersCount, ctx->outputBuffers);
-        if (ctx->captureBuffers)
-            ctx->captureBuffers = FreeBuffers(ctx->captureBuffersCount, ctx->captureBuffers);
-        if (StreamOn(ctx->decoderHandle, V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE, VIDIOC_STREAMOFF))
-            VDPAU_ERR("Stream OFF");
-        if (StreamOn(ctx->decoderHandle, V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE, VIDIOC_STREAMOFF))
-            VDPAU_ERR("Stream OFF");
-        close(ctx->decoderHandle);
+    int i, j;
+
+    // NV12 leaves the third pointer NULL, which is how the mixer tells the layouts apart
+    for (i = 0; i < count; i++)
+        for (j = 0; j < layout->planes; j++)
+            pictureData[i][j] = layout->contiguous ? (uint8_t *)buffers[i].cPlane[0] + layout->offset[j]
+                                                   : buffers[i].cPlane[j];
+}
+
+VdpStatus capture_dmabuf(int handle, capture_layout_t *layout, int count, v4l2_buffer_t *buffers,
+                    int frame, decoder_dmabuf_t *dmabuf)
+{
+    int i;
+
+    if (layout->exportFailed || frame < 0 || frame >= count)
+        return VDP_STATUS_NO_IMPLEMENTATION;
+
+    // exported on first use, the fds are closed with the buffers
+    if (!ExportBuffer(handle, V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE, &buffers[frame])) {
+        VDPAU_DBG("VIDIOC_EXPBUF not supported, pictures are mapped and uploaded");
+        layout->exportFailed = 1;
+        return VDP_STATUS_NO_IMPLEMENTATION;
     }
-    if (ctx->converterHandle >= 0) {
-        if (ctx->converterBuffers)
-            ctx->converterBuffers = FreeBuffers(ctx->converterBuffersCount, ctx->converterBuffers);
-        if (StreamOn(ctx->converterHandle, V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE, VIDIOC_STREAMOFF))
-            VDPAU_ERR("Stream OFF");
-        if (StreamOn(ctx->converterHandle, V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE, VIDIOC_STREAMOFF))
-            VDPAU_ERR("Stream OFF");
-        close(ctx->converterHandle);
+
+    dmabuf->planes = layout->planes;
+    for (i = 0; i < layout->planes; i++) {
+        dmabuf->fd[i] = buffers[frame].iFd[layout->contiguous ? 0 : i];
+        dmabuf->offset[i] = layout->offset[i];
+        dmabuf->pitch[i] = layout->pitch[i];
     }
+    dmabuf->width = layout->width;
+    dmabuf->height = layout->height;
+    dmabuf->generation = layout->generation;
+
+    return VDP_STATUS_OK;
 }
 
-static int process_header(v4l2_decoder_t *ctx, uint32_t buffer_count,
-                    VdpBitstreamBuffer const *buffers)
+static int converter_depth(v4l2_decoder_t *ctx)
+{
+    switch (ctx->buffering) {
+    case VDP_DECODER_BUFFERING_LOW_LATENCY_ODROID:
+        return CONVERTER_VIDEO_BUFFERS_CNT - 1;
+    case VDP_DECODER_BUFFERING_SMOOTH_ODROID:
+        return CONVERTER_VIDEO_BUFFERS_CNT + 1;
+    default:
+        return CONVERTER_VIDEO_BUFFERS_CNT;
+    }
+}
+
+// the MFC and FIMC CAPTURE queues keep every plane in a buffer of its own,
+// the size is the caller's to set from the crop
+static void queue_layout(capture_layout_t *layout, const struct v4l2_format *fmt, uint32_t generation)
+{
+    int i;
+
+    layout->pixelformat = fmt->fmt.pix_mp.pixelformat;
+    layout->planes = min(fmt->fmt.pix_mp.num_planes, DECODER_MAX_PLANES);
+    layout->contiguous = FALSE;
+    for (i = 0; i < DECODER_MAX_PLANES; i++) {
+        layout->pitch[i] = i < layout->planes ? fmt->fmt.pix_mp.plane_fmt[i].bytesperline : 0;
+        layout->offset[i] = 0;
+    }
+    layout->generation = generation;
+}
+
+// negotiates and allocates everything downstream of the MFC OUTPUT queue, the
+// size comes from the stream, so this runs after the header and on every
+// resolution change
+static int setup_capture(v4l2_decoder_t *ctx)
 {
-    int size = 0, ret, i;
+    int ret;
     struct v4l2_format fmt;
     struct v4l2_control ctrl;
     struct v4l2_crop crop;
+    uint32_t generation;
 
     int capturePlane1Size;
     int capturePlane2Size;
     int capturePlane3Size;
 
-    // Prepare header frame
-    for(i=0 ; i<buffer_count ; i++) {
-        memcpy(ctx->outputBuffers[0].cPlane[0] + size, buffers[i].bitstream, buffers[i].bitstream_bytes);
-        size += buffers[i].bitstream_bytes;
-    }
-    ctx->outputBuffers[0].iBytesUsed[0] = size;
-
-    // Queue header to mfc output
-    ret = QueueBuffer(ctx->decoderHandle, V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE, V4L2_MEMORY_MMAP, &ctx->outputBuffers[0]);
-    if (ret == V4L2_ERROR) {
-        VDPAU_ERR("queue input buffer");
-        return -1;
-    }
-
-    // STREAMON on mfc OUTPUT
-    if (!StreamOn(ctx->decoderHandle, V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE, VIDIOC_STREAMON)) {
-        VDPAU_ERR("Failed to Stream ON");
-        return -1;
-    }
-    VDPAU_DBG("Stream ON");
-
     // Get mfc capture picture format
     memzero(fmt);
     fmt.type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
@@ -336,6 +1229,9 @@ static int process_header(v4l2_decoder_t *ctx, uint32_t buffer_count,
                         (fmt.fmt.pix_mp.pixelformat >> 16) & 0xFF, (fmt.fmt.pix_mp.pixelformat >> 24) & 0xFF,
                         capturePlane1Size, capturePlane2Size, capturePlane3Size);
 
+    generation = NextBufferGeneration();
+    queue_layout(&ctx->captureLayout, &fmt, generation);
+
     // Setup FIMC OUTPUT fmt with data from MFC CAPTURE if required
     if(ctx->needConvert) {
         fmt.type = V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE;
@@ -352,7 +1248,9 @@ static int process_header(v4l2_decoder_t *ctx, uint32_t buffer_count,
         VDPAU_ERR("Failed to get the number of buffers required");
         return -1;
     }
-    ctx->captureBuffersCount = (int)(ctrl.value * 1.5);
+    ctx->captureRequired = ctrl.value;
+    ctx->captureDepth = capture_depth(ctrl.value, ctx->maxReferences, ctx->buffering, ctx->width, ctx->height);
+    ctx->captureBuffersCount = ctx->captureDepth;
 
     // Get mfc capture crop
     memzero(crop);
@@ -362,8 +1260,8 @@ static int process_header(v4l2_decoder_t *ctx, uint32_t buffer_count,
         return -1;
     }
     VDPAU_DBG("G_CROP %dx%d", crop.c.width, crop.c.height);
-    ctx->captureWidth = crop.c.width;
-    ctx->captureHeight = crop.c.height;
+    ctx->captureWidth = ctx->captureLayout.width = crop.c.width;
+    ctx->captureHeight = ctx->captureLayout.height = crop.c.height;
 
     if(ctx->needConvert) {
         //setup FIMC OUTPUT crop with data from MFC CAPTURE
@@ -389,7 +1287,9 @@ static int process_header(v4l2_decoder_t *ctx, uint32_t buffer_count,
         VDPAU_ERR("cannot allocate buffers");
         return -1;
     }
-    if(!MmapBuffers(ctx->decoderHandle, ctx->captureBuffersCount, ctx->captureBuffers, V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE, V4L2_MEMORY_MMAP, TRUE)) {
+    ret = MmapBuffers(ctx->decoderHandle, ctx->captureBuffersCount, ctx->captureBuffers, V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE, V4L2_MEMORY_MMAP, TRUE);
+    memstat_alloc(MEMSTAT_V4L2_CAPTURE, ctx->captureBuffersCount, 0, 0, buffers_size(ctx->captureBuffersCount, ctx->captureBuffers));
+    if(!ret) {
         VDPAU_DBG("cannot mmap capture buffers");
         return -1;
     }
@@ -445,9 +1345,12 @@ static int process_header(v4l2_decoder_t *ctx, uint32_t buffer_count,
         capturePlane1Size = fmt.fmt.pix_mp.plane_fmt[0].sizeimage;
         capturePlane2Size = fmt.fmt.pix_mp.plane_fmt[1].sizeimage;
         capturePlane3Size = fmt.fmt.pix_mp.plane_fmt[2].sizeimage;
+        queue_layout(&ctx->converterLayout, &fmt, generation);
+        ctx->converterLayout.width = ctx->width;
+        ctx->converterLayout.height = ctx->height;
 
         // Request fimc capture buffers
-        ctx->converterBuffersCount = RequestBuffer(ctx->converterHandle, V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE, V4L2_MEMORY_MMAP, CONVERTER_VIDEO_BUFFERS_CNT);
+        ctx->converterBuffersCount = RequestBuffer(ctx->converterHandle, V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE, V4L2_MEMORY_MMAP, converter_depth(ctx));
         if (ctx->converterBuffersCount == V4L2_ERROR) {
             VDPAU_ERR("REQBUFS failed");
             return -1;
@@ -461,7 +1364,9 @@ static int process_header(v4l2_decoder_t *ctx, uint32_t buffer_count,
             VDPAU_ERR("cannot allocate buffers");
             return -1;
         }
-        if(!MmapBuffers(ctx->converterHandle, ctx->converterBuffersCount, ctx->converterBuffers, V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE, V4L2_MEMORY_MMAP, TRUE)) {
+        ret = MmapBuffers(ctx->converterHandle, ctx->converterBuffersCount, ctx->converterBuffers, V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE, V4L2_MEMORY_MMAP, TRUE);
+        memstat_alloc(MEMSTAT_V4L2_CONVERTER, ctx->converterBuffersCount, 0, 0, buffers_size(ctx->converterBuffersCount, ctx->converterBuffers));
+        if(!ret) {
             VDPAU_ERR("cannot mmap capture buffers\n");
             return -1;
         }
@@ -476,13 +1381,129 @@ static int process_header(v4l2_decoder_t *ctx, uint32_t buffer_count,
         else
             VDPAU_ERR("Failed to Stream ON");
 
-        // create FIMC pumping threads
-        pthread_create(&ctx->fimc_thread, NULL, &pumpFIMC, ctx);
-        pthread_create(&ctx->mfc_thread, NULL, &pumpMFC, ctx);
+        // hand the MFC pictures through the FIMC
+        if (startPumps(ctx)) {
+            VDPAU_ERR("Failed to start MFC/FIMC buffer pumps");
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+/*
+ * Puts a bitstream into the OUTPUT buffer at index. Mmapped buffers always
+ * take a copy. With USERPTR buffers a single suitably aligned VdpBitstreamBuffer
+ * is queued from the application memory itself, the caller must then wait
+ * for it with wait_output() since the application owns it again once
+ * VdpDecoderRender returns. With the submit queue that memory is already the
+ * queue's copy, see submit_enqueue(). Anything else is gathered into memory of
+ * the slot that grows to the largest picture seen. Returns 1 if queued in
+ * place, 0 if copied, -1 if the bitstream doesn't fit.
+ */
+static int fill_output(v4l2_decoder_t *ctx, int index, uint32_t buffer_count,
+                    VdpBitstreamBuffer const *buffers)
+{
+    v4l2_buffer_t *buffer = &ctx->outputBuffers[index];
+    uint32_t size = 0, offset = 0, i;
+
+    for (i = 0; i < buffer_count; i++)
+        size += buffers[i].bitstream_bytes;
+
+    if (ctx->outputMemory == V4L2_MEMORY_USERPTR) {
+        gather_buffer_t *gather = &ctx->gatherBuffers[index];
+
+        if (buffer_count == 1 && size && !((uintptr_t)buffers[0].bitstream % STREAM_USERPTR_ALIGN)) {
+            buffer->cPlane[0] = (void *)buffers[0].bitstream;
+            buffer->iSize[0] = buffer->iBytesUsed[0] = size;
+            if (ctx->submit.depth)
+                ctx->submit.bytesInPlace += size;
+            else
+                ctx->bytesInPlace += size;
+            return 1;
+        }
+
+        if (size > gather->size) {
+            uint32_t grown = v4l2_align(size, STREAM_GATHER_GRANULE);
+            void *data;
+            if (posix_memalign(&data, 4096, grown)) {
+                VDPAU_ERR("Cannot grow bitstream buffer to %u bytes", grown);
+                return -1;
+            }
+            memstat_free(MEMSTAT_V4L2_OUTPUT, 0, gather->size, 0, 0);
+            memstat_alloc(MEMSTAT_V4L2_OUTPUT, 0, grown, 0, 0);
+            free(gather->data);
+            gather->data = data;
+            gather->size = grown;
+        }
+        buffer->cPlane[0] = gather->data;
+        buffer->iSize[0] = gather->size;
+    } else if (size > buffer->iSize[0]) {
+        VDPAU_ERR("Bitstream of %u bytes doesn't fit the %d byte MFC buffer", size, buffer->iSize[0]);
+        return -1;
+    }
+
+    for (i = 0; i < buffer_count; i++) {
+        memcpy(buffer->cPlane[0] + offset, buffers[i].bitstream, buffers[i].bitstream_bytes);
+        offset += buffers[i].bitstream_bytes;
+    }
+    buffer->iBytesUsed[0] = size;
+    ctx->bytesCopied += size;
+
+    return 0;
+}
+
+// blocks until the MFC handed the OUTPUT buffer at index back
+static int wait_output(v4l2_decoder_t *ctx, int index)
+{
+    int ret;
+
+    while (ctx->outputBuffers[index].bQueue) {
+        if (PollOutput(ctx->decoderHandle, 1000) != V4L2_READY) {
+            VDPAU_ERR("MFC didn't release bitstream buffer %d", index);
+            return -1;
+        }
+        ret = DequeueBuffer(ctx->decoderHandle, V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE, ctx->outputMemory);
+        if (ret < 0) {
+            VDPAU_ERR("error dequeue output buffer, got number %d, errno %d", ret, errno);
+            return -1;
+        }
+        ctx->outputBuffers[ret].bQueue = FALSE;
+    }
+    ctx->outputBuffers[index].cPlane[0] = NULL;
+
+    return 0;
+}
+
+static int process_header(v4l2_decoder_t *ctx, uint32_t buffer_count,
+                    VdpBitstreamBuffer const *buffers)
+{
+    int ret;
+
+    // Prepare header frame
+    if (fill_output(ctx, 0, buffer_count, buffers) < 0)
+        return -1;
+    memzero(ctx->outputBuffers[0].timestamp);
+
+    // Queue header to mfc output
+    ret = QueueBuffer(ctx->decoderHandle, V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE, ctx->outputMemory, &ctx->outputBuffers[0]);
+    if (ret == V4L2_ERROR) {
+        VDPAU_ERR("queue input buffer");
+        return -1;
+    }
+
+    // STREAMON on mfc OUTPUT
+    if (!StreamOn(ctx->decoderHandle, V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE, VIDIOC_STREAMON)) {
+        VDPAU_ERR("Failed to Stream ON");
+        return -1;
     }
+    VDPAU_DBG("Stream ON");
+
+    if (setup_capture(ctx))
+        return -1;
 
     // Dequeue header on input queue
-    ret = DequeueBuffer(ctx->decoderHandle, V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE, V4L2_MEMORY_MMAP);
+    ret = DequeueBuffer(ctx->decoderHandle, V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE, ctx->outputMemory);
     if (ret < 0) {
         VDPAU_ERR("error dequeue output buffer, got number %d, errno %d", ret, errno);
         return -1;
@@ -493,16 +1514,82 @@ static int process_header(v4l2_decoder_t *ctx, uint32_t buffer_count,
     return 0;
 }
 
+// releases what setup_capture() allocated, the MFC OUTPUT queue keeps streaming
+static void teardown_capture(v4l2_decoder_t *ctx)
+{
+    stopPumps(ctx);
+
+    StreamOn(ctx->decoderHandle, V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE, VIDIOC_STREAMOFF);
+    if (ctx->captureBuffers) {
+        memstat_free(MEMSTAT_V4L2_CAPTURE, ctx->captureBuffersCount, 0, 0, buffers_size(ctx->captureBuffersCount, ctx->captureBuffers));
+        ctx->captureBuffers = FreeBuffers(ctx->captureBuffersCount, ctx->captureBuffers);
+    }
+    RequestBuffer(ctx->decoderHandle, V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE, V4L2_MEMORY_MMAP, 0);
+
+    if (ctx->needConvert) {
+        StreamOn(ctx->converterHandle, V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE, VIDIOC_STREAMOFF);
+        StreamOn(ctx->converterHandle, V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE, VIDIOC_STREAMOFF);
+        if (ctx->converterBuffers) {
+            memstat_free(MEMSTAT_V4L2_CONVERTER, ctx->converterBuffersCount, 0, 0, buffers_size(ctx->converterBuffersCount, ctx->converterBuffers));
+            ctx->converterBuffers = FreeBuffers(ctx->converterBuffersCount, ctx->converterBuffers);
+        }
+        RequestBuffer(ctx->converterHandle, V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE, V4L2_MEMORY_USERPTR, 0);
+        RequestBuffer(ctx->converterHandle, V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE, V4L2_MEMORY_MMAP, 0);
+    }
+}
+
+// returns 1 once the MFC reported a new coded size
+static int pollSourceChange(v4l2_decoder_t *ctx)
+{
+#ifdef V4L2_EVENT_SOURCE_CHANGE
+    struct v4l2_event ev;
+    int changed = 0;
+
+    if (!ctx->sourceChangeEvents)
+        return 0;
+
+    memzero(ev);
+    while (!ioctl(ctx->decoderHandle, VIDIOC_DQEVENT, &ev))
+        if (ev.type == V4L2_EVENT_SOURCE_CHANGE && (ev.u.src_change.changes & V4L2_EVENT_SRC_CH_RESOLUTION))
+            changed = 1;
+
+    return changed;
+#else
+    return 0;
+#endif
+}
+
+/*
+ * The MFC stops decoding at a resolution change until CAPTURE is set up at
+ * the new size. The bitstream already queued on OUTPUT stays where it is,
+ * only the capture side (and the FIMC, whose input size changes) is rebuilt.
+ */
+static int reconfigure_capture(v4l2_decoder_t *ctx)
+{
+    int oldWidth = ctx->captureWidth, oldHeight = ctx->captureHeight;
+
+    ctx->sourceChanged = 0;
+    teardown_capture(ctx);
+    if (setup_capture(ctx)) {
+        VDPAU_ERR("Failed to set up capture after resolution change");
+        return -1;
+    }
+
+    VDPAU_DBG("Resolution change %dx%d -> %dx%d", oldWidth, oldHeight, ctx->captureWidth, ctx->captureHeight);
+    return 0;
+}
+
 static VdpStatus process_frames(v4l2_decoder_t *ctx, uint32_t buffer_count,
-                    VdpBitstreamBuffer const *buffers, VdpVideoSurface output)
+                    VdpBitstreamBuffer const *buffers, VdpVideoSurface output, uint32_t generation)
 {
     int index = 0;
-    int ret, i;
+    int ret, inPlace;
 
     while (index < ctx->outputBuffersCount && ctx->outputBuffers[index].bQueue)
         index++;
 
     if (index >= ctx->outputBuffersCount) { //all input buffers are busy, dequeue needed
+        ctx->outputStalls++;
         ret = PollOutput(ctx->decoderHandle, 1000); // POLLIN - Poll Capture, POLLOUT - Poll Output
         if (ret == V4L2_ERROR) {
             VDPAU_ERR("PollInput Error");
@@ -514,152 +1601,290 @@ static VdpStatus process_frames(v4l2_decoder_t *ctx, uint32_t buffer_count,
             VDPAU_ERR("PollOutput unexpected error, what the? %d", ret);
             return VDP_STATUS_ERROR;
         }
-        index = DequeueBuffer(ctx->decoderHandle, V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE, V4L2_MEMORY_MMAP);
+        index = DequeueBuffer(ctx->decoderHandle, V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE, ctx->outputMemory);
         if (index < 0) {
             VDPAU_ERR("error dequeue output buffer, got number %d, errno %d", index, errno);
             return VDP_STATUS_ERROR;
         }
     }
 
-    // Parse frame, copy it to buffer
-    int frameSize = 0;
-    for(i=0 ; i<buffer_count ; i++) {
-        memcpy(ctx->outputBuffers[index].cPlane[0] + frameSize, buffers[i].bitstream, buffers[i].bitstream_bytes);
-        frameSize += buffers[i].bitstream_bytes;
-    }
-    ctx->outputBuffers[index].iBytesUsed[0] = frameSize;
+    // Parse frame, copy it to buffer unless it can be queued in place
+    inPlace = fill_output(ctx, index, buffer_count, buffers);
+    if (inPlace < 0)
+        return VDP_STATUS_ERROR;
 
-    // Queue buffer into input queue
-    ctx->outputBuffers[index].iBytesUsed[0] = frameSize;
-    ret = QueueBuffer(ctx->decoderHandle, V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE, V4L2_MEMORY_MMAP, &ctx->outputBuffers[index]);
+    // Queue buffer into input queue, tagged so the picture finds its way back to output
+    pthread_mutex_lock(&ctx->mutex);
+    ctx->outputBuffers[index].timestamp = TimestampTag(&ctx->timestamps, output, generation);
+    ret = QueueBuffer(ctx->decoderHandle, V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE, ctx->outputMemory, &ctx->outputBuffers[index]);
+    pthread_mutex_unlock(&ctx->mutex);
     if (ret == V4L2_ERROR) {
         VDPAU_ERR("Failed to queue buffer with index %d, errno %d", index, errno);
         return VDP_STATUS_ERROR;
     }
+    // bitstream for the MFC, which may have been disarmed for having none
+    reactor_arm(ctx->mfcPump);
+
+    if (inPlace && wait_output(ctx, index))
+        return VDP_STATUS_ERROR;
 
     return VDP_STATUS_OK;
 }
 
-static void *pumpFIMC(void *arg)
+/*
+ * With the FIMC in the path every MFC picture makes a round trip through it,
+ * MFC CAPTURE -> FIMC OUTPUT -> back to MFC CAPTURE. Both hand-offs run on
+ * the reactor thread shared by all decoders. A queue polling POLLERR for lack
+ * of buffers is disarmed until a buffer is queued to that device again, or
+ * startPumps() registers it anew after STREAMON.
+ */
+static int pumpMFC(void *arg, uint32_t events)
 {
-    int ret, index;
+    int ret, index, bytesUsed;
+    __u32 flags;
+    struct timeval timestamp;
     v4l2_decoder_t *ctx = (v4l2_decoder_t *)arg;
+    int moved = 0;
+
+    ctx->mfcWakeups++;
+    while ((index = DequeueBufferInfo(ctx->decoderHandle, V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE, V4L2_MEMORY_MMAP, &timestamp, &flags, &bytesUsed)) >= 0) {
+        // an empty last buffer carries no picture, it stays with us until CAPTURE is set up again
+        if ((flags & V4L2_BUF_FLAG_LAST) && !bytesUsed)
+            break;
 
-    while(1){
-        // Dequeue frame from fimc output and pass it back to mfc capture
-        ret = PollOutput(ctx->converterHandle, 1000);
+        //Process frame after mfc, the FIMC passes the timestamp on
+        ctx->captureBuffers[index].timestamp = timestamp;
+        ret = QueueBuffer(ctx->converterHandle, V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE, V4L2_MEMORY_USERPTR, &ctx->captureBuffers[index]);
         if (ret == V4L2_ERROR) {
-            VDPAU_ERR("PollOutput Error");
-            return VDP_STATUS_ERROR;
-        } else if (ret == V4L2_BUSY) {
-            continue;
-        } else if (ret != V4L2_READY) {
-            VDPAU_ERR("PollOutput unexpected error, what the? %d", ret);
-            return VDP_STATUS_ERROR;
+            VDPAU_ERR("Failed to queue buffer with index %d", index);
+            return REACTOR_REMOVE;
         }
+        __atomic_add_fetch(&ctx->converting, 1, __ATOMIC_RELEASE);
+        moved++;
 
-        index = DequeueBuffer(ctx->converterHandle, V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE, V4L2_MEMORY_USERPTR);
-        if (index < 0) {
-            if (index != -EAGAIN) {// Dequeue buffer not ready, need more data on input. EAGAIN = 11
-                VDPAU_ERR("error dequeue output buffer, got number %d", index);
-                return VDP_STATUS_ERROR;
-            }
-        } else {
-            ret = QueueBuffer(ctx->decoderHandle, V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE, V4L2_MEMORY_MMAP, &ctx->captureBuffers[index]);
-            if (ret == V4L2_ERROR) {
-                VDPAU_ERR("Failed to queue buffer with index %d, errno = %d", index, errno);
-                return VDP_STATUS_ERROR;
-            }
-        }
+        if (flags & V4L2_BUF_FLAG_LAST)
+            break;
+    }
+
+    /*
+     * Drained before a resolution change, the MFC CAPTURE queue stays readable
+     * with EPIPE, so the pump goes until reconfigure_capture() starts it again.
+     */
+    if (index == -EPIPE || (index >= 0 && (flags & V4L2_BUF_FLAG_LAST))) {
+        __atomic_store_n(&ctx->mfcDrained, 1, __ATOMIC_RELEASE);
+        if (moved)
+            reactor_arm(ctx->fimcPump);
+        return REACTOR_REMOVE;
+    }
+
+    if (index != -EAGAIN) {
+        VDPAU_ERR("error dequeue output buffer, got number %d", index);
+        return REACTOR_REMOVE;
+    }
+    if (moved) {
+        reactor_arm(ctx->fimcPump);
+        return REACTOR_KEEP;
     }
+
+    // POLLERR while neither queue holds a buffer, it stays until pumpFIMC() or process_frames() queue one
+    ctx->spuriousWakeups++;
+    return events & EPOLLERR ? REACTOR_DISARM : REACTOR_KEEP;
 }
 
-static void *pumpMFC(void *arg)
+static int pumpFIMC(void *arg, uint32_t events)
 {
     int ret, index;
     v4l2_decoder_t *ctx = (v4l2_decoder_t *)arg;
+    int moved = 0;
 
-    while(1){
-        // Dequeue frame from MFC capture and pass it back to mfc capture
-        ret = PollInput(ctx->decoderHandle, 1000);
+    ctx->fimcWakeups++;
+    while ((index = DequeueBuffer(ctx->converterHandle, V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE, V4L2_MEMORY_USERPTR)) >= 0) {
+        ret = QueueBuffer(ctx->decoderHandle, V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE, V4L2_MEMORY_MMAP, &ctx->captureBuffers[index]);
         if (ret == V4L2_ERROR) {
-            VDPAU_ERR("PollInput Error");
-            return VDP_STATUS_ERROR;
-        } else if (ret == V4L2_BUSY) {
-            continue;
-        } else if (ret != V4L2_READY) {
-            VDPAU_ERR("PollInput unexpected error, what the? %d", ret);
-            return VDP_STATUS_ERROR;
+            VDPAU_ERR("Failed to queue buffer with index %d, errno = %d", index, errno);
+            return REACTOR_REMOVE;
         }
+        moved++;
+    }
 
-        index = DequeueBuffer(ctx->decoderHandle, V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE, V4L2_MEMORY_MMAP);
-        if (index < 0) {
-            if (index != -EAGAIN) {// Dequeue buffer not ready, need more data on input. EAGAIN = 11
-                VDPAU_ERR("error dequeue output buffer, got number %d", index);
-                return VDP_STATUS_ERROR;
-            }
-        } else {
-            //Process frame after mfc
-            ret = QueueBuffer(ctx->converterHandle, V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE, V4L2_MEMORY_USERPTR, &ctx->captureBuffers[index]);
-            if (ret == V4L2_ERROR) {
-                VDPAU_ERR("Failed to queue buffer with index %d", index);
-                return VDP_STATUS_ERROR;
-            }
-        }
+    if (index != -EAGAIN) {
+        VDPAU_ERR("error dequeue output buffer, got number %d", index);
+        return REACTOR_REMOVE;
+    }
+    if (moved) {
+        reactor_arm(ctx->mfcPump);
+        return REACTOR_KEEP;
     }
+
+    // until pumpMFC() or decoder_release_picture() queue a buffer to the FIMC again
+    ctx->spuriousWakeups++;
+    return events & EPOLLERR ? REACTOR_DISARM : REACTOR_KEEP;
 }
 
-VdpStatus decoder_get_picture(void *context, int *frame, void ***output)
+static int startPumps(v4l2_decoder_t *ctx)
 {
-    v4l2_decoder_t *ctx = (v4l2_decoder_t *)context;
-    int index = 0;
+    // both queues start out empty
+    ctx->mfcDrained = ctx->converting = 0;
+
+    ctx->mfcPump = reactor_add(ctx->decoderHandle, EPOLLIN, pumpMFC, ctx);
+    ctx->fimcPump = reactor_add(ctx->converterHandle, EPOLLOUT, pumpFIMC, ctx);
+    if (ctx->mfcPump < 0 || ctx->fimcPump < 0) {
+        stopPumps(ctx);
+        return -1;
+    }
+
+    return 0;
+}
+
+static void stopPumps(v4l2_decoder_t *ctx)
+{
+    reactor_remove(ctx->mfcPump);
+    reactor_remove(ctx->fimcPump);
+    ctx->mfcPump = ctx->fimcPump = -1;
+}
+
+// caller holds the mutex
+static VdpStatus get_picture(v4l2_decoder_t *ctx, int *frame, void ***output, VdpVideoSurface *surface,
+                    uint32_t *generation)
+{
+    struct timeval timestamp;
+    int index = 0, bytesUsed;
+    __u32 flags;
 
     *frame = -1;
     *output = NULL;
+    *surface = VDP_INVALID_HANDLE;
+    *generation = 0;
 
+    if (ctx->headerProcessed && pollSourceChange(ctx))
+        ctx->sourceChanged = 1;
+
+    /*
+     * At a resolution change the pictures of the old size still come out,
+     * CAPTURE is only set up again once the MFC marked its last buffer with
+     * V4L2_BUF_FLAG_LAST or returns EPIPE, and the FIMC converted them all.
+     */
     if(ctx->needConvert) {
-        index = DequeueBuffer(ctx->converterHandle, V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE, V4L2_MEMORY_MMAP);
+        index = DequeueBufferTimestamp(ctx->converterHandle, V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE, V4L2_MEMORY_MMAP, &timestamp);
+        if (index == -EAGAIN) { // Dequeue buffer not ready, need more data on input. EAGAIN = 11
+            if (ctx->sourceChanged && __atomic_load_n(&ctx->mfcDrained, __ATOMIC_ACQUIRE) &&
+                    !__atomic_load_n(&ctx->converting, __ATOMIC_ACQUIRE))
+                return reconfigure_capture(ctx) ? VDP_STATUS_ERROR : VDP_STATUS_OK;
+            ctx->pictureMisses++;
+            return VDP_STATUS_OK;
+        }
         if (index < 0) {
-            if (index == -EAGAIN) // Dequeue buffer not ready, need more data on input. EAGAIN = 11
-                return VDP_STATUS_OK;
             VDPAU_ERR("error dequeue output buffer, got number %d %d", index, errno);
             return VDP_STATUS_ERROR;
         }
+        __atomic_sub_fetch(&ctx->converting, 1, __ATOMIC_RELEASE);
         *output = ctx->converterBuffers[index].cPlane;
         *frame = index;
     } else {
-        index = DequeueBuffer(ctx->decoderHandle, V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE, V4L2_MEMORY_MMAP);
+        index = DequeueBufferInfo(ctx->decoderHandle, V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE, V4L2_MEMORY_MMAP, &timestamp, &flags, &bytesUsed);
+        // EPIPE once the last buffer went out, an empty last buffer carries no picture
+        if (index == -EPIPE || (index >= 0 && (flags & V4L2_BUF_FLAG_LAST) && !bytesUsed)) {
+            if (ctx->sourceChanged)
+                return reconfigure_capture(ctx) ? VDP_STATUS_ERROR : VDP_STATUS_OK;
+            if (index >= 0)
+                QueueBuffer(ctx->decoderHandle, V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE, V4L2_MEMORY_MMAP, &ctx->captureBuffers[index]);
+            return VDP_STATUS_OK;
+        }
+        if (index == -EAGAIN) { // Dequeue buffer not ready, need more data on input. EAGAIN = 11
+            ctx->pictureMisses++;
+            return VDP_STATUS_OK;
+        }
         if (index < 0) {
-            if (index == -EAGAIN) // Dequeue buffer not ready, need more data on input. EAGAIN = 11
-                return VDP_STATUS_OK;
             VDPAU_ERR("error dequeue output buffer, got number %d", index);
             return VDP_STATUS_ERROR;
         }
         *output = ctx->captureBuffers[index].cPlane;
         *frame = index;
     }
+    TimestampLookup(&ctx->timestamps, timestamp, surface, generation);
+    ctx->pictures++;
+
+    if (!ctx->firstPictureSeen) {
+        ctx->firstPictureSeen = 1;
+        pthread_mutex_lock(&pool.mutex);
+        pool.firstPictureTime[ctx->warm] += now_ns() - ctx->openedAt;
+        pool.firstPictures[ctx->warm]++;
+        pthread_mutex_unlock(&pool.mutex);
+    }
 
     return VDP_STATUS_OK;
 }
 
-VdpStatus decoder_release_picture(void *context, int frame)
+static VdpStatus decoder_get_picture(void *context, int *frame, void ***output, VdpVideoSurface *surface,
+                    uint32_t *generation)
+{
+    v4l2_decoder_t *ctx = (v4l2_decoder_t *)context;
+    VdpStatus status;
+
+    pthread_mutex_lock(&ctx->mutex);
+    status = get_picture(ctx, frame, output, surface, generation);
+    pthread_mutex_unlock(&ctx->mutex);
+
+    return status;
+}
+
+static VdpStatus decoder_release_picture(void *context, int frame)
 {
     v4l2_decoder_t *ctx = (v4l2_decoder_t *)context;
     int ret;
 
+    pthread_mutex_lock(&ctx->mutex);
     if(ctx->needConvert) {
         ret = QueueBuffer(ctx->converterHandle, V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE, V4L2_MEMORY_MMAP, &ctx->converterBuffers[frame]);
-        if (ret == V4L2_ERROR) {
-            VDPAU_ERR("Failed to queue buffer with index %d, errno = %d", frame, errno);
-            return VDP_STATUS_ERROR;
-        }
+        if (ret != V4L2_ERROR)
+            reactor_arm(ctx->fimcPump);
     } else {
         ret = QueueBuffer(ctx->decoderHandle, V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE, V4L2_MEMORY_MMAP, &ctx->captureBuffers[frame]);
-        if (ret == V4L2_ERROR) {
-            VDPAU_ERR("Failed to queue buffer with index %d, errno = %d", frame, errno);
-            return VDP_STATUS_ERROR;
-        }
+    }
+    pthread_mutex_unlock(&ctx->mutex);
+
+    if (ret == V4L2_ERROR) {
+        VDPAU_ERR("Failed to queue buffer with index %d, errno = %d", frame, errno);
+        return VDP_STATUS_ERROR;
     }
 
     return VDP_STATUS_OK;
 }
+
+// caller holds the mutex, the buffers may be set up again at a resolution change
+static VdpStatus get_dmabuf(v4l2_decoder_t *ctx, int frame, decoder_dmabuf_t *dmabuf)
+{
+    if (ctx->needConvert)
+        return capture_dmabuf(ctx->converterHandle, &ctx->converterLayout, ctx->converterBuffersCount,
+                              ctx->converterBuffers, frame, dmabuf);
+
+    return capture_dmabuf(ctx->decoderHandle, &ctx->captureLayout, ctx->captureBuffersCount,
+                          ctx->captureBuffers, frame, dmabuf);
+}
+
+static VdpStatus decoder_get_dmabuf(void *context, int frame, decoder_dmabuf_t *dmabuf)
+{
+    v4l2_decoder_t *ctx = (v4l2_decoder_t *)context;
+    VdpStatus status;
+
+    pthread_mutex_lock(&ctx->mutex);
+    status = get_dmabuf(ctx, frame, dmabuf);
+    pthread_mutex_unlock(&ctx->mutex);
+
+    return status;
+}
+
+const decoder_backend_t decoder_backend_mfc =
+{
+    .name = "mfc",
+    .query_capabilities = decoder_query_capabilities,
+    .open = decoder_open,
+    .close = decoder_close,
+    .decode = decoder_decode,
+    .get_picture = decoder_get_picture,
+    .release_picture = decoder_release_picture,
+    .get_dmabuf = decoder_get_dmabuf,
+    .flush = decoder_flush,
+    .set_buffering = decoder_set_buffering,
+    .drain = decoder_pool_drain,
+};
@@ -1,3 +1,57 @@
+// memory a USERPTR bitstream buffer is gathered into, see fill_output()
+typedef struct {
+    void *data;
+    uint32_t size;
+} gather_buffer_t;
+
+#define SUBMIT_QUEUE_DEFAULT      4       //pictures VdpDecoderRender may run ahead of the MFC OUTPUT queue
+#define SUBMIT_QUEUE_MAX          16
+#define SUBMIT_LATENCY_BUCKETS    6
+
+typedef struct {
+    uint8_t *data;
+    uint32_t size;
+    uint32_t capacity;
+    VdpVideoSurface surface;
+    uint32_t generation;
+    uint64_t queuedAt;
+} submit_entry_t;
+
+// see submit_thread()
+typedef struct {
+    int depth;              // 0 submits synchronously
+    submit_entry_t entries[SUBMIT_QUEUE_MAX];
+    int head;
+    int count;
+    int busy;
+    int stop;
+    VdpStatus error;
+    pthread_t thread;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+
+    uint64_t bytes;
+    uint64_t bytesInPlace;  // of those, queued to USERPTR buffers without another copy
+    uint32_t blocked;
+    uint64_t blockedTime;
+    uint32_t depthSeen[SUBMIT_QUEUE_MAX + 1];
+    uint32_t latency[SUBMIT_LATENCY_BUCKETS];
+} submit_queue_t;
+
+// pictures handed to the mixer, see capture_negotiate() and capture_dmabuf()
+typedef struct
+{
+    __u32 pixelformat;
+    int planes;
+    int contiguous;             // one buffer, the chroma planes follow luma
+    uint32_t pitch[DECODER_MAX_PLANES];
+    uint32_t offset[DECODER_MAX_PLANES];
+    int width;                  // visible part of the coded picture
+    int height;
+    uint32_t generation;
+    int exportFailed;
+} capture_layout_t;
+
 typedef struct {
     uint32_t width;
     uint32_t height;
@@ -16,18 +70,95 @@ typedef struct {
     v4l2_buffer_t *captureBuffers;
     v4l2_buffer_t *converterBuffers;
 
+    // MMAP, or USERPTR with VDPAU_BITSTREAM=userptr
+    enum v4l2_memory outputMemory;
+    gather_buffer_t *gatherBuffers;
+    uint64_t bytesCopied;
+    uint64_t bytesInPlace;
+
+    submit_queue_t submit;
+
     int captureWidth;
     int captureHeight;
 
     int headerProcessed;
+    int sourceChangeEvents;
+    int sourceChanged;
+
+    // the capture side, set up by the submit thread and at changes by get_picture
+    pthread_mutex_t mutex;
 
-    pthread_t fimc_thread;
-    pthread_t mfc_thread;
+    // of the MFC CAPTURE and the FIMC CAPTURE queues, see get_dmabuf()
+    capture_layout_t captureLayout;
+    capture_layout_t converterLayout;
+
+    // bitstream timestamp -> target surface
+    v4l2_timestamp_map_t timestamps;
+
+    // reactor registrations of the MFC <-> FIMC hand-offs, -1 if not running
+    int mfcPump;
+    int fimcPump;
+    // set by pumpMFC() at the last picture before a resolution change, and
+    // the MFC pictures queued to the FIMC the mixer hasn't dequeued yet
+    int mfcDrained;
+    int converting;
+    // capture sizing, see capture_depth(), the MFC minimum and what we asked for
+    uint32_t maxReferences;
+    uint32_t buffering;
+    int captureRequired;
+    int captureDepth;
+    int checkCaptureDepth;
+    // decode waited for a free bitstream buffer, the mixer found no picture ready
+    uint32_t outputStalls;
+    uint32_t pictureMisses;
+    uint32_t pictures;
+
+    uint32_t mfcWakeups;
+    uint32_t fimcWakeups;
+    uint32_t spuriousWakeups;
+
+    // decoder pool bookkeeping, see decoder_open()
+    int warm;
+    int firstPictureSeen;
+    uint64_t openedAt;
+    uint64_t parkedAt;
 } v4l2_decoder_t;
 
 #define STREAM_BUFFER_SIZE        1572864 //compressed frame size. 1080p mpeg4 10Mb/s can be >256k in size, so this is to make sure frame fits into buffer
                                           //for very unknown reason lesser than 1Mb buffer causes MFC to corrupt its own setup setting inapropriate values
 
+#define STREAM_USERPTR_ALIGN      64      //application bitstreams aligned to a cache line are queued without a copy
+#define STREAM_GATHER_GRANULE     65536   //gathered USERPTR bitstream buffers grow in these steps
+
 #define STREAM_BUFFER_CNT         3       //3 input buffers. 2 is enough almost for everything, but on some heavy videos 3 makes a difference
 
 #define CONVERTER_VIDEO_BUFFERS_CNT 3     //2 begins to be slow. maybe on video only, but not on convert.
+
+#define DECODER_POOL_DEFAULT_SIZE 2       //closed decoders kept streaming-ready for the next create of the same codec and size
+#define DECODER_POOL_DEFAULT_TTL  30      //seconds a parked decoder is kept
+#define DECODER_POOL_MAX_SIZE     8
+
+size_t buffers_size(int count, v4l2_buffer_t *buffers);
+
+// the stream format V4L2 decoders take for a profile, the MFC's if mfc, 0 if none
+__u32 stream_codec(VdpDecoderProfile profile, int mfc);
+
+// opens the best decoder for codec and, with media, its media controller node,
+// -ENODEV if there is none
+int open_decoder_device(__u32 codec, int mfc, v4l2_device_t *device, int *media);
+// query_capabilities() of a V4L2 backend, media only counts decoders with a media node
+VdpStatus query_decoder(__u32 codec, int mfc, int media, VdpBool *is_supported,
+                    uint32_t *max_width, uint32_t *max_height);
+
+// picks the first YUV420 or NV12 layout the driver takes and sets layout from
+// fmt, whose size is the coded one
+int capture_negotiate(int handle, capture_layout_t *layout, struct v4l2_format *fmt);
+// the plane pointers of each buffer handed to the mixer
+void capture_map(const capture_layout_t *layout, int count, v4l2_buffer_t *buffers,
+                    void *(*pictureData)[DECODER_MAX_PLANES]);
+// get_dmabuf() of a V4L2 backend, the caller holds what guards the buffers
+VdpStatus capture_dmabuf(int handle, capture_layout_t *layout, int count, v4l2_buffer_t *buffers,
+                    int frame, decoder_dmabuf_t *dmabuf);
+
+// capture buffers for a stream needing required of them, by VdpDecoderSetBufferingOdroid
+int capture_depth(int required, uint32_t maxReferences, uint32_t buffering, uint32_t width, uint32_t height);
@@ -0,0 +1,290 @@
+/*
+ * Copyright (c) 2013 Jens Kuske <jenskuske@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+
+/*
+ * VDPAU passes VC-1 pictures without the sequence layer, the MFC however
+ * wants an Annex L (Simple/Main) or Annex G (Advanced) stream. The missing
+ * headers are rebuilt here from VdpPictureInfoVC1, syntax references are to
+ * SMPTE 421M.
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#include "vc1_stream.h"
+#include "h264_stream.h"
+
+#define VC1_BDU_MAX_SIZE 64
+
+int vc1_is_advanced(VdpDecoderProfile profile)
+{
+    return profile == VDP_DECODER_PROFILE_VC1_ADVANCED;
+}
+
+void vc1_header_key(vc1_header_key_t *key, int width, int height, VdpDecoderProfile profile, VdpPictureInfoVC1 *info)
+{
+    memset(key, 0, sizeof(*key));
+
+    key->profile = profile;
+    key->width = width;
+    key->height = height;
+    key->postprocflag = info->postprocflag;
+    key->pulldown = info->pulldown;
+    key->interlace = info->interlace;
+    key->tfcntrflag = info->tfcntrflag;
+    key->finterpflag = info->finterpflag;
+    key->psf = info->psf;
+    key->dquant = info->dquant;
+    key->panscan_flag = info->panscan_flag;
+    key->refdist_flag = info->refdist_flag;
+    key->quantizer = info->quantizer;
+    key->extended_mv = info->extended_mv;
+    key->extended_dmv = info->extended_dmv;
+    key->overlap = info->overlap;
+    key->vstransform = info->vstransform;
+    key->loopfilter = info->loopfilter;
+    key->fastuvmc = info->fastuvmc;
+    key->range_mapy_flag = info->range_mapy_flag;
+    key->range_mapy = info->range_mapy;
+    key->range_mapuv_flag = info->range_mapuv_flag;
+    key->range_mapuv = info->range_mapuv;
+    key->multires = info->multires;
+    key->syncmarker = info->syncmarker;
+    key->rangered = info->rangered;
+    key->maxbframes = info->maxbframes;
+}
+
+static void write_le32(bs_t *b, uint32_t v)
+{
+    bs_write_u8(b, v & 0xff);
+    bs_write_u8(b, (v >> 8) & 0xff);
+    bs_write_u8(b, (v >> 16) & 0xff);
+    bs_write_u8(b, v >> 24);
+}
+
+// Annex E.5 flushing bits, a one followed by zeros up to the byte boundary
+static void write_flushing_bits(bs_t *b)
+{
+    bs_write_u1(b, 1);
+    while (!bs_byte_aligned(b))
+        bs_write_u1(b, 0);
+}
+
+// J.1.1 sequence header of Simple and Main profile, carried as STRUCT_C
+static void write_struct_c(bs_t *b, VdpDecoderProfile profile, VdpPictureInfoVC1 *info)
+{
+    bs_write_u(b, 2, profile == VDP_DECODER_PROFILE_VC1_MAIN ? 1 : 0); // PROFILE
+    bs_write_u1(b, 0);                  // RES_Y411
+    bs_write_u1(b, 0);                  // RES_SPRITE
+    bs_write_u(b, 3, 0);                // FRMRTQ_POSTPROC
+    bs_write_u(b, 5, 0);                // BITRTQ_POSTPROC
+    bs_write_u1(b, info->loopfilter);
+    bs_write_u1(b, 0);                  // RES_X8
+    bs_write_u1(b, info->multires);
+    bs_write_u1(b, 1);                  // RES_FASTTX
+    bs_write_u1(b, info->fastuvmc);
+    bs_write_u1(b, info->extended_mv);
+    bs_write_u(b, 2, info->dquant);
+    bs_write_u1(b, info->vstransform);
+    bs_write_u1(b, 0);                  // RES_TRANSTAB
+    bs_write_u1(b, info->overlap);
+    bs_write_u1(b, info->syncmarker);
+    bs_write_u1(b, info->rangered);
+    bs_write_u(b, 3, info->maxbframes);
+    bs_write_u(b, 2, info->quantizer);
+    bs_write_u1(b, info->finterpflag);
+    bs_write_u1(b, 1);                  // RES_RTM_FLAG, not an old WMV3 beta stream
+}
+
+// L.2 sequence layer, little endian words around STRUCT_A, STRUCT_B and STRUCT_C
+static void write_rcv_sequence_layer(bs_t *b, int width, int height, VdpDecoderProfile profile, VdpPictureInfoVC1 *info)
+{
+    int mbs = ((width + 15) / 16) * ((height + 15) / 16);
+    int level;
+
+    // Table 253 (Annex D), the lowest level the picture size fits in
+    if (profile == VDP_DECODER_PROFILE_VC1_SIMPLE)
+        level = mbs <= 99 ? 0 : 2;      // Low, Medium
+    else
+        level = mbs <= 396 ? 0 : mbs <= 1620 ? 2 : 4; // Low, Medium, High
+
+    write_le32(b, 0xc5ffffff);          // 0xC5, NUMFRAMES unknown
+    write_le32(b, VC1_RCV_STRUCT_C_SIZE);
+    write_struct_c(b, profile, info);
+    write_le32(b, height);              // STRUCT_A VERT_SIZE
+    write_le32(b, width);               // STRUCT_A HORIZ_SIZE
+    write_le32(b, VC1_RCV_STRUCT_B_SIZE);
+    write_le32(b, level << 29);         // STRUCT_B LEVEL, CBR = 0, HRD_BUFFER = 0
+    write_le32(b, 0);                   // HRD_RATE
+    write_le32(b, 0xffffffff);          // FRAMERATE, unknown
+}
+
+// 6.1 Advanced profile sequence header
+static void write_sequence_layer(bs_t *b, int width, int height, VdpPictureInfoVC1 *info)
+{
+    int mbs = ((width + 15) / 16) * ((height + 15) / 16);
+    int level;
+
+    // Table 253 (Annex D), the lowest level the picture size fits in
+    if (mbs <= 396)
+        level = 0;
+    else if (mbs <= 1620)
+        level = 1;
+    else if (mbs <= 8192)
+        level = 2;
+    else if (mbs <= 16384)
+        level = 3;
+    else
+        level = 4;
+
+    bs_write_u(b, 2, 3);                // PROFILE, Advanced
+    bs_write_u(b, 3, level);
+    bs_write_u(b, 2, 1);                // COLORDIFF_FORMAT, 4:2:0
+    bs_write_u(b, 3, 0);                // FRMRTQ_POSTPROC
+    bs_write_u(b, 5, 0);                // BITRTQ_POSTPROC
+    bs_write_u1(b, info->postprocflag);
+    bs_write_u(b, 12, width / 2 - 1);   // MAX_CODED_WIDTH
+    bs_write_u(b, 12, height / 2 - 1);  // MAX_CODED_HEIGHT
+    bs_write_u1(b, info->pulldown);
+    bs_write_u1(b, info->interlace);
+    bs_write_u1(b, info->tfcntrflag);
+    bs_write_u1(b, info->finterpflag);
+    bs_write_u1(b, 1);                  // reserved
+    bs_write_u1(b, info->psf);
+    bs_write_u1(b, 0);                  // DISPLAY_EXT
+    bs_write_u1(b, 0);                  // HRD_PARAM_FLAG
+    write_flushing_bits(b);
+}
+
+// 6.2 Entry-point header
+static void write_entry_point_layer(bs_t *b, VdpPictureInfoVC1 *info)
+{
+    bs_write_u1(b, 0);                  // BROKEN_LINK
+    bs_write_u1(b, 1);                  // CLOSED_ENTRY
+    bs_write_u1(b, info->panscan_flag);
+    bs_write_u1(b, info->refdist_flag);
+    bs_write_u1(b, info->loopfilter);
+    bs_write_u1(b, info->fastuvmc);
+    bs_write_u1(b, info->extended_mv);
+    bs_write_u(b, 2, info->dquant);
+    bs_write_u1(b, info->vstransform);
+    bs_write_u1(b, info->overlap);
+    bs_write_u(b, 2, info->quantizer);
+    bs_write_u1(b, 0);                  // CODED_SIZE_FLAG, the maximum from the sequence header
+    if (info->extended_mv)
+        bs_write_u1(b, info->extended_dmv);
+    bs_write_u1(b, info->range_mapy_flag);
+    if (info->range_mapy_flag)
+        bs_write_u(b, 3, info->range_mapy);
+    bs_write_u1(b, info->range_mapuv_flag);
+    if (info->range_mapuv_flag)
+        bs_write_u(b, 3, info->range_mapuv);
+    write_flushing_bits(b);
+}
+
+/*
+ * Annex E encapsulation: start code, BDU type and the payload with the same
+ * emulation prevention H.264 uses, so rbsp_to_nal does the escaping.
+ */
+static int write_bdu(int type, int width, int height, VdpPictureInfoVC1 *info, uint8_t *buf, int size)
+{
+    uint8_t payload[VC1_BDU_MAX_SIZE];
+    int payload_size;
+    int bdu_size = size - 3;
+    bs_t b;
+
+    if (bdu_size <= 0)
+        return -1;
+
+    bs_init(&b, payload, sizeof(payload));
+    if (type == VC1_SEQ_START_CODE)
+        write_sequence_layer(&b, width, height, info);
+    else
+        write_entry_point_layer(&b, info);
+
+    if (bs_overrun(&b))
+        return -1;
+    payload_size = bs_pos(&b);
+
+    // rbsp_to_nal leaves the first byte for the header, which is the BDU type here
+    if (rbsp_to_nal(payload, &payload_size, buf + 3, &bdu_size) < 0)
+        return -1;
+
+    buf[0] = 0x00;
+    buf[1] = 0x00;
+    buf[2] = 0x01;
+    buf[3] = type;
+
+    return bdu_size + 3;
+}
+
+int vc1_write_sequence_header(int width, int height, VdpDecoderProfile profile, VdpPictureInfoVC1 *info, uint8_t *buf, int size)
+{
+    int seq, entry;
+    bs_t b;
+
+    if (!vc1_is_advanced(profile))
+    {
+        bs_init(&b, buf, size);
+        write_rcv_sequence_layer(&b, width, height, profile, info);
+
+        if (bs_overrun(&b))
+            return -1;
+
+        return bs_pos(&b);
+    }
+
+    seq = write_bdu(VC1_SEQ_START_CODE, width, height, info, buf, size);
+    if (seq < 0)
+        return -1;
+    entry = write_bdu(VC1_ENTRY_START_CODE, width, height, info, buf + seq, size - seq);
+    if (entry < 0)
+        return -1;
+
+    return seq + entry;
+}
+
+int vc1_write_frame_header(VdpDecoderProfile profile, VdpPictureInfoVC1 *info, uint32_t frame_size,
+                           const uint8_t *frame, uint8_t *buf, int size)
+{
+    bs_t b;
+
+    bs_init(&b, buf, size);
+
+    if (!vc1_is_advanced(profile))
+    {
+        // L.3 frame layer, KEY flag for I pictures and a 24 bit FRAMESIZE
+        write_le32(&b, (info->picture_type == 0 ? 0x80000000 : 0) | (frame_size & 0xffffff));
+        write_le32(&b, 0);              // TIMESTAMP
+    }
+    else if (!frame || frame[0] != 0x00 || frame[1] != 0x00 || frame[2] != 0x01)
+    {
+        // the application stripped the frame start code
+        bs_write_u8(&b, 0x00);
+        bs_write_u8(&b, 0x00);
+        bs_write_u8(&b, 0x01);
+        bs_write_u8(&b, VC1_FRAME_START_CODE);
+    }
+
+    if (bs_overrun(&b))
+        return -1;
+
+    return bs_pos(&b);
+}
@@ -0,0 +1,84 @@
+/*
+ * Copyright (c) 2013 Jens Kuske <jenskuske@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+
+#ifndef _VC1_STREAM_H
+#define _VC1_STREAM_H           1
+
+#include <stdint.h>
+
+#include <vdpau/vdpau.h>
+
+#include "bs.h"
+
+// every VdpPictureInfoVC1 field the sequence level headers consume, zero padded so it can be hashed
+typedef struct
+{
+    uint32_t profile;
+    uint16_t width;
+    uint16_t height;
+    uint8_t postprocflag;
+    uint8_t pulldown;
+    uint8_t interlace;
+    uint8_t tfcntrflag;
+    uint8_t finterpflag;
+    uint8_t psf;
+    uint8_t dquant;
+    uint8_t panscan_flag;
+    uint8_t refdist_flag;
+    uint8_t quantizer;
+    uint8_t extended_mv;
+    uint8_t extended_dmv;
+    uint8_t overlap;
+    uint8_t vstransform;
+    uint8_t loopfilter;
+    uint8_t fastuvmc;
+    uint8_t range_mapy_flag;
+    uint8_t range_mapy;
+    uint8_t range_mapuv_flag;
+    uint8_t range_mapuv;
+    uint8_t multires;
+    uint8_t syncmarker;
+    uint8_t rangered;
+    uint8_t maxbframes;
+} vc1_header_key_t;
+
+void vc1_header_key(vc1_header_key_t *key, int width, int height, VdpDecoderProfile profile, VdpPictureInfoVC1 *info);
+
+int vc1_is_advanced(VdpDecoderProfile profile);
+
+// Annex L sequence layer for Simple/Main, sequence and entry-point header BDUs for Advanced
+int vc1_write_sequence_header(int width, int height, VdpDecoderProfile profile, VdpPictureInfoVC1 *info, uint8_t *buf, int size);
+
+// Annex L frame layer for Simple/Main, a frame start code for Advanced pictures passed without one
+int vc1_write_frame_header(VdpDecoderProfile profile, VdpPictureInfoVC1 *info, uint32_t frame_size,
+                           const uint8_t *frame, uint8_t *buf, int size);
+
+#define VC1_FRAME_HEADER_MAX_SIZE 8
+
+// Annex L struct sizes
+#define VC1_RCV_STRUCT_C_SIZE    4
+#define VC1_RCV_STRUCT_B_SIZE    12
+
+// Table E.1 BDU types
+#define VC1_FRAME_START_CODE     0x0d
+#define VC1_ENTRY_START_CODE     0x0e
+#define VC1_SEQ_START_CODE       0x0f
+
+#endif
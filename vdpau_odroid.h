@@ -0,0 +1,56 @@
+/*
+ * Copyright (c) 2013 Jens Kuske <jenskuske@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifndef __VDPAU_ODROID_H__
+#define __VDPAU_ODROID_H__
+
+#include <vdpau/vdpau.h>
+
+/*
+ * Driver specific extensions, fetched with VdpGetProcAddress. Applications
+ * must be prepared for VDP_STATUS_INVALID_FUNC_ID from other drivers.
+ */
+
+/*
+ * Discards every picture queued in or decoded by the hardware but not yet
+ * rendered, e.g. on seek. Decoding continues with the next random access
+ * picture passed to VdpDecoderRender, without recreating the decoder.
+ */
+typedef VdpStatus VdpDecoderFlushOdroid(VdpDecoder decoder);
+
+#define VDP_FUNC_ID_DECODER_FLUSH_ODROID (VDP_FUNC_ID_BASE_DRIVER + 0)
+
+/*
+ * How many decoded pictures the hardware may keep beyond what the stream
+ * needs for reference and reordering. Low latency holds one, smooth
+ * doubles the depth to ride out a slow consumer, at a memory cost of
+ * about 12 MB per picture at 4K. Takes effect when the capture buffers are
+ * (re)allocated, i.e. set it before the first VdpDecoderRender.
+ */
+typedef uint32_t VdpDecoderBufferingOdroid;
+
+#define VDP_DECODER_BUFFERING_LOW_LATENCY_ODROID (VdpDecoderBufferingOdroid)0
+#define VDP_DECODER_BUFFERING_BALANCED_ODROID    (VdpDecoderBufferingOdroid)1
+#define VDP_DECODER_BUFFERING_SMOOTH_ODROID      (VdpDecoderBufferingOdroid)2
+
+typedef VdpStatus VdpDecoderSetBufferingOdroid(VdpDecoder decoder, VdpDecoderBufferingOdroid buffering);
+
+#define VDP_FUNC_ID_DECODER_SET_BUFFERING_ODROID (VDP_FUNC_ID_BASE_DRIVER + 1)
+
+#endif
@@ -21,20 +21,35 @@
 #define __VDPAU_PRIVATE_H__
 
 #define DEBUG
-#define MAX_HANDLES 64
 #define VBV_SIZE (1 * 1024 * 1024)
+#define SURFACE_POOL_DEFAULT_SIZE 16
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <pthread.h>
 #include <vdpau/vdpau.h>
 #include <X11/Xlib.h>
 
 #include <EGL/egl.h>
+#include <EGL/eglext.h>
 #include <GLES2/gl2.h>
+#include <GLES2/gl2ext.h>
 
 #define INTERNAL_YCBCR_FORMAT (VdpYCbCrFormat)0xffff
 #define INTERNAL_RGB8_FORMAT (VdpYCbCrFormat)0xfffe
 
+typedef enum
+{
+    HANDLE_TYPE_DEVICE = 1,
+    HANDLE_TYPE_VIDEO_SURFACE,
+    HANDLE_TYPE_OUTPUT_SURFACE,
+    HANDLE_TYPE_BITMAP_SURFACE,
+    HANDLE_TYPE_DECODER,
+    HANDLE_TYPE_VIDEO_MIXER,
+    HANDLE_TYPE_PRESENTATION_QUEUE_TARGET,
+    HANDLE_TYPE_PRESENTATION_QUEUE
+} handle_type_t;
+
 typedef enum
 {
     SHADER_YUVI420_RGB = 0,
@@ -44,7 +59,9 @@ typedef enum
     SHADER_YUV8444_RGB,
     SHADER_VUY8444_RGB,
     SHADER_COPY,
-    SHADER_BRSWAP_COPY
+    SHADER_BRSWAP_COPY,
+    SHADER_YUVI420_EXTERNAL_RGB,
+    SHADER_YUVNV12_EXTERNAL_RGB
 } shader_type_t;
 
 typedef struct
@@ -66,6 +83,30 @@ typedef struct
     GLint texture[3];
 } shader_ctx_t;
 
+#define DMABUF_CACHE_SIZE 64
+#define DECODER_MAX_PLANES 3
+
+// EGLImages of one decoder buffer, a single channel image per plane
+typedef struct
+{
+    void *decoder;
+    int frame;
+    uint32_t generation;
+    int planes;
+    EGLImageKHR images[DECODER_MAX_PLANES];
+    GLuint textures[DECODER_MAX_PLANES];
+} dmabuf_image_t;
+
+typedef struct
+{
+    int enabled;
+    dmabuf_image_t images[DMABUF_CACHE_SIZE];
+    int next;
+    uint32_t imports;
+    uint32_t hits;
+    pthread_mutex_t mutex;
+} dmabuf_cache_t;
+
 typedef struct
 {
     EGLDisplay display;
@@ -81,8 +122,29 @@ typedef struct
     shader_ctx_t vuy8444_rgb;
     shader_ctx_t copy;
     shader_ctx_t brswap;
+    shader_ctx_t yuvi420_external_rgb;
+    shader_ctx_t yuvnv12_external_rgb;
+
+    // EGL_EXT_image_dma_buf_import, see video_surface_dmabuf_init()
+    PFNEGLCREATEIMAGEKHRPROC create_image;
+    PFNEGLDESTROYIMAGEKHRPROC destroy_image;
+    PFNGLEGLIMAGETARGETTEXTURE2DOESPROC image_target_texture;
+    dmabuf_cache_t dmabuf;
 } device_egl_t;
 
+struct video_surface_ctx_struct;
+
+typedef struct
+{
+    struct video_surface_ctx_struct **surfaces;
+    int count;
+    int max;
+    uint32_t hits;
+    uint32_t misses;
+    uint32_t evictions;
+    pthread_mutex_t mutex;
+} surface_pool_t;
+
 typedef struct
 {
     Display *display;
@@ -91,15 +153,20 @@ typedef struct
     void *preemption_callback_context;
 
     device_egl_t egl;
+    surface_pool_t surface_pool;
 } device_ctx_t;
 
-typedef struct
+typedef struct video_surface_ctx_struct
 {
     device_ctx_t *device;
     uint32_t width, height;
     VdpChromaType chroma_type;
     VdpYCbCrFormat source_format;
+    // the decoder the surface was last rendered by
+    const struct decoder_backend_struct *backend;
     void *private;
+    // counts VdpDecoderRender calls to the surface, pictures carry the one they were decoded for
+    uint32_t decode_generation;
 
     GLuint y_tex;
     GLuint u_tex;
@@ -110,6 +177,32 @@ typedef struct
     GLuint framebuffer;
 } video_surface_ctx_t;
 
+#define HEADER_CACHE_SIZE 4
+#define HEADER_KEY_SIZE 1280
+#define HEADER_MAX_SIZE 4096
+
+#define DECODER_AUTO_FLUSH_DEFAULT_MS 0
+
+typedef struct
+{
+    uint32_t hash;
+    uint32_t key_len;
+    uint8_t key[HEADER_KEY_SIZE];
+    uint32_t len;
+    uint8_t data[HEADER_MAX_SIZE];
+} header_cache_entry_t;
+
+// a decoded picture as dma-bufs, for sampling it in GL without a copy
+typedef struct
+{
+    int planes;                 // 3 for YUV420, 2 for NV12 (interleaved CbCr)
+    int fd[DECODER_MAX_PLANES];
+    uint32_t offset[DECODER_MAX_PLANES];
+    uint32_t pitch[DECODER_MAX_PLANES];
+    uint32_t width, height;
+    uint32_t generation;        // changes whenever the decoder reallocates its buffers
+} decoder_dmabuf_t;
+
 #define DEBUG_DECODE_DUMP (1 << 0)
 #define DEBUG_DECODE_RAW (1 << 1)
 
@@ -118,16 +211,27 @@ typedef struct decoder_ctx_struct
     uint32_t width, height;
     VdpDecoderProfile profile;
     device_ctx_t *device;
-    uint8_t *header;
-    uint     header_len;
-    uint8_t *last_header;
-    uint     last_header_len;
+    header_cache_entry_t header_cache[HEADER_CACHE_SIZE];
+    int header_cache_next;
+    header_cache_entry_t *last_header;
+    uint32_t header_hits;
+    uint32_t header_misses;
     uint32_t debug;
+    struct capture_struct *capture;
+    struct h264_reorder_struct *h264_reorder;
+    struct hevc_rps_table_struct *hevc_rps;
 
     VdpStatus (*decode)(struct decoder_ctx_struct *dec, VdpPictureInfo const *info, uint32_t buffer_count,
                         VdpBitstreamBuffer const *buffers, VdpVideoSurface output);
+    // whether this is an H.264 IDR or HEVC IRAP picture, NULL for the other codecs
+    int (*random_access)(VdpPictureInfo const *info, uint32_t buffer_count, VdpBitstreamBuffer const *buffers);
+    uint64_t auto_flush;
+    uint64_t last_render;
 
+    const struct decoder_backend_struct *backend;
     void *private;
+    // decode_generation of the target surface of the render in progress
+    uint32_t generation;
 } decoder_ctx_t;
 
 typedef struct
@@ -189,6 +293,27 @@ typedef struct
     VdpBool frequently_accessed;
 } bitmap_surface_ctx_t;
 
+typedef enum
+{
+    MEMSTAT_VIDEO_SURFACE = 0,
+    MEMSTAT_OUTPUT_SURFACE,
+    MEMSTAT_BITMAP_SURFACE,
+    MEMSTAT_RGBA_BUFFER,
+    MEMSTAT_DECODER,
+    MEMSTAT_V4L2_OUTPUT,
+    MEMSTAT_V4L2_CAPTURE,
+    MEMSTAT_V4L2_CONVERTER,
+    MEMSTAT_TYPE_COUNT
+} memstat_type_t;
+
+typedef enum
+{
+    MEMSTAT_CPU = 0,
+    MEMSTAT_GL,
+    MEMSTAT_V4L2,
+    MEMSTAT_KIND_COUNT
+} memstat_kind_t;
+
 #ifndef ARRAY_SIZE
 #define ARRAY_SIZE(a) (sizeof((a)) / sizeof((a)[0]))
 #endif
@@ -222,18 +347,53 @@ typedef struct
 
 #endif
 
-/* HW Specific decoder methods */
-void *decoder_open(VdpDecoderProfile profile, uint32_t width, uint32_t height);
-void decoder_close(void *private);
-VdpStatus decoder_decode(void *private, uint32_t buffer_count,
-                    VdpBitstreamBuffer const *buffers, VdpVideoSurface output);
-VdpStatus decoder_get_picture(void *context, int *frame, void ***output);
-VdpStatus decoder_release_picture(void *context, int frame);
-
-int handle_create(void *data);
-void *handle_get(int handle);
+/*
+ * A decoder implementation. vdp_decoder_create() opens the first one in
+ * decoder_backends that supports the profile, or the one VDPAU_BACKEND names.
+ * Every function but open and query_capabilities takes what open returned,
+ * which may be NULL if no backend could be opened. Backends that take the
+ * parsed VdpPictureInfo instead of an elementary stream set decode_picture,
+ * decoder.c then hands pictures over as they come and never calls decode.
+ */
+typedef struct decoder_backend_struct
+{
+    const char *name;
+    VdpStatus (*query_capabilities)(VdpDecoderProfile profile, VdpBool *is_supported,
+                    uint32_t *max_width, uint32_t *max_height);
+    void *(*open)(VdpDecoderProfile profile, uint32_t width, uint32_t height, uint32_t max_references);
+    void (*close)(void *private);
+    // pictures are tagged with output and the surface's decode_generation for get_picture()
+    VdpStatus (*decode)(void *private, uint32_t buffer_count,
+                    VdpBitstreamBuffer const *buffers, VdpVideoSurface output, uint32_t generation);
+    VdpStatus (*decode_picture)(void *private, VdpPictureInfo const *info, uint32_t buffer_count,
+                    VdpBitstreamBuffer const *buffers, VdpVideoSurface output, uint32_t generation);
+    VdpStatus (*get_picture)(void *private, int *frame, void ***output, VdpVideoSurface *surface,
+                    uint32_t *generation);
+    VdpStatus (*release_picture)(void *private, int frame);
+    VdpStatus (*get_dmabuf)(void *private, int frame, decoder_dmabuf_t *dmabuf);
+    VdpStatus (*flush)(void *private);
+    VdpStatus (*set_buffering)(void *private, uint32_t buffering);
+    // optional, drops whatever is kept across decoders, called on device destroy
+    void (*drain)(void);
+} decoder_backend_t;
+
+// in order of preference, NULL terminated, defined by whatever links decoder.c
+extern const decoder_backend_t *const decoder_backends[];
+
+extern const decoder_backend_t decoder_backend_mfc;
+extern const decoder_backend_t decoder_backend_v4l2;
+extern const decoder_backend_t decoder_backend_stateless;
+
+int handle_create(void *data, handle_type_t type);
+void *handle_get(int handle, handle_type_t type);
 void handle_destroy(int handle);
 
+void memstat_init(void);
+int memstat_enabled(void);
+void memstat_alloc(memstat_type_t type, int count, size_t cpu, size_t gl, size_t v4l2);
+void memstat_free(memstat_type_t type, int count, size_t cpu, size_t gl, size_t v4l2);
+void memstat_dump(void);
+
 int gl_init_shader (shader_ctx_t *shader, shader_type_t process_type);
 void gl_delete_shader (shader_ctx_t *shader);
 GLuint gl_create_texture(GLuint tex_filter);
@@ -266,7 +426,12 @@ VdpStatus vdp_video_surface_get_bits_y_cb_cr(VdpVideoSurface surface, VdpYCbCrFo
 VdpStatus vdp_video_surface_put_bits_y_cb_cr(VdpVideoSurface surface, VdpYCbCrFormat source_ycbcr_format, void const *const *source_data, uint32_t const *source_pitches);
 VdpStatus vdp_video_surface_query_capabilities(VdpDevice device, VdpChromaType surface_chroma_type, VdpBool *is_supported, uint32_t *max_width, uint32_t *max_height);
 VdpStatus vdp_video_surface_query_get_put_bits_y_cb_cr_capabilities(VdpDevice device, VdpChromaType surface_chroma_type, VdpYCbCrFormat bits_ycbcr_format, VdpBool *is_supported);
-VdpStatus video_surface_render_picture(video_surface_ctx_t *vs, void **source_data);
+VdpStatus video_surface_render_picture(video_surface_ctx_t *vs, void *decoder, int frame, void **source_data);
+void video_surface_pool_init(device_ctx_t *dev);
+void video_surface_pool_flush(device_ctx_t *dev);
+void video_surface_dmabuf_init(device_ctx_t *dev);
+void video_surface_dmabuf_purge(device_ctx_t *dev, void *decoder);
+void video_surface_dmabuf_flush(device_ctx_t *dev);
 
 VdpStatus vdp_output_surface_create(VdpDevice device, VdpRGBAFormat rgba_format, uint32_t width, uint32_t height, VdpOutputSurface  *surface);
 VdpStatus vdp_output_surface_destroy(VdpOutputSurface surface);
@@ -303,6 +468,8 @@ VdpStatus vdp_decoder_destroy(VdpDecoder decoder);
 VdpStatus vdp_decoder_get_parameters(VdpDecoder decoder, VdpDecoderProfile *profile, uint32_t *width, uint32_t *height);
 VdpStatus vdp_decoder_render(VdpDecoder decoder, VdpVideoSurface target, VdpPictureInfo const *picture_info, uint32_t bitstream_buffer_count, VdpBitstreamBuffer const *bitstream_buffers);
 VdpStatus vdp_decoder_query_capabilities(VdpDevice device, VdpDecoderProfile profile, VdpBool *is_supported, uint32_t *max_level, uint32_t *max_macroblocks, uint32_t *max_width, uint32_t *max_height);
+VdpStatus vdp_decoder_flush_odroid(VdpDecoder decoder);
+VdpStatus vdp_decoder_set_buffering_odroid(VdpDecoder decoder, uint32_t buffering);
 
 VdpStatus vdp_bitmap_surface_create(VdpDevice device, VdpRGBAFormat rgba_format, uint32_t width, uint32_t height, VdpBool frequently_accessed, VdpBitmapSurface *surface);
 VdpStatus vdp_bitmap_surface_destroy(VdpBitmapSurface surface);
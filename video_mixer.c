@@ -30,7 +30,7 @@ VdpStatus vdp_video_mixer_create(VdpDevice device,
                                  void const *const *parameter_values,
                                  VdpVideoMixer *mixer)
 {
-    device_ctx_t *dev = handle_get(device);
+    device_ctx_t *dev = handle_get(device, HANDLE_TYPE_DEVICE);
     if (!dev)
         return VDP_STATUS_INVALID_HANDLE;
 
@@ -42,7 +42,7 @@ VdpStatus vdp_video_mixer_create(VdpDevice device,
     mix->contrast = 1.0;
     mix->saturation = 1.0;
 
-    int handle = handle_create(mix);
+    int handle = handle_create(mix, HANDLE_TYPE_VIDEO_MIXER);
     if (handle == -1)
     {
         free(mix);
@@ -56,7 +56,7 @@ VdpStatus vdp_video_mixer_create(VdpDevice device,
 
 VdpStatus vdp_video_mixer_destroy(VdpVideoMixer mixer)
 {
-    mixer_ctx_t *mix = handle_get(mixer);
+    mixer_ctx_t *mix = handle_get(mixer, HANDLE_TYPE_VIDEO_MIXER);
     if (!mix)
         return VDP_STATUS_INVALID_HANDLE;
 
@@ -66,6 +66,48 @@ VdpStatus vdp_video_mixer_destroy(VdpVideoMixer mixer)
     return VDP_STATUS_OK;
 }
 
+/*
+ * Uploads decoded pictures to the surfaces they were decoded for until vs has
+ * its own. Pictures for surfaces the application renders later are uploaded
+ * along the way, so reordered pictures don't end up on the wrong surface.
+ * Pictures the decoder can't map, e.g. from drivers not copying timestamps,
+ * go to vs as before. A surface only counts as uploaded with the picture of
+ * its latest VdpDecoderRender, one of an earlier render is dropped.
+ */
+static void harvest_pictures(video_surface_ctx_t *vs)
+{
+    const decoder_backend_t *backend = vs->backend;
+    void *private = vs->private;
+    VdpVideoSurface surface;
+    uint32_t generation;
+    void **buffers;
+    int frame;
+
+    while (vs->source_format == INTERNAL_YCBCR_FORMAT) {
+        backend->get_picture(private, &frame, &buffers, &surface, &generation);
+        if (buffers == NULL)
+            break;
+
+        video_surface_ctx_t *target = vs;
+        if (surface != VDP_INVALID_HANDLE)
+            target = handle_get(surface, HANDLE_TYPE_VIDEO_SURFACE);
+        else
+            generation = vs->decode_generation;
+
+        if (target && target->private == private && target->source_format == INTERNAL_YCBCR_FORMAT) {
+            if (generation == target->decode_generation) {
+                video_surface_render_picture(target, private, frame, buffers);
+                target->source_format = INTERNAL_RGB8_FORMAT;
+            } else {
+                // rendered to again before this picture came out, the newer one is still to come
+                VDPAU_DBG("Dropping picture of render %u to surface %u, now at %u",
+                          generation, surface, target->decode_generation);
+            }
+        }
+        backend->release_picture(private, frame);
+    }
+}
+
 VdpStatus vdp_video_mixer_render(VdpVideoMixer mixer,
                                  VdpOutputSurface background_surface,
                                  VdpRect const *background_source_rect,
@@ -82,7 +124,7 @@ VdpStatus vdp_video_mixer_render(VdpVideoMixer mixer,
                                  uint32_t layer_count,
                                  VdpLayer const *layers)
 {
-    mixer_ctx_t *mix = handle_get(mixer);
+    mixer_ctx_t *mix = handle_get(mixer, HANDLE_TYPE_VIDEO_MIXER);
     if (!mix)
         return VDP_STATUS_INVALID_HANDLE;
 
@@ -92,11 +134,11 @@ VdpStatus vdp_video_mixer_render(VdpVideoMixer mixer,
     if (current_picture_structure != VDP_VIDEO_MIXER_PICTURE_STRUCTURE_FRAME)
         VDPAU_DBG_ONCE("Requested unimplemented picture_structure");
 
-    output_surface_ctx_t *os = handle_get(destination_surface);
+    output_surface_ctx_t *os = handle_get(destination_surface, HANDLE_TYPE_OUTPUT_SURFACE);
     if (!os)
         return VDP_STATUS_INVALID_HANDLE;
 
-    os->vs = handle_get(video_surface_current);
+    os->vs = handle_get(video_surface_current, HANDLE_TYPE_VIDEO_SURFACE);
     if (!(os->vs))
         return VDP_STATUS_INVALID_HANDLE;
 
@@ -122,17 +164,9 @@ VdpStatus vdp_video_mixer_render(VdpVideoMixer mixer,
     if (os->rgba.flags & RGBA_FLAG_DIRTY)
         os->rgba.flags |= RGBA_FLAG_NEEDS_CLEAR;
 
-    if (os->vs->source_format == INTERNAL_YCBCR_FORMAT) {
-        int frame;
-        void **buffers;
-        decoder_get_picture(os->vs->private, &frame, &buffers);
-        if (buffers != NULL) {
-            video_surface_render_picture(os->vs, buffers);
-            decoder_release_picture(os->vs->private, frame);
-        }
-        // we do this so that once the buffer is poplated it won't try again
-        os->vs->source_format = INTERNAL_RGB8_FORMAT;
-    }
+    // the surface is only marked uploaded once its own picture came, until then every render asks again
+    if (os->vs->source_format == INTERNAL_YCBCR_FORMAT)
+        harvest_pictures(os->vs);
 
     if (layer_count != 0)
         VDPAU_DBG_ONCE("Requested unimplemented additional layers");
@@ -151,7 +185,7 @@ VdpStatus vdp_video_mixer_get_feature_support(VdpVideoMixer mixer,
     if (!features || !feature_supports)
         return VDP_STATUS_INVALID_POINTER;
 
-    mixer_ctx_t *mix = handle_get(mixer);
+    mixer_ctx_t *mix = handle_get(mixer, HANDLE_TYPE_VIDEO_MIXER);
     if (!mix)
         return VDP_STATUS_INVALID_HANDLE;
 
@@ -169,7 +203,7 @@ VdpStatus vdp_video_mixer_set_feature_enables(VdpVideoMixer mixer,
     if (!features || !feature_enables)
         return VDP_STATUS_INVALID_POINTER;
 
-    mixer_ctx_t *mix = handle_get(mixer);
+    mixer_ctx_t *mix = handle_get(mixer, HANDLE_TYPE_VIDEO_MIXER);
     if (!mix)
         return VDP_STATUS_INVALID_HANDLE;
 
@@ -184,7 +218,7 @@ VdpStatus vdp_video_mixer_get_feature_enables(VdpVideoMixer mixer,
     if (!features || !feature_enables)
         return VDP_STATUS_INVALID_POINTER;
 
-    mixer_ctx_t *mix = handle_get(mixer);
+    mixer_ctx_t *mix = handle_get(mixer, HANDLE_TYPE_VIDEO_MIXER);
     if (!mix)
         return VDP_STATUS_INVALID_HANDLE;
 
@@ -219,7 +253,7 @@ VdpStatus vdp_video_mixer_set_attribute_values(VdpVideoMixer mixer,
     if (!attributes || !attribute_values)
         return VDP_STATUS_INVALID_POINTER;
 
-    mixer_ctx_t *mix = handle_get(mixer);
+    mixer_ctx_t *mix = handle_get(mixer, HANDLE_TYPE_VIDEO_MIXER);
     if (!mix)
         return VDP_STATUS_INVALID_HANDLE;
 
@@ -239,7 +273,7 @@ VdpStatus vdp_video_mixer_get_parameter_values(VdpVideoMixer mixer,
     if (!parameters || !parameter_values)
         return VDP_STATUS_INVALID_POINTER;
 
-    mixer_ctx_t *mix = handle_get(mixer);
+    mixer_ctx_t *mix = handle_get(mixer, HANDLE_TYPE_VIDEO_MIXER);
     if (!mix)
         return VDP_STATUS_INVALID_HANDLE;
 
@@ -254,7 +288,7 @@ VdpStatus vdp_video_mixer_get_attribute_values(VdpVideoMixer mixer,
     if (!attributes || !attribute_values)
         return VDP_STATUS_INVALID_POINTER;
 
-    mixer_ctx_t *mix = handle_get(mixer);
+    mixer_ctx_t *mix = handle_get(mixer, HANDLE_TYPE_VIDEO_MIXER);
     if (!mix)
         return VDP_STATUS_INVALID_HANDLE;
 
@@ -268,7 +302,7 @@ VdpStatus vdp_video_mixer_query_feature_support(VdpDevice device,
     if (!is_supported)
         return VDP_STATUS_INVALID_POINTER;
 
-    device_ctx_t *dev = handle_get(device);
+    device_ctx_t *dev = handle_get(device, HANDLE_TYPE_DEVICE);
     if (!dev)
         return VDP_STATUS_INVALID_HANDLE;
 
@@ -283,7 +317,7 @@ VdpStatus vdp_video_mixer_query_parameter_support(VdpDevice device,
     if (!is_supported)
         return VDP_STATUS_INVALID_POINTER;
 
-    device_ctx_t *dev = handle_get(device);
+    device_ctx_t *dev = handle_get(device, HANDLE_TYPE_DEVICE);
     if (!dev)
         return VDP_STATUS_INVALID_HANDLE;
 
@@ -311,7 +345,7 @@ VdpStatus vdp_video_mixer_query_parameter_value_range(VdpDevice device,
     if (!min_value || !max_value)
         return VDP_STATUS_INVALID_POINTER;
 
-    device_ctx_t *dev = handle_get(device);
+    device_ctx_t *dev = handle_get(device, HANDLE_TYPE_DEVICE);
     if (!dev)
         return VDP_STATUS_INVALID_HANDLE;
 
@@ -338,7 +372,7 @@ VdpStatus vdp_video_mixer_query_attribute_support(VdpDevice device,
     if (!is_supported)
         return VDP_STATUS_INVALID_POINTER;
 
-    device_ctx_t *dev = handle_get(device);
+    device_ctx_t *dev = handle_get(device, HANDLE_TYPE_DEVICE);
     if (!dev)
         return VDP_STATUS_INVALID_HANDLE;
 
@@ -355,7 +389,7 @@ VdpStatus vdp_video_mixer_query_attribute_value_range(VdpDevice device,
     if (!min_value || !max_value)
         return VDP_STATUS_INVALID_POINTER;
 
-    device_ctx_t *dev = handle_get(device);
+    device_ctx_t *dev = handle_get(device, HANDLE_TYPE_DEVICE);
     if (!dev)
         return VDP_STATUS_INVALID_HANDLE;
 